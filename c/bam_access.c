@@ -20,14 +20,379 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "bam_access.h"
 #include "bam_stats_calcs.h"
+#include "bam_stats_kernels.h"
+#include "htslib/bgzf.h"
 
-int get_rg_index_from_rg_store(rg_info_t **grps, char *rg, int grps_size){
+//Bytes of [rg] and [rg][end] pointer tables ahead of the entries, padded to keep the entries line aligned
+#define STATS_TABLES_SIZE(grps_size) ((((sizeof(stats_rd_t **) + 2 * sizeof(stats_rd_t *)) * (grps_size) + STATS_CACHE_LINE - 1) \
+                                      / STATS_CACHE_LINE) * STATS_CACHE_LINE)
+
+int bam_access_insert_hist_add(insert_hist_t *hist, uint32_t insert, uint64_t count){
+  assert(hist != NULL);
+  if(insert < INSERT_DENSE_SIZE){
+    if(hist->dense == NULL){
+      hist->dense = (uint64_t *) calloc(INSERT_DENSE_SIZE, sizeof(uint64_t));
+      check_mem(hist->dense);
+    }
+    hist->dense[insert] += count;
+  }else{
+    if(hist->overflow == NULL){
+      hist->overflow = kh_init(ins);
+      check_mem(hist->overflow);
+    }
+    int res;
+    khint_t k = kh_put(ins, hist->overflow, insert, &res);
+    check(res >= 0, "Error adding insert size %"PRIu32".", insert);
+    if(res){
+      kh_value(hist->overflow, k) = count;
+    }else{
+      kh_value(hist->overflow, k) += count;
+    }
+  }
+  hist->total += count;
+  hist->sum += (uint64_t)insert * count;
+  return 0;
+error:
+  return -1;
+}
+
+uint64_t bam_access_insert_hist_get(insert_hist_t *hist, uint32_t insert){
+  assert(hist != NULL);
+  if(insert < INSERT_DENSE_SIZE) return hist->dense ? hist->dense[insert] : 0;
+  if(hist->overflow == NULL) return 0;
+  khint_t k = kh_get(ins, hist->overflow, insert);
+  return k == kh_end(hist->overflow) ? 0 : kh_value(hist->overflow, k);
+}
+
+int bam_access_insert_hist_merge(insert_hist_t *target, insert_hist_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  if(source->dense){
+    if(target->dense == NULL){
+      target->dense = (uint64_t *) calloc(INSERT_DENSE_SIZE, sizeof(uint64_t));
+      check_mem(target->dense);
+    }
+    int i=0;
+    for(i=0; i<INSERT_DENSE_SIZE; i++) target->dense[i] += source->dense[i];
+  }
+  if(source->overflow){
+    if(target->overflow == NULL){
+      target->overflow = kh_init(ins);
+      check_mem(target->overflow);
+    }
+    khint_t k;
+    for(k = kh_begin(source->overflow); k != kh_end(source->overflow); ++k){
+      if(!kh_exist(source->overflow, k)) continue;
+      int res;
+      khint_t kt = kh_put(ins, target->overflow, kh_key(source->overflow, k), &res);
+      check(res >= 0, "Error merging insert size counts.");
+      if(res){
+        kh_value(target->overflow, kt) = kh_value(source->overflow, k);
+      }else{
+        kh_value(target->overflow, kt) += kh_value(source->overflow, k);
+      }
+    }
+  }
+  target->total += source->total;
+  target->sum += source->sum;
+  return 0;
+error:
+  return -1;
+}
+
+void bam_access_insert_hist_destroy(insert_hist_t *hist){
+  if(hist == NULL) return;
+  if(hist->dense) free(hist->dense);
+  if(hist->overflow) kh_destroy(ins, hist->overflow);
+  hist->dense = NULL;
+  hist->overflow = NULL;
+  hist->total = 0;
+  hist->sum = 0;
+  return;
+}
+
+void bam_access_cycle_hist_flush(cycle_hist_t *hist){
+  assert(hist != NULL);
+  if(hist->n_staged == 0) return;
+  uint32_t row, cycle;
+  for(row=0; row<CYCLE_QUALS; row++){
+    uint8_t *staged = hist->staged + (size_t)row * hist->stride;
+    for(cycle=0; cycle<hist->n_cycles; cycle++) hist->quals[(size_t)cycle * CYCLE_QUALS + row] += staged[cycle];
+  }
+  for(row=0; row<CYCLE_BASES; row++){
+    uint8_t *staged = hist->staged + (size_t)(CYCLE_QUALS + row) * hist->stride;
+    for(cycle=0; cycle<hist->n_cycles; cycle++) hist->bases[(size_t)cycle * CYCLE_BASES + row] += staged[cycle];
+  }
+  memset(hist->staged, 0, (size_t)(CYCLE_QUALS + CYCLE_BASES) * hist->stride);
+  hist->n_staged = 0;
+}
+
+int bam_access_cycle_hist_reserve(cycle_hist_t *hist, uint32_t n_cycles){
+  assert(hist != NULL);
+  if(n_cycles <= hist->n_cycles) return 0;
+  bam_access_cycle_hist_flush(hist);
+  uint64_t *quals = (uint64_t *) realloc(hist->quals, sizeof(uint64_t) * n_cycles * CYCLE_QUALS);
+  check_mem(quals);
+  hist->quals = quals;
+  uint64_t *bases = (uint64_t *) realloc(hist->bases, sizeof(uint64_t) * n_cycles * CYCLE_BASES);
+  check_mem(bases);
+  hist->bases = bases;
+  memset(hist->quals + (size_t)hist->n_cycles * CYCLE_QUALS, 0, sizeof(uint64_t) * (n_cycles - hist->n_cycles) * CYCLE_QUALS);
+  memset(hist->bases + (size_t)hist->n_cycles * CYCLE_BASES, 0, sizeof(uint64_t) * (n_cycles - hist->n_cycles) * CYCLE_BASES);
+  hist->n_cycles = n_cycles;
+  if(n_cycles > hist->stride){
+    uint32_t stride = (n_cycles + CYCLE_STRIDE_ALIGN - 1) & ~(CYCLE_STRIDE_ALIGN - 1);
+    uint8_t *staged = (uint8_t *) calloc((size_t)CYCLE_STAGED_ROWS * stride, sizeof(uint8_t));
+    check_mem(staged);
+    if(hist->staged) free(hist->staged);
+    hist->staged = staged;
+    hist->stride = stride;
+  }
+  return 0;
+error:
+  return -1;
+}
+
+int bam_access_cycle_hist_add(cycle_hist_t *hist, bam1_t *b){
+  assert(hist != NULL);
+  check(bam_access_cycle_hist_reserve(hist, b->core.l_qseq) == 0, "Error growing per cycle counts.");
+  if(hist->n_staged == UINT8_MAX) bam_access_cycle_hist_flush(hist);
+  bam_stats_kernels_cycle_update(bam_get_seq(b), bam_get_qual(b), b->core.l_qseq, b->core.flag & BAM_FREVERSE, hist->staged, hist->stride);
+  hist->n_staged++;
+  return 0;
+error:
+  return -1;
+}
+
+int bam_access_cycle_hist_merge(cycle_hist_t *target, cycle_hist_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  bam_access_cycle_hist_flush(source);
+  bam_access_cycle_hist_flush(target);
+  check(bam_access_cycle_hist_reserve(target, source->n_cycles) == 0, "Error growing per cycle counts.");
+  size_t i=0;
+  for(i=0; i<(size_t)source->n_cycles * CYCLE_QUALS; i++) target->quals[i] += source->quals[i];
+  for(i=0; i<(size_t)source->n_cycles * CYCLE_BASES; i++) target->bases[i] += source->bases[i];
+  return 0;
+error:
+  return -1;
+}
+
+void bam_access_cycle_hist_destroy(cycle_hist_t *hist){
+  if(hist == NULL) return;
+  if(hist->quals) free(hist->quals);
+  if(hist->bases) free(hist->bases);
+  if(hist->staged) free(hist->staged);
+  memset(hist, 0, sizeof(cycle_hist_t));
+  return;
+}
+
+int bam_access_count_hist_add(count_hist_t *hist, uint32_t bin, uint64_t count){
+  assert(hist != NULL);
+  if(bin >= hist->size){
+    uint32_t size = hist->size ? hist->size : 64;
+    while(size <= bin) size *= 2;
+    uint64_t *counts = (uint64_t *) realloc(hist->counts, sizeof(uint64_t) * size);
+    check_mem(counts);
+    memset(counts + hist->size, 0, sizeof(uint64_t) * (size - hist->size));
+    hist->counts = counts;
+    hist->size = size;
+  }
+  hist->counts[bin] += count;
+  return 0;
+error:
+  return -1;
+}
+
+int bam_access_count_hist_merge(count_hist_t *target, count_hist_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  uint32_t i=0;
+  for(i=0; i<source->size; i++){
+    if(source->counts[i] == 0) continue;
+    check(bam_access_count_hist_add(target, i, source->counts[i]) == 0, "Error merging counts.");
+  }
+  return 0;
+error:
+  return -1;
+}
+
+void bam_access_count_hist_destroy(count_hist_t *hist){
+  if(hist == NULL) return;
+  if(hist->counts) free(hist->counts);
+  hist->counts = NULL;
+  hist->size = 0;
+  return;
+}
+
+int bam_access_qc_add(qc_hist_t *qc, bam1_t *b){
+  assert(qc != NULL);
+  if(b->core.flag & BAM_FUNMAP){
+    if(b->core.tid < 0){
+      qc->no_coor++;
+      return 0;
+    }
+    return bam_access_count_hist_add(&qc->unmapped, b->core.tid, 1);
+  }
+  check(bam_access_count_hist_add(&qc->mapped, b->core.tid, 1) == 0, "Error counting contig reads.");
+  check(bam_access_count_hist_add(&qc->mapq, b->core.qual, 1) == 0, "Error counting MAPQ.");
+  uint32_t soft = 0, hard = 0;
+  uint32_t *cigar = bam_get_cigar(b);
+  uint32_t i=0;
+  for(i=0; i<b->core.n_cigar; i++){
+    int op = bam_cigar_op(cigar[i]);
+    if(op == BAM_CSOFT_CLIP){
+      soft += bam_cigar_oplen(cigar[i]);
+    }else if(op == BAM_CHARD_CLIP){
+      hard += bam_cigar_oplen(cigar[i]);
+    }
+  }
+  check(bam_access_count_hist_add(&qc->soft_clip, soft, 1) == 0, "Error counting soft clipping.");
+  check(bam_access_count_hist_add(&qc->hard_clip, hard, 1) == 0, "Error counting hard clipping.");
+  return 0;
+error:
+  return -1;
+}
+
+int bam_access_qc_merge(qc_hist_t *target, qc_hist_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  check(bam_access_count_hist_merge(&target->mapped, &source->mapped) == 0, "Error merging contig counts.");
+  check(bam_access_count_hist_merge(&target->unmapped, &source->unmapped) == 0, "Error merging contig counts.");
+  target->no_coor += source->no_coor;
+  check(bam_access_count_hist_merge(&target->mapq, &source->mapq) == 0, "Error merging MAPQ counts.");
+  check(bam_access_count_hist_merge(&target->soft_clip, &source->soft_clip) == 0, "Error merging clipping counts.");
+  check(bam_access_count_hist_merge(&target->hard_clip, &source->hard_clip) == 0, "Error merging clipping counts.");
+  return 0;
+error:
+  return -1;
+}
+
+void bam_access_qc_destroy(qc_hist_t *qc){
+  if(qc == NULL) return;
+  bam_access_count_hist_destroy(&qc->mapped);
+  bam_access_count_hist_destroy(&qc->unmapped);
+  bam_access_count_hist_destroy(&qc->mapq);
+  bam_access_count_hist_destroy(&qc->soft_clip);
+  bam_access_count_hist_destroy(&qc->hard_clip);
+  qc->no_coor = 0;
+  return;
+}
+
+int bam_access_index_counts(hts_idx_t *idx, bam_hdr_t *head, qc_hist_t *qc){
+  assert(idx != NULL);
+  assert(head != NULL);
+  assert(qc != NULL);
+  int tid=0;
+  for(tid=0; tid<head->n_targets; tid++){
+    uint64_t mapped = 0;
+    uint64_t unmapped = 0;
+    //No pseudo-bin when a contig has no reads
+    if(hts_idx_get_stat(idx, tid, &mapped, &unmapped) != 0) continue;
+    check(bam_access_count_hist_add(&qc->mapped, tid, mapped) == 0, "Error counting contig reads.");
+    check(bam_access_count_hist_add(&qc->unmapped, tid, unmapped) == 0, "Error counting contig reads.");
+  }
+  qc->no_coor += hts_idx_get_n_no_coor(idx);
+  return 0;
+error:
+  return -1;
+}
+
+rg_lookup_t *bam_access_rg_lookup_init(rg_info_t **grps, int grps_size){
+  assert(grps != NULL);
+  rg_lookup_t *lookup = (rg_lookup_t *) calloc(1, sizeof(rg_lookup_t));
+  check_mem(lookup);
+  lookup->ids = kh_init(rg_ids);
+  check_mem(lookup->ids);
+  lookup->grps = grps;
+  lookup->grps_size = grps_size;
+  lookup->last_idx = -1;
   int i=0;
   for(i=0; i<grps_size; i++){
-    if (strncmp(rg,grps[i]->id,strlen(rg))==0) return i;
+    int res;
+    khint_t k = kh_put(rg_ids, lookup->ids, grps[i]->id, &res);
+    check(res >= 0, "Error adding @RG ID:%s to lookup.", grps[i]->id);
+    if(res == 0){ //Keep the first occurrence of a duplicated ID
+      log_warn("Duplicate @RG ID:%s in header, reads will be assigned to the first.", grps[i]->id);
+      continue;
+    }
+    kh_value(lookup->ids, k) = i;
   }
+  return lookup;
+
+error:
+  bam_access_rg_lookup_destroy(lookup);
+  return NULL;
+}
+
+int bam_access_rg_lookup_get(rg_lookup_t *lookup, const char *rg){
+  //Reads are generally grouped by RG so check the last hit before hashing
+  if(lookup->last_idx >= 0 && strcmp(rg, lookup->grps[lookup->last_idx]->id) == 0) return lookup->last_idx;
+  khint_t k = kh_get(rg_ids, lookup->ids, rg);
+  if(k == kh_end(lookup->ids)) return -1;
+  lookup->last_idx = kh_value(lookup->ids, k);
+  return lookup->last_idx;
+}
+
+void bam_access_rg_lookup_destroy(rg_lookup_t *lookup){
+  if(lookup == NULL) return;
+  //Keys belong to the rg_info_t entries
+  if(lookup->ids) kh_destroy(rg_ids, lookup->ids);
+  free(lookup);
+  return;
+}
+
+int bam_access_scan_aux(bam1_t *b, char **rg, uint8_t **nm){
+  //Single walk of the aux block collecting RG and NM, rather than a bam_aux_get per tag
+  uint8_t *s = bam_get_aux(b);
+  uint8_t *end = b->data + b->l_data;
+  *rg = NULL;
+  *nm = NULL;
+  while(s + 3 <= end){
+    uint8_t *val = s + 2;
+    if(s[0] == 'R' && s[1] == 'G' && *val == 'Z'){
+      *rg = (char *)(val + 1);
+      if(*nm) return 0;
+    }else if(s[0] == 'N' && s[1] == 'M'){
+      *nm = val;
+      if(*rg) return 0;
+    }
+    switch(*val){
+      case 'A': case 'c': case 'C':
+        s = val + 2;
+        break;
+      case 's': case 'S':
+        s = val + 3;
+        break;
+      case 'i': case 'I': case 'f':
+        s = val + 5;
+        break;
+      case 'd':
+        s = val + 9;
+        break;
+      case 'Z': case 'H':
+        s = val + 1;
+        while(s < end && *s) s++;
+        s++;
+        break;
+      case 'B': {
+        check(val + 6 <= end, "Truncated B array aux tag in read %s.", bam_get_qname(b));
+        uint8_t sub = val[1];
+        uint32_t n;
+        memcpy(&n, val + 2, 4);
+        int size = (sub == 'c' || sub == 'C') ? 1 : (sub == 's' || sub == 'S') ? 2 : 4;
+        s = val + 6 + (uint64_t)n * size;
+        break;
+      }
+      default:
+        sentinel("Unrecognised aux type '%c' in read %s.", *val, bam_get_qname(b));
+    }
+  }
+  return 0;
+error:
   return -1;
 }
 
@@ -56,21 +421,46 @@ void parse_rg_line(char *tmp_line, rg_info_t *group) {
   return;
 }
 
+rg_info_t *bam_access_anon_group(){
+  rg_info_t *anon = (rg_info_t *) malloc(sizeof(rg_info_t));
+  check_mem(anon);
+  anon->id = strdup(".");
+  anon->sample = strdup(".");
+  anon->platform = strdup(".");
+  anon->platform_unit = strdup(".");
+  anon->lib = strdup(".");
+  anon->head = strdup("@RG\tID:anon\tLB:anon\tSM:anon"); //As PCAP::Bam::Stats names the anonymous group
+  check(anon->id && anon->sample && anon->platform && anon->platform_unit && anon->lib && anon->head, "Error allocating anonymous read group.");
+  return anon;
+error:
+  if(anon){
+    free(anon->id);
+    free(anon->sample);
+    free(anon->platform);
+    free(anon->platform_unit);
+    free(anon->lib);
+    free(anon->head);
+    free(anon);
+  }
+  return NULL;
+}
+
 rg_info_t **bam_access_parse_header(bam_hdr_t *head, int *grps_size, stats_rd_t ****grp_stats){
   assert(head != NULL);
   char *line = NULL;
-  rg_info_t **groups;
+  rg_info_t **groups = NULL;
   int size = 0;
-  char *head_txt = head->text;
+  const char *head_txt = head->text;
   char *head_bac = strdup(head_txt);
-  //First pass counts read groups
-  line = strtok(head_txt,"\n");
-  while(line != NULL){
+  check_mem(head_bac);
+  //First pass counts read groups, the header text is left intact for the caller
+  while(head_txt != NULL && *head_txt != '\0'){
 		//Check for a read group line
-		if(strncmp(line,"@RG",3)==0){
+		if(strncmp(head_txt,"@RG",3)==0){
       size++;
     }
-    line = strtok(NULL,"\n");
+    head_txt = strchr(head_txt,'\n');
+    if(head_txt) head_txt++;
   }
   if(size>0){
     //We now have the number of read groups, assign the RG id to each.
@@ -87,6 +477,7 @@ rg_info_t **bam_access_parse_header(bam_hdr_t *head, int *grps_size, stats_rd_t
         char * tmp = strdup(line);
         parse_rg_line(tmp,groups[idx]);
         free (tmp);
+        groups[idx]->head = strdup(line);
 
         check((groups[idx]->id != NULL),"Error recognising ID from RG line. NULL found.");
         check((groups[idx]->id[0]!='\0'),"Error recognising ID from RG line. Empty string.");
@@ -106,165 +497,270 @@ rg_info_t **bam_access_parse_header(bam_hdr_t *head, int *grps_size, stats_rd_t
 	}else{ //Deal with a possible lack of @RG lines.
     groups = malloc(sizeof(rg_info_t*) * 1);
     check_mem(groups);
-    groups[0]->id = strdup(".");
-    groups[0]->sample = strdup(".");
-    groups[0]->platform = strdup(".");
-    groups[0]->platform_unit = strdup(".");
-    groups[0]->lib = strdup(".");
+    groups[0] = bam_access_anon_group();
+    check(groups[0] != NULL, "Error creating anonymous read group.");
     size = 1;
 	}
-	*grp_stats = (stats_rd_t***) malloc(sizeof(stats_rd_t**) * (size));
-  check_mem(*grp_stats);
-  int j=0;
-  for(j=0; j<size; j++){
-    (*grp_stats)[j] = (stats_rd_t **) malloc((sizeof(stats_rd_t*)*2));
-    check_mem((*grp_stats)[j]);
-    (*grp_stats)[j][0] = (stats_rd_t *) malloc(sizeof(stats_rd_t));//Setup read one stats store
-    check_mem((*grp_stats)[j][0]);
-    (*grp_stats)[j][0]->length= 0;
-    (*grp_stats)[j][0]->count= 0;
-    (*grp_stats)[j][0]->dups= 0;
-    (*grp_stats)[j][0]->gc= 0;
-    (*grp_stats)[j][0]->umap= 0;
-    (*grp_stats)[j][0]->divergent= 0;
-    (*grp_stats)[j][0]->mapped_bases= 0;
-    (*grp_stats)[j][0]->proper= 0;
-    (*grp_stats)[j][0]->mapped_pairs= 0;
-    (*grp_stats)[j][0]->inter_chr_pairs= 0;
-    (*grp_stats)[j][0]->inserts = kh_init(ins);
-    (*grp_stats)[j][1] = (stats_rd_t *)malloc(sizeof(stats_rd_t));//Setup read two stats store
-    check_mem((*grp_stats)[j][1]);
-    (*grp_stats)[j][1]->length= 0;
-    (*grp_stats)[j][1]->count= 0;
-    (*grp_stats)[j][1]->dups= 0;
-    (*grp_stats)[j][1]->gc= 0;
-    (*grp_stats)[j][1]->umap= 0;
-    (*grp_stats)[j][1]->divergent= 0;
-    (*grp_stats)[j][1]->mapped_bases= 0;
-    (*grp_stats)[j][1]->proper= 0;
-  }
+  free(head_bac);
+  head_bac = NULL;
+	*grp_stats = bam_access_init_stats(size);
+  check(*grp_stats != NULL,"Error allocating read group stats.");
   *grps_size = size;
 	return groups;
 
 error:
   if(groups) free(groups);
+  if(head_bac) free(head_bac);
   if(line) free(line);
   if(grp_stats) free(grp_stats);
   return NULL;
 }
 
-int bam_access_process_reads(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int rna){
-  assert(input != NULL);
-  assert(head != NULL);
-  assert(grps != NULL);
+void bam_access_destroy_groups(rg_info_t **grps, int grps_size){
+  if(grps == NULL) return;
+  int j=0;
+  for(j=0; j<grps_size; j++){
+    if(grps[j] == NULL) continue;
+    free(grps[j]->id);
+    free(grps[j]->platform);
+    free(grps[j]->platform_unit);
+    free(grps[j]->lib);
+    free(grps[j]->sample);
+    free(grps[j]->head);
+    free(grps[j]);
+  }
+  free(grps);
+  return;
+}
 
-  bam1_t *b;
-  //Iterate through each read in bam file.
-  b = bam_init1();
-  int ret;
-  while((ret = sam_read1(input, head, b)) >= 0){
-    if (b->core.flag & BAM_FSECONDARY && rna == 0) continue; //skip secondary hits so no double counts
-    if (b->core.flag & BAM_FQCFAIL) continue; // skip vendor fail as generally aren't considered
-    if (b->core.flag & BAM_FSUPPLEMENTARY) continue; // skip supplimentary
+stats_rd_t ***bam_access_init_stats(int grps_size){
+  size_t size = STATS_TABLES_SIZE(grps_size) + sizeof(stats_rd_t) * 2 * grps_size;
+  void *mem = NULL;
+  check(posix_memalign(&mem, STATS_CACHE_LINE, size > 0 ? size : STATS_CACHE_LINE) == 0, "Out of memory.");
+  memset(mem, 0, size);
+  stats_rd_t ***grp_stats = (stats_rd_t ***) mem;
+  stats_rd_t **ends = (stats_rd_t **) (grp_stats + grps_size);
+  stats_rd_t *entries = (stats_rd_t *) ((char *) mem + STATS_TABLES_SIZE(grps_size));
+  int j=0;
+  for(j=0; j<grps_size; j++){
+    grp_stats[j] = ends + 2 * j;
+    grp_stats[j][0] = entries + 2 * j;
+    grp_stats[j][1] = entries + 2 * j + 1;
+  }
+  return grp_stats;
+
+error:
+  return NULL;
+}
 
-    uint8_t read = 1; //second read
-    if (b->core.flag & BAM_FREAD1) read = 0; //first read
+int bam_access_grow_stats(stats_rd_t ****grp_stats, int grps_size, int new_size){
+  assert(new_size >= grps_size);
+  stats_rd_t ***grown = bam_access_init_stats(new_size);
+  check(grown != NULL, "Error allocating stats for %d read groups.", new_size);
+  //Histograms are owned through pointers so the entries move as they are
+  if(grps_size > 0) memcpy(grown[0][0], (*grp_stats)[0][0], sizeof(stats_rd_t) * 2 * grps_size);
+  free(*grp_stats);
+  *grp_stats = grown;
+  return 0;
+error:
+  return -1;
+}
+
+void bam_access_destroy_stats(stats_rd_t ***grp_stats, int grps_size){
+  if(grp_stats == NULL) return;
+  int j=0;
+  for(j=0; j<grps_size; j++){
+    int rd=0;
+    for(rd=0; rd<2; rd++){
+      bam_access_insert_hist_destroy(&grp_stats[j][rd]->inserts);
+      bam_access_cycle_hist_destroy(&grp_stats[j][rd]->cycles);
+      bam_access_qc_destroy(&grp_stats[j][rd]->qc);
+    }
+  }
+  //Tables and entries are one allocation
+  free(grp_stats);
+  return;
+}
 
-    char *rg = bam_aux2Z(bam_aux_get(b,"RG"));
-    if(rg == NULL || strlen(rg)==0){
-      rg = ".";
+int bam_access_merge_stats(stats_rd_t ***target, stats_rd_t ***source, int grps_size){
+  assert(target != NULL);
+  assert(source != NULL);
+  int j=0;
+  for(j=0; j<grps_size; j++){
+    int rd=0;
+    for(rd=0; rd<2; rd++){
+      stats_rd_t *to = target[j][rd];
+      stats_rd_t *from = source[j][rd];
+      //Read length is taken from the first read seen, so callers merge in file order
+      if(to->length == 0) to->length = from->length;
+      to->count += from->count;
+      to->dups += from->dups;
+      to->gc += from->gc;
+      to->umap += from->umap;
+      to->divergent += from->divergent;
+      to->mapped_bases += from->mapped_bases;
+      to->proper += from->proper;
+      to->mapped_pairs += from->mapped_pairs;
+      to->inter_chr_pairs += from->inter_chr_pairs;
+      check(bam_access_insert_hist_merge(&to->inserts, &from->inserts) == 0, "Error merging insert size counts.");
+      check(bam_access_cycle_hist_merge(&to->cycles, &from->cycles) == 0, "Error merging per cycle counts.");
+      check(bam_access_qc_merge(&to->qc, &from->qc) == 0, "Error merging extended QC counts.");
     }
+  }
+  return 0;
+error:
+  return -1;
+}
 
-    int rg_index = get_rg_index_from_rg_store(grps,rg,grps_size);
-    check(rg_index>=0, "Error assigning @RG ID index for ID:%s.", rg);
-    check(rg_index<grps_size, "Error assigning @RG ID index for ID:%s.", rg);
+int bam_access_set_cram_fields(htsFile *input, int opts){
+  if(input->format.format != cram) return 0;
+  //length still comes from l_qseq, which CRAM fills without SAM_SEQ
+  //read names are only used in error messages, left undecoded they may be blank there
+  int fields = SAM_FLAG | SAM_RNAME | SAM_POS | SAM_CIGAR | SAM_RNEXT | SAM_TLEN | SAM_AUX;
+  if(!(opts & BAM_ACCESS_NO_GC) || (opts & BAM_ACCESS_CYCLES)) fields |= SAM_SEQ;
+  if(opts & BAM_ACCESS_CYCLES) fields |= SAM_QUAL;
+  if(opts & BAM_ACCESS_QC) fields |= SAM_MAPQ;
+  check(hts_set_opt(input, CRAM_OPT_REQUIRED_FIELDS, fields) == 0, "Error setting CRAM required fields.");
+  if(!(fields & SAM_SEQ)){
+    //NM is taken as stored, never regenerated against the reference
+    check(hts_set_opt(input, CRAM_OPT_DECODE_MD, 0) == 0, "Error disabling CRAM MD/NM generation.");
+  }
+  return 0;
+error:
+  return -1;
+}
 
-    // grp_stats[rg_index][read]; Stats for this RG/read order combination
-    if((*grp_stats)[rg_index][read]->length == 0) (*grp_stats)[rg_index][read]->length = b->core.l_qseq;
+int bam_access_process_read(bam1_t *b, rg_lookup_t *lookup, stats_rd_t ***grp_stats, int opts){
+  if (b->core.flag & BAM_FSECONDARY && !(opts & BAM_ACCESS_RNA)) return 0; //skip secondary hits so no double counts
+  if (b->core.flag & BAM_FQCFAIL) return 0; // skip vendor fail as generally aren't considered
+  if (b->core.flag & BAM_FSUPPLEMENTARY) return 0; // skip supplimentary
 
-    (*grp_stats)[rg_index][read]->count++;
-    if(b->core.flag & BAM_FDUP) (*grp_stats)[rg_index][read]->dups++;
+  uint8_t read = 1; //second read
+  if (b->core.flag & BAM_FREAD1) read = 0; //first read
 
-    //Get the count of GCs in the sequence.
-    int i=0;
-    for(i=0;i<b->core.l_qseq;i++){
-      uint8_t base = bam_seqi(bam_get_seq(b),i);
-      if(base==4||base==2) (*grp_stats)[rg_index][read]->gc++; //Check for G/C
-    }
+  char *rg = NULL;
+  uint8_t *nm = NULL;
+  check(bam_access_scan_aux(b, &rg, &nm) == 0, "Error reading aux data of read %s.", bam_get_qname(b));
+  if(rg == NULL || rg[0] == '\0'){
+    rg = ".";
+  }
 
-    //Count unmapped and go to next read as anything after this is for mapped only.
-    if(b->core.flag & BAM_FUNMAP){
-      (*grp_stats)[rg_index][read]->umap++;
-      continue;
-    }
+  int rg_index = bam_access_rg_lookup_get(lookup, rg);
+  if(rg_index < 0 && (opts & BAM_ACCESS_ANON)) rg_index = bam_access_rg_lookup_get(lookup, ".");
+  check(rg_index>=0, "Error assigning @RG ID index for ID:%s.", rg);
+  check(rg_index<lookup->grps_size, "Error assigning @RG ID index for ID:%s.", rg);
 
-    // everything after this point must require reads are mapped
+  // grp_stats[rg_index][read]; Stats for this RG/read order combination
+  stats_rd_t *rd_stats = bam_access_stats_entry(grp_stats, rg_index, read);
+  if(rd_stats->length == 0) rd_stats->length = b->core.l_qseq;
 
-    // Divergence calculation: Collect stats that will allow us to calculate the the number of bases that diverge from the reference.
-    //                         This requires collecting the value from the NM tag and the mapped proportion of the query string.
-    uint8_t *nm = 0;
-    nm = bam_aux_get(b,"NM");
+  rd_stats->count++;
+  if(b->core.flag & BAM_FDUP) rd_stats->dups++;
 
-    if(nm){
-      uint32_t nm_val = bam_aux2i(nm);
-      if(nm_val>0){
-        (*grp_stats)[rg_index][read]->divergent += nm_val;
-      }
+  //Get the count of GCs in the sequence.
+  if(!(opts & BAM_ACCESS_NO_GC)) rd_stats->gc += bam_stats_kernels_gc_count(bam_get_seq(b), b->core.l_qseq);
+
+  //Quality plot data, cycles in sequencing order
+  if(opts & BAM_ACCESS_CYCLES){
+    check(bam_access_cycle_hist_add(&rd_stats->cycles, b) == 0, "Error counting per cycle data.");
+  }
+
+  if(opts & BAM_ACCESS_QC){
+    check(bam_access_qc_add(&rd_stats->qc, b) == 0, "Error counting extended QC data.");
+  }
+
+  //Count unmapped and go to next read as anything after this is for mapped only.
+  if(b->core.flag & BAM_FUNMAP){
+    rd_stats->umap++;
+    return 0;
+  }
+
+  // everything after this point must require reads are mapped
+
+  // Divergence calculation: Collect stats that will allow us to calculate the the number of bases that diverge from the reference.
+  //                         This requires collecting the value from the NM tag and the mapped proportion of the query string.
+  if(nm){
+    uint32_t nm_val = bam_aux2i(nm);
+    if(nm_val>0){
+      rd_stats->divergent += nm_val;
     }
-    (*grp_stats)[rg_index][read]->mapped_bases += bam_access_get_mapped_base_count_from_cigar(b);
-
-    // stats that only assess read 1
-    if(b->core.flag & BAM_FREAD1) {
-      // Count all the pairs where both ends are not unmapped
-      // already tested if this read is mapped above
-      if(!(b->core.flag & BAM_FMUNMAP)) {
-        (*grp_stats)[rg_index][read]->mapped_pairs++;
-
-        // Insert size can only be calculated based on reads that are on same chr
-        // so it is more sensible to generate the distribution based on $PROPER-pairs.
-        // only assess read 1 as size is a factor of the pair
-        if(b->core.flag & BAM_FPROPER_PAIR){
-          (*grp_stats)[rg_index][read]->proper++;
-          uint32_t ins = b->core.isize;
-          int res;
-          khint_t k;
-          k = kh_put(ins,(*grp_stats)[rg_index][read]->inserts,abs(ins),&res);
-          if(res){
-            kh_value((*grp_stats)[rg_index][read]->inserts,k) = 1;
-          }else{
-            kh_value((*grp_stats)[rg_index][read]->inserts,k) = kh_value((*grp_stats)[rg_index][read]->inserts,k)+1;
-          }
-        }
-        else if(b->core.tid != b->core.mtid) {
-          // here count the reads where the chr are different
-          (*grp_stats)[rg_index][read]->inter_chr_pairs++;
+  }
+  rd_stats->mapped_bases += bam_access_get_mapped_base_count_from_cigar(b);
+
+  // stats that only assess read 1
+  if(b->core.flag & BAM_FREAD1) {
+    // Count all the pairs where both ends are not unmapped
+    // already tested if this read is mapped above
+    if(!(b->core.flag & BAM_FMUNMAP)) {
+      rd_stats->mapped_pairs++;
+
+      // Insert size can only be calculated based on reads that are on same chr
+      // so it is more sensible to generate the distribution based on $PROPER-pairs.
+      // only assess read 1 as size is a factor of the pair
+      if(b->core.flag & BAM_FPROPER_PAIR){
+        rd_stats->proper++;
+        uint32_t ins = abs(b->core.isize);
+        if(ins < INSERT_DENSE_SIZE && rd_stats->inserts.dense){
+          rd_stats->inserts.dense[ins]++;
+          rd_stats->inserts.total++;
+          rd_stats->inserts.sum += ins;
+        }else{
+          check(bam_access_insert_hist_add(&rd_stats->inserts, ins, 1) == 0, "Error counting insert size %"PRIu32".", ins);
         }
       }
+      else if(b->core.tid != b->core.mtid) {
+        // here count the reads where the chr are different
+        rd_stats->inter_chr_pairs++;
+      }
     }
+  }
+  return 0;
+error:
+  return -1;
+}
+
+int bam_access_process_reads(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts){
+  return bam_access_process_reads_checkpointed(input, head, grps, grps_size, grp_stats, opts, 0, 0, NULL, NULL);
+}
+
+int bam_access_process_reads_checkpointed(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts,
+                                            uint64_t every, uint64_t records, bam_access_checkpoint_fn checkpoint, void *data){
+  assert(input != NULL);
+  assert(head != NULL);
+  assert(grps != NULL);
 
+  bam1_t *b = NULL;
+  rg_lookup_t *lookup = NULL;
+  if(checkpoint) check(input->format.format == bam, "Checkpoints need BGZF compressed BAM input.");
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+  //Iterate through each read in bam file.
+  b = bam_init1();
+  int ret;
+  uint64_t since = 0;
+  while((ret = sam_read1(input, head, b)) >= 0){
+    int chk = bam_access_process_read(b, lookup, *grp_stats, opts);
+    check(chk==0, "Error processing read %s.", bam_get_qname(b));
+    records++;
+    if(checkpoint && ++since == every){
+      //Offset is that of the next record so a resume doesn't count this one twice
+      check(checkpoint(bgzf_tell(input->fp.bgzf), records, data) == 0, "Error writing checkpoint after %"PRIu64" records.", records);
+      since = 0;
+    }
   }
+  check(ret == -1, "Error reading input file, truncated or corrupt record (%d).", ret);
   bam_destroy1(b);
+  bam_access_rg_lookup_destroy(lookup);
   return 0;
   error:
     if(b) bam_destroy1(b);
+    bam_access_rg_lookup_destroy(lookup);
     return -1;
 }
 
 uint64_t bam_access_get_mapped_base_count_from_cigar(bam1_t *b){
-#define _cop(c) ((c)&BAM_CIGAR_MASK)
-#define _cln(c) ((c)>>BAM_CIGAR_SHIFT)
   assert(b != NULL);
-  uint64_t count = 0;
-  uint32_t *cigar = bam_get_cigar(b);
-  //iterate through each cigar operation
-  int i=0;
-  for(i=0;i<b->core.n_cigar;i++){
-    int op = _cop(cigar[i]);
-    int l = _cln(cigar[i]);
-    if(op == BAM_CINS|| op == BAM_CEQUAL || op == BAM_CMATCH || op == BAM_CDIFF ){ //Match,Insert,Missmatch,Equal all sum to generate the length of mapped bases
-      count += l;
-    }
-  }
-  return count;
+  //Match,Insert,Missmatch,Equal all sum to generate the length of mapped bases
+  return bam_stats_kernels_mapped_bases(bam_get_cigar(b), b->core.n_cigar);
 }
 
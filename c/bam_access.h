@@ -26,25 +26,84 @@
 #include "htslib/sam.h"
 #include "dbg.h"
 #include "khash.h"
+#include "bam_stats_kernels.h"
 
 KHASH_MAP_INIT_INT(ins,uint64_t)
 //KHASH_INIT2(ins,, khint32_t, uint64_t, 1, kh_int_hash_func, kh_int_hash_equal)
 
+//bam_access_process_read(s) opts flags
+#define BAM_ACCESS_RNA 1 //count secondary hits
+#define BAM_ACCESS_NO_GC 2 //sequence not decoded, G/C left at 0
+#define BAM_ACCESS_CYCLES 4 //collect per cycle quality and base composition
+#define BAM_ACCESS_QC 8 //collect per contig counts, MAPQ and clipping histograms
+#define BAM_ACCESS_ANON 16 //reads with a missing or unknown RG are counted in the anonymous '.' group, which must be present
+
+#define INSERT_DENSE_SIZE 8192 //Insert sizes below this are counted in a flat array
+
+#define STATS_CACHE_LINE 64
+
+//Insert size histogram, a flat array over the common range with the long RNA/mate-pair tail in a hash.
+//Both parts are only allocated once a size in their range is seen.
+typedef struct {
+  uint64_t *dense;
+  khash_t(ins) *overflow;
+  uint64_t total; //Count of all inserts
+  uint64_t sum; //Sum of all insert sizes
+} insert_hist_t;
+
+//Per cycle quality and base composition, grown to the longest read seen.
+//Reads are counted in byte wide staged rows (bam_stats_kernels.h) that are added to quals/bases every 255 reads,
+//call bam_access_cycle_hist_flush before reading the totals.
+typedef struct {
+  uint32_t n_cycles;
+  uint64_t *quals; //n_cycles x CYCLE_QUALS
+  uint64_t *bases; //n_cycles x CYCLE_BASES
+  uint8_t *staged; //CYCLE_STAGED_ROWS x stride
+  uint32_t stride;
+  uint32_t n_staged;
+} cycle_hist_t;
+
+//Counts by a small integer (contig, MAPQ, clip length), grown to the largest bin seen
+typedef struct {
+  uint32_t size;
+  uint64_t *counts;
+} count_hist_t;
+
+//Extended QC, counting the same reads as the .bas
+typedef struct {
+  count_hist_t mapped; //by tid
+  count_hist_t unmapped; //by tid, unmapped reads placed with their mate
+  uint64_t no_coor; //unmapped reads without a position
+  count_hist_t mapq; //mapped reads
+  count_hist_t soft_clip; //soft clipped bases per mapped read
+  count_hist_t hard_clip; //hard clipped bases per mapped read
+} qc_hist_t;
+
+//One read group/end entry of the stats arena (bam_access_init_stats), cache line aligned.
+//Counters updated for every record fill the first line, read 1 pair counters start the second,
+//the optional histograms follow so they're only touched when enabled.
 typedef struct {
-  uint32_t length;
 	uint64_t count;
 	uint64_t dups;
   uint64_t gc;
   uint64_t umap;
   uint64_t divergent;
   uint64_t mapped_bases;
-  uint64_t proper;
+  uint32_t length;
+  //Starts the second line, without the alignment it would pack into the first after length
+  uint64_t proper __attribute__((aligned(STATS_CACHE_LINE)));
   uint64_t mapped_pairs;
   uint64_t inter_chr_pairs;
   //list of counts of possible insert sizes....
-  khash_t(ins) *inserts; //from counts of insert size from 0-200000 bp. See how this works, might need amore dynamic means for some data.
-  //FQP is not included as we're not covering quality plots yet.
-} stats_rd_t;
+  insert_hist_t inserts;
+  //Quality plot data, only when BAM_ACCESS_CYCLES
+  cycle_hist_t cycles;
+  //Extended QC, only when BAM_ACCESS_QC
+  qc_hist_t qc;
+} __attribute__((aligned(STATS_CACHE_LINE))) stats_rd_t;
+
+//Entry for read group rg and end (0 read 1, 1 read 2), as grp_stats[rg][end] without going through the pointer tables
+#define bam_access_stats_entry(grp_stats, rg, end) ((grp_stats)[0][0] + 2 * (rg) + (end))
 
 typedef struct{
   char *id;
@@ -52,11 +111,95 @@ typedef struct{
   char *platform_unit;
   char *lib;
   char *sample;
+  char *head; //@RG line as found in the header
 } rg_info_t;
 
+KHASH_MAP_INIT_STR(rg_ids,int)
+
+//Read group ID to index lookup. The hash is read only once built so threads share it,
+//each thread working on its own copy of the struct so the last hit cache isn't shared.
+typedef struct{
+  khash_t(rg_ids) *ids;
+  rg_info_t **grps;
+  int grps_size;
+  int last_idx;
+} rg_lookup_t;
+
+void parse_rg_line(char *tmp_line, rg_info_t *group);
+
+//The '.' group reads without a known RG are counted in, named anon in the .bas as PCAP::Bam::Stats does
+rg_info_t *bam_access_anon_group();
+
 rg_info_t **bam_access_parse_header(bam_hdr_t *head, int *grps_size, stats_rd_t ****grp_stats);
 
-int bam_access_process_reads(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int rna);
+void bam_access_destroy_groups(rg_info_t **grps, int grps_size);
+
+//A single allocation: the [rg] and [rg][end] pointer tables then the zeroed entries, contiguous in [rg][end] order.
+//Per-thread replicas are separate arenas so never share a cache line, reduce them with bam_access_merge_stats.
+stats_rd_t ***bam_access_init_stats(int grps_size);
+
+//Moves the entries into a larger arena, new read groups are zeroed
+int bam_access_grow_stats(stats_rd_t ****grp_stats, int grps_size, int new_size);
+
+void bam_access_destroy_stats(stats_rd_t ***grp_stats, int grps_size);
+
+int bam_access_merge_stats(stats_rd_t ***target, stats_rd_t ***source, int grps_size);
+
+int bam_access_insert_hist_add(insert_hist_t *hist, uint32_t insert, uint64_t count);
+
+uint64_t bam_access_insert_hist_get(insert_hist_t *hist, uint32_t insert);
+
+int bam_access_insert_hist_merge(insert_hist_t *target, insert_hist_t *source);
+
+void bam_access_insert_hist_destroy(insert_hist_t *hist);
+
+//Makes room for at least n_cycles, new cycles are zeroed
+int bam_access_cycle_hist_reserve(cycle_hist_t *hist, uint32_t n_cycles);
+
+int bam_access_cycle_hist_add(cycle_hist_t *hist, bam1_t *b);
+
+void bam_access_cycle_hist_flush(cycle_hist_t *hist);
+
+int bam_access_cycle_hist_merge(cycle_hist_t *target, cycle_hist_t *source);
+
+void bam_access_cycle_hist_destroy(cycle_hist_t *hist);
+
+int bam_access_count_hist_add(count_hist_t *hist, uint32_t bin, uint64_t count);
+
+int bam_access_count_hist_merge(count_hist_t *target, count_hist_t *source);
+
+void bam_access_count_hist_destroy(count_hist_t *hist);
+
+int bam_access_qc_add(qc_hist_t *qc, bam1_t *b);
+
+int bam_access_qc_merge(qc_hist_t *target, qc_hist_t *source);
+
+void bam_access_qc_destroy(qc_hist_t *qc);
+
+//Per contig and unplaced read counts from the index pseudo-bins (BAI/CSI), the BGZF body isn't read
+int bam_access_index_counts(hts_idx_t *idx, bam_hdr_t *head, qc_hist_t *qc);
+
+rg_lookup_t *bam_access_rg_lookup_init(rg_info_t **grps, int grps_size);
+
+int bam_access_rg_lookup_get(rg_lookup_t *lookup, const char *rg);
+
+void bam_access_rg_lookup_destroy(rg_lookup_t *lookup);
+
+int bam_access_scan_aux(bam1_t *b, char **rg, uint8_t **nm);
+
+//Restrict CRAM decoding to the fields read by bam_access_process_read, no-op for other formats
+int bam_access_set_cram_fields(htsFile *input, int opts);
+
+int bam_access_process_read(bam1_t *b, rg_lookup_t *lookup, stats_rd_t ***grp_stats, int opts);
+
+int bam_access_process_reads(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts);
+
+//Called with the BGZF virtual offset of the next record and the count of records read so far
+typedef int (*bam_access_checkpoint_fn)(int64_t voffset, uint64_t records, void *data);
+
+//As bam_access_process_reads, calling checkpoint every 'every' records. Input must be BGZF compressed (BAM).
+int bam_access_process_reads_checkpointed(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts,
+                                            uint64_t every, uint64_t records, bam_access_checkpoint_fn checkpoint, void *data);
 
 uint64_t bam_access_get_mapped_base_count_from_cigar(bam1_t *b);
 
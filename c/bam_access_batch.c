@@ -0,0 +1,323 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "bam_access_batch.h"
+
+//Number of jobs handed out per worker over the whole batch
+#define BATCH_JOBS_PER_WORKER 4
+
+typedef struct {
+  batch_input_t *input;
+  int whole; //Not indexed, read sequentially
+  shard_t shard;
+  uint64_t ord; //Position of the shard in the input
+  uint64_t weight;
+} batch_job_t;
+
+typedef struct {
+  batch_job_t *jobs;
+  int n_jobs;
+  int next_job;
+  pthread_mutex_t lock;
+  char *ref_file;
+  int opts;
+  bam_access_batch_done_fn done;
+  void *data;
+} batch_t;
+
+static int job_cmp(const void *a, const void *b){
+  const batch_job_t *ja = (const batch_job_t *)a;
+  const batch_job_t *jb = (const batch_job_t *)b;
+  //Largest inputs first, jobs of an input kept together in file order
+  if(ja->weight != jb->weight) return ja->weight > jb->weight ? -1 : 1;
+  if(ja->input != jb->input) return ja->input < jb->input ? -1 : 1;
+  if(ja->ord != jb->ord) return ja->ord < jb->ord ? -1 : 1;
+  return 0;
+}
+
+static void input_destroy(batch_input_t *in){
+  if(in->grp_stats) bam_access_destroy_stats(in->grp_stats, in->grps_size);
+  if(in->grps) bam_access_destroy_groups(in->grps, in->grps_size);
+  if(in->len_ord) free(in->len_ord);
+  if(in->len_val) free(in->len_val);
+  in->grp_stats = NULL;
+  in->grps = NULL;
+  in->len_ord = NULL;
+  in->len_val = NULL;
+}
+
+//Adds a finished job to its input, reporting the input once all its jobs are in
+static void job_finish(batch_t *batch, batch_job_t *job, stats_rd_t ***stats, int status){
+  batch_input_t *in = job->input;
+  int j, rd;
+  pthread_mutex_lock(&in->lock);
+  if(status == 0 && in->status == 0){
+    //Read length is first-seen, keep the earliest job's value as a sequential pass would
+    for(j=0; j<in->grps_size; j++){
+      for(rd=0; rd<2; rd++){
+        if(stats[j][rd]->length != 0 && job->ord < in->len_ord[j*2+rd]){
+          in->len_ord[j*2+rd] = job->ord;
+          in->len_val[j*2+rd] = stats[j][rd]->length;
+        }
+        stats[j][rd]->length = 0;
+      }
+    }
+    if(bam_access_merge_stats(in->grp_stats, stats, in->grps_size) != 0) status = -1;
+  }
+  if(status != 0) in->status = -1;
+  int last = --in->remaining == 0;
+  pthread_mutex_unlock(&in->lock);
+  if(!last) return;
+
+  if(in->status == 0){
+    for(j=0; j<in->grps_size; j++) for(rd=0; rd<2; rd++) in->grp_stats[j][rd]->length = in->len_val[j*2+rd];
+    if(batch->done && batch->done(in, batch->data) != 0) in->status = -1;
+  }
+  if(in->status != 0) log_err("Error generating stats for '%s'.", in->input_file);
+  input_destroy(in);
+}
+
+//Reads the header of an input and splits it into index shards of about per_job bytes,
+//returns the number of jobs with shards left NULL when the input is read whole.
+static int plan_input(batch_input_t *in, uint64_t size, uint64_t per_job, shard_t **shards){
+  htsFile *input = NULL;
+  bam_hdr_t *head = NULL;
+  hts_idx_t *idx = NULL;
+  int n_shards = 1;
+  int j=0;
+  *shards = NULL;
+  input = hts_open(in->input_file, "r");
+  check(input != NULL, "Error opening hts file for reading '%s'.", in->input_file);
+  head = sam_hdr_read(input);
+  check(head != NULL, "Error reading header from opened hts file '%s'.", in->input_file);
+  in->grps = bam_access_parse_header(head, &in->grps_size, &in->grp_stats);
+  check(in->grps != NULL, "Error fetching read groups from header of '%s'.", in->input_file);
+  idx = sam_index_load(input, in->input_file);
+  if(idx){
+    uint64_t pieces = (size + per_job - 1) / per_job;
+    *shards = bam_access_parallel_plan_shards(head, idx, pieces > INT_MAX ? INT_MAX : (int)pieces, &n_shards);
+    check(*shards != NULL, "Error planning shards of '%s'.", in->input_file);
+  }
+  in->len_ord = (uint64_t *) malloc(sizeof(uint64_t) * in->grps_size * 2);
+  check_mem(in->len_ord);
+  in->len_val = (uint32_t *) calloc(in->grps_size * 2, sizeof(uint32_t));
+  check_mem(in->len_val);
+  for(j=0; j<in->grps_size*2; j++) in->len_ord[j] = UINT64_MAX;
+  in->remaining = n_shards;
+
+  if(idx) hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return n_shards;
+
+error:
+  if(*shards) free(*shards);
+  *shards = NULL;
+  if(idx) hts_idx_destroy(idx);
+  if(head) bam_hdr_destroy(head);
+  if(input) hts_close(input);
+  return -1;
+}
+
+static void *batch_worker(void *arg){
+  batch_t *batch = (batch_t *) arg;
+  batch_input_t *open_input = NULL;
+  htsFile *input = NULL;
+  bam_hdr_t *head = NULL;
+  hts_idx_t *idx = NULL;
+  rg_lookup_t *lookup = NULL;
+  stats_rd_t ***stats = NULL;
+
+  while(1){
+    pthread_mutex_lock(&batch->lock);
+    int s = batch->next_job++;
+    pthread_mutex_unlock(&batch->lock);
+    if(s >= batch->n_jobs) break;
+    batch_job_t *job = &batch->jobs[s];
+    batch_input_t *in = job->input;
+    int status = -1;
+
+    //No point reading the rest of an input that has already failed
+    pthread_mutex_lock(&in->lock);
+    int skip = in->status != 0;
+    pthread_mutex_unlock(&in->lock);
+    if(skip){
+      job_finish(batch, job, NULL, -1);
+      continue;
+    }
+
+    //Jobs of an input are adjacent, so a worker mostly keeps its open file
+    if(open_input != in || job->whole){
+      if(idx) hts_idx_destroy(idx);
+      if(head) bam_hdr_destroy(head);
+      if(input) hts_close(input);
+      bam_access_rg_lookup_destroy(lookup);
+      idx = NULL;
+      head = NULL;
+      lookup = NULL;
+      open_input = in;
+      input = hts_open(in->input_file, "r");
+      check(input != NULL, "Error opening hts file for reading '%s'.", in->input_file);
+      if(batch->ref_file) hts_set_fai_filename(input, batch->ref_file);
+      check(bam_access_set_cram_fields(input, batch->opts) == 0, "Error restricting CRAM decoding of '%s'.", in->input_file);
+      head = sam_hdr_read(input);
+      check(head != NULL, "Error reading header from opened hts file '%s'.", in->input_file);
+      if(!job->whole){
+        idx = sam_index_load(input, in->input_file);
+        check(idx != NULL, "Error loading index for '%s'.", in->input_file);
+      }
+      lookup = bam_access_rg_lookup_init(in->grps, in->grps_size);
+      check(lookup != NULL, "Error building read group lookup.");
+    }
+    stats = bam_access_init_stats(in->grps_size);
+    check(stats != NULL, "Error allocating stats for '%s'.", in->input_file);
+    if(job->whole){
+      check(bam_access_process_reads(input, head, in->grps, in->grps_size, &stats, batch->opts) == 0,
+            "Error processing reads in '%s'.", in->input_file);
+      //The input is read to its end, reopen for anything else
+      open_input = NULL;
+    }else{
+      check(bam_access_parallel_process_shard(input, idx, &job->shard, lookup, stats, batch->opts) == 0,
+            "Error processing shard %d:%d-%d of '%s'.", job->shard.tid, job->shard.beg, job->shard.end, in->input_file);
+    }
+    status = 0;
+  error:
+    //Start afresh for the next job
+    if(status != 0) open_input = NULL;
+    job_finish(batch, job, stats, status);
+    bam_access_destroy_stats(stats, in->grps_size);
+    stats = NULL;
+  }
+
+  if(idx) hts_idx_destroy(idx);
+  if(head) bam_hdr_destroy(head);
+  if(input) hts_close(input);
+  bam_access_rg_lookup_destroy(lookup);
+  return NULL;
+}
+
+int bam_access_batch_process(char **input_files, int n_inputs, char *ref_file, int opts, int nthreads,
+                              bam_access_batch_done_fn done, void *data){
+  assert(input_files != NULL);
+  batch_input_t *inputs = NULL;
+  uint64_t *sizes = NULL;
+  batch_t batch;
+  pthread_t *threads = NULL;
+  int started = 0;
+  int i, j;
+  memset(&batch, 0, sizeof(batch_t));
+  pthread_mutex_init(&batch.lock, NULL);
+  batch.ref_file = ref_file;
+  batch.opts = opts;
+  batch.done = done;
+  batch.data = data;
+  if(nthreads < 1) nthreads = 1;
+
+  inputs = (batch_input_t *) calloc(n_inputs, sizeof(batch_input_t));
+  check_mem(inputs);
+  sizes = (uint64_t *) calloc(n_inputs, sizeof(uint64_t));
+  check_mem(sizes);
+  for(i=0; i<n_inputs; i++) pthread_mutex_init(&inputs[i].lock, NULL);
+
+  //Inputs are weighted by size on disk, the one measure shared by BAM and CRAM, indexed or not
+  uint64_t total = 0;
+  for(i=0; i<n_inputs; i++){
+    struct stat st;
+    check(stat(input_files[i], &st) == 0, "Error reading size of '%s'.", input_files[i]);
+    sizes[i] = st.st_size > 0 ? st.st_size : 1;
+    total += sizes[i];
+  }
+  uint64_t per_job = total / ((uint64_t)nthreads * BATCH_JOBS_PER_WORKER);
+  if(per_job == 0) per_job = 1;
+
+  int size = 0;
+  for(i=0; i<n_inputs; i++){
+    batch_input_t *in = &inputs[i];
+    shard_t *shards = NULL;
+    in->input_file = input_files[i];
+    int n_shards = plan_input(in, sizes[i], per_job, &shards);
+    //An unreadable input fails alone rather than stopping the batch
+    if(n_shards < 0){
+      log_err("Error preparing '%s', no stats will be written for it.", in->input_file);
+      in->status = -1;
+      input_destroy(in);
+      continue;
+    }
+    if(batch.n_jobs + n_shards > size){
+      while(batch.n_jobs + n_shards > size) size = size ? size * 2 : 64;
+      batch_job_t *grown = (batch_job_t *) realloc(batch.jobs, sizeof(batch_job_t) * size);
+      if(grown == NULL) free(shards);
+      check_mem(grown);
+      batch.jobs = grown;
+    }
+    for(j=0; j<n_shards; j++){
+      batch_job_t *job = &batch.jobs[batch.n_jobs++];
+      job->input = in;
+      job->whole = shards == NULL;
+      if(shards) job->shard = shards[j];
+      job->ord = j;
+      job->weight = sizes[i];
+    }
+    if(shards) free(shards);
+  }
+  qsort(batch.jobs, batch.n_jobs, sizeof(batch_job_t), job_cmp);
+  log_info("Processing %d inputs as %d jobs on %d workers.", n_inputs, batch.n_jobs, nthreads);
+
+  threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+  check_mem(threads);
+  for(started=0; started<nthreads; started++){
+    check(pthread_create(&threads[started], NULL, batch_worker, &batch) == 0, "Error starting worker thread %d.", started);
+  }
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+
+  int failed = 0;
+  for(i=0; i<n_inputs; i++){
+    if(inputs[i].status != 0) failed++;
+    pthread_mutex_destroy(&inputs[i].lock);
+  }
+  free(threads);
+  free(batch.jobs);
+  free(inputs);
+  free(sizes);
+  pthread_mutex_destroy(&batch.lock);
+  return failed;
+
+error:
+  //Workers take every job before finishing, let any started finish the batch so nothing is left half merged
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  if(threads) free(threads);
+  if(inputs){
+    for(i=0; i<n_inputs; i++){
+      input_destroy(&inputs[i]);
+      pthread_mutex_destroy(&inputs[i].lock);
+    }
+    free(inputs);
+  }
+  if(batch.jobs) free(batch.jobs);
+  if(sizes) free(sizes);
+  pthread_mutex_destroy(&batch.lock);
+  return -1;
+}
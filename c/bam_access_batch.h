@@ -0,0 +1,49 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_access_batch_h__
+#define __bam_access_batch_h__
+
+#include <pthread.h>
+#include "bam_access_parallel.h"
+
+//One input of a batch run
+typedef struct {
+  char *input_file;
+  rg_info_t **grps;
+  int grps_size;
+  stats_rd_t ***grp_stats; //Complete once remaining reaches 0
+  uint64_t *len_ord; //[rg*2+read] ordinal of the earliest job that set the read length
+  uint32_t *len_val;
+  int remaining; //Jobs not yet finished
+  int status;
+  pthread_mutex_t lock;
+} batch_input_t;
+
+//Called from the worker that finishes the last job of an input, while other inputs are still being read
+typedef int (*bam_access_batch_done_fn)(batch_input_t *input, void *data);
+
+//Stats for many inputs on one pool of nthreads workers.
+//Indexed inputs are split into shards sized against the whole batch, others are one job each, largest inputs first.
+//Workers take the next job whatever its input so large inputs spread over otherwise idle workers.
+//Returns the number of inputs that failed, -1 if the batch couldn't be run.
+int bam_access_batch_process(char **input_files, int n_inputs, char *ref_file, int opts, int nthreads,
+                              bam_access_batch_done_fn done, void *data);
+
+#endif
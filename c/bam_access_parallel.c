@@ -0,0 +1,530 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "bam_access_parallel.h"
+
+//Number of shards handed out per worker, gives some slack for unevenly populated regions
+#define SHARDS_PER_WORKER 4
+//Records per batch passed from the reader to the stats workers in stream mode
+#define STREAM_BATCH_SIZE 4096
+//Batches in flight per stats worker in stream mode
+#define STREAM_BATCHES_PER_WORKER 3
+
+typedef struct {
+  char *input_file;
+  char *ref_file;
+  shard_t *shards;
+  int n_shards;
+  int *next_shard;
+  pthread_mutex_t *lock;
+  rg_lookup_t lookup; //Own copy, sharing the read only hash
+  int grps_size;
+  int opts;
+  stats_rd_t ***stats;
+  uint64_t *len_ord; //[rg*2+read] ordinal of the earliest shard that set the read length
+  uint32_t *len_val;
+  int status;
+} shard_worker_t;
+
+typedef struct {
+  bam1_t **reads;
+  int n;
+  uint64_t ord;
+} batch_t;
+
+typedef struct {
+  batch_t **items;
+  int size;
+  int head;
+  int count;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} batch_queue_t;
+
+typedef struct {
+  batch_queue_t *full;
+  batch_queue_t *empty;
+  int *failed;
+  rg_lookup_t lookup; //Own copy, sharing the read only hash
+  int grps_size;
+  int opts;
+  stats_rd_t ***stats;
+  uint64_t *len_ord;
+  uint32_t *len_val;
+  int status;
+} __attribute__((aligned(STATS_CACHE_LINE))) stream_worker_t;
+
+shard_t *bam_access_parallel_plan_shards(bam_hdr_t *head, hts_idx_t *idx, int target_shards, int *n_shards){
+  assert(head != NULL);
+  assert(idx != NULL);
+  shard_t *shards = NULL;
+  uint64_t *weight = NULL;
+  uint64_t total = 0;
+  int have_stats = 0;
+  int tid = 0;
+  if(target_shards < 1) target_shards = 1;
+
+  weight = (uint64_t *) calloc(head->n_targets + 1, sizeof(uint64_t));
+  check_mem(weight);
+  //Weight each contig by its read count from the index pseudo-bins
+  for(tid=0; tid<head->n_targets; tid++){
+    uint64_t mapped = 0;
+    uint64_t unmapped = 0;
+    if(hts_idx_get_stat(idx, tid, &mapped, &unmapped) == 0){
+      weight[tid] = mapped + unmapped;
+      have_stats = 1;
+    }
+  }
+  if(!have_stats){ //CRAM indices carry no counts, fall back to contig length
+    for(tid=0; tid<head->n_targets; tid++) weight[tid] = head->target_len[tid];
+  }
+  for(tid=0; tid<head->n_targets; tid++) total += weight[tid];
+
+  uint64_t per_shard = total / target_shards;
+  if(per_shard == 0) per_shard = 1;
+
+  int size = 1; //Always have the unmapped tail
+  for(tid=0; tid<head->n_targets; tid++){
+    if(weight[tid] == 0) continue;
+    uint64_t pieces = (weight[tid] + per_shard - 1) / per_shard;
+    if(pieces > head->target_len[tid]) pieces = head->target_len[tid] ? head->target_len[tid] : 1;
+    size += pieces;
+  }
+
+  shards = (shard_t *) malloc(sizeof(shard_t) * size);
+  check_mem(shards);
+  int idx_shard = 0;
+  for(tid=0; tid<head->n_targets; tid++){
+    if(weight[tid] == 0) continue;
+    uint64_t pieces = (weight[tid] + per_shard - 1) / per_shard;
+    if(pieces > head->target_len[tid]) pieces = head->target_len[tid] ? head->target_len[tid] : 1;
+    uint64_t width = head->target_len[tid] / pieces;
+    uint64_t p = 0;
+    for(p=0; p<pieces; p++){
+      shards[idx_shard].tid = tid;
+      shards[idx_shard].beg = (int)(p * width);
+      //Last piece is open ended so reads hanging off the contig end are still collected
+      shards[idx_shard].end = (p == pieces-1) ? INT_MAX : (int)((p+1) * width);
+      idx_shard++;
+    }
+  }
+  shards[idx_shard].tid = HTS_IDX_NOCOOR;
+  shards[idx_shard].beg = 0;
+  shards[idx_shard].end = 0;
+  idx_shard++;
+
+  free(weight);
+  *n_shards = idx_shard;
+  return shards;
+
+error:
+  if(weight) free(weight);
+  if(shards) free(shards);
+  return NULL;
+}
+
+int bam_access_parallel_process_shard(htsFile *input, hts_idx_t *idx, shard_t *shard, rg_lookup_t *lookup, stats_rd_t ***grp_stats, int opts){
+  assert(input != NULL);
+  assert(idx != NULL);
+  assert(shard != NULL);
+  hts_itr_t *iter = NULL;
+  bam1_t *b = NULL;
+  int ret;
+
+  iter = sam_itr_queryi(idx, shard->tid, shard->beg, shard->end);
+  check(iter != NULL, "Error creating iterator for shard %d:%d-%d.", shard->tid, shard->beg, shard->end);
+  b = bam_init1();
+  check_mem(b);
+  while((ret = sam_itr_next(input, iter, b)) >= 0){
+    //Reads overlapping the shard start are owned by the previous shard
+    if(shard->tid >= 0 && b->core.pos < shard->beg) continue;
+    int chk = bam_access_process_read(b, lookup, grp_stats, opts);
+    check(chk==0, "Error processing read %s.", bam_get_qname(b));
+  }
+  check(ret == -1, "Error reading shard %d:%d-%d, truncated or corrupt record (%d).", shard->tid, shard->beg, shard->end, ret);
+
+  bam_destroy1(b);
+  hts_itr_destroy(iter);
+  return 0;
+
+error:
+  if(b) bam_destroy1(b);
+  if(iter) hts_itr_destroy(iter);
+  return -1;
+}
+
+static void *shard_worker(void *arg){
+  shard_worker_t *w = (shard_worker_t *) arg;
+  htsFile *input = NULL;
+  bam_hdr_t *head = NULL;
+  hts_idx_t *idx = NULL;
+  int j, rd;
+
+  w->status = -1;
+  input = hts_open(w->input_file, "r");
+  check(input != NULL, "Error opening hts file for reading '%s'.", w->input_file);
+  if(w->ref_file) hts_set_fai_filename(input, w->ref_file);
+  check(bam_access_set_cram_fields(input, w->opts) == 0, "Error restricting CRAM decoding of '%s'.", w->input_file);
+  head = sam_hdr_read(input);
+  check(head != NULL, "Error reading header from opened hts file '%s'.", w->input_file);
+  idx = sam_index_load(input, w->input_file);
+  check(idx != NULL, "Error loading index for '%s'.", w->input_file);
+
+  while(1){
+    pthread_mutex_lock(w->lock);
+    int s = (*w->next_shard)++;
+    pthread_mutex_unlock(w->lock);
+    if(s >= w->n_shards) break;
+
+    //Read length is first-seen, so isolate this shard's view of it and keep the earliest shard's value
+    for(j=0; j<w->grps_size; j++) for(rd=0; rd<2; rd++) w->stats[j][rd]->length = 0;
+    int chk = bam_access_parallel_process_shard(input, idx, &w->shards[s], &w->lookup, w->stats, w->opts);
+    check(chk == 0, "Error processing shard %d.", s);
+    for(j=0; j<w->grps_size; j++){
+      for(rd=0; rd<2; rd++){
+        if(w->stats[j][rd]->length != 0 && (uint64_t)s < w->len_ord[j*2+rd]){
+          w->len_ord[j*2+rd] = s;
+          w->len_val[j*2+rd] = w->stats[j][rd]->length;
+        }
+      }
+    }
+  }
+  for(j=0; j<w->grps_size; j++) for(rd=0; rd<2; rd++) w->stats[j][rd]->length = w->len_val[j*2+rd];
+
+  w->status = 0;
+error:
+  if(idx) hts_idx_destroy(idx);
+  if(head) bam_hdr_destroy(head);
+  if(input) hts_close(input);
+  return NULL;
+}
+
+int bam_access_parallel_process_indexed(char *input_file, char *ref_file, bam_hdr_t *head, hts_idx_t *idx, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts, int nthreads){
+  assert(input_file != NULL);
+  assert(head != NULL);
+  assert(idx != NULL);
+  assert(grps != NULL);
+  shard_t *shards = NULL;
+  rg_lookup_t *lookup = NULL;
+  shard_worker_t *workers = NULL;
+  pthread_t *threads = NULL;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  int n_shards = 0;
+  int next_shard = 0;
+  int started = 0;
+  int i, j, rd;
+  if(nthreads < 1) nthreads = 1;
+
+  shards = bam_access_parallel_plan_shards(head, idx, nthreads * SHARDS_PER_WORKER, &n_shards);
+  check(shards != NULL, "Error planning shards from index.");
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+
+  workers = (shard_worker_t *) calloc(nthreads, sizeof(shard_worker_t));
+  check_mem(workers);
+  threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+  check_mem(threads);
+  for(i=0; i<nthreads; i++){
+    workers[i].input_file = input_file;
+    workers[i].ref_file = ref_file;
+    workers[i].shards = shards;
+    workers[i].n_shards = n_shards;
+    workers[i].next_shard = &next_shard;
+    workers[i].lock = &lock;
+    workers[i].lookup = *lookup;
+    workers[i].grps_size = grps_size;
+    workers[i].opts = opts;
+    workers[i].stats = bam_access_init_stats(grps_size);
+    check(workers[i].stats != NULL, "Error allocating stats for worker %d.", i);
+    workers[i].len_ord = (uint64_t *) malloc(sizeof(uint64_t) * grps_size * 2);
+    check_mem(workers[i].len_ord);
+    workers[i].len_val = (uint32_t *) calloc(grps_size * 2, sizeof(uint32_t));
+    check_mem(workers[i].len_val);
+    for(j=0; j<grps_size*2; j++) workers[i].len_ord[j] = UINT64_MAX;
+  }
+  for(started=0; started<nthreads; started++){
+    check(pthread_create(&threads[started], NULL, shard_worker, &workers[started]) == 0, "Error starting worker thread %d.", started);
+  }
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  started = 0;
+
+  for(i=0; i<nthreads; i++){
+    check(workers[i].status == 0, "Worker %d failed.", i);
+    check(bam_access_merge_stats(*grp_stats, workers[i].stats, grps_size) == 0, "Error merging stats from worker %d.", i);
+  }
+  //Read lengths come from the earliest shard in file order, as a sequential pass would see them
+  for(j=0; j<grps_size; j++){
+    for(rd=0; rd<2; rd++){
+      uint64_t best = UINT64_MAX;
+      for(i=0; i<nthreads; i++){
+        if(workers[i].len_ord[j*2+rd] < best){
+          best = workers[i].len_ord[j*2+rd];
+          (*grp_stats)[j][rd]->length = workers[i].len_val[j*2+rd];
+        }
+      }
+    }
+  }
+
+  for(i=0; i<nthreads; i++){
+    bam_access_destroy_stats(workers[i].stats, grps_size);
+    free(workers[i].len_ord);
+    free(workers[i].len_val);
+  }
+  free(workers);
+  free(threads);
+  free(shards);
+  bam_access_rg_lookup_destroy(lookup);
+  return 0;
+
+error:
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  if(workers){
+    for(i=0; i<nthreads; i++){
+      bam_access_destroy_stats(workers[i].stats, grps_size);
+      if(workers[i].len_ord) free(workers[i].len_ord);
+      if(workers[i].len_val) free(workers[i].len_val);
+    }
+    free(workers);
+  }
+  if(threads) free(threads);
+  if(shards) free(shards);
+  bam_access_rg_lookup_destroy(lookup);
+  return -1;
+}
+
+static int batch_queue_init(batch_queue_t *q, int size){
+  q->items = (batch_t **) calloc(size, sizeof(batch_t *));
+  if(q->items == NULL) return -1;
+  q->size = size;
+  q->head = 0;
+  q->count = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+  return 0;
+}
+
+static void batch_queue_destroy(batch_queue_t *q){
+  if(q->items == NULL) return;
+  free(q->items);
+  q->items = NULL;
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_cond_destroy(&q->not_full);
+}
+
+static void batch_queue_push(batch_queue_t *q, batch_t *batch){
+  pthread_mutex_lock(&q->lock);
+  while(q->count == q->size) pthread_cond_wait(&q->not_full, &q->lock);
+  q->items[(q->head + q->count) % q->size] = batch;
+  q->count++;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static batch_t *batch_queue_pop(batch_queue_t *q){
+  pthread_mutex_lock(&q->lock);
+  while(q->count == 0) pthread_cond_wait(&q->not_empty, &q->lock);
+  batch_t *batch = q->items[q->head];
+  q->head = (q->head + 1) % q->size;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return batch;
+}
+
+static void *stream_worker(void *arg){
+  stream_worker_t *w = (stream_worker_t *) arg;
+  batch_t *batch;
+  int i, j, rd;
+  w->status = 0;
+  //A NULL batch is the end of input marker
+  while((batch = batch_queue_pop(w->full)) != NULL){
+    if(w->status == 0 && !__atomic_load_n(w->failed, __ATOMIC_RELAXED)){
+      for(j=0; j<w->grps_size; j++) for(rd=0; rd<2; rd++) w->stats[j][rd]->length = 0;
+      for(i=0; i<batch->n; i++){
+        if(bam_access_process_read(batch->reads[i], &w->lookup, w->stats, w->opts) != 0){
+          log_err("Error processing read %s.", bam_get_qname(batch->reads[i]));
+          w->status = -1;
+          __atomic_store_n(w->failed, 1, __ATOMIC_RELAXED);
+          break;
+        }
+      }
+      for(j=0; j<w->grps_size; j++){
+        for(rd=0; rd<2; rd++){
+          if(w->stats[j][rd]->length != 0 && batch->ord < w->len_ord[j*2+rd]){
+            w->len_ord[j*2+rd] = batch->ord;
+            w->len_val[j*2+rd] = w->stats[j][rd]->length;
+          }
+        }
+      }
+    }
+    //Keep draining after a failure so the reader never blocks on a full queue
+    batch_queue_push(w->empty, batch);
+  }
+  for(j=0; j<w->grps_size; j++) for(rd=0; rd<2; rd++) w->stats[j][rd]->length = w->len_val[j*2+rd];
+  return NULL;
+}
+
+int bam_access_parallel_process_stream(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts, int nthreads){
+  assert(input != NULL);
+  assert(head != NULL);
+  assert(grps != NULL);
+  rg_lookup_t *lookup = NULL;
+  stream_worker_t *workers = NULL;
+  pthread_t *threads = NULL;
+  batch_t *batches = NULL;
+  batch_queue_t full = {0};
+  batch_queue_t empty = {0};
+  int n_batches = 0;
+  int failed = 0;
+  int started = 0;
+  int ret = 0;
+  int i, j, rd;
+  uint64_t ord = 0;
+  if(nthreads < 1) nthreads = 1;
+
+  n_batches = nthreads * STREAM_BATCHES_PER_WORKER;
+  batches = (batch_t *) calloc(n_batches, sizeof(batch_t));
+  check_mem(batches);
+  check(batch_queue_init(&full, n_batches + nthreads) == 0, "Error creating batch queue.");
+  check(batch_queue_init(&empty, n_batches) == 0, "Error creating batch queue.");
+  //Records are recycled between batches rather than reallocated per read
+  for(i=0; i<n_batches; i++){
+    batches[i].reads = (bam1_t **) calloc(STREAM_BATCH_SIZE, sizeof(bam1_t *));
+    check_mem(batches[i].reads);
+    for(j=0; j<STREAM_BATCH_SIZE; j++){
+      batches[i].reads[j] = bam_init1();
+      check_mem(batches[i].reads[j]);
+    }
+    batch_queue_push(&empty, &batches[i]);
+  }
+
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+  //calloc only guarantees 16 byte alignment, each worker gets its own cache lines
+  void *mem = NULL;
+  check(posix_memalign(&mem, STATS_CACHE_LINE, sizeof(stream_worker_t) * nthreads) == 0, "Out of memory.");
+  memset(mem, 0, sizeof(stream_worker_t) * nthreads);
+  workers = (stream_worker_t *) mem;
+  threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+  check_mem(threads);
+  for(i=0; i<nthreads; i++){
+    workers[i].full = &full;
+    workers[i].empty = &empty;
+    workers[i].failed = &failed;
+    workers[i].lookup = *lookup;
+    workers[i].grps_size = grps_size;
+    workers[i].opts = opts;
+    workers[i].stats = bam_access_init_stats(grps_size);
+    check(workers[i].stats != NULL, "Error allocating stats for worker %d.", i);
+    workers[i].len_ord = (uint64_t *) malloc(sizeof(uint64_t) * grps_size * 2);
+    check_mem(workers[i].len_ord);
+    workers[i].len_val = (uint32_t *) calloc(grps_size * 2, sizeof(uint32_t));
+    check_mem(workers[i].len_val);
+    for(j=0; j<grps_size*2; j++) workers[i].len_ord[j] = UINT64_MAX;
+  }
+  for(started=0; started<nthreads; started++){
+    check(pthread_create(&threads[started], NULL, stream_worker, &workers[started]) == 0, "Error starting worker thread %d.", started);
+  }
+
+  //This thread is the reader, filling recycled batches in file order
+  while(!__atomic_load_n(&failed, __ATOMIC_RELAXED)){
+    batch_t *batch = batch_queue_pop(&empty);
+    batch->n = 0;
+    batch->ord = ord++;
+    while(batch->n < STREAM_BATCH_SIZE && (ret = sam_read1(input, head, batch->reads[batch->n])) >= 0) batch->n++;
+    if(batch->n > 0){
+      batch_queue_push(&full, batch);
+    }else{
+      batch_queue_push(&empty, batch);
+    }
+    if(ret < 0) break;
+  }
+  for(i=0; i<started; i++) batch_queue_push(&full, NULL);
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  started = 0;
+  check(!__atomic_load_n(&failed, __ATOMIC_RELAXED), "Error processing reads in stream mode.");
+  check(ret == -1, "Error reading input file, truncated or corrupt record (%d).", ret);
+
+  for(i=0; i<nthreads; i++){
+    check(bam_access_merge_stats(*grp_stats, workers[i].stats, grps_size) == 0, "Error merging stats from worker %d.", i);
+  }
+  //Read lengths come from the earliest batch in file order, as a sequential pass would see them
+  for(j=0; j<grps_size; j++){
+    for(rd=0; rd<2; rd++){
+      uint64_t best = UINT64_MAX;
+      for(i=0; i<nthreads; i++){
+        if(workers[i].len_ord[j*2+rd] < best){
+          best = workers[i].len_ord[j*2+rd];
+          (*grp_stats)[j][rd]->length = workers[i].len_val[j*2+rd];
+        }
+      }
+    }
+  }
+
+  for(i=0; i<nthreads; i++){
+    bam_access_destroy_stats(workers[i].stats, grps_size);
+    free(workers[i].len_ord);
+    free(workers[i].len_val);
+  }
+  free(workers);
+  free(threads);
+  for(i=0; i<n_batches; i++){
+    for(j=0; j<STREAM_BATCH_SIZE; j++) bam_destroy1(batches[i].reads[j]);
+    free(batches[i].reads);
+  }
+  free(batches);
+  batch_queue_destroy(&full);
+  batch_queue_destroy(&empty);
+  bam_access_rg_lookup_destroy(lookup);
+  return 0;
+
+error:
+  __atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+  for(i=0; i<started; i++) batch_queue_push(&full, NULL);
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  if(workers){
+    for(i=0; i<nthreads; i++){
+      bam_access_destroy_stats(workers[i].stats, grps_size);
+      if(workers[i].len_ord) free(workers[i].len_ord);
+      if(workers[i].len_val) free(workers[i].len_val);
+    }
+    free(workers);
+  }
+  if(threads) free(threads);
+  if(batches){
+    for(i=0; i<n_batches; i++){
+      if(batches[i].reads == NULL) continue;
+      for(j=0; j<STREAM_BATCH_SIZE; j++) if(batches[i].reads[j]) bam_destroy1(batches[i].reads[j]);
+      free(batches[i].reads);
+    }
+    free(batches);
+  }
+  batch_queue_destroy(&full);
+  batch_queue_destroy(&empty);
+  bam_access_rg_lookup_destroy(lookup);
+  return -1;
+}
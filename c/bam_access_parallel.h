@@ -0,0 +1,39 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_access_parallel_h__
+#define __bam_access_parallel_h__
+
+#include "bam_access.h"
+
+typedef struct {
+  int tid; //HTS_IDX_NOCOOR for the unplaced unmapped tail
+  int beg;
+  int end;
+} shard_t;
+
+shard_t *bam_access_parallel_plan_shards(bam_hdr_t *head, hts_idx_t *idx, int target_shards, int *n_shards);
+
+int bam_access_parallel_process_shard(htsFile *input, hts_idx_t *idx, shard_t *shard, rg_lookup_t *lookup, stats_rd_t ***grp_stats, int opts);
+
+int bam_access_parallel_process_indexed(char *input_file, char *ref_file, bam_hdr_t *head, hts_idx_t *idx, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts, int nthreads);
+
+int bam_access_parallel_process_stream(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts, int nthreads);
+
+#endif
@@ -0,0 +1,171 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bam_access_regions.h"
+
+static int region_cmp(const void *a, const void *b){
+  const shard_t *ra = (const shard_t *)a;
+  const shard_t *rb = (const shard_t *)b;
+  if(ra->tid != rb->tid) return ra->tid < rb->tid ? -1 : 1;
+  if(ra->beg != rb->beg) return ra->beg < rb->beg ? -1 : 1;
+  return 0;
+}
+
+//Unsigned integer column, optionally followed by more text
+static int parse_pos(const char *field, long *pos){
+  if(field == NULL || *field < '0' || *field > '9') return -1;
+  *pos = strtol(field, NULL, 10);
+  return 0;
+}
+
+static int is_gff(const char *file){
+  size_t len = strlen(file);
+  return (len > 5 && strcmp(file + len - 5, ".gff3") == 0) || (len > 4 && strcmp(file + len - 4, ".gff") == 0);
+}
+
+shard_t *bam_access_regions_read(const char *file, bam_hdr_t *head, int *n_regions){
+  assert(file != NULL);
+  assert(head != NULL);
+  FILE *fp = NULL;
+  char *line = NULL;
+  size_t line_size = 0;
+  shard_t *regions = NULL;
+  int size = 0;
+  int n = 0;
+  int gff = is_gff(file);
+  int line_no = 0;
+
+  fp = fopen(file, "r");
+  check(fp != NULL, "Error trying to open file to read targets from '%s'.", file);
+  while(getline(&line, &line_size, fp) != -1){
+    line_no++;
+    char *p = line;
+    while(*p == ' ' || *p == '\t') p++;
+    if(*p == '#' || *p == '\n' || *p == '\0') continue; //Skip comment and blank lines
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char *fields[5] = {NULL, NULL, NULL, NULL, NULL};
+    char *save = NULL;
+    char *tok = strtok_r(line, "\t", &save);
+    int f = 0;
+    while(tok != NULL && f < 5){
+      fields[f++] = tok;
+      tok = strtok_r(NULL, "\t", &save);
+    }
+    long start = 0;
+    long end = 0;
+    if(gff){
+      check(parse_pos(fields[3], &start) == 0 && parse_pos(fields[4], &end) == 0,
+            "File doesn't appear to be GFF3 formatted, line %d of '%s'.", line_no, file);
+      check(start <= end, "Start greater than end position, not valid gff3: %s, %ld, %ld", fields[0], start, end);
+      start--; //1-based closed to 0-based half open
+    }else{
+      check(parse_pos(fields[1], &start) == 0 && parse_pos(fields[2], &end) == 0,
+            "File doesn't appear to be BED formatted, line %d of '%s'.", line_no, file);
+      check(start != end, "Start and end positions are the same, not bed format: %s, %ld, %ld", fields[0], start, end);
+      check(start < end, "Start greater than end position, not bed format: %s, %ld, %ld", fields[0], start, end);
+    }
+    int tid = bam_name2id(head, fields[0]);
+    if(tid < 0){
+      log_warn("Target contig '%s' is not in the header, skipped.", fields[0]);
+      continue;
+    }
+    if(n == size){
+      size = size ? size * 2 : 64;
+      shard_t *grown = (shard_t *) realloc(regions, sizeof(shard_t) * size);
+      check_mem(grown);
+      regions = grown;
+    }
+    regions[n].tid = tid;
+    regions[n].beg = start;
+    regions[n].end = end;
+    n++;
+  }
+  fclose(fp);
+  fp = NULL;
+  free(line);
+  line = NULL;
+  check(n > 0, "No targets on contigs of the header found in '%s'.", file);
+
+  //Merge overlapping and abutting regions so each index chunk is read once
+  qsort(regions, n, sizeof(shard_t), region_cmp);
+  int merged = 0;
+  int i=0;
+  for(i=1; i<n; i++){
+    if(regions[i].tid == regions[merged].tid && regions[i].beg <= regions[merged].end){
+      if(regions[i].end > regions[merged].end) regions[merged].end = regions[i].end;
+    }else{
+      regions[++merged] = regions[i];
+    }
+  }
+  *n_regions = merged + 1;
+  return regions;
+
+error:
+  if(fp) fclose(fp);
+  if(line) free(line);
+  if(regions) free(regions);
+  return NULL;
+}
+
+int bam_access_regions_process(htsFile *input, hts_idx_t *idx, shard_t *regions, int n_regions,
+                                rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats, int opts){
+  assert(input != NULL);
+  assert(idx != NULL);
+  assert(regions != NULL);
+  rg_lookup_t *lookup = NULL;
+  hts_itr_t *iter = NULL;
+  bam1_t *b = NULL;
+  int prev_tid = -1;
+  int prev_end = 0;
+  int ret, i;
+
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+  b = bam_init1();
+  check_mem(b);
+  for(i=0; i<n_regions; i++){
+    shard_t *region = &regions[i];
+    iter = sam_itr_queryi(idx, region->tid, region->beg, region->end);
+    check(iter != NULL, "Error creating iterator for region %d:%d-%d.", region->tid, region->beg, region->end);
+    while((ret = sam_itr_next(input, iter, b)) >= 0){
+      //Regions are sorted and disjoint, a read starting before the end of the previous region on this contig overlaps it too so was counted there
+      if(region->tid == prev_tid && b->core.pos < prev_end) continue;
+      check(bam_access_process_read(b, lookup, grp_stats, opts) == 0, "Error processing read %s.", bam_get_qname(b));
+    }
+    check(ret == -1, "Error reading region %d:%d-%d, truncated or corrupt record (%d).", region->tid, region->beg, region->end, ret);
+    hts_itr_destroy(iter);
+    iter = NULL;
+    prev_tid = region->tid;
+    prev_end = region->end;
+  }
+  bam_destroy1(b);
+  bam_access_rg_lookup_destroy(lookup);
+  return 0;
+
+error:
+  if(iter) hts_itr_destroy(iter);
+  if(b) bam_destroy1(b);
+  if(lookup) bam_access_rg_lookup_destroy(lookup);
+  return -1;
+}
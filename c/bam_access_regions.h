@@ -0,0 +1,34 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_access_regions_h__
+#define __bam_access_regions_h__
+
+#include "bam_access_parallel.h"
+
+//Reads target regions from BED, or GFF3 when the file name ends .gff3/.gff, as parse_bed/parse_gff of PCAP::Bam::Coverage.
+//Regions are returned 0-based half open, sorted and with overlapping or abutting regions merged.
+//Contigs not in the header are skipped with a warning.
+shard_t *bam_access_regions_read(const char *file, bam_hdr_t *head, int *n_regions);
+
+//Counts every read overlapping the regions once, only the index chunks of each region are read.
+int bam_access_regions_process(htsFile *input, hts_idx_t *idx, shard_t *regions, int n_regions,
+                                rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats, int opts);
+
+#endif
@@ -0,0 +1,281 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/bgzf.h"
+#include "bam_access_sample.h"
+
+static int chunk_cmp(const void *a, const void *b){
+  const shard_t *ca = (const shard_t *)a;
+  const shard_t *cb = (const shard_t *)b;
+  //Unplaced unmapped reads follow all contigs in the file
+  unsigned int ta = (unsigned int)ca->tid;
+  unsigned int tb = (unsigned int)cb->tid;
+  if(ta != tb) return ta < tb ? -1 : 1;
+  if(ca->beg != cb->beg) return ca->beg < cb->beg ? -1 : 1;
+  return 0;
+}
+
+shard_t *bam_access_sample_plan_chunks(bam_hdr_t *head, hts_idx_t *idx, int n_chunks, unsigned int seed){
+  assert(head != NULL);
+  assert(idx != NULL);
+  shard_t *chunks = NULL;
+  uint64_t *weight = NULL;
+  uint64_t total = 0;
+  int have_stats = 0;
+  int tid = 0;
+  int i = 0;
+  check(n_chunks > 0, "Number of chunks to sample must be positive, got %d.", n_chunks);
+
+  //Last slot is the unplaced unmapped tail
+  weight = (uint64_t *) calloc(head->n_targets + 1, sizeof(uint64_t));
+  check_mem(weight);
+  for(tid=0; tid<head->n_targets; tid++){
+    uint64_t mapped = 0;
+    uint64_t unmapped = 0;
+    if(hts_idx_get_stat(idx, tid, &mapped, &unmapped) == 0){
+      weight[tid] = mapped + unmapped;
+      have_stats = 1;
+    }
+  }
+  if(have_stats){
+    weight[head->n_targets] = hts_idx_get_n_no_coor(idx);
+  }else{ //CRAM indices carry no counts, fall back to contig length
+    for(tid=0; tid<head->n_targets; tid++) weight[tid] = head->target_len[tid];
+  }
+  for(tid=0; tid<=head->n_targets; tid++) total += weight[tid];
+  check(total > 0, "No reads found in the index to sample from.");
+
+  chunks = (shard_t *) malloc(sizeof(shard_t) * n_chunks);
+  check_mem(chunks);
+  unsigned short xsubi[3] = {0x330e, seed & 0xffff, (seed >> 16) & 0xffff};
+  for(i=0; i<n_chunks; i++){
+    uint64_t pick = (uint64_t)(erand48(xsubi) * total);
+    if(pick >= total) pick = total - 1;
+    for(tid=0; tid<head->n_targets && pick >= weight[tid]; tid++) pick -= weight[tid];
+    if(tid == head->n_targets){
+      chunks[i].tid = HTS_IDX_NOCOOR;
+      chunks[i].beg = 0;
+    }else{
+      chunks[i].tid = tid;
+      chunks[i].beg = (int)(erand48(xsubi) * head->target_len[tid]);
+    }
+    chunks[i].end = INT_MAX;
+  }
+  qsort(chunks, n_chunks, sizeof(shard_t), chunk_cmp);
+
+  free(weight);
+  return chunks;
+
+error:
+  if(weight) free(weight);
+  if(chunks) free(chunks);
+  return NULL;
+}
+
+static void sum_counters(stats_rd_t ***grp_stats, int grps_size, uint64_t *sums){
+  int i, rd;
+  memset(sums, 0, sizeof(uint64_t) * 6);
+  for(i=0; i<grps_size; i++){
+    for(rd=0; rd<2; rd++){
+      stats_rd_t *s = grp_stats[i][rd];
+      sums[0] += s->count;
+      sums[1] += s->dups;
+      sums[2] += s->divergent;
+      sums[3] += s->mapped_bases;
+      sums[4] += s->inserts.total;
+      sums[5] += s->inserts.sum;
+    }
+  }
+}
+
+sample_t *bam_access_sample_process(htsFile *input, bam_hdr_t *head, hts_idx_t *idx, shard_t *chunks, int n_chunks,
+                                      rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats, int opts, int chunk_reads){
+  assert(input != NULL);
+  assert(input->format.format == bam || input->format.format == cram);
+  assert(chunks != NULL);
+  sample_t *sample = NULL;
+  rg_lookup_t *lookup = NULL;
+  hts_itr_t *iter = NULL;
+  bam1_t *b = NULL;
+  int64_t last_end = -1; //Virtual offset just past the last record counted
+  uint64_t before[6];
+  uint64_t after[6];
+  int ret, i, tid;
+
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+
+  sample = (sample_t *) calloc(1, sizeof(sample_t));
+  check_mem(sample);
+  sample->n_chunks = n_chunks;
+  sample->count = (uint64_t *) calloc(n_chunks, sizeof(uint64_t));
+  sample->dups = (uint64_t *) calloc(n_chunks, sizeof(uint64_t));
+  sample->divergent = (uint64_t *) calloc(n_chunks, sizeof(uint64_t));
+  sample->mapped_bases = (uint64_t *) calloc(n_chunks, sizeof(uint64_t));
+  sample->inserts = (uint64_t *) calloc(n_chunks, sizeof(uint64_t));
+  sample->insert_sum = (uint64_t *) calloc(n_chunks, sizeof(uint64_t));
+  check_mem(sample->count);
+  check_mem(sample->dups);
+  check_mem(sample->divergent);
+  check_mem(sample->mapped_bases);
+  check_mem(sample->inserts);
+  check_mem(sample->insert_sum);
+
+  for(tid=0; tid<head->n_targets; tid++){
+    uint64_t mapped = 0;
+    uint64_t unmapped = 0;
+    if(hts_idx_get_stat(idx, tid, &mapped, &unmapped) == 0) sample->index_records += mapped + unmapped;
+  }
+  if(sample->index_records > 0) sample->index_records += hts_idx_get_n_no_coor(idx);
+
+  b = bam_init1();
+  check_mem(b);
+  for(i=0; i<n_chunks; i++){
+    shard_t *chunk = &chunks[i];
+    sum_counters(grp_stats, grps_size, before);
+    iter = sam_itr_queryi(idx, chunk->tid, chunk->beg, chunk->end);
+    check(iter != NULL, "Error creating iterator for chunk %d:%d.", chunk->tid, chunk->beg);
+    int n = 0;
+    while(n < chunk_reads && (ret = sam_itr_next(input, iter, b)) >= 0){
+      //Chunks are in file order, anything ending before the last counted record was read by an earlier chunk.
+      //CRAM has no equivalent offset per record, overlapping chunks may count a few reads twice.
+      if(input->format.format == bam){
+        int64_t end = bgzf_tell(input->fp.bgzf);
+        if(end <= last_end) continue;
+        last_end = end;
+      }
+      check(bam_access_process_read(b, lookup, grp_stats, opts) == 0, "Error processing read %s.", bam_get_qname(b));
+      sample->records++;
+      n++;
+    }
+    if(n < chunk_reads) check(ret == -1, "Error reading chunk %d:%d, truncated or corrupt record (%d).", chunk->tid, chunk->beg, ret);
+    hts_itr_destroy(iter);
+    iter = NULL;
+    sum_counters(grp_stats, grps_size, after);
+    sample->count[i] = after[0] - before[0];
+    sample->dups[i] = after[1] - before[1];
+    sample->divergent[i] = after[2] - before[2];
+    sample->mapped_bases[i] = after[3] - before[3];
+    sample->inserts[i] = after[4] - before[4];
+    sample->insert_sum[i] = after[5] - before[5];
+  }
+
+  bam_destroy1(b);
+  bam_access_rg_lookup_destroy(lookup);
+  return sample;
+
+error:
+  if(iter) hts_itr_destroy(iter);
+  if(b) bam_destroy1(b);
+  if(lookup) bam_access_rg_lookup_destroy(lookup);
+  if(sample) bam_access_sample_destroy(sample);
+  return NULL;
+}
+
+double bam_access_sample_scale(sample_t *sample, stats_rd_t ***grp_stats, int grps_size){
+  assert(sample != NULL);
+  if(sample->index_records == 0 || sample->records == 0) return 1.0;
+  double scale = (double)sample->index_records / (double)sample->records;
+  int i, rd;
+  for(i=0; i<grps_size; i++){
+    for(rd=0; rd<2; rd++){
+      stats_rd_t *s = grp_stats[i][rd];
+      s->count = llround(s->count * scale);
+      s->dups = llround(s->dups * scale);
+      s->gc = llround(s->gc * scale);
+      s->umap = llround(s->umap * scale);
+      s->divergent = llround(s->divergent * scale);
+      s->mapped_bases = llround(s->mapped_bases * scale);
+      s->mapped_pairs = llround(s->mapped_pairs * scale);
+      s->proper = llround(s->proper * scale);
+      s->inter_chr_pairs = llround(s->inter_chr_pairs * scale);
+    }
+  }
+  return scale;
+}
+
+int bam_access_sample_ratio(uint64_t *y, uint64_t *x, int n, double *est, double *half_width){
+  double sum_y = 0;
+  double sum_x = 0;
+  double ss = 0;
+  int i;
+  for(i=0; i<n; i++){
+    sum_y += y[i];
+    sum_x += x[i];
+  }
+  if(sum_x == 0) return -1;
+  *est = sum_y / sum_x;
+  if(n < 2){
+    *half_width = NAN;
+    return 0;
+  }
+  //Linearised variance of a ratio estimator with chunks as sampling units
+  for(i=0; i<n; i++){
+    double d = y[i] - *est * x[i];
+    ss += d * d;
+  }
+  *half_width = 1.96 * sqrt(ss * n / (n - 1)) / sum_x;
+  return 0;
+}
+
+static void report_ratio(FILE *out, char *name, uint64_t *y, uint64_t *x, int n, double multiplier){
+  double est = 0;
+  double half = 0;
+  if(bam_access_sample_ratio(y, x, n, &est, &half) != 0){
+    fprintf(out, "%s\tNA\tNA\tNA\n", name);
+  }else if(isnan(half)){
+    fprintf(out, "%s\t%.4f\tNA\tNA\n", name, est * multiplier);
+  }else{
+    fprintf(out, "%s\t%.4f\t%.4f\t%.4f\n", name, est * multiplier, (est - half) * multiplier, (est + half) * multiplier);
+  }
+}
+
+int bam_access_sample_report(FILE *out, sample_t *sample){
+  assert(out != NULL);
+  assert(sample != NULL);
+  fprintf(out, "#sampled_chunks\t%d\n", sample->n_chunks);
+  fprintf(out, "#sampled_records\t%"PRIu64"\n", sample->records);
+  if(sample->index_records > 0){
+    fprintf(out, "#index_records\t%"PRIu64"\n", sample->index_records);
+  }else{
+    fprintf(out, "#index_records\tNA\n");
+  }
+  fprintf(out, "#estimate\tvalue\tci95_low\tci95_high\n");
+  report_ratio(out, "duplicate_fraction", sample->dups, sample->count, sample->n_chunks, 1.0);
+  report_ratio(out, "percent_divergent_bases", sample->divergent, sample->mapped_bases, sample->n_chunks, 100.0);
+  report_ratio(out, "mean_insert_size", sample->insert_sum, sample->inserts, sample->n_chunks, 1.0);
+  return ferror(out) ? -1 : 0;
+}
+
+void bam_access_sample_destroy(sample_t *sample){
+  if(sample == NULL) return;
+  if(sample->count) free(sample->count);
+  if(sample->dups) free(sample->dups);
+  if(sample->divergent) free(sample->divergent);
+  if(sample->mapped_bases) free(sample->mapped_bases);
+  if(sample->inserts) free(sample->inserts);
+  if(sample->insert_sum) free(sample->insert_sum);
+  free(sample);
+}
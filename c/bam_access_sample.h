@@ -0,0 +1,60 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_access_sample_h__
+#define __bam_access_sample_h__
+
+#include "bam_access_parallel.h"
+
+#define SAMPLE_CHUNK_READS 10000 //Default records read from each sampled chunk
+
+//Quick-look estimates from randomly placed chunks of an indexed input.
+//Per chunk totals are kept so confidence intervals reflect the clustering of reads in chunks.
+typedef struct {
+  int n_chunks;
+  uint64_t *count;
+  uint64_t *dups;
+  uint64_t *divergent;
+  uint64_t *mapped_bases;
+  uint64_t *inserts;
+  uint64_t *insert_sum;
+  uint64_t records; //Records read, including those not counted in stats
+  uint64_t index_records; //Records in the whole file according to the index, 0 if unknown (CRAM)
+} sample_t;
+
+//Picks n_chunks chunk starts at random, in proportion to the index read counts, sorted in file order.
+shard_t *bam_access_sample_plan_chunks(bam_hdr_t *head, hts_idx_t *idx, int n_chunks, unsigned int seed);
+
+//Reads up to chunk_reads records from the start of each chunk (in file order) into grp_stats,
+//records are never counted twice when chunks overlap.
+sample_t *bam_access_sample_process(htsFile *input, bam_hdr_t *head, hts_idx_t *idx, shard_t *chunks, int n_chunks,
+                                      rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats, int opts, int chunk_reads);
+
+//Scales the sampled counters (not the insert size histograms) by index_records/records.
+double bam_access_sample_scale(sample_t *sample, stats_rd_t ***grp_stats, int grps_size);
+
+//Ratio sum(y)/sum(x) over chunks with the half width of its 95% confidence interval.
+int bam_access_sample_ratio(uint64_t *y, uint64_t *x, int n, double *est, double *half_width);
+
+//Writes the estimates with their 95% confidence intervals as tab separated lines.
+int bam_access_sample_report(FILE *out, sample_t *sample);
+
+void bam_access_sample_destroy(sample_t *sample);
+
+#endif
@@ -0,0 +1,208 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "htslib/bgzf.h"
+#include "bam_access_split.h"
+
+#define BGZF_HEADER_SIZE 18
+#define BGZF_MAX_BLOCK 65536
+
+static uint32_t le32(const uint8_t *p){
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+//gzip member with the BGZF 'BC' extra field, giving the compressed block size
+static int bgzf_block_size(const uint8_t *p){
+  if(p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4)) return -1;
+  if(p[10] != 6 || p[11] != 0 || p[12] != 'B' || p[13] != 'C' || p[14] != 2 || p[15] != 0) return -1;
+  return (p[16] | p[17] << 8) + 1;
+}
+
+//Compressed offset and uncompressed size of the first BGZF block at or after target, confirmed by a following block header
+//(or the end of file) at the offset its size gives. Returns 0 on success, 1 when there is no such block.
+static int next_block(FILE *fp, int64_t file_size, int64_t target, int64_t *block, uint32_t *isize){
+  uint8_t *buf = NULL;
+  int found = 1;
+  size_t window = 4 * BGZF_MAX_BLOCK;
+  buf = (uint8_t *) malloc(window + BGZF_MAX_BLOCK + BGZF_HEADER_SIZE);
+  check_mem(buf);
+  int64_t start = target;
+  while(start < file_size){
+    check(fseeko(fp, start, SEEK_SET) == 0, "Error seeking to %"PRId64".", start);
+    size_t got = fread(buf, 1, window + BGZF_MAX_BLOCK + BGZF_HEADER_SIZE, fp);
+    size_t i=0;
+    for(i=0; i<window && i + BGZF_HEADER_SIZE <= got; i++){
+      int size = bgzf_block_size(buf + i);
+      if(size < BGZF_HEADER_SIZE + 8) continue;
+      int64_t next = start + i + size;
+      if(i + size > got) continue;
+      if(next != file_size && (i + size + BGZF_HEADER_SIZE > got || bgzf_block_size(buf + i + size) < 0)) continue;
+      *block = start + i;
+      *isize = le32(buf + i + size - 4);
+      found = 0;
+      break;
+    }
+    if(found == 0 || got < window) break;
+    start += window;
+  }
+  free(buf);
+  return found;
+error:
+  if(buf) free(buf);
+  return -1;
+}
+
+//A plausible BAM record at p, returns its length or -1
+static int64_t record_size(const uint8_t *p, size_t avail, bam_hdr_t *head){
+  if(avail < 36) return -1;
+  int32_t block_size = (int32_t)le32(p);
+  int32_t tid = (int32_t)le32(p + 4);
+  int32_t pos = (int32_t)le32(p + 8);
+  uint32_t l_read_name = p[12];
+  uint32_t n_cigar = p[16] | p[17] << 8;
+  int32_t l_seq = (int32_t)le32(p + 20);
+  int32_t mtid = (int32_t)le32(p + 24);
+  int32_t mpos = (int32_t)le32(p + 28);
+  if(block_size < 32 || tid < -1 || tid >= head->n_targets || mtid < -1 || mtid >= head->n_targets) return -1;
+  if(pos < -1 || mpos < -1 || l_read_name < 1 || l_seq < 0) return -1;
+  if((int64_t)32 + l_read_name + 4 * (int64_t)n_cigar + (l_seq + 1) / 2 + l_seq > block_size) return -1;
+  if(avail < 4 + l_read_name + 32) return -1;
+  //Read name is printable and NUL terminated
+  const uint8_t *name = p + 36;
+  uint32_t i=0;
+  for(i=0; i<l_read_name - 1; i++) if(name[i] < '!' || name[i] > '~') return -1;
+  if(name[l_read_name - 1] != '\0') return -1;
+  return 4 + (int64_t)block_size;
+}
+
+static int is_record_start(const uint8_t *buf, size_t len, size_t u, int at_eof, bam_hdr_t *head){
+  int n=0;
+  size_t p = u;
+  while(n < SPLIT_SYNC_RECORDS){
+    if(p == len) return at_eof ? n > 0 : n > 1; //Ran out of data after enough records
+    int64_t size = record_size(buf + p, len - p, head);
+    if(size < 0) return p + 36 > len && n > 1; //Truncated by the buffer rather than invalid
+    p += size;
+    if(p > len) return n > 0;
+    n++;
+  }
+  return 1;
+}
+
+int64_t bam_access_split_boundary(htsFile *input, const char *input_file, bam_hdr_t *head, int64_t first_record, int64_t target){
+  assert(input != NULL);
+  assert(input_file != NULL);
+  FILE *fp = NULL;
+  uint8_t *buf = NULL;
+  int64_t result = -1;
+  if(target <= (first_record >> 16)) return first_record;
+
+  struct stat st;
+  check(stat(input_file, &st) == 0, "Error reading size of '%s'.", input_file);
+  fp = fopen(input_file, "rb");
+  check(fp != NULL, "Error opening '%s' to find BGZF blocks.", input_file);
+  buf = (uint8_t *) malloc(SPLIT_SYNC_BYTES);
+  check_mem(buf);
+
+  int64_t from = target;
+  while(1){
+    int64_t block = 0;
+    uint32_t isize = 0;
+    int chk = next_block(fp, st.st_size, from, &block, &isize);
+    check(chk >= 0, "Error scanning BGZF blocks of '%s'.", input_file);
+    if(chk == 1 || isize == 0) break; //End of file, or the empty EOF marker block
+    check(bgzf_seek(input->fp.bgzf, block << 16, SEEK_SET) == 0, "Error seeking to BGZF block at %"PRId64" of '%s'.", block, input_file);
+    ssize_t len = bgzf_read(input->fp.bgzf, buf, SPLIT_SYNC_BYTES);
+    check(len >= 0, "Error reading BGZF block at %"PRId64" of '%s'.", block, input_file);
+    uint32_t u=0;
+    for(u=0; u<isize && u<(uint32_t)len; u++){
+      if(is_record_start(buf, len, u, len < SPLIT_SYNC_BYTES, head)){
+        result = block << 16 | u;
+        break;
+      }
+    }
+    if(result >= 0) break;
+    from = block + 1; //A record spans the whole block, try the next
+  }
+  free(buf);
+  fclose(fp);
+  return result;
+
+error:
+  if(buf) free(buf);
+  if(fp) fclose(fp);
+  return -2;
+}
+
+int bam_access_split_range(htsFile *input, const char *input_file, bam_hdr_t *head, int part, int n_parts, int64_t *beg, int64_t *end){
+  assert(part >= 0 && part < n_parts);
+  struct stat st;
+  check(input->format.format == bam, "Splitting by byte range needs BGZF compressed BAM input.");
+  check(stat(input_file, &st) == 0, "Error reading size of '%s'.", input_file);
+  int64_t first_record = bgzf_tell(input->fp.bgzf);
+  *beg = bam_access_split_boundary(input, input_file, head, first_record, (int64_t)((double)st.st_size * part / n_parts));
+  check(*beg != -2, "Error finding start of part %d of '%s'.", part + 1, input_file);
+  *end = -1;
+  if(part + 1 < n_parts && *beg >= 0){
+    *end = bam_access_split_boundary(input, input_file, head, first_record, (int64_t)((double)st.st_size * (part + 1) / n_parts));
+    check(*end != -2, "Error finding end of part %d of '%s'.", part + 1, input_file);
+  }
+  return 0;
+error:
+  return -1;
+}
+
+int bam_access_split_process(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts,
+                              int64_t beg, int64_t end){
+  assert(input != NULL);
+  bam1_t *b = NULL;
+  rg_lookup_t *lookup = NULL;
+  int ret = -1;
+  if(beg < 0) return 0; //Nothing starts in this part
+  check(bgzf_seek(input->fp.bgzf, beg, SEEK_SET) == 0, "Error seeking to %"PRId64".", beg);
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+  b = bam_init1();
+  check_mem(b);
+  while(1){
+    //A fully read block leaves the offset at the start of the next, so a boundary record is always seen at exactly end
+    int64_t start = bgzf_tell(input->fp.bgzf);
+    if(end >= 0 && start >= end){
+      check(start == end, "Part end %"PRId64" is not at a record start (passed at %"PRId64").", end, start);
+      break;
+    }
+    if((ret = sam_read1(input, head, b)) < 0) break;
+    check(bam_access_process_read(b, lookup, *grp_stats, opts) == 0, "Error processing read %s.", bam_get_qname(b));
+  }
+  if(ret < 0) check(ret == -1, "Error reading input file, truncated or corrupt record (%d).", ret);
+  bam_destroy1(b);
+  bam_access_rg_lookup_destroy(lookup);
+  return 0;
+
+error:
+  if(b) bam_destroy1(b);
+  bam_access_rg_lookup_destroy(lookup);
+  return -1;
+}
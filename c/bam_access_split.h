@@ -0,0 +1,42 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_access_split_h__
+#define __bam_access_split_h__
+
+#include "bam_access.h"
+
+#define SPLIT_SYNC_RECORDS 8 //Consecutive records that must parse at a candidate record start
+#define SPLIT_SYNC_BYTES 262144 //Uncompressed bytes read to check a candidate record start
+
+//Virtual offset of the first record starting in the first BGZF block at or after compressed offset target.
+//Found by scanning block headers and then checking for a run of parseable records, so every process splitting
+//a file gets the same boundaries with or without an index. Returns first_record when target is at or before
+//its block, -1 when no record starts after target, -2 on error.
+int64_t bam_access_split_boundary(htsFile *input, const char *input_file, bam_hdr_t *head, int64_t first_record, int64_t target);
+
+//Virtual offsets bounding part (0 based) of n_parts equal byte ranges of a BAM, end is -1 for the end of file.
+//Call after the header has been read.
+int bam_access_split_range(htsFile *input, const char *input_file, bam_hdr_t *head, int part, int n_parts, int64_t *beg, int64_t *end);
+
+//Counts the records starting in [beg, end). Fails if end is passed without landing on it, i.e. isn't a record start.
+int bam_access_split_process(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts,
+                              int64_t beg, int64_t end);
+
+#endif
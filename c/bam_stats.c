@@ -24,16 +24,54 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "dbg.h"
 #include "bam_access.h"
+#include "bam_access_parallel.h"
 #include "bam_stats_output.h"
+#include "bam_stats_calcs.h"
+#include "bam_stats_dump.h"
+#include "bam_stats_tee.h"
+#include "bam_access_sample.h"
+#include "bam_access_regions.h"
+#include "bam_access_batch.h"
+#include "bam_access_split.h"
 
 #include "khash.h"
+#include "htslib/thread_pool.h"
+#include "htslib/bgzf.h"
 
 static char *input_file = NULL;
+static char **input_files = NULL; //Batch mode, more than one -i or -f
+static int n_input_files = 0;
+static char *fofn_file = NULL;
 static char *output_file = NULL;
 static char *ref_file = NULL;
 static int rna = 0;
+static int no_gc = 0;
+static int plots = 0;
+static char *qc_file = NULL;
+static int index_only = 0;
+static char *targets_file = NULL;
+static int nthreads = 0;
+static char *dump_file = NULL;
+static int merge = 0;
+static char **merge_files = NULL;
+static int n_merge_files = 0;
+static char *checkpoint_file = NULL;
+static uint64_t checkpoint_every = 20000000;
+static int resume = 0;
+static char *tee_file = NULL;
+static int tee_index = 0;
+static int tee_md5 = 0;
+static int sample_chunks = 0;
+static int sample_reads = SAMPLE_CHUNK_READS;
+static unsigned int sample_seed = 0;
+static int shard_part = 0; //1 based
+static int shard_parts = 0;
 int grps_size = 0;
 stats_rd_t*** grp_stats;
 
@@ -53,13 +91,51 @@ void print_version (int exit_code){
 
 void print_usage (int exit_code){
 
-	printf ("Usage: bam_stats -i file -o file [-p plots] [-r reference.fa.fai] [-h] [-v]\n\n");
+	printf ("Usage: bam_stats -i file -o file [-p] [-q file.qc] [-t targets.bed] [-r reference.fa.fai] [-@ threads] [-d file.stats] [-g] [-h] [-v]\n");
+	printf ("       bam_stats -i a.bam -i b.bam ... | -f files.txt [-o dir] [-@ threads] [-a] [-g] [-r reference.fa.fai]\n");
+	printf ("       bam_stats --index-only -i file.bam -o file\n");
+	printf ("       bam_stats --shard i/N -i file.bam -o file -d file.i.stats [-p] [-a] [-g] [-@ threads]\n");
+	printf ("       bam_stats --merge [-i name.bam] -o file [-d file.stats] a.stats b.stats ...\n\n");
   printf ("-i --input     File path to read in.\n");
   printf ("-o --output    File path to output.\n\n");
 	printf ("Optional:\n");
 	printf ("-r --ref-file  File path to reference index (.fai) file.\n");
 	printf ("               NB. If cram format is supplied via -b and the reference listed in the cram header can't be found bam_stats may fail to work correctly.\n");
 	printf ("-a --rna       Uses the RNA method of calculating insert size (ignores anything outside ± ('sd'*standard_dev) of the mean in calculating a new mean)\n");
+	printf ("               repeated until stable, 'sd' is %d. Secondary hits are also counted.\n", RNA_INSERT_SD);
+	printf ("-g --no-gc     Don't count G/C bases (reported as 0), CRAM sequence is then not decoded so the reference isn't needed.\n");
+	printf ("               NB. Divergent bases for CRAM then rely on NM tags stored in the file rather than those regenerated from the reference.\n");
+	printf ("-@ --threads   Number of additional threads used to decompress BAM blocks / decode CRAM containers [0].\n");
+	printf ("               When > 1 and the input is indexed the genome is split into index balanced shards processed in parallel,\n");
+	printf ("               otherwise (e.g. stdin) records are pipelined in batches to stats workers sharing the threads with decompression.\n");
+	printf ("-p --plots     Collect per cycle quality and base composition for each read group/end into the dump (-d),\n");
+	printf ("               as fqp_1/fqp_2 (PCAP::Bam::Stats::fqplots) and fqb_1/fqb_2 (A,C,G,T,N).\n");
+	printf ("-q --qc        Also write per contig mapped/unmapped read counts, MAPQ and soft/hard clip length histograms\n");
+	printf ("               for each read group/end to this file (tab separated), counting the same reads as the .bas.\n");
+	printf ("-t --targets   Only count reads overlapping these regions, BED or GFF3 (.gff3/.gff) as PCAP::Bam::Coverage (indexed input).\n");
+	printf ("               Overlapping regions are merged and a read spanning several regions is counted once.\n");
+	printf ("-d --dump      Also write the raw per read group counters and insert size histograms to this file (JSON),\n");
+	printf ("               these can be combined exactly with --merge.\n");
+	printf ("-x --index-only  Only report per contig mapped/unmapped and unplaced read counts from the .bai/.csi (as samtools idxstats),\n");
+	printf ("                 totals go to stderr. Reads the header and index only so returns immediately, e.g. as a pre-flight check.\n");
+	printf ("-m --merge     Merge the stats dumps given as arguments into a single output, -i only sets the bam name reported.\n");
+	printf ("               Dumps are merged in the order given, read lengths come from the earliest dump that has one.\n");
+	printf ("-k --checkpoint        Periodically save progress to this file (BAM input only, reads sequentially, -@ threads only decompress).\n");
+	printf ("-K --checkpoint-every  Records between checkpoints [20000000].\n");
+	printf ("-R --resume            Continue from the checkpoint (-k) if it exists.\n");
+	printf ("-T --tee       Copy the input unchanged to this file ('-' for stdout) while computing stats, replaces 'tee file | bam_stats'.\n");
+	printf ("-I --tee-index Also write a .bai for the copy (-T file, coordinate sorted BAM).\n");
+	printf ("-M --tee-md5   Also write a .md5 for the copy (-T file).\n");
+
+	printf ("-s --sample        Quick-look estimate from this many randomly placed chunks (indexed input), counts are scaled to the\n");
+	printf ("                   index read total and 95%% confidence intervals for duplicates, divergence and mean insert size go to stderr.\n");
+	printf ("                   Estimates aren't written to a stats dump (-d) as they can't be merged.\n");
+	printf ("-S --sample-reads  Records read per sampled chunk [%d].\n", SAMPLE_CHUNK_READS);
+	printf ("-e --sample-seed   Seed for choosing the sampled chunks [0].\n");
+
+	printf ("-N --shard     Only count records starting in part i (1..N) of N equal compressed byte ranges of the BAM, for\n");
+	printf ("               spreading one file over several nodes. The dumps (-d) of all N parts --merge to the whole file stats,\n");
+	printf ("               list them in part order. Reads sequentially, -@ threads only decompress.\n");
 
 	printf ("Other:\n");
 	printf ("-h --help      Display this usage information.\n");
@@ -67,6 +143,89 @@ void print_usage (int exit_code){
   exit(exit_code);
 }
 
+int add_input(char *file){
+  char **grown = (char **) realloc(input_files, sizeof(char *) * (n_input_files + 1));
+  check_mem(grown);
+  input_files = grown;
+  input_files[n_input_files++] = file;
+  input_file = file;
+  return 0;
+error:
+  return -1;
+}
+
+int read_fofn(char *fofn){
+  FILE *fp = fopen(fofn, "r");
+  char *line = NULL;
+  size_t line_size = 0;
+  check(fp != NULL, "Error opening file of file names '%s'.", fofn);
+  while(getline(&line, &line_size, fp) != -1){
+    line[strcspn(line, "\r\n")] = '\0';
+    if(line[0] == '\0' || line[0] == '#') continue;
+    char *file = strdup(line);
+    check_mem(file);
+    check(add_input(file) == 0, "Error adding input '%s'.", file);
+  }
+  free(line);
+  fclose(fp);
+  return 0;
+error:
+  if(line) free(line);
+  if(fp) fclose(fp);
+  return -1;
+}
+
+//.bas written for a batch input, in the -o directory when given otherwise next to the input
+char *batch_bas_name(char *input){
+  char *bas = NULL;
+  char *name = strdup(input);
+  check_mem(name);
+  if(output_file){
+    char *base = basename(name);
+    bas = malloc(strlen(output_file) + strlen(base) + 6);
+    check_mem(bas);
+    sprintf(bas, "%s/%s.bas", output_file, base);
+  }else{
+    bas = malloc(strlen(input) + 5);
+    check_mem(bas);
+    sprintf(bas, "%s.bas", input);
+  }
+  free(name);
+  return bas;
+error:
+  if(name) free(name);
+  return NULL;
+}
+
+static int cmp_name(const void *a, const void *b){
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+//Inputs sharing a basename (or listed twice) would overwrite each other's .bas, returns the first such input
+char *batch_bas_clash(){
+  char *clash = NULL;
+  int i=0;
+  char **bas = (char **) calloc(n_input_files, sizeof(char *));
+  check_mem(bas);
+  for(i=0; i<n_input_files; i++){
+    bas[i] = batch_bas_name(input_files[i]);
+    check(bas[i] != NULL, "Error naming output for '%s'.", input_files[i]);
+  }
+  qsort(bas, n_input_files, sizeof(char *), cmp_name);
+  for(i=1; i<n_input_files && clash == NULL; i++){
+    if(strcmp(bas[i-1], bas[i]) == 0) clash = strdup(bas[i]);
+  }
+  for(i=0; i<n_input_files; i++) free(bas[i]);
+  free(bas);
+  return clash;
+error:
+  if(bas){
+    for(i=0; i<n_input_files; i++) if(bas[i]) free(bas[i]);
+    free(bas);
+  }
+  return NULL;
+}
+
 void options(int argc, char *argv[]){
 
   ref_file = NULL;
@@ -76,9 +235,28 @@ void options(int argc, char *argv[]){
              	{"version", no_argument, 0, 'v'},
              	{"help",no_argument,0,'h'},
               {"input",required_argument,0,'i'},
+              {"fofn",required_argument,0,'f'},
               {"ref-file",required_argument,0,'r'},
               {"output",required_argument,0,'o'},
               {"rna",no_argument,0, 'a'},
+              {"no-gc",no_argument,0, 'g'},
+              {"plots",no_argument,0, 'p'},
+              {"qc",required_argument,0, 'q'},
+              {"targets",required_argument,0, 't'},
+              {"threads",required_argument,0, '@'},
+              {"dump",required_argument,0, 'd'},
+              {"merge",no_argument,0, 'm'},
+              {"index-only",no_argument,0, 'x'},
+              {"checkpoint",required_argument,0, 'k'},
+              {"checkpoint-every",required_argument,0, 'K'},
+              {"resume",no_argument,0, 'R'},
+              {"tee",required_argument,0, 'T'},
+              {"tee-index",no_argument,0, 'I'},
+              {"tee-md5",no_argument,0, 'M'},
+              {"sample",required_argument,0, 's'},
+              {"sample-reads",required_argument,0, 'S'},
+              {"sample-seed",required_argument,0, 'e'},
+              {"shard",required_argument,0, 'N'},
               { NULL, 0, NULL, 0}
 
    }; //End of declaring opts
@@ -87,10 +265,14 @@ void options(int argc, char *argv[]){
    int iarg = 0;
 
    //Iterate through options
-   while((iarg = getopt_long(argc, argv, "i:o:r:vha", long_opts, &index)) != -1){
+   while((iarg = getopt_long(argc, argv, "i:f:o:r:@:d:q:t:mk:K:RT:IMs:S:e:N:vhagpx", long_opts, &index)) != -1){
    	switch(iarg){
    		case 'i':
-        input_file = optarg;
+        if(add_input(optarg) != 0) print_usage(1);
+        break;
+
+   		case 'f':
+        fofn_file = optarg;
         break;
 
    		case 'o':
@@ -103,6 +285,96 @@ void options(int argc, char *argv[]){
 
    		case 'a':
         rna = 1;
+        break;
+
+   		case 'g':
+        no_gc = 1;
+        break;
+
+   		case 'p':
+        plots = 1;
+        break;
+
+   		case 'q':
+        qc_file = optarg;
+        break;
+
+   		case 't':
+        targets_file = optarg;
+        break;
+
+   		case '@':
+        if(sscanf(optarg, "%i", &nthreads) != 1 || nthreads < 0){
+          printf("Invalid number of threads (-@) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+   		case 'd':
+        dump_file = optarg;
+        break;
+
+   		case 'm':
+        merge = 1;
+        break;
+
+   		case 'x':
+        index_only = 1;
+        break;
+
+   		case 'k':
+        checkpoint_file = optarg;
+        break;
+
+   		case 'K':
+        if(sscanf(optarg, "%"SCNu64, &checkpoint_every) != 1 || checkpoint_every == 0){
+          printf("Invalid checkpoint interval (-K) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+   		case 'R':
+        resume = 1;
+        break;
+
+   		case 'T':
+        tee_file = optarg;
+        break;
+
+   		case 'I':
+        tee_index = 1;
+        break;
+
+   		case 'M':
+        tee_md5 = 1;
+        break;
+
+   		case 's':
+        if(sscanf(optarg, "%i", &sample_chunks) != 1 || sample_chunks < 1){
+          printf("Invalid number of chunks to sample (-s) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+   		case 'S':
+        if(sscanf(optarg, "%i", &sample_reads) != 1 || sample_reads < 1){
+          printf("Invalid number of records per sampled chunk (-S) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+   		case 'e':
+        if(sscanf(optarg, "%u", &sample_seed) != 1){
+          printf("Invalid sampling seed (-e) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+   		case 'N':
+        if(sscanf(optarg, "%i/%i", &shard_part, &shard_parts) != 2 || shard_parts < 1 || shard_part < 1 || shard_part > shard_parts){
+          printf("Invalid shard (-N) '%s', expected i/N with 1 <= i <= N.\n",optarg);
+          print_usage(1);
+        }
         break;
 
    		case 'h':
@@ -124,6 +396,68 @@ void options(int argc, char *argv[]){
 
    }//End of iteration through options
 
+   if(merge){
+     if(qc_file){
+       printf("Extended QC (-q) isn't kept in stats dumps so can't be produced by --merge.\n");
+       print_usage(1);
+     }
+     merge_files = argv + optind;
+     n_merge_files = argc - optind;
+     if(n_merge_files < 1){
+       printf("No stats dumps given to merge.\n");
+       print_usage(1);
+     }
+     int i=0;
+     for(i=0; i<n_merge_files; i++){
+       if(check_exist(merge_files[i]) != 1){
+         printf("Stats dump %s does not exist.\n",merge_files[i]);
+         print_usage(1);
+       }
+     }
+     if (output_file==NULL || strcmp(output_file,"/dev/stdout")==0) {
+      output_file = "-";
+     }
+     return;
+   }
+
+   if(fofn_file){
+     if(read_fofn(fofn_file) != 0) print_usage(1);
+     if(n_input_files == 0){
+       printf("No input files found in %s.\n",fofn_file);
+       print_usage(1);
+     }
+   }
+   if(n_input_files > 1 || fofn_file){
+     if(dump_file || plots || qc_file || targets_file || index_only || checkpoint_file || tee_file || sample_chunks || shard_parts){
+       printf("Batch mode (several -i or -f) only supports -o, -@, -a, -g and -r.\n");
+       print_usage(1);
+     }
+     int i=0;
+     for(i=0; i<n_input_files; i++){
+       if(strcmp(input_files[i],"-") == 0 || strcmp(input_files[i],"/dev/stdin") == 0){
+         printf("Batch mode inputs must be files, not stdin.\n");
+         print_usage(1);
+       }
+       if(check_exist(input_files[i]) != 1){
+         printf("Input file %s does not exist.\n",input_files[i]);
+         print_usage(1);
+       }
+     }
+     if(output_file){
+       struct stat st;
+       if(stat(output_file, &st) != 0 || !S_ISDIR(st.st_mode)){
+         printf("Output (-o) %s must be an existing directory in batch mode.\n",output_file);
+         print_usage(1);
+       }
+     }
+     char *clash = batch_bas_clash();
+     if(clash){
+       printf("More than one input would be written to %s, inputs in batch mode need distinct file names.\n",clash);
+       print_usage(1);
+     }
+     return;
+   }
+
    //Do some checking to ensure required arguments were passed and are accessible files
    if (input_file==NULL || strcmp(input_file,"/dev/stdin")==0) {
     input_file = "-";   // htslib recognises this as a special case
@@ -137,6 +471,69 @@ void options(int argc, char *argv[]){
    if (output_file==NULL || strcmp(output_file,"/dev/stdout")==0) {
     output_file = "-";   // we recognise this as a special case
    }
+   if(index_only && strcmp(input_file,"-") == 0){
+     printf("Index only (-x) needs an indexed input file, not stdin.\n");
+     print_usage(1);
+   }
+   if(resume && checkpoint_file == NULL){
+     printf("Resume (-R) requires a checkpoint file (-k).\n");
+     print_usage(1);
+   }
+   if(tee_file){
+     if(strcmp(tee_file,"/dev/stdout") == 0) tee_file = "-";
+     if(strcmp(tee_file,"-") == 0 && strcmp(output_file,"-") == 0){
+       printf("Only one of the copy (-T) and output (-o) can go to stdout.\n");
+       print_usage(1);
+     }
+     if(strcmp(tee_file,"-") == 0 && (tee_index || tee_md5)){
+       printf("Index (-I) and md5 (-M) of the copy need a file for -T.\n");
+       print_usage(1);
+     }
+     if(checkpoint_file){
+       printf("Checkpoints (-k) can't be used with a copy (-T).\n");
+       print_usage(1);
+     }
+   }else if(tee_index || tee_md5){
+     printf("Index (-I) and md5 (-M) apply to the copy (-T).\n");
+     print_usage(1);
+   }
+   if(checkpoint_file && strcmp(input_file,"-") == 0){
+     printf("Checkpoints (-k) need a seekable input file, not stdin.\n");
+     print_usage(1);
+   }
+   if(plots && dump_file == NULL){
+     printf("Quality plot data (-p) is written to the stats dump (-d).\n");
+     print_usage(1);
+   }
+   if(qc_file && (checkpoint_file || sample_chunks)){
+     printf("Extended QC (-q) can't be combined with checkpoints (-k) or sampling (-s).\n");
+     print_usage(1);
+   }
+   //Scaled estimates would merge as if they were exact counts
+   if(sample_chunks && (strcmp(input_file,"-") == 0 || checkpoint_file || tee_file || dump_file)){
+     printf("Sampling (-s) needs an indexed input file and can't be combined with -k, -T or -d.\n");
+     print_usage(1);
+   }
+   if(targets_file){
+     if(check_exist(targets_file) != 1){
+       printf("Targets file (-t) %s does not exist.\n",targets_file);
+       print_usage(1);
+     }
+     if(strcmp(input_file,"-") == 0 || checkpoint_file || tee_file || sample_chunks){
+       printf("Targets (-t) need an indexed input file and can't be combined with -k, -T or -s.\n");
+       print_usage(1);
+     }
+   }
+   if(shard_parts){
+     if(strcmp(input_file,"-") == 0 || dump_file == NULL){
+       printf("Shards (-N) need a BAM input file and a stats dump (-d) to merge.\n");
+       print_usage(1);
+     }
+     if(qc_file || targets_file || index_only || checkpoint_file || tee_file || sample_chunks){
+       printf("Shards (-N) can't be combined with -q, -t, -x, -k, -T or -s.\n");
+       print_usage(1);
+     }
+   }
    if(ref_file){
      if(check_exist(ref_file) != 1){
       printf("Reference fasta index file (-r) %s does not exist.\n",ref_file);
@@ -147,20 +544,156 @@ void options(int argc, char *argv[]){
    return;
 }
 
+int merge_dumps(){
+  rg_info_t **grps = NULL;
+  char *bam_name = NULL;
+  int i=0;
+  for(i=0; i<n_merge_files; i++){
+    check(bam_stats_dump_merge_file(merge_files[i], &grps, &grps_size, &grp_stats, &bam_name) == 0,
+          "Error merging stats dump '%s'.", merge_files[i]);
+  }
+  char *name = input_file ? input_file : (bam_name ? bam_name : "-");
+  if(dump_file){
+    check(bam_stats_dump_write(dump_file, name, grps, grps_size, grp_stats) == 0, "Error writing stats dump '%s'.", dump_file);
+  }
+  int res = bam_stats_output_print_results(grps,grps_size,grp_stats,name,output_file,rna);
+  check(res==0,"Error writing bam_stats output to file.");
+  return 0;
+error:
+  return 1;
+}
+
+int index_summary(){
+  htsFile *input = NULL;
+  bam_hdr_t *head = NULL;
+  hts_idx_t *idx = NULL;
+  rg_info_t **grps = NULL;
+  qc_hist_t counts;
+  memset(&counts, 0, sizeof(qc_hist_t));
+  input = hts_open(input_file,"r");
+  check(input != NULL, "Error opening hts file for reading '%s'.",input_file);
+  check(input->format.format == bam, "Index only (-x) needs a BAM input, CRAM indices carry no read counts.");
+  head = sam_hdr_read(input);
+  check(head != NULL, "Error reading header from opened hts file '%s'.",input_file);
+  //Header is checked as for a full run so problems show before a long job is started
+  grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  check(grps != NULL, "Error fetching read groups from header.");
+  idx = sam_index_load(input, input_file);
+  check(idx != NULL, "Index only (-x) requires an index for '%s'.",input_file);
+  check(bam_access_index_counts(idx, head, &counts) == 0, "Error reading counts from index of '%s'.",input_file);
+  check(bam_stats_output_print_index(head, &counts, output_file) == 0, "Error writing index counts to '%s'.",output_file);
+
+  uint64_t mapped = 0;
+  uint64_t unmapped = counts.no_coor;
+  uint32_t i=0;
+  for(i=0; i<counts.mapped.size; i++) mapped += counts.mapped.counts[i];
+  for(i=0; i<counts.unmapped.size; i++) unmapped += counts.unmapped.counts[i];
+  log_info("'%s': %d contigs, %d read groups, %"PRIu64" reads (%"PRIu64" mapped, %"PRIu64" unmapped of which %"PRIu64" unplaced).",
+            input_file, head->n_targets, grps_size, mapped + unmapped, mapped, unmapped, counts.no_coor);
+
+  bam_access_qc_destroy(&counts);
+  bam_access_destroy_stats(grp_stats, grps_size);
+  free(grps);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return 0;
+error:
+  bam_access_qc_destroy(&counts);
+  if(grps) free(grps);
+  if(idx) hts_idx_destroy(idx);
+  if(head) bam_hdr_destroy(head);
+  if(input) hts_close(input);
+  return 1;
+}
+
+int write_batch_bas(batch_input_t *in, void *data){
+  char *bas = batch_bas_name(in->input_file);
+  check(bas != NULL, "Error naming output for '%s'.", in->input_file);
+  check(bam_stats_output_print_results(in->grps, in->grps_size, in->grp_stats, in->input_file, bas, rna) == 0,
+        "Error writing bam_stats output to '%s'.", bas);
+  log_info("Written '%s'.", bas);
+  free(bas);
+  return 0;
+error:
+  if(bas) free(bas);
+  return -1;
+}
+
+int process_batch(){
+  int opts = (rna ? BAM_ACCESS_RNA : 0) | (no_gc ? BAM_ACCESS_NO_GC : 0);
+  int failed = bam_access_batch_process(input_files, n_input_files, ref_file, opts, nthreads, write_batch_bas, NULL);
+  check(failed >= 0, "Error running batch of %d inputs.", n_input_files);
+  check(failed == 0, "%d of %d inputs failed.", failed, n_input_files);
+  return 0;
+error:
+  return 1;
+}
+
+int write_checkpoint(int64_t voffset, uint64_t records, void *data){
+  rg_info_t **grps = (rg_info_t **) data;
+  bam_stats_checkpoint_t ckpt = {voffset, records, 1};
+  return bam_stats_dump_write_checkpoint(checkpoint_file, input_file, &ckpt, grps, grps_size, grp_stats);
+}
+
 int main(int argc, char *argv[]){
 	options(argc, argv);
+  if(merge) return merge_dumps();
+  if(index_only) return index_summary();
+  if(n_input_files > 1 || fofn_file) return process_batch();
 	htsFile *input = NULL;
 	bam_hdr_t *head = NULL;
   rg_info_t **grps = NULL;
-  //Open bam file as object
-  input = hts_open(input_file,"r");
+  hts_idx_t *idx = NULL;
+  int stream_workers = 0;
+  htsThreadPool pool = {NULL, 0};
+  bam_stats_tee_t *tee = NULL;
+  //Open bam file as object, or the decoding end of a pass-through copy
+  if(tee_file){
+    tee = bam_stats_tee_start(input_file, tee_file, tee_md5);
+    check(tee != NULL, "Error starting copy of '%s' to '%s'.",input_file,tee_file);
+    input = bam_stats_tee_input(tee);
+  }else{
+    input = hts_open(input_file,"r");
+  }
   check(input != NULL, "Error opening hts file for reading '%s'.",input_file);
 
+  //Indexed input can be split by region, each worker decompressing its own shard
+  //Checkpointed runs read sequentially so a single offset describes progress
+  if(checkpoint_file && nthreads > 1) log_info("Checkpointing to '%s', %d threads are used for decompression only.",checkpoint_file,nthreads);
+  if(sample_chunks){
+    idx = sam_index_load(input, input_file);
+    check(idx != NULL, "Sampling (-s) requires an index for '%s'.",input_file);
+  }else if(targets_file){
+    idx = sam_index_load(input, input_file);
+    check(idx != NULL, "Targets (-t) require an index for '%s'.",input_file);
+  }else if(nthreads > 1 && strcmp(input_file,"-") != 0 && checkpoint_file == NULL && tee == NULL && shard_parts == 0){
+    idx = sam_index_load(input, input_file);
+    if(idx == NULL) log_info("No index found for '%s', pipelining reads to stats workers.",input_file);
+  }
+
+  //Non-indexed input with spare threads is pipelined, share threads between decompression and stats workers
+  if(nthreads > 1 && idx == NULL && checkpoint_file == NULL && !tee_index && shard_parts == 0){
+    stream_workers = nthreads / 2;
+  }
+
+  //Attach a thread pool for BGZF block decompression / CRAM container decoding
+  if(nthreads > 0 && (idx == NULL || sample_chunks || targets_file)){
+    pool.pool = hts_tpool_init(nthreads - stream_workers);
+    check(pool.pool != NULL, "Error creating thread pool of %d threads.",nthreads);
+    check(hts_set_opt(input, HTS_OPT_THREAD_POOL, &pool) == 0, "Error attaching thread pool to '%s'.",input_file);
+  }
+
+  //Only decode the CRAM fields used for stats
+  int opts = (rna ? BAM_ACCESS_RNA : 0) | (no_gc ? BAM_ACCESS_NO_GC : 0) | (plots ? BAM_ACCESS_CYCLES : 0)
+             | (qc_file ? BAM_ACCESS_QC : 0);
+  check(bam_access_set_cram_fields(input, opts) == 0, "Error restricting CRAM decoding of '%s'.",input_file);
+
   //Set reference index file
   if(ref_file){
     hts_set_fai_filename(input, ref_file);
   }else{
-    if(input->format.format == cram) log_warn("No reference file provided for a cram input file, if the reference described in the cram header can't be located bam_stats may fail.");
+    if(input->format.format == cram && !no_gc) log_warn("No reference file provided for a cram input file, if the reference described in the cram header can't be located bam_stats may fail.");
   }
 
   //Read header from bam file
@@ -171,22 +704,108 @@ int main(int argc, char *argv[]){
   grps = bam_access_parse_header(head, &grps_size, &grp_stats);
   check(grps != NULL, "Error fetching read groups from header.");
 
+  bam_stats_checkpoint_t ckpt = {0, 0, 0};
+  if(checkpoint_file){
+    check(input->format.format == bam, "Checkpoints (-k) are only supported for BAM input.");
+  }
+  if(resume && check_exist(checkpoint_file)){
+    char *ckpt_bam = NULL;
+    check(bam_stats_dump_read_checkpoint(checkpoint_file, &grps, &grps_size, &grp_stats, &ckpt_bam, &ckpt) == 0,
+          "Error reading checkpoint '%s'.", checkpoint_file);
+    char *name = strdup(input_file);
+    int same = ckpt_bam && strcmp(basename(name), ckpt_bam) == 0;
+    free(name);
+    check(same, "Checkpoint '%s' was written for '%s', not '%s'.", checkpoint_file, ckpt_bam ? ckpt_bam : "-", input_file);
+    free(ckpt_bam);
+    check(bgzf_seek(input->fp.bgzf, ckpt.voffset, SEEK_SET) == 0, "Error seeking to checkpoint offset %"PRId64" in '%s'.", ckpt.voffset, input_file);
+    log_info("Resuming '%s' after %"PRIu64" records.", input_file, ckpt.records);
+  }
+
   //Process every read in bam file.
-  int check = bam_access_process_reads(input,head,grps, grps_size, &grp_stats, rna);
+  int check = 0;
+  if(sample_chunks){
+    shard_t *chunks = bam_access_sample_plan_chunks(head, idx, sample_chunks, sample_seed);
+    check(chunks != NULL, "Error choosing chunks of '%s' to sample.",input_file);
+    sample_t *sample = bam_access_sample_process(input, head, idx, chunks, sample_chunks, grps, grps_size, grp_stats, opts, sample_reads);
+    free(chunks);
+    check(sample != NULL, "Error sampling reads in bam file.");
+    double scale = bam_access_sample_scale(sample, grp_stats, grps_size);
+    if(sample->records == 0) log_warn("No records found in the %d sampled chunks of '%s', try more chunks (-s).",sample_chunks,input_file);
+    if(sample->index_records == 0) log_warn("Index of '%s' has no read counts, sampled counts are not scaled.",input_file);
+    log_info("Sampled %"PRIu64" records from %d chunks, counts scaled by %.2f.",sample->records,sample_chunks,scale);
+    check = bam_access_sample_report(stderr, sample);
+    bam_access_sample_destroy(sample);
+  }else if(targets_file){
+    int n_regions = 0;
+    shard_t *regions = bam_access_regions_read(targets_file, head, &n_regions);
+    check(regions != NULL, "Error reading targets from '%s'.",targets_file);
+    log_info("Counting reads overlapping %d merged target regions.",n_regions);
+    check = bam_access_regions_process(input, idx, regions, n_regions, grps, grps_size, grp_stats, opts);
+    free(regions);
+  }else if(tee_index){
+    check = bam_stats_tee_process_reads(input, head, grps, grps_size, &grp_stats, opts, tee_file);
+  }else if(shard_parts){
+    int64_t beg = 0, end = 0;
+    check(bam_access_split_range(input, input_file, head, shard_part - 1, shard_parts, &beg, &end) == 0,
+          "Error finding shard %d/%d of '%s'.",shard_part,shard_parts,input_file);
+    log_info("Shard %d/%d of '%s' covers virtual offsets %"PRId64" to %"PRId64".",shard_part,shard_parts,input_file,beg,end);
+    check = bam_access_split_process(input, head, grps, grps_size, &grp_stats, opts, beg, end);
+  }else if(checkpoint_file){
+    check = bam_access_process_reads_checkpointed(input, head, grps, grps_size, &grp_stats, opts, checkpoint_every, ckpt.records, write_checkpoint, grps);
+  }else if(idx){
+    check = bam_access_parallel_process_indexed(input_file, ref_file, head, idx, grps, grps_size, &grp_stats, opts, nthreads);
+  }else if(stream_workers > 0){
+    check = bam_access_parallel_process_stream(input, head, grps, grps_size, &grp_stats, opts, stream_workers);
+  }else{
+    check = bam_access_process_reads(input,head,grps, grps_size, &grp_stats, opts);
+  }
   check(check==0,"Error processing reads in bam file.");
 
-  int res = bam_stats_output_print_results(grps,grps_size,grp_stats,input_file,output_file);
+  if(tee){
+    char *md5_file = NULL;
+    if(tee_md5){
+      md5_file = malloc(strlen(tee_file) + 5);
+      check_mem(md5_file);
+      sprintf(md5_file, "%s.md5", tee_file);
+    }
+    //Closes input
+    check = bam_stats_tee_finish(tee, md5_file);
+    tee = NULL;
+    input = NULL;
+    if(md5_file) free(md5_file);
+    check(check==0,"Error completing copy of '%s' to '%s'.",input_file,tee_file);
+  }
+
+  if(dump_file){
+    check(bam_stats_dump_write(dump_file, input_file, grps, grps_size, grp_stats) == 0, "Error writing stats dump '%s'.", dump_file);
+  }
+
+  if(qc_file){
+    check(bam_stats_output_print_qc(grps,grps_size,grp_stats,head,qc_file) == 0, "Error writing extended QC '%s'.", qc_file);
+  }
+
+  int res = bam_stats_output_print_results(grps,grps_size,grp_stats,input_file,output_file,rna);
   check(res==0,"Error writing bam_stats output to file.");
+  //Complete, a later run shouldn't resume from here
+  if(checkpoint_file && check_exist(checkpoint_file)) unlink(checkpoint_file);
 
+  if(idx) hts_idx_destroy(idx);
   bam_hdr_destroy(head);
-  hts_close(input);
+  if(input) hts_close(input);
+  if(pool.pool) hts_tpool_destroy(pool.pool);
 
   return 0;
 
   error:
     if(grps) free(grps);
+    if(idx) hts_idx_destroy(idx);
     if(head) bam_hdr_destroy(head);
-    if(input) hts_close(input);
+    if(tee){
+      bam_stats_tee_finish(tee, NULL);
+    }else if(input){
+      hts_close(input);
+    }
+    if(pool.pool) hts_tpool_destroy(pool.pool);
     return 1;
 }
 
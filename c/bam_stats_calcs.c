@@ -20,92 +20,232 @@
 #include <math.h>
 #include <stdlib.h>
 #include <inttypes.h>
-#include "bam_access.h"
+#include "bam_stats_calcs.h"
 
 int compare( const void* a, const void* b)
 {
-     uint64_t int_a = * ( (uint64_t*) a );
-     uint64_t int_b = * ( (uint64_t*) b );
+     uint32_t int_a = * ( (uint32_t*) a );
+     uint32_t int_b = * ( (uint32_t*) b );
      if ( int_a == int_b ) return 0;
      else if ( int_a < int_b ) return -1;
      else return 1;
 }
 
-int bam_stats_calcs_calculate_mean_sd_median_insert_size(khash_t(ins) *inserts,double *mean, double *sd, double *median){
-
-    uint64_t pp_mean = 0;
-    uint64_t tt_mean = 0;
-    uint64_t key;
-    uint64_t val;
-
-    uint64_t *insert_bins;
+//State carried through the ordered sweep of insert size bins
+typedef struct {
+  double mean;
+  uint64_t midpoint;
+  uint64_t running_total;
+  uint64_t current_bin_count;
+  uint64_t insert;
+  uint64_t prev_insert;
+  int found;
+  uint64_t pp_sd;
+} insert_sweep_t;
+
+static inline void sweep_bin(insert_sweep_t *sw, uint64_t insert, uint64_t val){
+  double diff = (double)(insert) - sw->mean;
+  sw->pp_sd += (diff * diff) * (double)val;
+  if(sw->found) return;
+  sw->insert = insert; // The insert size...
+  sw->running_total += val;
+  sw->current_bin_count = val;
+  if(sw->running_total >= sw->midpoint){
+    sw->found = 1;
+    return;
+  }
+  sw->prev_insert = insert;
+}
 
-    insert_bins = malloc(sizeof(uint64_t) * kh_size(inserts));
+int bam_stats_calcs_calculate_mean_sd_median_insert_size(insert_hist_t *inserts,double *mean, double *sd, double *median){
 
-    int i=0;
-    kh_foreach(inserts,key,val,
-        { pp_mean += key * val;
-          tt_mean += val;
-          insert_bins[i] = key;
-          i++;
-        });
+    uint64_t tt_mean = inserts->total;
+    uint32_t *overflow_bins = NULL;
 
     if(tt_mean){//Calculate mean , median, sd
-      *mean = (double) ((double)pp_mean/(double)tt_mean);
-
-
-      //sort the array of insert sizes.
-      qsort( insert_bins, kh_size(inserts), sizeof(uint64_t), compare );
-
-      int midpoint2 = (int)(tt_mean / 2);
-      int midpoint = (midpoint2 + 1);
-      uint64_t insert = 0;
-      uint64_t prev_insert = 0;
-      uint64_t running_total = 0;
-      uint64_t current_bin_count = 0;
-
-
-      int j=0;
-      for(j=0; j<=kh_size(inserts); j++){
-        insert = insert_bins[j]; // The insert size...
+      *mean = (double) ((double)inserts->sum/(double)tt_mean);
+
+      insert_sweep_t sw = {0};
+      sw.mean = *mean;
+      uint64_t midpoint2 = tt_mean / 2;
+      sw.midpoint = midpoint2 + 1;
+
+      //Median and SD from one sweep in insert size order, the dense range is already sorted
+      if(inserts->dense){
+        int i=0;
+        for(i=0; i<INSERT_DENSE_SIZE; i++){
+          if(inserts->dense[i]) sweep_bin(&sw, i, inserts->dense[i]);
+        }
+      }
+      //then the (small) sorted long insert tail.
+      if(inserts->overflow && kh_size(inserts->overflow)){
+        int n = kh_size(inserts->overflow);
+        overflow_bins = malloc(sizeof(uint32_t) * n);
+        check_mem(overflow_bins);
+        int i=0;
         khint_t k;
-        k = kh_get(ins,inserts,insert);
-        uint64_t val = kh_val(inserts,k);
-        running_total += val;
-        current_bin_count = val;
-        if(running_total >= midpoint) break;
-        prev_insert = insert_bins[j];
+        for(k = kh_begin(inserts->overflow); k != kh_end(inserts->overflow); ++k){
+          if(kh_exist(inserts->overflow, k)) overflow_bins[i++] = kh_key(inserts->overflow, k);
+        }
+        qsort( overflow_bins, n, sizeof(uint32_t), compare );
+        for(i=0; i<n; i++){
+          k = kh_get(ins,inserts->overflow,overflow_bins[i]);
+          sweep_bin(&sw, overflow_bins[i], kh_val(inserts->overflow,k));
+        }
       }
 
-      if(tt_mean %2 == 0 && ( running_total - midpoint2 >= current_bin_count )){
+      if(tt_mean %2 == 0 && ( sw.running_total - midpoint2 >= sw.current_bin_count )){
         //warn "Thinks is even AND split between bins ";
-        *median = (((double)insert + (double)prev_insert) / (double)2);
+        *median = (((double)sw.insert + (double)sw.prev_insert) / (double)2);
       }else{
         //warn "Thinks is odd or NOT split between bins";
-        *median = (double)(insert);
+        *median = (double)(sw.insert);
       }
 
       //We have mean and median so calculate the SD
-      uint64_t pp_sd = 0;
-      uint64_t tt_sd = 0;
+      double variance = fabs((double)((double)sw.pp_sd / (double)tt_mean));
+      *sd = sqrt(variance);
 
-      kh_foreach(inserts,key,val,
-            { double diff = (double)(key) - (*mean);
-              pp_sd += (diff * diff) * (double)val;
-              tt_sd += val;
-            });
+    } //End of if we have data to calculate from.
+    if(overflow_bins) free(overflow_bins);
+  return 0;
+error:
+  if(overflow_bins) free(overflow_bins);
+  return -1;
+}
 
+//Non-empty bins in insert size order with prefix sums, statistics over any window of sizes are then O(log bins)
+typedef struct {
+  int n;
+  uint32_t *key;
+  uint64_t *count; //count[i] is the number of inserts in bins before i, n+1 entries
+  long double *sum;
+  long double *sumsq;
+} insert_prefix_t;
+
+static void insert_prefix_destroy(insert_prefix_t *p){
+  if(p->key) free(p->key);
+  if(p->count) free(p->count);
+  if(p->sum) free(p->sum);
+  if(p->sumsq) free(p->sumsq);
+}
 
+static int insert_prefix_build(insert_hist_t *inserts, insert_prefix_t *p){
+  int n = 0;
+  int i = 0;
+  uint32_t *overflow_bins = NULL;
+  int n_overflow = inserts->overflow ? kh_size(inserts->overflow) : 0;
+  if(inserts->dense){
+    for(i=0; i<INSERT_DENSE_SIZE; i++) if(inserts->dense[i]) n++;
+  }
+  n += n_overflow;
+  p->n = 0;
+  p->key = malloc(sizeof(uint32_t) * (n + 1));
+  p->count = malloc(sizeof(uint64_t) * (n + 1));
+  p->sum = malloc(sizeof(long double) * (n + 1));
+  p->sumsq = malloc(sizeof(long double) * (n + 1));
+  check_mem(p->key);
+  check_mem(p->count);
+  check_mem(p->sum);
+  check_mem(p->sumsq);
+  p->count[0] = 0;
+  p->sum[0] = 0;
+  p->sumsq[0] = 0;
+  if(inserts->dense){
+    for(i=0; i<INSERT_DENSE_SIZE; i++){
+      if(!inserts->dense[i]) continue;
+      p->key[p->n] = i;
+      p->count[p->n+1] = p->count[p->n] + inserts->dense[i];
+      p->sum[p->n+1] = p->sum[p->n] + (long double)i * inserts->dense[i];
+      p->sumsq[p->n+1] = p->sumsq[p->n] + (long double)i * i * inserts->dense[i];
+      p->n++;
+    }
+  }
+  if(n_overflow){
+    overflow_bins = malloc(sizeof(uint32_t) * n_overflow);
+    check_mem(overflow_bins);
+    khint_t k;
+    i = 0;
+    for(k = kh_begin(inserts->overflow); k != kh_end(inserts->overflow); ++k){
+      if(kh_exist(inserts->overflow, k)) overflow_bins[i++] = kh_key(inserts->overflow, k);
+    }
+    qsort(overflow_bins, n_overflow, sizeof(uint32_t), compare);
+    for(i=0; i<n_overflow; i++){
+      uint32_t ins = overflow_bins[i];
+      uint64_t val = kh_val(inserts->overflow, kh_get(ins, inserts->overflow, ins));
+      p->key[p->n] = ins;
+      p->count[p->n+1] = p->count[p->n] + val;
+      p->sum[p->n+1] = p->sum[p->n] + (long double)ins * val;
+      p->sumsq[p->n+1] = p->sumsq[p->n] + (long double)ins * ins * val;
+      p->n++;
+    }
+    free(overflow_bins);
+  }
+  return 0;
+error:
+  if(overflow_bins) free(overflow_bins);
+  return -1;
+}
 
-      if(tt_sd){
-        double variance = fabs((double)((double)pp_sd / (double)tt_sd));
-        *sd = sqrt(variance);
-      }else{
-        *sd = 0;
-      }
+//First bin with a size >= value
+static int insert_prefix_lower(insert_prefix_t *p, double value){
+  int lo = 0;
+  int hi = p->n;
+  while(lo < hi){
+    int mid = lo + (hi - lo) / 2;
+    if((double)p->key[mid] < value) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
 
-      kh_destroy(ins, inserts);
+//Mean, SD and median of the inserts in bins [a,b), same median convention as the full sweep
+static void insert_prefix_window(insert_prefix_t *p, int a, int b, double *mean, double *sd, double *median){
+  uint64_t total = p->count[b] - p->count[a];
+  long double m = (p->sum[b] - p->sum[a]) / total;
+  long double variance = (p->sumsq[b] - p->sumsq[a]) / total - m * m;
+  *mean = (double)m;
+  *sd = sqrt(fabs((double)variance));
+
+  uint64_t midpoint2 = total / 2;
+  uint64_t base = p->count[a];
+  int lo = a;
+  int hi = b - 1;
+  while(lo < hi){ //first bin reaching the midpoint
+    int mid = lo + (hi - lo) / 2;
+    if(p->count[mid+1] - base >= midpoint2 + 1) hi = mid;
+    else lo = mid + 1;
+  }
+  if(total % 2 == 0 && p->count[lo] - base >= midpoint2){
+    *median = ((double)p->key[lo] + (double)p->key[lo-1]) / (double)2;
+  }else{
+    *median = (double)p->key[lo];
+  }
+}
 
-    } //End of if we have data to calculate from.
+int bam_stats_calcs_calculate_trimmed_insert_size(insert_hist_t *inserts, double n_sd, double *mean, double *sd, double *median){
+  insert_prefix_t p = {0};
+  if(inserts->total == 0) return 0;
+  check(insert_prefix_build(inserts, &p) == 0, "Error building insert size prefix sums.");
+
+  int a = 0;
+  int b = p.n;
+  insert_prefix_window(&p, a, b, mean, sd, median);
+  int iter = 0;
+  for(iter=0; iter<RNA_TRIM_MAX_ITER; iter++){
+    int new_a = insert_prefix_lower(&p, *mean - n_sd * *sd);
+    //Bins are integral so the first bin above the window is the first >= floor(hi)+1
+    int new_b = insert_prefix_lower(&p, floor(*mean + n_sd * *sd) + 1);
+    if(new_a >= new_b) break; //Nothing left in the window, keep the last estimate
+    if(new_a == a && new_b == b) break;
+    a = new_a;
+    b = new_b;
+    insert_prefix_window(&p, a, b, mean, sd, median);
+  }
+
+  insert_prefix_destroy(&p);
   return 0;
-}
\ No newline at end of file
+error:
+  insert_prefix_destroy(&p);
+  return -1;
+}
@@ -22,6 +22,12 @@
 
 #include "bam_access.h"
 
-int bam_stats_calcs_calculate_mean_sd_median_insert_size(khash_t(ins) *inserts,double *mean, double *sd, double *median);
+#define RNA_INSERT_SD 2 //Inserts further than this many SD from the mean are dropped in RNA mode
+#define RNA_TRIM_MAX_ITER 100
+
+int bam_stats_calcs_calculate_mean_sd_median_insert_size(insert_hist_t *inserts,double *mean, double *sd, double *median);
+
+//Repeatedly recalculates mean, SD and median from only the inserts within n_sd SD of the previous mean until the window is stable.
+int bam_stats_calcs_calculate_trimmed_insert_size(insert_hist_t *inserts, double n_sd, double *mean, double *sd, double *median);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,632 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include "bam_stats_dump.h"
+
+typedef struct {
+  char *s;
+  char *end;
+} json_cursor_t;
+
+static int write_json_string(FILE *out, const char *str){
+  const unsigned char *c = (const unsigned char *) str;
+  if(fputc('"', out) == EOF) return -1;
+  for(; *c; c++){
+    int chk;
+    switch(*c){
+      case '"': chk = fputs("\\\"", out); break;
+      case '\\': chk = fputs("\\\\", out); break;
+      case '\t': chk = fputs("\\t", out); break;
+      case '\n': chk = fputs("\\n", out); break;
+      case '\r': chk = fputs("\\r", out); break;
+      default:
+        chk = (*c < 0x20) ? fprintf(out, "\\u%04x", *c) : fputc(*c, out);
+    }
+    if(chk < 0) return -1;
+  }
+  return fputc('"', out) == EOF ? -1 : 0;
+}
+
+//Per cycle matrix as an array (cycle) of arrays (quality or base), as the fqp_* arrays of PCAP::Bam::Stats.
+//Trailing zeros are trimmed when requested as fqplots draws one row per quality listed.
+static int write_cycles(FILE *out, char *key, int r, uint64_t *counts, uint32_t n_cycles, int width, int trim){
+  check(fprintf(out, ",\"%s_%d\":[", key, r) > 0, "Error writing stats dump.");
+  uint32_t cycle=0;
+  for(cycle=0; cycle<n_cycles; cycle++){
+    check(fputs(cycle ? ",[" : "[", out) >= 0, "Error writing stats dump.");
+    uint64_t *row = counts + (size_t)cycle * width;
+    int n = width;
+    if(trim) while(n > 0 && row[n-1] == 0) n--;
+    int i=0;
+    for(i=0; i<n; i++){
+      check(fprintf(out, "%s%"PRIu64, i ? "," : "", row[i]) > 0, "Error writing stats dump.");
+    }
+    check(fputc(']', out) != EOF, "Error writing stats dump.");
+  }
+  check(fputc(']', out) != EOF, "Error writing stats dump.");
+  return 0;
+error:
+  return -1;
+}
+
+static int write_group(FILE *out, rg_info_t *grp, stats_rd_t **rd_stats){
+  check(write_json_string(out, grp->id) == 0, "Error writing read group ID.");
+  check(fputs(":{\"head\":", out) >= 0, "Error writing stats dump.");
+  check(write_json_string(out, grp->head ? grp->head : "") == 0, "Error writing read group header.");
+  int rd=0;
+  for(rd=0; rd<2; rd++){
+    stats_rd_t *st = rd_stats[rd];
+    int r = rd + 1;
+    //Length only exists once a read has been seen, as in PCAP::Bam::Stats
+    if(st->length) check(fprintf(out, ",\"length_%d\":%"PRIu32, r, st->length) > 0, "Error writing stats dump.");
+    check(fprintf(out, ",\"count_%d\":%"PRIu64",\"dup_%d\":%"PRIu64",\"gc_%d\":%"PRIu64",\"unmap_%d\":%"PRIu64
+                       ",\"total_divergent_bases_%d\":%"PRIu64",\"total_mapped_bases_%d\":%"PRIu64,
+                  r, st->count, r, st->dups, r, st->gc, r, st->umap, r, st->divergent, r, st->mapped_bases) > 0,
+                  "Error writing stats dump.");
+    bam_access_cycle_hist_flush(&st->cycles);
+    if(st->cycles.n_cycles){
+      check(write_cycles(out, "fqp", r, st->cycles.quals, st->cycles.n_cycles, CYCLE_QUALS, 1) == 0, "Error writing quality plot data.");
+      check(write_cycles(out, "fqb", r, st->cycles.bases, st->cycles.n_cycles, CYCLE_BASES, 0) == 0, "Error writing base composition data.");
+    }
+  }
+  //Pair stats are only collected on read 1
+  stats_rd_t *st = rd_stats[0];
+  check(fprintf(out, ",\"mapped_pairs\":%"PRIu64",\"proper\":%"PRIu64",\"inter_chr_pairs\":%"PRIu64",\"inserts\":{",
+                st->mapped_pairs, st->proper, st->inter_chr_pairs) > 0, "Error writing stats dump.");
+  int first = 1;
+  if(st->inserts.dense){
+    uint32_t ins=0;
+    for(ins=0; ins<INSERT_DENSE_SIZE; ins++){
+      if(st->inserts.dense[ins] == 0) continue;
+      check(fprintf(out, "%s\"%"PRIu32"\":%"PRIu64, first ? "" : ",", ins, st->inserts.dense[ins]) > 0, "Error writing stats dump.");
+      first = 0;
+    }
+  }
+  if(st->inserts.overflow){
+    khint_t k;
+    for(k = kh_begin(st->inserts.overflow); k != kh_end(st->inserts.overflow); ++k){
+      if(!kh_exist(st->inserts.overflow, k)) continue;
+      check(fprintf(out, "%s\"%"PRIu32"\":%"PRIu64, first ? "" : ",", kh_key(st->inserts.overflow, k), kh_value(st->inserts.overflow, k)) > 0,
+                    "Error writing stats dump.");
+      first = 0;
+    }
+  }
+  check(fputs("}}", out) >= 0, "Error writing stats dump.");
+  return 0;
+error:
+  return -1;
+}
+
+static int write_dump(char *dump_file, char *bam_name, bam_stats_checkpoint_t *ckpt, rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats){
+  assert(dump_file != NULL);
+  char *name = NULL;
+  FILE *out = fopen(dump_file, "w");
+  check(out != NULL, "Error trying to open stats dump file %s for writing.", dump_file);
+  name = strdup(bam_name ? bam_name : "-");
+  check_mem(name);
+  check(fprintf(out, "{\"format\":\"%s\",\"version\":%d,\"bam\":", BAM_STATS_DUMP_FORMAT, BAM_STATS_DUMP_VERSION) > 0, "Error writing stats dump.");
+  check(write_json_string(out, basename(name)) == 0, "Error writing stats dump.");
+  if(ckpt){
+    check(fprintf(out, ",\"checkpoint\":{\"voffset\":%"PRId64",\"records\":%"PRIu64"}", ckpt->voffset, ckpt->records) > 0,
+          "Error writing stats dump.");
+  }
+  check(fputs(",\"groups\":{", out) >= 0, "Error writing stats dump.");
+  int i=0;
+  for(i=0; i<grps_size; i++){
+    if(i) check(fputc(',', out) != EOF, "Error writing stats dump.");
+    check(write_group(out, grps[i], grp_stats[i]) == 0, "Error writing read group %s to stats dump.", grps[i]->id);
+  }
+  check(fputs("}}\n", out) >= 0, "Error writing stats dump.");
+  free(name);
+  name = NULL;
+  int chk = fclose(out);
+  out = NULL;
+  check(chk == 0, "Error closing stats dump file %s.", dump_file);
+  return 0;
+error:
+  if(name) free(name);
+  if(out) fclose(out);
+  return -1;
+}
+
+int bam_stats_dump_write(char *dump_file, char *bam_name, rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats){
+  return write_dump(dump_file, bam_name, NULL, grps, grps_size, grp_stats);
+}
+
+int bam_stats_dump_write_checkpoint(char *dump_file, char *bam_name, bam_stats_checkpoint_t *ckpt, rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats){
+  assert(ckpt != NULL);
+  //Written aside and renamed so a preempted run never leaves a partial checkpoint
+  char *tmp = (char *) malloc(strlen(dump_file) + 5);
+  check_mem(tmp);
+  sprintf(tmp, "%s.tmp", dump_file);
+  check(write_dump(tmp, bam_name, ckpt, grps, grps_size, grp_stats) == 0, "Error writing checkpoint %s.", tmp);
+  check(rename(tmp, dump_file) == 0, "Error moving checkpoint %s to %s.", tmp, dump_file);
+  free(tmp);
+  return 0;
+error:
+  if(tmp) free(tmp);
+  return -1;
+}
+
+/* Minimal JSON reader, enough for the dump layout and PCAP::Bam::Stats::json_stats output */
+
+static void json_skip_ws(json_cursor_t *c){
+  while(c->s < c->end && (*c->s == ' ' || *c->s == '\t' || *c->s == '\n' || *c->s == '\r')) c->s++;
+}
+
+static int json_expect(json_cursor_t *c, char ch){
+  json_skip_ws(c);
+  if(c->s >= c->end || *c->s != ch) return -1;
+  c->s++;
+  return 0;
+}
+
+static int json_peek(json_cursor_t *c){
+  json_skip_ws(c);
+  return c->s < c->end ? *c->s : -1;
+}
+
+//Returns a malloc'd copy of the string with escapes resolved, non-ASCII \u escapes become '?'
+static char *json_string(json_cursor_t *c){
+  char *str = NULL;
+  check(json_expect(c, '"') == 0, "Expected a JSON string.");
+  char *start = c->s;
+  while(c->s < c->end && *c->s != '"'){
+    if(*c->s == '\\') c->s++;
+    c->s++;
+  }
+  check(c->s < c->end, "Unterminated JSON string.");
+  str = (char *) malloc(c->s - start + 1);
+  check_mem(str);
+  char *o = str;
+  char *i = start;
+  while(i < c->s){
+    if(*i != '\\'){
+      *o++ = *i++;
+      continue;
+    }
+    i++;
+    switch(*i){
+      case 't': *o++ = '\t'; break;
+      case 'n': *o++ = '\n'; break;
+      case 'r': *o++ = '\r'; break;
+      case 'b': *o++ = '\b'; break;
+      case 'f': *o++ = '\f'; break;
+      case 'u': {
+        check(c->s - i >= 5, "Truncated \\u escape in JSON string.");
+        char hex[5] = {i[1], i[2], i[3], i[4], 0};
+        long cp = strtol(hex, NULL, 16);
+        *o++ = (cp > 0 && cp < 0x80) ? (char)cp : '?';
+        i += 4;
+        break;
+      }
+      default: *o++ = *i; break;
+    }
+    i++;
+  }
+  *o = '\0';
+  c->s++;
+  return str;
+error:
+  if(str) free(str);
+  return NULL;
+}
+
+static int json_uint(json_cursor_t *c, uint64_t *val){
+  json_skip_ws(c);
+  char *num_end = NULL;
+  *val = strtoull(c->s, &num_end, 10);
+  check(num_end != c->s && num_end <= c->end, "Expected a JSON number.");
+  if(num_end < c->end && (*num_end == '.' || *num_end == 'e' || *num_end == 'E')){
+    double d = strtod(c->s, &num_end);
+    *val = (uint64_t) d;
+  }
+  c->s = num_end;
+  return 0;
+error:
+  return -1;
+}
+
+static int json_skip_value(json_cursor_t *c){
+  int ch = json_peek(c);
+  char *str = NULL;
+  switch(ch){
+    case '"':
+      str = json_string(c);
+      check(str != NULL, "Error reading JSON string.");
+      free(str);
+      return 0;
+    case '{':
+    case '[': {
+      char close = ch == '{' ? '}' : ']';
+      c->s++;
+      if(json_peek(c) == close){
+        c->s++;
+        return 0;
+      }
+      while(1){
+        if(ch == '{'){
+          str = json_string(c);
+          check(str != NULL, "Error reading JSON key.");
+          free(str);
+          check(json_expect(c, ':') == 0, "Expected ':' in JSON object.");
+        }
+        check(json_skip_value(c) == 0, "Error reading JSON value.");
+        if(json_peek(c) == ',') {
+          c->s++;
+          continue;
+        }
+        check(json_expect(c, close) == 0, "Unterminated JSON %s.", ch == '{' ? "object" : "array");
+        return 0;
+      }
+    }
+    default:
+      //Numbers, true, false, null
+      while(c->s < c->end && *c->s != ',' && *c->s != '}' && *c->s != ']' && *c->s != ' ' && *c->s != '\n') c->s++;
+      return 0;
+  }
+error:
+  return -1;
+}
+
+static int json_read_inserts(json_cursor_t *c, insert_hist_t *hist){
+  char *key = NULL;
+  check(json_expect(c, '{') == 0, "Expected inserts object.");
+  if(json_peek(c) == '}'){
+    c->s++;
+    return 0;
+  }
+  while(1){
+    key = json_string(c);
+    check(key != NULL, "Error reading insert size.");
+    check(json_expect(c, ':') == 0, "Expected ':' in inserts object.");
+    uint64_t count;
+    check(json_uint(c, &count) == 0, "Error reading count for insert size %s.", key);
+    uint32_t ins = (uint32_t) strtoul(key, NULL, 10);
+    check(bam_access_insert_hist_add(hist, ins, count) == 0, "Error adding insert size %s.", key);
+    free(key);
+    key = NULL;
+    if(json_peek(c) == ','){
+      c->s++;
+      continue;
+    }
+    check(json_expect(c, '}') == 0, "Unterminated inserts object.");
+    return 0;
+  }
+error:
+  if(key) free(key);
+  return -1;
+}
+
+//fqp_N/fqb_N arrays, null cycles or qualities (PCAP::Bam::Stats) count as 0 and qualities beyond the matrix go in the last column
+static int json_read_cycles(json_cursor_t *c, cycle_hist_t *hist, int quals){
+  int width = quals ? CYCLE_QUALS : CYCLE_BASES;
+  uint32_t cycle = 0;
+  check(json_expect(c, '[') == 0, "Expected per cycle array.");
+  if(json_peek(c) == ']'){
+    c->s++;
+    return 0;
+  }
+  for(cycle=0;;cycle++){
+    check(bam_access_cycle_hist_reserve(hist, cycle + 1) == 0, "Error growing per cycle counts.");
+    uint64_t *row = (quals ? hist->quals : hist->bases) + (size_t)cycle * width;
+    if(json_peek(c) == '['){
+      c->s++;
+      int i=0;
+      while(json_peek(c) != ']'){
+        if(i) check(json_expect(c, ',') == 0, "Expected ',' in per cycle array.");
+        uint64_t val = 0;
+        if(json_peek(c) == 'n'){
+          check(json_skip_value(c) == 0, "Error reading per cycle value.");
+        }else{
+          check(json_uint(c, &val) == 0, "Error reading per cycle value.");
+        }
+        row[i < width ? i : width - 1] += val;
+        i++;
+      }
+      c->s++;
+    }else{
+      check(json_skip_value(c) == 0, "Error reading per cycle array.");
+    }
+    if(json_peek(c) == ','){
+      c->s++;
+      continue;
+    }
+    check(json_expect(c, ']') == 0, "Unterminated per cycle array.");
+    return 0;
+  }
+error:
+  return -1;
+}
+
+//Per end counters by key prefix, key suffix _1/_2 gives the end
+static uint64_t *group_counter(stats_rd_t **rd_stats, char *key){
+  size_t len = strlen(key);
+  if(strcmp(key, "mapped_pairs") == 0) return &rd_stats[0]->mapped_pairs;
+  if(strcmp(key, "proper") == 0) return &rd_stats[0]->proper;
+  if(strcmp(key, "inter_chr_pairs") == 0) return &rd_stats[0]->inter_chr_pairs;
+  if(len < 3 || key[len-2] != '_' || (key[len-1] != '1' && key[len-1] != '2')) return NULL;
+  stats_rd_t *st = rd_stats[key[len-1] - '1'];
+  if(strncmp(key, "count_", len-1) == 0) return &st->count;
+  if(strncmp(key, "dup_", len-1) == 0) return &st->dups;
+  if(strncmp(key, "gc_", len-1) == 0) return &st->gc;
+  if(strncmp(key, "unmap_", len-1) == 0) return &st->umap;
+  if(strncmp(key, "total_divergent_bases_", len-1) == 0) return &st->divergent;
+  if(strncmp(key, "total_mapped_bases_", len-1) == 0) return &st->mapped_bases;
+  return NULL;
+}
+
+static int json_read_group(json_cursor_t *c, rg_info_t *grp, stats_rd_t **rd_stats){
+  char *key = NULL;
+  check(json_expect(c, '{') == 0, "Expected read group object.");
+  if(json_peek(c) == '}'){
+    c->s++;
+    return 0;
+  }
+  while(1){
+    key = json_string(c);
+    check(key != NULL, "Error reading read group key.");
+    check(json_expect(c, ':') == 0, "Expected ':' in read group object.");
+    uint64_t *counter = NULL;
+    if(strcmp(key, "head") == 0){
+      grp->head = json_string(c);
+      check(grp->head != NULL, "Error reading read group header.");
+    }else if(strcmp(key, "length_1") == 0 || strcmp(key, "length_2") == 0){
+      uint64_t len;
+      check(json_uint(c, &len) == 0, "Error reading %s.", key);
+      rd_stats[key[7] - '1']->length = (uint32_t) len;
+    }else if(strcmp(key, "inserts") == 0){
+      check(json_read_inserts(c, &rd_stats[0]->inserts) == 0, "Error reading inserts.");
+    }else if(strcmp(key, "fqp_1") == 0 || strcmp(key, "fqp_2") == 0 || strcmp(key, "fqb_1") == 0 || strcmp(key, "fqb_2") == 0){
+      check(json_read_cycles(c, &rd_stats[key[4] - '1']->cycles, key[2] == 'p') == 0, "Error reading %s.", key);
+    }else if((counter = group_counter(rd_stats, key)) != NULL){
+      check(json_uint(c, counter) == 0, "Error reading %s.", key);
+    }else{
+      //Anything newer than we know about
+      check(json_skip_value(c) == 0, "Error reading %s.", key);
+    }
+    free(key);
+    key = NULL;
+    if(json_peek(c) == ','){
+      c->s++;
+      continue;
+    }
+    check(json_expect(c, '}') == 0, "Unterminated read group object.");
+    return 0;
+  }
+error:
+  if(key) free(key);
+  return -1;
+}
+
+static void free_group(rg_info_t *grp){
+  if(grp == NULL) return;
+  free(grp->id);
+  free(grp->sample);
+  free(grp->platform);
+  free(grp->platform_unit);
+  free(grp->lib);
+  free(grp->head);
+  free(grp);
+}
+
+static void default_field(char **field){
+  if(*field && (*field)[0] != '\0') return;
+  free(*field);
+  *field = strdup(".");
+}
+
+static int same_field(char *a, char *b){
+  return strcmp(a ? a : ".", b ? b : ".") == 0;
+}
+
+static int merge_group(char *id, json_cursor_t *c, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats){
+  rg_info_t *grp = NULL;
+  stats_rd_t ***tmp = bam_access_init_stats(1);
+  check(tmp != NULL, "Error allocating stats for read group %s.", id);
+  grp = (rg_info_t *) calloc(1, sizeof(rg_info_t));
+  check_mem(grp);
+  check(json_read_group(c, grp, tmp[0]) == 0, "Error reading read group %s.", id);
+
+  if(grp->head && strncmp(grp->head, "@RG\t", 4) == 0){
+    char *line = strdup(grp->head);
+    check_mem(line);
+    parse_rg_line(line, grp);
+    free(line);
+  }
+  //The key is the ID, the anonymous group's header says ID:anon
+  free(grp->id);
+  grp->id = strdup(id);
+  check_mem(grp->id);
+  //Empty fields are '.' as in bam_access_parse_header
+  default_field(&grp->sample);
+  default_field(&grp->platform);
+  default_field(&grp->platform_unit);
+  default_field(&grp->lib);
+
+  int i=0;
+  for(i=0; i<*grps_size; i++){
+    if(strcmp((*grps)[i]->id, id) == 0) break;
+  }
+  if(i == *grps_size){
+    rg_info_t **g = (rg_info_t **) realloc(*grps, sizeof(rg_info_t *) * (*grps_size + 1));
+    check_mem(g);
+    *grps = g;
+    check(bam_access_grow_stats(grp_stats, *grps_size, *grps_size + 1) == 0, "Error adding read group %s.", id);
+    (*grps)[i] = grp;
+    (*grps_size)++;
+    grp = NULL;
+  }else{
+    //Same checks as PCAP::Bam::Stats::merge_json_stats
+    rg_info_t *have = (*grps)[i];
+    check(same_field(have->sample, grp->sample) && same_field(have->platform, grp->platform)
+            && same_field(have->platform_unit, grp->platform_unit) && same_field(have->lib, grp->lib),
+          "Read group %s header doesn't match, aborting merge.", id);
+  }
+  //Read length is kept from the earliest dump that has one, as a single pass over the parts in order would see it
+  check(bam_access_merge_stats(&(*grp_stats)[i], tmp, 1) == 0, "Error merging read group %s.", id);
+  bam_access_destroy_stats(tmp, 1);
+  free_group(grp);
+  return 0;
+
+error:
+  if(tmp) bam_access_destroy_stats(tmp, 1);
+  free_group(grp);
+  return -1;
+}
+
+static int merge_groups(json_cursor_t *c, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats){
+  char *id = NULL;
+  check(json_expect(c, '{') == 0, "Expected groups object.");
+  if(json_peek(c) == '}'){
+    c->s++;
+    return 0;
+  }
+  while(1){
+    id = json_string(c);
+    check(id != NULL, "Error reading read group ID.");
+    check(json_expect(c, ':') == 0, "Expected ':' in groups object.");
+    check(merge_group(id, c, grps, grps_size, grp_stats) == 0, "Error merging read group %s.", id);
+    free(id);
+    id = NULL;
+    if(json_peek(c) == ','){
+      c->s++;
+      continue;
+    }
+    check(json_expect(c, '}') == 0, "Unterminated groups object.");
+    return 0;
+  }
+error:
+  if(id) free(id);
+  return -1;
+}
+
+static int json_read_checkpoint(json_cursor_t *c, bam_stats_checkpoint_t *ckpt){
+  char *key = NULL;
+  check(json_expect(c, '{') == 0, "Expected checkpoint object.");
+  while(json_peek(c) == '"'){
+    key = json_string(c);
+    check(key != NULL, "Error reading checkpoint key.");
+    check(json_expect(c, ':') == 0, "Expected ':' in checkpoint object.");
+    uint64_t val = 0;
+    if(strcmp(key, "voffset") == 0 || strcmp(key, "records") == 0){
+      check(json_uint(c, &val) == 0, "Error reading checkpoint %s.", key);
+      if(ckpt && key[0] == 'v') ckpt->voffset = (int64_t) val;
+      if(ckpt && key[0] == 'r') ckpt->records = val;
+    }else{
+      check(json_skip_value(c) == 0, "Error reading checkpoint %s.", key);
+    }
+    free(key);
+    key = NULL;
+    if(json_peek(c) == ',') c->s++;
+  }
+  check(json_expect(c, '}') == 0, "Unterminated checkpoint object.");
+  return 0;
+error:
+  if(key) free(key);
+  return -1;
+}
+
+static int read_dump(char *dump_file, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats, char **bam_name, bam_stats_checkpoint_t *ckpt){
+  assert(dump_file != NULL);
+  FILE *in = NULL;
+  char *buf = NULL;
+  char *key = NULL;
+  in = fopen(dump_file, "r");
+  check(in != NULL, "Error trying to open stats dump file %s for reading.", dump_file);
+  check(fseek(in, 0, SEEK_END) == 0, "Error reading stats dump file %s.", dump_file);
+  long size = ftell(in);
+  check(size >= 0, "Error reading stats dump file %s.", dump_file);
+  rewind(in);
+  buf = (char *) malloc(size + 1);
+  check_mem(buf);
+  check(fread(buf, 1, size, in) == (size_t)size, "Error reading stats dump file %s.", dump_file);
+  buf[size] = '\0';
+  fclose(in);
+  in = NULL;
+
+  json_cursor_t c = {buf, buf + size};
+  check(json_expect(&c, '{') == 0, "Stats dump %s is not a JSON object.", dump_file);
+  //Either the versioned dump or a plain PCAP::Bam::Stats::json_stats read group object
+  while(json_peek(&c) == '"'){
+    key = json_string(&c);
+    check(key != NULL, "Error reading stats dump %s.", dump_file);
+    check(json_expect(&c, ':') == 0, "Expected ':' in stats dump %s.", dump_file);
+    if(strcmp(key, "format") == 0){
+      char *format = json_string(&c);
+      check(format != NULL, "Error reading format of stats dump %s.", dump_file);
+      int ok = strcmp(format, BAM_STATS_DUMP_FORMAT) == 0;
+      free(format);
+      check(ok, "Stats dump %s is not in '%s' format.", dump_file, BAM_STATS_DUMP_FORMAT);
+    }else if(strcmp(key, "version") == 0){
+      uint64_t version;
+      check(json_uint(&c, &version) == 0, "Error reading version of stats dump %s.", dump_file);
+      check(version <= BAM_STATS_DUMP_VERSION, "Stats dump %s is version %"PRIu64", this bam_stats reads up to %d.",
+            dump_file, version, BAM_STATS_DUMP_VERSION);
+    }else if(strcmp(key, "bam") == 0){
+      char *name = json_string(&c);
+      check(name != NULL, "Error reading bam name of stats dump %s.", dump_file);
+      if(*bam_name == NULL){
+        *bam_name = name;
+      }else{
+        free(name);
+      }
+    }else if(strcmp(key, "checkpoint") == 0){
+      check(json_read_checkpoint(&c, ckpt) == 0, "Error reading checkpoint details of %s.", dump_file);
+      if(ckpt) ckpt->found = 1;
+    }else if(strcmp(key, "groups") == 0){
+      check(merge_groups(&c, grps, grps_size, grp_stats) == 0, "Error merging groups from stats dump %s.", dump_file);
+    }else if(json_peek(&c) == '{'){
+      check(merge_group(key, &c, grps, grps_size, grp_stats) == 0, "Error merging read group %s from %s.", key, dump_file);
+    }else{
+      check(json_skip_value(&c) == 0, "Error reading stats dump %s.", dump_file);
+    }
+    free(key);
+    key = NULL;
+    if(json_peek(&c) == ',') c.s++;
+  }
+  check(json_expect(&c, '}') == 0, "Malformed stats dump %s.", dump_file);
+  free(buf);
+  return 0;
+
+error:
+  if(key) free(key);
+  if(buf) free(buf);
+  if(in) fclose(in);
+  return -1;
+}
+
+int bam_stats_dump_merge_file(char *dump_file, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats, char **bam_name){
+  return read_dump(dump_file, grps, grps_size, grp_stats, bam_name, NULL);
+}
+
+int bam_stats_dump_read_checkpoint(char *dump_file, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats, char **bam_name, bam_stats_checkpoint_t *ckpt){
+  assert(ckpt != NULL);
+  ckpt->found = 0;
+  check(read_dump(dump_file, grps, grps_size, grp_stats, bam_name, ckpt) == 0, "Error reading checkpoint %s.", dump_file);
+  check(ckpt->found, "%s is a stats dump without checkpoint details.", dump_file);
+  return 0;
+error:
+  return -1;
+}
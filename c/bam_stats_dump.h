@@ -0,0 +1,49 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_stats_dump_h__
+#define __bam_stats_dump_h__
+
+#include "bam_access.h"
+
+//Raw per read group counters and insert size histograms, in the JSON layout of PCAP::Bam::Stats::json_stats
+//wrapped with a format name and version so dumps from per-lane or per-shard runs can be merged exactly.
+#define BAM_STATS_DUMP_FORMAT "pcap-bam-stats"
+#define BAM_STATS_DUMP_VERSION 1
+
+//Position of the next unprocessed record in a BGZF compressed input
+typedef struct {
+  int64_t voffset; //bgzf_tell virtual offset
+  uint64_t records; //Records read before voffset
+  int found;
+} bam_stats_checkpoint_t;
+
+int bam_stats_dump_write(char *dump_file, char *bam_name, rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats);
+
+//Adds the groups in dump_file to grps/grp_stats, matching on read group ID and appending unseen ones.
+//*grps may start as NULL with *grps_size 0. Sets *bam_name from the dump if still NULL.
+int bam_stats_dump_merge_file(char *dump_file, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats, char **bam_name);
+
+//Dump with the input position included, replaced atomically
+int bam_stats_dump_write_checkpoint(char *dump_file, char *bam_name, bam_stats_checkpoint_t *ckpt, rg_info_t **grps, int grps_size, stats_rd_t ***grp_stats);
+
+//As bam_stats_dump_merge_file, failing when the dump holds no checkpoint details
+int bam_stats_dump_read_checkpoint(char *dump_file, rg_info_t ***grps, int *grps_size, stats_rd_t ****grp_stats, char **bam_name, bam_stats_checkpoint_t *ckpt);
+
+#endif
@@ -0,0 +1,401 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <string.h>
+#include <htslib/sam.h>
+#include "bam_stats_kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+//Nibble codes of C (2) and G (4) in the packed sequence
+#define GC_NIBBLE(n) ((n) == 2 || (n) == 4)
+
+//Ops that count towards mapped bases, as a bit per op code
+#define MAPPED_OPS ((1u << BAM_CMATCH) | (1u << BAM_CINS) | (1u << BAM_CEQUAL) | (1u << BAM_CDIFF))
+
+static uint8_t gc_pair[256]; //G/C count of both bases in a packed byte
+static gc_count_fn gc_best;
+static mapped_bases_fn mapped_best;
+static cycle_update_fn cycle_best;
+
+static uint64_t gc_count_scalar(const uint8_t *seq, int len){
+  uint64_t count = 0;
+  int i=0;
+  for(i=0;i<len;i++){
+    uint8_t base = bam_seqi(seq,i);
+    if(GC_NIBBLE(base)) count++;
+  }
+  return count;
+}
+
+//Whole bytes from 'from' onwards through the pair table, then the odd final base
+//on its own as the padding nibble isn't guaranteed to be zero.
+static inline uint64_t gc_count_tail(const uint8_t *seq, int from, int len){
+  uint64_t count = 0;
+  int nbytes = len >> 1;
+  int i=from;
+  for(;i<nbytes;i++) count += gc_pair[seq[i]];
+  if(len & 1) count += GC_NIBBLE(seq[nbytes] >> 4);
+  return count;
+}
+
+static uint64_t gc_count_lut(const uint8_t *seq, int len){
+  return gc_count_tail(seq, 0, len);
+}
+
+static uint64_t mapped_bases_scalar(const uint32_t *cigar, int n_cigar){
+  uint64_t count = 0;
+  int i=0;
+  for(i=0;i<n_cigar;i++){
+    int op = bam_cigar_op(cigar[i]);
+    if(op == BAM_CINS|| op == BAM_CEQUAL || op == BAM_CMATCH || op == BAM_CDIFF ){
+      count += bam_cigar_oplen(cigar[i]);
+    }
+  }
+  return count;
+}
+
+//Masks the op length by the op's bit in MAPPED_OPS rather than branching per op
+static inline uint64_t mapped_bases_tail(const uint32_t *cigar, int from, int n_cigar){
+  uint64_t count = 0;
+  int i=from;
+  for(;i<n_cigar;i++){
+    uint32_t keep = (MAPPED_OPS >> bam_cigar_op(cigar[i])) & 1;
+    count += bam_cigar_oplen(cigar[i]) & -keep;
+  }
+  return count;
+}
+
+static uint64_t mapped_bases_branchless(const uint32_t *cigar, int n_cigar){
+  return mapped_bases_tail(cigar, 0, n_cigar);
+}
+
+//Nibble code to A/C/G/T/N row, forward and complemented
+static const uint8_t cycle_base[16] = {4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4};
+static const uint8_t cycle_comp[16] = {4, 3, 2, 4, 1, 4, 4, 4, 0, 4, 4, 4, 4, 4, 4, 4};
+
+//Base row of each cycle from base 'from' onwards
+static inline void cycle_base_codes_tail(const uint8_t *seq, int from, int len, int reverse, uint8_t *b){
+  int i=from;
+  if(!reverse){
+    for(;i<len;i++) b[i] = cycle_base[bam_seqi(seq,i)];
+  }else{
+    for(;i<len;i++) b[len - 1 - i] = cycle_comp[bam_seqi(seq,i)];
+  }
+}
+
+//Clamped quality of each cycle from 'from' onwards, widening the range seen
+static inline void cycle_qual_codes_tail(const uint8_t *qual, int from, int len, int reverse, uint8_t *q, int *qmin, int *qmax){
+  int i=from;
+  for(;i<len;i++){
+    uint8_t v = qual[i] < CYCLE_QUALS ? qual[i] : CYCLE_QUALS - 1;
+    q[reverse ? len - 1 - i : i] = v;
+    if(v < *qmin) *qmin = v;
+    if(v > *qmax) *qmax = v;
+  }
+}
+
+//Base row and clamped quality of each cycle into the scratch rows, padded to the stride with 0xff which matches no row.
+//Gives the quality range seen, qmin > qmax when there are no qualities.
+static inline void cycle_codes(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *b, uint8_t *q, int stride, int *qmin, int *qmax){
+  *qmin = CYCLE_QUALS;
+  *qmax = -1;
+  cycle_base_codes_tail(seq, 0, len, reverse, b);
+  if(len > 0 && qual[0] != 0xff){
+    cycle_qual_codes_tail(qual, 0, len, reverse, q, qmin, qmax);
+  }else{
+    memset(q, 0xff, len);
+  }
+  memset(b + len, 0xff, stride - len);
+  memset(q + len, 0xff, stride - len);
+}
+
+//One scattered increment per base and quality
+static void cycle_update_scalar(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *staged, int stride){
+  uint8_t *b = staged + (size_t)(CYCLE_QUALS + CYCLE_BASES) * stride;
+  uint8_t *q = b + stride;
+  int qmin, qmax;
+  cycle_codes(seq, qual, len, reverse, b, q, stride, &qmin, &qmax);
+  int i=0;
+  for(i=0;i<len;i++) staged[(size_t)(CYCLE_QUALS + b[i]) * stride + i]++;
+  if(qmin > qmax) return;
+  for(i=0;i<len;i++) staged[(size_t)q[i] * stride + i]++;
+}
+
+#ifdef KERNELS_X86
+
+//cycle_codes with 32 bases / 16 qualities per iteration, nibbles mapped by pshufb and reverse reads flipped by a byte shuffle
+__attribute__((target("ssse3")))
+static void cycle_codes_ssse3(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *b, uint8_t *q, int stride, int *qmin, int *qmax){
+  const __m128i lut = _mm_loadu_si128((const __m128i *)(reverse ? cycle_comp : cycle_base));
+  const __m128i low = _mm_set1_epi8(0x0f);
+  const __m128i flip = _mm_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+  int nbytes = len >> 1;
+  int i=0;
+  for(;i+16<=nbytes;i+=16){
+    __m128i v = _mm_loadu_si128((const __m128i *)(seq+i));
+    __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, low));
+    __m128i first = _mm_unpacklo_epi8(hi, lo);
+    __m128i second = _mm_unpackhi_epi8(hi, lo);
+    if(!reverse){
+      _mm_storeu_si128((__m128i *)(b + 2*i), first);
+      _mm_storeu_si128((__m128i *)(b + 2*i + 16), second);
+    }else{
+      _mm_storeu_si128((__m128i *)(b + len - 2*i - 16), _mm_shuffle_epi8(first, flip));
+      _mm_storeu_si128((__m128i *)(b + len - 2*i - 32), _mm_shuffle_epi8(second, flip));
+    }
+  }
+  cycle_base_codes_tail(seq, 2*i, len, reverse, b);
+
+  *qmin = CYCLE_QUALS;
+  *qmax = -1;
+  if(len > 0 && qual[0] != 0xff){
+    const __m128i top = _mm_set1_epi8(CYCLE_QUALS - 1);
+    __m128i vmin = top;
+    __m128i vmax = _mm_setzero_si128();
+    for(i=0;i+16<=len;i+=16){
+      __m128i v = _mm_min_epu8(_mm_loadu_si128((const __m128i *)(qual+i)), top);
+      vmin = _mm_min_epu8(vmin, v);
+      vmax = _mm_max_epu8(vmax, v);
+      if(!reverse){
+        _mm_storeu_si128((__m128i *)(q + i), v);
+      }else{
+        _mm_storeu_si128((__m128i *)(q + len - i - 16), _mm_shuffle_epi8(v, flip));
+      }
+    }
+    if(i){
+      uint8_t lanes_min[16], lanes_max[16];
+      _mm_storeu_si128((__m128i *)lanes_min, vmin);
+      _mm_storeu_si128((__m128i *)lanes_max, vmax);
+      int l=0;
+      for(l=0;l<16;l++){
+        if(lanes_min[l] < *qmin) *qmin = lanes_min[l];
+        if(lanes_max[l] > *qmax) *qmax = lanes_max[l];
+      }
+    }
+    cycle_qual_codes_tail(qual, i, len, reverse, q, qmin, qmax);
+  }else{
+    memset(q, 0xff, len);
+  }
+  memset(b + len, 0xff, stride - len);
+  memset(q + len, 0xff, stride - len);
+}
+
+//Whole rows of byte counters updated by compare (0xff on match) and subtract, only for qualities present in the read
+__attribute__((target("ssse3")))
+static void cycle_update_ssse3(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *staged, int stride){
+  uint8_t *b = staged + (size_t)(CYCLE_QUALS + CYCLE_BASES) * stride;
+  uint8_t *q = b + stride;
+  int qmin, qmax;
+  cycle_codes_ssse3(seq, qual, len, reverse, b, q, stride, &qmin, &qmax);
+  int n = (len + 15) & ~15;
+  int row, i;
+  for(row=0;row<CYCLE_BASES;row++){
+    const __m128i code = _mm_set1_epi8(row);
+    uint8_t *acc = staged + (size_t)(CYCLE_QUALS + row) * stride;
+    for(i=0;i<n;i+=16){
+      __m128i hit = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(b+i)), code);
+      _mm_storeu_si128((__m128i *)(acc+i), _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(acc+i)), hit));
+    }
+  }
+  for(row=qmin;row<=qmax;row++){
+    const __m128i code = _mm_set1_epi8(row);
+    uint8_t *acc = staged + (size_t)row * stride;
+    for(i=0;i<n;i+=16){
+      __m128i hit = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(q+i)), code);
+      _mm_storeu_si128((__m128i *)(acc+i), _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(acc+i)), hit));
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static void cycle_update_avx2(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *staged, int stride){
+  uint8_t *b = staged + (size_t)(CYCLE_QUALS + CYCLE_BASES) * stride;
+  uint8_t *q = b + stride;
+  int qmin, qmax;
+  cycle_codes_ssse3(seq, qual, len, reverse, b, q, stride, &qmin, &qmax);
+  int n = (len + 31) & ~31;
+  int row, i;
+  for(row=0;row<CYCLE_BASES;row++){
+    const __m256i code = _mm256_set1_epi8(row);
+    uint8_t *acc = staged + (size_t)(CYCLE_QUALS + row) * stride;
+    for(i=0;i<n;i+=32){
+      __m256i hit = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(b+i)), code);
+      _mm256_storeu_si256((__m256i *)(acc+i), _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(acc+i)), hit));
+    }
+  }
+  for(row=qmin;row<=qmax;row++){
+    const __m256i code = _mm256_set1_epi8(row);
+    uint8_t *acc = staged + (size_t)row * stride;
+    for(i=0;i<n;i+=32){
+      __m256i hit = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q+i)), code);
+      _mm256_storeu_si256((__m256i *)(acc+i), _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(acc+i)), hit));
+    }
+  }
+}
+
+//16 bytes (32 bases) per iteration, each nibble mapped to 0/1 by pshufb and summed by psadbw
+__attribute__((target("ssse3")))
+static uint64_t gc_count_ssse3(const uint8_t *seq, int len){
+  const __m128i lut = _mm_setr_epi8(0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0);
+  const __m128i low = _mm_set1_epi8(0x0f);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  int nbytes = len >> 1;
+  int i=0;
+  for(;i+16<=nbytes;i+=16){
+    __m128i v = _mm_loadu_si128((const __m128i *)(seq+i));
+    __m128i lo = _mm_and_si128(v, low);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low);
+    __m128i c = _mm_add_epi8(_mm_shuffle_epi8(lut, lo), _mm_shuffle_epi8(lut, hi));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(c, zero));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return lanes[0] + lanes[1] + gc_count_tail(seq, i, len);
+}
+
+__attribute__((target("avx2")))
+static uint64_t gc_count_avx2(const uint8_t *seq, int len){
+  const __m256i lut = _mm256_setr_epi8(0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,
+                                       0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  int nbytes = len >> 1;
+  int i=0;
+  for(;i+32<=nbytes;i+=32){
+    __m256i v = _mm256_loadu_si256((const __m256i *)(seq+i));
+    __m256i lo = _mm256_and_si256(v, low);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+    __m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(c, zero));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + gc_count_tail(seq, i, len);
+}
+
+//8 ops per iteration, op selected by a variable shift of MAPPED_OPS and lengths widened to 64 bit
+__attribute__((target("avx2")))
+static uint64_t mapped_bases_avx2(const uint32_t *cigar, int n_cigar){
+  const __m256i op_mask = _mm256_set1_epi32(BAM_CIGAR_MASK);
+  const __m256i ops = _mm256_set1_epi32(MAPPED_OPS);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  int i=0;
+  for(;i+8<=n_cigar;i+=8){
+    __m256i c = _mm256_loadu_si256((const __m256i *)(cigar+i));
+    __m256i keep = _mm256_and_si256(_mm256_srlv_epi32(ops, _mm256_and_si256(c, op_mask)), one);
+    __m256i l = _mm256_and_si256(_mm256_srli_epi32(c, BAM_CIGAR_SHIFT), _mm256_sub_epi32(zero, keep));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(l)));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(l, 1)));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + mapped_bases_tail(cigar, i, n_cigar);
+}
+
+#endif
+
+//Resolved once at load time so the per-record entry points are a plain indirect call
+__attribute__((constructor))
+static void kernels_init(void){
+  int i=0;
+  for(i=0;i<256;i++) gc_pair[i] = GC_NIBBLE(i >> 4) + GC_NIBBLE(i & 0x0f);
+  gc_best = gc_count_lut;
+  mapped_best = mapped_bases_branchless;
+  cycle_best = cycle_update_scalar;
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("ssse3")){
+    gc_best = gc_count_ssse3;
+    cycle_best = cycle_update_ssse3;
+  }
+  if(__builtin_cpu_supports("avx2")){
+    gc_best = gc_count_avx2;
+    mapped_best = mapped_bases_avx2;
+    cycle_best = cycle_update_avx2;
+  }
+#endif
+}
+
+gc_count_fn bam_stats_kernels_gc_impl(kernel_impl_t impl){
+  switch(impl){
+    case KERNEL_SCALAR:
+      return gc_count_scalar;
+    case KERNEL_LUT:
+      return gc_count_lut;
+#ifdef KERNELS_X86
+    case KERNEL_SSSE3:
+      return __builtin_cpu_supports("ssse3") ? gc_count_ssse3 : NULL;
+    case KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2") ? gc_count_avx2 : NULL;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+mapped_bases_fn bam_stats_kernels_mapped_bases_impl(kernel_impl_t impl){
+  switch(impl){
+    case KERNEL_SCALAR:
+      return mapped_bases_scalar;
+    case KERNEL_LUT:
+      return mapped_bases_branchless;
+#ifdef KERNELS_X86
+    case KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2") ? mapped_bases_avx2 : NULL;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+cycle_update_fn bam_stats_kernels_cycle_impl(kernel_impl_t impl){
+  switch(impl){
+    case KERNEL_SCALAR:
+      return cycle_update_scalar;
+#ifdef KERNELS_X86
+    case KERNEL_SSSE3:
+      return __builtin_cpu_supports("ssse3") ? cycle_update_ssse3 : NULL;
+    case KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2") ? cycle_update_avx2 : NULL;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+uint64_t bam_stats_kernels_gc_count(const uint8_t *seq, int len){
+  return gc_best(seq, len);
+}
+
+uint64_t bam_stats_kernels_mapped_bases(const uint32_t *cigar, int n_cigar){
+  return mapped_best(cigar, n_cigar);
+}
+
+void bam_stats_kernels_cycle_update(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *staged, int stride){
+  cycle_best(seq, qual, len, reverse, staged, stride);
+}
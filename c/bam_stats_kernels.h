@@ -0,0 +1,65 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_stats_kernels_h__
+#define __bam_stats_kernels_h__
+
+#include <stdint.h>
+
+#define CYCLE_QUALS 64 //Phred qualities above 63 are counted as 63
+#define CYCLE_BASES 5 //A, C, G, T then anything else as N
+#define CYCLE_SCRATCH_ROWS 2
+#define CYCLE_STAGED_ROWS (CYCLE_QUALS + CYCLE_BASES + CYCLE_SCRATCH_ROWS)
+#define CYCLE_STRIDE_ALIGN 32
+
+//Implementations of the per-record kernels, chosen at runtime from what the CPU supports
+typedef enum {
+  KERNEL_SCALAR = 0,
+  KERNEL_LUT,
+  KERNEL_SSSE3,
+  KERNEL_AVX2,
+  KERNEL_IMPL_COUNT
+} kernel_impl_t;
+
+typedef uint64_t (*gc_count_fn)(const uint8_t *seq, int len);
+
+typedef uint64_t (*mapped_bases_fn)(const uint32_t *cigar, int n_cigar);
+
+//Returns NULL when the implementation isn't built or the CPU lacks the instructions
+gc_count_fn bam_stats_kernels_gc_impl(kernel_impl_t impl);
+
+mapped_bases_fn bam_stats_kernels_mapped_bases_impl(kernel_impl_t impl);
+
+//G/C count over a 4-bit packed sequence of len bases (bam_get_seq)
+uint64_t bam_stats_kernels_gc_count(const uint8_t *seq, int len);
+
+//Sum of M/I/=/X op lengths over a CIGAR op array (bam_get_cigar)
+uint64_t bam_stats_kernels_mapped_bases(const uint32_t *cigar, int n_cigar);
+
+typedef void (*cycle_update_fn)(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *staged, int stride);
+
+cycle_update_fn bam_stats_kernels_cycle_impl(kernel_impl_t impl);
+
+//Adds one read to byte counters staged[row * stride + cycle], rows 0..CYCLE_QUALS-1 by quality then CYCLE_BASES rows by base,
+//followed by CYCLE_SCRATCH_ROWS rows of scratch. stride is a multiple of CYCLE_STRIDE_ALIGN and >= len, callers flush
+//the counters before they can wrap (255 reads). Reverse strand reads are walked from the end and complemented so cycles
+//are in sequencing order, qualities are skipped when absent (0xff).
+void bam_stats_kernels_cycle_update(const uint8_t *seq, const uint8_t *qual, int len, int reverse, uint8_t *staged, int stride);
+
+#endif
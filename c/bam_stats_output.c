@@ -25,8 +25,96 @@
 static char *bas_header = "bam_filename\tsample\tplatform\tplatform_unit\tlibrary\treadgroup\tread_length_r1\tread_length_r2\t#_mapped_bases\t#_mapped_bases_r1\t#_mapped_bases_r2\t#_divergent_bases\t#_divergent_bases_r1\t#_divergent_bases_r2\t#_total_reads\t#_total_reads_r1\t#_total_reads_r2\t#_mapped_reads\t#_mapped_reads_r1\t#_mapped_reads_r2\t#_mapped_reads_properly_paired\t#_gc_bases_r1\t#_gc_bases_r2\tmean_insert_size\tinsert_size_sd\tmedian_insert_size\t#_duplicate_reads\t#_mapped_pairs\t#_inter_chr_pairs\n";
 static char *rg_line_pattern = "%s\t%s\t%s\t%s\t%s\t%s\t%"PRIu32"\t%"PRIu32"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%.3f\t%.3f\t%.3f\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\n";
 
+static char *qc_header = "readgroup\tread\tmetric\tkey\tcount\n";
+
+static int print_count_hist(FILE *out, char *rg, int read, char *metric, count_hist_t *hist, bam_hdr_t *head){
+  uint32_t i=0;
+  for(i=0;i<hist->size;i++){
+    if(hist->counts[i] == 0) continue;
+    int chk;
+    if(head){
+      check((int32_t)i < head->n_targets, "Contig index %"PRIu32" not in header.", i);
+      chk = fprintf(out,"%s\t%d\t%s\t%s\t%"PRIu64"\n",rg,read,metric,head->target_name[i],hist->counts[i]);
+    }else{
+      chk = fprintf(out,"%s\t%d\t%s\t%"PRIu32"\t%"PRIu64"\n",rg,read,metric,i,hist->counts[i]);
+    }
+    check(chk>0,"Error writing %s line to QC output file.",metric);
+  }
+  return 0;
+error:
+  return -1;
+}
+
+int bam_stats_output_print_qc(rg_info_t **grps,int grps_size,stats_rd_t*** grp_stats,bam_hdr_t *head,char *output_file){
+  FILE *out = NULL;
+  check(output_file != NULL, "QC output file was NULL");
+  check(head != NULL, "Header needed to name contigs in QC output.");
+  if (strcmp(output_file,"-")==0) {
+    out = stdout;
+  } else {
+    out = fopen(output_file,"w");
+  }
+  check(out != NULL,"Error trying to open QC output file %s for writing.",output_file);
+
+  int chk = fprintf(out,"%s",qc_header);
+  check(chk==strlen(qc_header),"Error writing header to QC output file.");
+
+  int i=0;
+  for(i=0;i<grps_size;i++){
+    if(grp_stats[i][0]->count==0 && grp_stats[i][1]->count==0) continue; // Skip empty read groups as the .bas does
+    int rd=0;
+    for(rd=0;rd<2;rd++){
+      qc_hist_t *qc = &grp_stats[i][rd]->qc;
+      char *rg = grps[i]->id;
+      check(print_count_hist(out,rg,rd+1,"contig_mapped",&qc->mapped,head)==0,"Error writing contig counts.");
+      check(print_count_hist(out,rg,rd+1,"contig_unmapped",&qc->unmapped,head)==0,"Error writing contig counts.");
+      if(qc->no_coor){
+        chk = fprintf(out,"%s\t%d\tunplaced\t*\t%"PRIu64"\n",rg,rd+1,qc->no_coor);
+        check(chk>0,"Error writing unplaced line to QC output file.");
+      }
+      check(print_count_hist(out,rg,rd+1,"mapq",&qc->mapq,NULL)==0,"Error writing MAPQ counts.");
+      check(print_count_hist(out,rg,rd+1,"soft_clip",&qc->soft_clip,NULL)==0,"Error writing soft clip counts.");
+      check(print_count_hist(out,rg,rd+1,"hard_clip",&qc->hard_clip,NULL)==0,"Error writing hard clip counts.");
+    }
+  }
+
+  if (out != stdout) fclose(out);
+  return 0;
+
+error:
+  if(out && out != stdout) fclose(out);
+  return -1;
+}
+
+int bam_stats_output_print_index(bam_hdr_t *head,qc_hist_t *counts,char *output_file){
+  FILE *out = NULL;
+  check(output_file != NULL, "Output file was NULL");
+  if (strcmp(output_file,"-")==0) {
+    out = stdout;
+  } else {
+    out = fopen(output_file,"w");
+  }
+  check(out != NULL,"Error trying to open output file %s for writing.",output_file);
+
+  int tid=0;
+  for(tid=0;tid<head->n_targets;tid++){
+    uint64_t mapped = (uint32_t)tid < counts->mapped.size ? counts->mapped.counts[tid] : 0;
+    uint64_t unmapped = (uint32_t)tid < counts->unmapped.size ? counts->unmapped.counts[tid] : 0;
+    int chk = fprintf(out,"%s\t%"PRIu32"\t%"PRIu64"\t%"PRIu64"\n",head->target_name[tid],head->target_len[tid],mapped,unmapped);
+    check(chk>0,"Error writing contig counts to output file.");
+  }
+  int chk = fprintf(out,"*\t0\t0\t%"PRIu64"\n",counts->no_coor);
+  check(chk>0,"Error writing unplaced count to output file.");
+
+  if (out != stdout) fclose(out);
+  return 0;
+
+error:
+  if(out && out != stdout) fclose(out);
+  return -1;
+}
 
-int bam_stats_output_print_results(rg_info_t **grps,int grps_size,stats_rd_t*** grp_stats,char *input_file,char *output_file){
+int bam_stats_output_print_results(rg_info_t **grps,int grps_size,stats_rd_t*** grp_stats,char *input_file,char *output_file,int rna){
   FILE *out = NULL;
   check(output_file != NULL, "Output file was NULL");
   if (strcmp(output_file,"-")==0) {
@@ -89,7 +177,12 @@ int bam_stats_output_print_results(rg_info_t **grps,int grps_size,stats_rd_t***
       divergent_bases_r2 = grp_stats[i][1]->divergent;
       divergent_bases = grp_stats[i][0]->divergent + grp_stats[i][1]->divergent;
 
-      bam_stats_calcs_calculate_mean_sd_median_insert_size(grp_stats[i][0]->inserts,&mean_insert_size,&insert_size_sd,&median_insert_size);
+      if(rna){
+        check(bam_stats_calcs_calculate_trimmed_insert_size(&grp_stats[i][0]->inserts,RNA_INSERT_SD,&mean_insert_size,&insert_size_sd,&median_insert_size)==0,
+              "Error calculating RNA insert size stats.");
+      }else{
+        bam_stats_calcs_calculate_mean_sd_median_insert_size(&grp_stats[i][0]->inserts,&mean_insert_size,&insert_size_sd,&median_insert_size);
+      }
       dup_reads = grp_stats[i][0]->dups + grp_stats[i][1]->dups;
     }
 
@@ -22,6 +22,12 @@
 
 #include "bam_access.h"
 
-int bam_stats_output_print_results(rg_info_t **grps,int grps_size,stats_rd_t*** grp_stats,char *input_file,char *output_file);
+int bam_stats_output_print_results(rg_info_t **grps,int grps_size,stats_rd_t*** grp_stats,char *input_file,char *output_file,int rna);
+
+//Extended QC (BAM_ACCESS_QC) as tab separated readgroup/read/metric/key/count lines, zero counts are omitted
+int bam_stats_output_print_qc(rg_info_t **grps,int grps_size,stats_rd_t*** grp_stats,bam_hdr_t *head,char *output_file);
+
+//Per contig counts (bam_access_index_counts) as samtools idxstats, contig/length/mapped/unmapped with unplaced reads on '*'
+int bam_stats_output_print_index(bam_hdr_t *head,qc_hist_t *counts,char *output_file);
 
 #endif
\ No newline at end of file
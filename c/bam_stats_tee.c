@@ -0,0 +1,334 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "htslib/hts.h"
+#include "hfile_internal.h" //Private to htslib, see HTS_TREE_VERSION in the Makefile
+#include "bam_stats_tee.h"
+
+#define TEE_CHUNK 1048576
+#define TEE_CHUNKS 4
+
+struct bam_stats_tee_t {
+  int in_fd;
+  int out_fd;
+  int close_in;
+  int close_out;
+  hts_md5_context *md5;
+  htsFile *hts;
+  pthread_t thread;
+  int started;
+  int status;
+  //Ring of chunks filled by the copy thread and handed to the decoder once written out
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int sync_init;
+  char *chunks[TEE_CHUNKS];
+  ssize_t len[TEE_CHUNKS];
+  int head; //Next chunk to fill
+  int tail; //Next chunk to decode
+  int filled;
+  ssize_t offset; //Bytes of the tail chunk already decoded
+  int eof; //Copy finished, no more chunks will be filled
+  int closed; //Decoder has gone away
+  int abort; //Start up failed, stop copying
+};
+
+//hFILE backend reading the copy thread's chunks in place of a file descriptor
+typedef struct {
+  hFILE base;
+  bam_stats_tee_t *tee;
+} hFILE_tee;
+
+static ssize_t tee_backend_read(hFILE *fpv, void *buffer, size_t nbytes){
+  bam_stats_tee_t *tee = ((hFILE_tee *) fpv)->tee;
+  pthread_mutex_lock(&tee->lock);
+  while(tee->filled == 0 && !tee->eof) pthread_cond_wait(&tee->cond, &tee->lock);
+  if(tee->filled == 0){
+    int status = tee->status;
+    pthread_mutex_unlock(&tee->lock);
+    if(status == 0) return 0;
+    errno = EIO;
+    return -1;
+  }
+  pthread_mutex_unlock(&tee->lock);
+  //The copy thread doesn't touch a chunk again until it is released below
+  ssize_t n = tee->len[tee->tail] - tee->offset;
+  if((size_t) n > nbytes) n = nbytes;
+  memcpy(buffer, tee->chunks[tee->tail] + tee->offset, n);
+  tee->offset += n;
+  if(tee->offset == tee->len[tee->tail]){
+    pthread_mutex_lock(&tee->lock);
+    tee->tail = (tee->tail + 1) % TEE_CHUNKS;
+    tee->filled--;
+    tee->offset = 0;
+    pthread_cond_broadcast(&tee->cond);
+    pthread_mutex_unlock(&tee->lock);
+  }
+  return n;
+}
+
+static ssize_t tee_backend_write(hFILE *fpv, const void *buffer, size_t nbytes){
+  errno = EBADF;
+  return -1;
+}
+
+static off_t tee_backend_seek(hFILE *fpv, off_t offset, int whence){
+  errno = ESPIPE;
+  return -1;
+}
+
+static int tee_backend_flush(hFILE *fpv){
+  return 0;
+}
+
+static int tee_backend_close(hFILE *fpv){
+  bam_stats_tee_t *tee = ((hFILE_tee *) fpv)->tee;
+  pthread_mutex_lock(&tee->lock);
+  tee->closed = 1;
+  pthread_cond_broadcast(&tee->cond);
+  pthread_mutex_unlock(&tee->lock);
+  return 0;
+}
+
+static const struct hFILE_backend tee_backend = {
+  tee_backend_read, tee_backend_write, tee_backend_seek, tee_backend_flush, tee_backend_close
+};
+
+static int write_all(int fd, const char *buf, ssize_t n){
+  while(n > 0){
+    ssize_t w = write(fd, buf, n);
+    if(w < 0){
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    buf += w;
+    n -= w;
+  }
+  return 0;
+}
+
+static void *tee_copy(void *arg){
+  bam_stats_tee_t *tee = (bam_stats_tee_t *) arg;
+  int status = -1;
+  while(1){
+    pthread_mutex_lock(&tee->lock);
+    while(tee->filled == TEE_CHUNKS && !tee->closed) pthread_cond_wait(&tee->cond, &tee->lock);
+    if(tee->abort){
+      pthread_mutex_unlock(&tee->lock);
+      goto error;
+    }
+    //The copy is what matters, if the decoder has gone away keep copying through the same chunk
+    int feeding = !tee->closed;
+    pthread_mutex_unlock(&tee->lock);
+    char *buf = tee->chunks[tee->head];
+    ssize_t n = read(tee->in_fd, buf, TEE_CHUNK);
+    if(n < 0 && errno == EINTR) continue;
+    check(n >= 0, "Error reading input to copy.");
+    if(n == 0) break;
+    check(write_all(tee->out_fd, buf, n) == 0, "Error writing copy of input.");
+    if(tee->md5) hts_md5_update(tee->md5, buf, n);
+    if(feeding){
+      pthread_mutex_lock(&tee->lock);
+      tee->len[tee->head] = n;
+      tee->head = (tee->head + 1) % TEE_CHUNKS;
+      tee->filled++;
+      pthread_cond_broadcast(&tee->cond);
+      pthread_mutex_unlock(&tee->lock);
+    }
+  }
+  status = 0;
+error:
+  //EOF for the decoder
+  pthread_mutex_lock(&tee->lock);
+  tee->status = status;
+  tee->eof = 1;
+  pthread_cond_broadcast(&tee->cond);
+  pthread_mutex_unlock(&tee->lock);
+  return NULL;
+}
+
+static void tee_free(bam_stats_tee_t *tee){
+  int i=0;
+  for(i=0; i<TEE_CHUNKS; i++) if(tee->chunks[i]) free(tee->chunks[i]);
+  if(tee->sync_init){
+    pthread_mutex_destroy(&tee->lock);
+    pthread_cond_destroy(&tee->cond);
+  }
+  if(tee->md5) hts_md5_destroy(tee->md5);
+  free(tee);
+}
+
+bam_stats_tee_t *bam_stats_tee_start(char *input_file, char *copy_file, int md5){
+  assert(input_file != NULL);
+  assert(copy_file != NULL);
+  hFILE_tee *hfp = NULL;
+  int i=0;
+  bam_stats_tee_t *tee = (bam_stats_tee_t *) calloc(1, sizeof(bam_stats_tee_t));
+  check_mem(tee);
+  tee->in_fd = tee->out_fd = -1;
+#ifdef HTS_TREE_VERSION
+  //The backend below depends on the hFILE layout of the htslib tree it was compiled against
+  check(strcmp(hts_version(), HTS_TREE_VERSION) == 0,
+          "Copy mode was built against htslib %s but is running with %s, rebuild bam_stats against the htslib source tree in use.",
+          HTS_TREE_VERSION, hts_version());
+#endif
+
+  if(strcmp(input_file, "-") == 0){
+    tee->in_fd = STDIN_FILENO;
+  }else{
+    tee->in_fd = open(input_file, O_RDONLY);
+    check(tee->in_fd >= 0, "Error opening '%s' for reading.", input_file);
+    tee->close_in = 1;
+  }
+  if(strcmp(copy_file, "-") == 0){
+    tee->out_fd = STDOUT_FILENO;
+  }else{
+    tee->out_fd = open(copy_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    check(tee->out_fd >= 0, "Error opening '%s' for writing.", copy_file);
+    tee->close_out = 1;
+  }
+  if(md5){
+    tee->md5 = hts_md5_init();
+    check(tee->md5 != NULL, "Error initialising md5.");
+  }
+  for(i=0; i<TEE_CHUNKS; i++){
+    tee->chunks[i] = (char *) malloc(TEE_CHUNK);
+    check_mem(tee->chunks[i]);
+  }
+  check(pthread_mutex_init(&tee->lock, NULL) == 0, "Error initialising copy lock.");
+  check(pthread_cond_init(&tee->cond, NULL) == 0, "Error initialising copy condition.");
+  tee->sync_init = 1;
+
+  hfp = (hFILE_tee *) hfile_init(sizeof(hFILE_tee), "r", 0);
+  check(hfp != NULL, "Error opening stats decoder input.");
+  hfp->base.backend = &tee_backend;
+  hfp->tee = tee;
+  //Format detection reads from the stream, so the copy has to be running first
+  check(pthread_create(&tee->thread, NULL, tee_copy, tee) == 0, "Error starting copy thread.");
+  tee->started = 1;
+  tee->hts = hts_hopen(&hfp->base, input_file, "r");
+  check(tee->hts != NULL, "Error opening stats decoder on copy of '%s'.", input_file);
+  return tee;
+
+error:
+  if(tee && tee->started){
+    pthread_mutex_lock(&tee->lock);
+    tee->abort = 1;
+    tee->closed = 1;
+    pthread_cond_broadcast(&tee->cond);
+    pthread_mutex_unlock(&tee->lock);
+    pthread_join(tee->thread, NULL);
+  }
+  if(hfp) hfile_destroy(&hfp->base);
+  if(tee){
+    if(tee->close_in && tee->in_fd >= 0) close(tee->in_fd);
+    if(tee->close_out && tee->out_fd >= 0) close(tee->out_fd);
+    tee_free(tee);
+  }
+  return NULL;
+}
+
+htsFile *bam_stats_tee_input(bam_stats_tee_t *tee){
+  assert(tee != NULL);
+  return tee->hts;
+}
+
+int bam_stats_tee_finish(bam_stats_tee_t *tee, char *md5_file){
+  assert(tee != NULL);
+  FILE *md5_out = NULL;
+  int status = 0;
+  //Closing the decoder end lets the copy run on past anything left unread
+  if(tee->hts) hts_close(tee->hts);
+  tee->hts = NULL;
+  if(tee->started) pthread_join(tee->thread, NULL);
+  status = tee->status;
+  check(status == 0, "Error copying input.");
+  if(tee->close_out){
+    int chk = close(tee->out_fd);
+    tee->close_out = 0;
+    check(chk == 0, "Error closing copy of input.");
+  }
+  if(md5_file && tee->md5){
+    unsigned char digest[16];
+    char hex[33];
+    hts_md5_final(digest, tee->md5);
+    hts_md5_hex(hex, digest);
+    md5_out = fopen(md5_file, "w");
+    check(md5_out != NULL, "Error opening md5 file '%s' for writing.", md5_file);
+    check(fputs(hex, md5_out) >= 0, "Error writing md5 to '%s'.", md5_file);
+    int chk = fclose(md5_out);
+    md5_out = NULL;
+    check(chk == 0, "Error closing md5 file '%s'.", md5_file);
+  }
+  if(tee->close_in) close(tee->in_fd);
+  tee_free(tee);
+  return 0;
+
+error:
+  if(md5_out) fclose(md5_out);
+  if(tee->close_in) close(tee->in_fd);
+  if(tee->close_out) close(tee->out_fd);
+  tee_free(tee);
+  return -1;
+}
+
+int bam_stats_tee_process_reads(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts, char *copy_file){
+  assert(input != NULL);
+  assert(head != NULL);
+  assert(copy_file != NULL);
+  bam1_t *b = NULL;
+  hts_idx_t *idx = NULL;
+  rg_lookup_t *lookup = NULL;
+  check(input->format.format == bam, "Indexing the copy needs BAM input.");
+  BGZF *fp = input->fp.bgzf;
+  //Same parameters as sam_index_build for BAI
+  idx = hts_idx_init(head->n_targets, HTS_FMT_BAI, bgzf_tell(fp), 14, 5);
+  check(idx != NULL, "Error creating index for '%s'.", copy_file);
+  lookup = bam_access_rg_lookup_init(grps, grps_size);
+  check(lookup != NULL, "Error building read group lookup.");
+  b = bam_init1();
+  check_mem(b);
+  int ret;
+  while((ret = sam_read1(input, head, b)) >= 0){
+    check(bam_access_process_read(b, lookup, *grp_stats, opts) == 0, "Error processing read %s.", bam_get_qname(b));
+    check(hts_idx_push(idx, b->core.tid, b->core.pos, bam_endpos(b), bgzf_tell(fp), !(b->core.flag & BAM_FUNMAP)) == 0,
+          "Error indexing read %s, is the input coordinate sorted?", bam_get_qname(b));
+  }
+  check(ret == -1, "Error reading input file, truncated or corrupt record (%d).", ret);
+  hts_idx_finish(idx, bgzf_tell(fp));
+  check(hts_idx_save(idx, copy_file, HTS_FMT_BAI) == 0, "Error writing index '%s.bai'.", copy_file);
+  hts_idx_destroy(idx);
+  bam_access_rg_lookup_destroy(lookup);
+  bam_destroy1(b);
+  return 0;
+
+error:
+  if(idx) hts_idx_destroy(idx);
+  bam_access_rg_lookup_destroy(lookup);
+  if(b) bam_destroy1(b);
+  return -1;
+}
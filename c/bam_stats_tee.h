@@ -0,0 +1,41 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __bam_stats_tee_h__
+#define __bam_stats_tee_h__
+
+#include "bam_access.h"
+
+//Pass-through of the compressed input, copied byte for byte to a file/stdout by a
+//helper thread while the decoder reads the same buffers in-process through an hFILE backend.
+typedef struct bam_stats_tee_t bam_stats_tee_t;
+
+//Start copying input_file ("-" for stdin) to copy_file ("-" for stdout), md5 is computed over the copy when requested.
+bam_stats_tee_t *bam_stats_tee_start(char *input_file, char *copy_file, int md5);
+
+//htsFile decoding the bytes being copied
+htsFile *bam_stats_tee_input(bam_stats_tee_t *tee);
+
+//Waits for the copy to complete, writes the md5 hex digest to md5_file if given and frees tee.
+int bam_stats_tee_finish(bam_stats_tee_t *tee, char *md5_file);
+
+//Sequential stats pass that also writes copy_file.bai, virtual offsets of the decoded stream match the copy exactly.
+int bam_stats_tee_process_reads(htsFile *input, bam_hdr_t *head, rg_info_t **grps, int grps_size, stats_rd_t ****grp_stats, int opts, char *copy_file);
+
+#endif
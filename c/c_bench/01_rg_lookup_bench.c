@@ -0,0 +1,126 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+//Per record cost of read group dispatch against the number of @RG lines.
+//Compares the old linear prefix scan with two bam_aux_get calls against
+//the hashed lookup with a single aux walk.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bam_access.h"
+
+#define N_RECORDS 2000000
+#define N_DISTINCT 4096
+
+static int linear_rg_index(rg_info_t **grps, char *rg, int limit){
+  int i=0;
+  for(i=0;i<limit;i++){
+    if(strncmp(grps[i]->id,rg,strlen(grps[i]->id))==0) return i;
+  }
+  return -1;
+}
+
+//Record with typical bwa tags, RG last so both approaches walk the full aux block
+static bam1_t *make_record(const char *rg){
+  bam1_t *b = bam_init1();
+  uint8_t buf[256];
+  int l = 0;
+  memcpy(buf, "read", 5); l += 5;
+  b->core.l_qname = 5;
+  memcpy(buf+l, "NMC", 3); l += 3; buf[l++] = 2;
+  memcpy(buf+l, "MDZ", 3); l += 3; memcpy(buf+l, "50A49", 6); l += 6;
+  memcpy(buf+l, "ASi", 3); l += 3; int32_t as = 95; memcpy(buf+l, &as, 4); l += 4;
+  memcpy(buf+l, "XSi", 3); l += 3; int32_t xs = 20; memcpy(buf+l, &xs, 4); l += 4;
+  memcpy(buf+l, "RGZ", 3); l += 3; size_t rl = strlen(rg) + 1; memcpy(buf+l, rg, rl); l += rl;
+  b->data = (uint8_t *) realloc(b->data, l);
+  b->m_data = l;
+  b->l_data = l;
+  memcpy(b->data, buf, l);
+  return b;
+}
+
+static double now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(int n_grps, int shuffled){
+  rg_info_t **grps = (rg_info_t **) malloc(sizeof(rg_info_t *) * n_grps);
+  bam1_t **recs = (bam1_t **) malloc(sizeof(bam1_t *) * N_DISTINCT);
+  int i;
+  char id[32];
+  for(i=0;i<n_grps;i++){
+    grps[i] = (rg_info_t *) calloc(1, sizeof(rg_info_t));
+    //Fixed width ids so the linear scan's prefix match is exact here
+    snprintf(id, sizeof(id), "%06d", 100000 + i);
+    grps[i]->id = strdup(id);
+  }
+  //Sorted input: long runs of one RG. Shuffled input: RG changes every record.
+  srand(42);
+  for(i=0;i<N_DISTINCT;i++){
+    int g = shuffled ? rand() % n_grps : (int)((int64_t)i * n_grps / N_DISTINCT);
+    recs[i] = make_record(grps[g]->id);
+  }
+
+  volatile int64_t sink = 0;
+  double t = now();
+  for(i=0;i<N_RECORDS;i++){
+    bam1_t *b = recs[i % N_DISTINCT];
+    char *rg = bam_aux2Z(bam_aux_get(b,"RG"));
+    uint8_t *nm = bam_aux_get(b,"NM");
+    sink += linear_rg_index(grps, rg, n_grps) + bam_aux2i(nm);
+  }
+  double linear = (now() - t) * 1e9 / N_RECORDS;
+
+  rg_lookup_t *lookup = bam_access_rg_lookup_init(grps, n_grps);
+  t = now();
+  for(i=0;i<N_RECORDS;i++){
+    bam1_t *b = recs[i % N_DISTINCT];
+    char *rg;
+    uint8_t *nm;
+    bam_access_scan_aux(b, &rg, &nm);
+    sink += bam_access_rg_lookup_get(lookup, rg) + bam_aux2i(nm);
+  }
+  double hashed = (now() - t) * 1e9 / N_RECORDS;
+
+  printf("%d\t%s\t%.1f\t%.1f\n", n_grps, shuffled ? "shuffled" : "sorted", linear, hashed);
+
+  bam_access_rg_lookup_destroy(lookup);
+  for(i=0;i<N_DISTINCT;i++) bam_destroy1(recs[i]);
+  for(i=0;i<n_grps;i++){
+    free(grps[i]->id);
+    free(grps[i]);
+  }
+  free(recs);
+  free(grps);
+}
+
+int main(int argc, char *argv[]){
+  int sizes[] = {1, 10, 50, 200, 1000};
+  int i;
+  printf("read_groups\torder\tlinear_ns_per_record\thashed_ns_per_record\n");
+  for(i=0;i<5;i++){
+    run(sizes[i], 0);
+    run(sizes[i], 1);
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+//Per record cost of each G/C count and mapped base implementation, and of the per cycle update, on 150bp reads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bam_stats_kernels.h"
+
+#define N_RECORDS 5000000
+#define READ_LEN 150
+#define N_DISTINCT 1024
+
+static const char *impl_names[] = {"scalar", "lut", "ssse3", "avx2"};
+
+static double now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]){
+  static uint8_t seqs[N_DISTINCT][(READ_LEN+1)/2];
+  static uint32_t cigars[N_DISTINCT][4];
+  static uint8_t quals[N_DISTINCT][READ_LEN];
+  static uint8_t staged[CYCLE_STAGED_ROWS*((READ_LEN+CYCLE_STRIDE_ALIGN-1)/CYCLE_STRIDE_ALIGN*CYCLE_STRIDE_ALIGN)];
+  const uint8_t nt[] = {1, 2, 4, 8};
+  int i, j, impl;
+  srand(42);
+  for(i=0;i<N_DISTINCT;i++){
+    for(j=0;j<(READ_LEN+1)/2;j++) seqs[i][j] = nt[rand()%4] << 4 | nt[rand()%4];
+    for(j=0;j<READ_LEN;j++) quals[i][j] = 2 + rand()%40;
+    //Typical soft clipped alignment with an indel, 20S100M1I29M
+    cigars[i][0] = 20<<4|4;
+    cigars[i][1] = 100<<4|0;
+    cigars[i][2] = 1<<4|1;
+    cigars[i][3] = 29<<4|0;
+  }
+  volatile uint64_t sink = 0;
+  printf("kernel\timpl\tns_per_record\n");
+  for(impl=0;impl<KERNEL_IMPL_COUNT;impl++){
+    gc_count_fn fn = bam_stats_kernels_gc_impl(impl);
+    if(fn == NULL) continue;
+    double t = now();
+    for(i=0;i<N_RECORDS;i++) sink += fn(seqs[i % N_DISTINCT], READ_LEN);
+    printf("gc\t%s\t%.2f\n", impl_names[impl], (now() - t) * 1e9 / N_RECORDS);
+  }
+  for(impl=0;impl<KERNEL_IMPL_COUNT;impl++){
+    mapped_bases_fn fn = bam_stats_kernels_mapped_bases_impl(impl);
+    if(fn == NULL) continue;
+    double t = now();
+    for(i=0;i<N_RECORDS;i++) sink += fn(cigars[i % N_DISTINCT], 4);
+    printf("mapped_bases\t%s\t%.2f\n", impl_names[impl], (now() - t) * 1e9 / N_RECORDS);
+  }
+  int stride = (READ_LEN+CYCLE_STRIDE_ALIGN-1)/CYCLE_STRIDE_ALIGN*CYCLE_STRIDE_ALIGN;
+  for(impl=0;impl<KERNEL_IMPL_COUNT;impl++){
+    cycle_update_fn fn = bam_stats_kernels_cycle_impl(impl);
+    if(fn == NULL) continue;
+    double t = now();
+    //Byte counters wrap, fine for timing
+    for(i=0;i<N_RECORDS;i++) fn(seqs[i % N_DISTINCT], quals[i % N_DISTINCT], READ_LEN, i & 1, staged, stride);
+    printf("cycle_update\t%s\t%.2f\n", impl_names[impl], (now() - t) * 1e9 / N_RECORDS);
+  }
+  sink += staged[0];
+  return 0;
+}
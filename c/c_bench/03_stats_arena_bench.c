@@ -0,0 +1,132 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+//Per record cost of bam_access_process_read against the number of read groups, records in shuffled RG order
+//so every update lands on a different [rg][end] entry. Also run with a replica per thread to show
+//whether workers counting into their own stats slow each other down.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "bam_access.h"
+
+#define N_RECORDS 4000000
+#define N_DISTINCT 4096
+#define READ_LEN 150
+#define N_THREADS 4
+
+//Mapped proper pair, 150M, RG and NM tags
+static bam1_t *make_record(const char *rg, int read1){
+  bam1_t *b = bam_init1();
+  size_t rl = strlen(rg) + 1;
+  int l = 5 + 4 + (READ_LEN + 1) / 2 + READ_LEN + 3 + rl + 4;
+  b->data = (uint8_t *) calloc(1, l);
+  b->m_data = l;
+  b->l_data = l;
+  uint8_t *p = b->data;
+  memcpy(p, "read", 5); p += 5;
+  uint32_t cigar = READ_LEN << BAM_CIGAR_SHIFT | BAM_CMATCH;
+  memcpy(p, &cigar, 4); p += 4;
+  int i;
+  for(i=0;i<(READ_LEN + 1) / 2;i++) *p++ = (i & 1) ? 0x12 : 0x48; //AC / GT
+  for(i=0;i<READ_LEN;i++) *p++ = 30;
+  memcpy(p, "RGZ", 3); p += 3; memcpy(p, rg, rl); p += rl;
+  memcpy(p, "NMC", 3); p += 3; *p++ = 2;
+  b->core.l_qname = 5;
+  b->core.n_cigar = 1;
+  b->core.l_qseq = READ_LEN;
+  b->core.flag = BAM_FPAIRED | BAM_FPROPER_PAIR | (read1 ? BAM_FREAD1 : BAM_FREAD2);
+  b->core.isize = 300 + rand() % 200;
+  return b;
+}
+
+static double now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  rg_info_t **grps;
+  int n_grps;
+  bam1_t **recs;
+  stats_rd_t ***stats;
+} bench_t;
+
+static void *count(void *data){
+  bench_t *bench = (bench_t *) data;
+  rg_lookup_t *lookup = bam_access_rg_lookup_init(bench->grps, bench->n_grps);
+  int i;
+  for(i=0;i<N_RECORDS;i++) bam_access_process_read(bench->recs[i % N_DISTINCT], lookup, bench->stats, BAM_ACCESS_NO_GC);
+  bam_access_rg_lookup_destroy(lookup);
+  return NULL;
+}
+
+static void run(int n_grps){
+  rg_info_t **grps = (rg_info_t **) malloc(sizeof(rg_info_t *) * n_grps);
+  bam1_t **recs = (bam1_t **) malloc(sizeof(bam1_t *) * N_DISTINCT);
+  int i;
+  char id[32];
+  for(i=0;i<n_grps;i++){
+    grps[i] = (rg_info_t *) calloc(1, sizeof(rg_info_t));
+    snprintf(id, sizeof(id), "%06d", 100000 + i);
+    grps[i]->id = strdup(id);
+  }
+  srand(42);
+  for(i=0;i<N_DISTINCT;i++) recs[i] = make_record(grps[rand() % n_grps]->id, i & 1);
+
+  bench_t bench[N_THREADS];
+  for(i=0;i<N_THREADS;i++){
+    bench[i].grps = grps;
+    bench[i].n_grps = n_grps;
+    bench[i].recs = recs;
+    bench[i].stats = bam_access_init_stats(n_grps);
+  }
+  double t = now();
+  count(&bench[0]);
+  double single = (now() - t) * 1e9 / N_RECORDS;
+
+  pthread_t threads[N_THREADS];
+  t = now();
+  for(i=0;i<N_THREADS;i++) pthread_create(&threads[i], NULL, count, &bench[i]);
+  for(i=0;i<N_THREADS;i++) pthread_join(threads[i], NULL);
+  double threaded = (now() - t) * 1e9 / N_RECORDS;
+
+  printf("%d\t%.1f\t%.1f\n", n_grps, single, threaded);
+
+  for(i=0;i<N_THREADS;i++) bam_access_destroy_stats(bench[i].stats, n_grps);
+  for(i=0;i<N_DISTINCT;i++) bam_destroy1(recs[i]);
+  for(i=0;i<n_grps;i++){
+    free(grps[i]->id);
+    free(grps[i]);
+  }
+  free(recs);
+  free(grps);
+}
+
+int main(int argc, char *argv[]){
+  int sizes[] = {1, 16, 256, 4096};
+  int i;
+  printf("read_groups\tns_per_record\tns_per_record_%d_threads\n", N_THREADS);
+  for(i=0;i<4;i++) run(sizes[i]);
+  return 0;
+}
@@ -0,0 +1,92 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+//bam_stats wall time against the size of the decompression thread pool (-@), reading the whole of
+//BENCH_BAM (or the first argument) each time. The default test file is far too small to show scaling,
+//point it at a production sized BAM/CRAM on a machine with at least 16 free cores.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "htslib/thread_pool.h"
+#include "bam_access.h"
+
+#define DEFAULT_BAM "../t/data/Stats.bam"
+
+static double now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Seconds for one full pass with n pool threads, 0 for no pool, negative on error
+static double run(const char *file, int n){
+  htsThreadPool pool = {NULL, 0};
+  htsFile *input = hts_open(file, "r");
+  if(input == NULL) return -1;
+  if(n > 0){
+    pool.pool = hts_tpool_init(n);
+    if(pool.pool == NULL || hts_set_opt(input, HTS_OPT_THREAD_POOL, &pool) != 0) return -1;
+  }
+  double t = now();
+  bam_hdr_t *head = sam_hdr_read(input);
+  int grps_size = 0;
+  stats_rd_t ***grp_stats = NULL;
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  int chk = bam_access_process_reads(input, head, grps, grps_size, &grp_stats, 0);
+  t = now() - t;
+  bam_access_destroy_stats(grp_stats, grps_size);
+  bam_access_destroy_groups(grps, grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  if(pool.pool) hts_tpool_destroy(pool.pool);
+  return chk == 0 ? t : -1;
+}
+
+int main(int argc, char *argv[]){
+  const char *file = argc > 1 ? argv[1] : getenv("BENCH_BAM");
+  if(file == NULL) file = DEFAULT_BAM;
+  int threads[] = {0, 1, 2, 4, 8, 16};
+  int i;
+  double times[6];
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  printf("%s\n%ld online cores, htslib %s\nthreads\tseconds\tspeedup\n", file, cores, hts_version());
+  //Untimed pass first so the no pool baseline doesn't also pay for a cold page cache
+  double base = run(file, 0);
+  if(base >= 0) base = run(file, 0);
+  if(base < 0){
+    fprintf(stderr, "Error reading %s\n", file);
+    return 1;
+  }
+  for(i=0;i<6;i++){
+    double t = i == 0 ? base : run(file, threads[i]);
+    if(t < 0){
+      fprintf(stderr, "Error reading %s with %d threads\n", file, threads[i]);
+      return 1;
+    }
+    //The pool can't outrun the cores it has, such rows say nothing about scaling
+    printf("%d\t%.3f\t%.2f%s\n", threads[i], t, base / t, threads[i] > cores ? "\t(more threads than cores)" : "");
+    times[i] = t;
+  }
+  //One line per run for recording against the -@ entry in CHANGES.md
+  printf("\n  * -@ scaling, %ld cores:", cores);
+  for(i=1;i<6;i++) printf(" %d %.2fx%s", threads[i], base / times[i], i < 5 ? "," : "\n");
+  return 0;
+}
@@ -18,6 +18,7 @@
 *#########LICENCE#########*/
 
 #include	<unistd.h>
+#include <inttypes.h>
 #include "minunit.h"
 #include "bam_stats_output.h"
 
@@ -55,13 +56,13 @@ char *bam_stats_output_print_results_test_file(){
   int grps_size;
   stats_rd_t*** grp_stats;
   char *output_file = NULL;
-  int res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file);
+  int res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file,0);
   if(res != -1){
     sprintf(err,"Should have encountered an error for bad output file.");
     return err;
   }
   output_file = "/cantwritehere/reallycant";
-  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file);
+  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file,0);
   if(res != -1){
     sprintf(err,"Should have encountered an error for bad output file.");
     return err;
@@ -97,7 +98,7 @@ char *bam_stats_output_print_results_test_file(){
     return err;
   }
   output_file  = "../t/data/test_out.bam.bas";
-  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file);
+  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file,0);
 
   //Check test file is equal to expected
   if(compare_files(exp_file,output_file) != 0){
@@ -117,13 +118,13 @@ char *bam_stats_output_print_results_test_stdout(){
   int grps_size;
   stats_rd_t*** grp_stats;
   char *output_file = NULL;
-  int res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file);
+  int res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file,0);
   if(res != -1){
     sprintf(err,"Should have encountered an error for bad output file.");
     return err;
   }
   output_file = "/cantwritehere/reallycant";
-  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file);
+  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file,0);
   if(res != -1){
     sprintf(err,"Should have encountered an error for bad output file.");
     return err;
@@ -166,7 +167,7 @@ char *bam_stats_output_print_results_test_stdout(){
   if(frp == NULL){
     sprintf(err,"Error reassigning stdout to file %s\n",output_file);
   }
-  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file);
+  res = bam_stats_output_print_results(grps, grps_size,grp_stats,input_file,output_file,0);
   frp = freopen("/dev/stdout", "w", stdout);
   //Check test file is equal to expected
   if(compare_files(exp_file,output_file) != 0){
@@ -180,10 +181,69 @@ char *bam_stats_output_print_results_test_stdout(){
   return NULL;
 }
 
+char *bam_stats_output_print_qc_test(){
+  rg_info_t **grps = NULL;
+  int grps_size = 0;
+  stats_rd_t*** grp_stats;
+  htsFile *input = hts_open(input_file,"r");
+  if(input==NULL){
+    snprintf(err,sizeof(err),"Error opening hts file for reading '%s'.\n",input_file);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  if(bam_access_process_reads(input,head,grps, grps_size, &grp_stats, BAM_ACCESS_QC) != 0){
+    snprintf(err,sizeof(err),"Error processing reads in bam file.\n");
+    return err;
+  }
+  char *output_file = "../t/data/test_out.bam.qc";
+  if(bam_stats_output_print_qc(grps, grps_size, grp_stats, head, output_file) != 0){
+    snprintf(err,sizeof(err),"Error writing QC output.\n");
+    return err;
+  }
+  //Contig lines sum to the mapped reads of the .bas
+  uint64_t exp_mapped = 0;
+  int i=0;
+  for(i=0;i<grps_size;i++) exp_mapped += grp_stats[i][0]->count - grp_stats[i][0]->umap + grp_stats[i][1]->count - grp_stats[i][1]->umap;
+  FILE *fp = fopen(output_file, "r");
+  char line[500];
+  char rg[100], metric[100], key[100];
+  int rd = 0;
+  uint64_t count = 0, mapped = 0;
+  if(fgets(line, 500, fp) == NULL || strcmp(line, "readgroup\tread\tmetric\tkey\tcount\n") != 0){
+    snprintf(err,sizeof(err),"QC header not written.\n");
+    return err;
+  }
+  while(fgets(line, 500, fp) != NULL){
+    if(sscanf(line, "%99s\t%d\t%99s\t%99s\t%"SCNu64, rg, &rd, metric, key, &count) != 5){
+      snprintf(err,sizeof(err),"Malformed QC line '%.60s'.\n",line);
+      return err;
+    }
+    if(strcmp(metric, "contig_mapped") == 0){
+      if(bam_name2id(head, key) < 0){
+        snprintf(err,sizeof(err),"Contig '%.60s' is not in the header.\n",key);
+        return err;
+      }
+      mapped += count;
+    }
+  }
+  fclose(fp);
+  unlink(output_file);
+  if(mapped != exp_mapped || mapped == 0){
+    snprintf(err,sizeof(err),"Expected %"PRIu64" mapped reads over contigs got %"PRIu64".\n",exp_mapped,mapped);
+    return err;
+  }
+  bam_access_destroy_stats(grp_stats, grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
 char *all_tests() {
    mu_suite_start();
    mu_run_test(bam_stats_output_print_results_test_file);
    mu_run_test(bam_stats_output_print_results_test_stdout);
+   mu_run_test(bam_stats_output_print_qc_test);
    return NULL;
 }
 
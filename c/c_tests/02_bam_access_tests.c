@@ -18,6 +18,7 @@
 *#########LICENCE#########*/
 
 #include <inttypes.h>
+#include <stddef.h>
 #include "minunit.h"
 #include "bam_access.h"
 
@@ -112,6 +113,40 @@ char *test_bam_access_parse_header(){
 	return NULL;
 }
 
+char *test_bam_access_init_stats_arena(){
+  //Counters updated for every record in the first line, read 1 pair counters in the second
+  if(offsetof(stats_rd_t, length) >= STATS_CACHE_LINE || offsetof(stats_rd_t, proper) != STATS_CACHE_LINE
+      || offsetof(stats_rd_t, inter_chr_pairs) >= 2 * STATS_CACHE_LINE){
+    sprintf(err,"Stats counters not laid out by cache line\n");
+    return err;
+  }
+  stats_rd_t ***grp_stats = bam_access_init_stats(3);
+  int j=0, rd=0;
+  for(j=0;j<3;j++){
+    for(rd=0;rd<2;rd++){
+      stats_rd_t *st = grp_stats[j][rd];
+      if(st != bam_access_stats_entry(grp_stats, j, rd) || (uintptr_t)st % STATS_CACHE_LINE != 0){
+        sprintf(err,"Entry %d/%d is not at its aligned arena position\n",j,rd);
+        return err;
+      }
+    }
+  }
+  grp_stats[2][1]->count = 7;
+  bam_access_insert_hist_add(&grp_stats[2][1]->inserts, 300, 2);
+  //Growing keeps counts and histograms, new read groups start empty
+  if(bam_access_grow_stats(&grp_stats, 3, 5) != 0){
+    sprintf(err,"Error growing stats\n");
+    return err;
+  }
+  if(grp_stats[2][1]->count != 7 || bam_access_insert_hist_get(&grp_stats[2][1]->inserts, 300) != 2
+      || grp_stats[4][1]->count != 0 || grp_stats[4][1] != bam_access_stats_entry(grp_stats, 4, 1)){
+    sprintf(err,"Stats not carried over when growing\n");
+    return err;
+  }
+  bam_access_destroy_stats(grp_stats, 5);
+  return NULL;
+}
+
 char *test_bam_access_get_mapped_base_count_from_cigar(){
   htsFile *input;
   bam_hdr_t *head;
@@ -165,6 +200,72 @@ char *test_bam_access_get_mapped_base_count_from_cigar(){
 	return NULL;
 }
 
+char *test_bam_access_rg_lookup(){
+  rg_info_t *grps[3];
+  rg_info_t a = {"29976",NULL,NULL,NULL,NULL};
+  rg_info_t b = {"299",NULL,NULL,NULL,NULL};
+  rg_info_t c = {"29976",NULL,NULL,NULL,NULL};
+  grps[0] = &a; grps[1] = &b; grps[2] = &c;
+  rg_lookup_t *lookup = bam_access_rg_lookup_init(grps, 3);
+  if(lookup == NULL){
+    sprintf(err,"Error building read group lookup\n");
+    return err;
+  }
+  //Exact matches only, no prefix matching
+  if(bam_access_rg_lookup_get(lookup, "299") != 1){
+    sprintf(err,"Expected @RG 299 at index 1\n");
+    return err;
+  }
+  //Duplicated IDs go to the first occurrence, also when served from the last hit cache
+  if(bam_access_rg_lookup_get(lookup, "29976") != 0 || bam_access_rg_lookup_get(lookup, "29976") != 0){
+    sprintf(err,"Expected @RG 29976 at index 0\n");
+    return err;
+  }
+  if(bam_access_rg_lookup_get(lookup, "2997") != -1 || bam_access_rg_lookup_get(lookup, "29976x") != -1){
+    sprintf(err,"Unexpected match for unknown @RG\n");
+    return err;
+  }
+  bam_access_rg_lookup_destroy(lookup);
+  return NULL;
+}
+
+char *test_bam_access_scan_aux(){
+  bam_hdr_t *head;
+  kstring_t str = {0,0,0};
+  char *sample_sam = "IL29_5178:2:54:17473:17010	579	1	9993	0	20M	=	9993	100	CTCTTCCGATCTTTAGGGTT	;\?;\?\?>>>>F<BBDEBEEFF	XA:A:x	AS:i:1000	MD:Z:20	NM:i:3	XT:A:U	RG:Z:29978";
+  kputs(sample_sam,&str);
+  htsFile *input = hts_open(test_bam,"r");
+  if (input == NULL){
+    sprintf(err,"Error opening bam file %s\n",test_bam);
+    return err;
+  }
+  head = sam_hdr_read(input);
+  bam1_t *b = bam_init1();
+  if(sam_parse1(&str,head,b)<0){
+    sprintf(err,"Error parsing sam record\n");
+    return err;
+  }
+  char *rg = NULL;
+  uint8_t *nm = NULL;
+  if(bam_access_scan_aux(b, &rg, &nm) != 0){
+    sprintf(err,"Error scanning aux data\n");
+    return err;
+  }
+  if(rg == NULL || strcmp(rg, "29978") != 0){
+    sprintf(err,"Expected RG 29978 got %s\n", rg ? rg : "NULL");
+    return err;
+  }
+  if(nm == NULL || bam_aux2i(nm) != 3){
+    sprintf(err,"Expected NM 3\n");
+    return err;
+  }
+  bam_destroy1(b);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  free(str.s);
+  return NULL;
+}
+
 char *test_bam_access_process_reads_no_rna(){
   htsFile *input;
 	bam_hdr_t *head;
@@ -404,12 +505,164 @@ char *test_bam_access_process_reads_rna(){ // rna flag in this method includes s
 }
 
 
+char *test_bam_access_process_reads_no_gc(){
+	int grps_size = 0;
+	stats_rd_t*** grp_stats;
+  htsFile *input = hts_open(test_bam,"r");
+  if (input == NULL){
+    sprintf(err,"Error opening bam file %s\n",test_bam);
+    return err;
+  }
+  if(bam_access_set_cram_fields(input, BAM_ACCESS_NO_GC) != 0){
+    sprintf(err,"Error restricting decoded fields of %s\n",test_bam);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  if(bam_access_process_reads(input, head, grps, grps_size, &grp_stats, BAM_ACCESS_NO_GC) != 0){
+    sprintf(err,"Error processing reads in bam file, no G/C.\n");
+    return err;
+  }
+  if(grp_stats[0][0]->gc != 0 || grp_stats[1][1]->gc != 0){
+    sprintf(err,"G/C counted when disabled.\n");
+    return err;
+  }
+  //Everything else is unaffected
+  if(grp_stats[0][0]->count != exp_rg1_rd1_tot_count || grp_stats[0][0]->divergent != exp_rg1_rd1_divergent
+      || grp_stats[0][0]->mapped_bases != exp_rg1_rd1_mapped_bases || grp_stats[0][0]->length != exp_rd_length){
+    sprintf(err,"RG 1, read_1 counters changed when G/C disabled.\n");
+    return err;
+  }
+  bam_access_destroy_stats(grp_stats, grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+	return NULL;
+}
+
+static uint64_t count_hist_total(count_hist_t *hist){
+  uint64_t total = 0;
+  uint32_t i=0;
+  for(i=0;i<hist->size;i++) total += hist->counts[i];
+  return total;
+}
+
+char *test_bam_access_process_reads_qc(){
+	int grps_size = 0;
+	stats_rd_t*** grp_stats;
+  htsFile *input = hts_open(test_bam,"r");
+  if (input == NULL){
+    sprintf(err,"Error opening bam file %s\n",test_bam);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  if(bam_access_process_reads(input, head, grps, grps_size, &grp_stats, BAM_ACCESS_QC) != 0){
+    sprintf(err,"Error processing reads in bam file, extended QC.\n");
+    return err;
+  }
+  int i=0;
+  for(i=0;i<grps_size;i++){
+    int rd=0;
+    for(rd=0;rd<2;rd++){
+      stats_rd_t *st = grp_stats[i][rd];
+      uint64_t mapped = st->count - st->umap;
+      //Every counted read is on a contig or unplaced, every mapped read has a MAPQ and clip length
+      if(count_hist_total(&st->qc.mapped) != mapped || count_hist_total(&st->qc.unmapped) + st->qc.no_coor != st->umap
+          || count_hist_total(&st->qc.mapq) != mapped || count_hist_total(&st->qc.soft_clip) != mapped
+          || count_hist_total(&st->qc.hard_clip) != mapped){
+        sprintf(err,"RG %s read_%d extended QC totals don't match the read counts.\n",grps[i]->id,rd+1);
+        return err;
+      }
+    }
+  }
+  if(grp_stats[0][0]->qc.mapped.size == 0){
+    sprintf(err,"No contig counts collected.\n");
+    return err;
+  }
+  //Merging doubles, unaffected by the other stats
+  stats_rd_t ***copy = bam_access_init_stats(grps_size);
+  if(bam_access_merge_stats(copy, grp_stats, grps_size) != 0 || bam_access_merge_stats(copy, grp_stats, grps_size) != 0){
+    sprintf(err,"Error merging extended QC.\n");
+    return err;
+  }
+  if(count_hist_total(&copy[0][0]->qc.mapq) != 2*count_hist_total(&grp_stats[0][0]->qc.mapq)
+      || copy[0][0]->qc.no_coor != 2*grp_stats[0][0]->qc.no_coor){
+    sprintf(err,"Extended QC not doubled by merge.\n");
+    return err;
+  }
+  bam_access_destroy_stats(copy, grps_size);
+  bam_access_destroy_stats(grp_stats, grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+	return NULL;
+}
+
+char *test_bam_access_index_counts(){
+  char *indexed_bam = "../t/data/coverage.bam";
+  htsFile *input = hts_open(indexed_bam,"r");
+  if (input == NULL){
+    sprintf(err,"Error opening bam file %s\n",indexed_bam);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, indexed_bam);
+  if(idx == NULL){
+    sprintf(err,"Error loading index of %s\n",indexed_bam);
+    return err;
+  }
+  qc_hist_t counts;
+  memset(&counts, 0, sizeof(qc_hist_t));
+  if(bam_access_index_counts(idx, head, &counts) != 0){
+    sprintf(err,"Error reading counts from index.\n");
+    return err;
+  }
+  //Index counts every record, whatever its flags
+  qc_hist_t exp;
+  memset(&exp, 0, sizeof(qc_hist_t));
+  bam1_t *b = bam_init1();
+  while(sam_read1(input, head, b) >= 0){
+    if(b->core.tid < 0){
+      exp.no_coor++;
+    }else{
+      bam_access_count_hist_add(b->core.flag & BAM_FUNMAP ? &exp.unmapped : &exp.mapped, b->core.tid, 1);
+    }
+  }
+  int tid=0;
+  for(tid=0;tid<head->n_targets;tid++){
+    uint64_t got_mapped = (uint32_t)tid < counts.mapped.size ? counts.mapped.counts[tid] : 0;
+    uint64_t exp_mapped = (uint32_t)tid < exp.mapped.size ? exp.mapped.counts[tid] : 0;
+    uint64_t got_unmapped = (uint32_t)tid < counts.unmapped.size ? counts.unmapped.counts[tid] : 0;
+    uint64_t exp_unmapped = (uint32_t)tid < exp.unmapped.size ? exp.unmapped.counts[tid] : 0;
+    if(got_mapped != exp_mapped || got_unmapped != exp_unmapped){
+      sprintf(err,"Index counts for %s don't match the reads.\n",head->target_name[tid]);
+      return err;
+    }
+  }
+  if(counts.no_coor != exp.no_coor || counts.mapped.size == 0){
+    sprintf(err,"Index unplaced count doesn't match the reads.\n");
+    return err;
+  }
+  bam_destroy1(b);
+  bam_access_qc_destroy(&counts);
+  bam_access_qc_destroy(&exp);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
 char *all_tests() {
    mu_suite_start();
    mu_run_test(test_bam_access_parse_header);
+   mu_run_test(test_bam_access_init_stats_arena);
    mu_run_test(test_bam_access_get_mapped_base_count_from_cigar);
+   mu_run_test(test_bam_access_rg_lookup);
+   mu_run_test(test_bam_access_scan_aux);
    mu_run_test(test_bam_access_process_reads_no_rna);
    mu_run_test(test_bam_access_process_reads_rna);
+   mu_run_test(test_bam_access_process_reads_no_gc);
+   mu_run_test(test_bam_access_process_reads_qc);
+   mu_run_test(test_bam_access_index_counts);
    return NULL;
 }
 
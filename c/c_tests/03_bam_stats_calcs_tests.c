@@ -18,12 +18,9 @@
 *#########LICENCE#########*/
 
 #include <inttypes.h>
+#include <math.h>
 #include "minunit.h"
 #include "bam_stats_calcs.h"
-#include "khash.h"
-
-KHASH_MAP_INIT_INT(insert,uint64_t)
-//KHASH_INIT2(ins,, khint32_t, uint64_t, 1, kh_int_hash_func, kh_int_hash_equal)
 
 double exp_mean = 150;
 double exp_sd = 50;
@@ -31,20 +28,15 @@ double exp_median = 150;
 char err[100];
 
 char *bam_stats_calcs_calculate_mean_sd_median_insert_size_test(){
-  int res;
-  khash_t(ins) *inserts;
-  inserts = kh_init(ins);
-  khint_t k;
-  k = kh_put(ins,inserts,abs(200),&res);
-  kh_value(inserts,k) = 50;
-  k = kh_put(ins,inserts,abs(100),&res);
-  kh_value(inserts,k) = 50;
+  insert_hist_t inserts = {0};
+  bam_access_insert_hist_add(&inserts,abs(200),50);
+  bam_access_insert_hist_add(&inserts,abs(100),50);
 
   double mean;
   double sd;
   double median;
 
-  int check = bam_stats_calcs_calculate_mean_sd_median_insert_size(inserts, &mean, &sd, &median);
+  int check = bam_stats_calcs_calculate_mean_sd_median_insert_size(&inserts, &mean, &sd, &median);
   if(check != 0) {
     sprintf(err,"Calculation failed to complete\n");
     return err;
@@ -62,15 +54,89 @@ char *bam_stats_calcs_calculate_mean_sd_median_insert_size_test(){
     sprintf(err,"median from calculation %f is not as expected %f\n",median,exp_median);
     return err;
   }
+  bam_access_insert_hist_destroy(&inserts);
+  return NULL;
+}
+
+char *bam_stats_calcs_calculate_insert_size_overflow_test(){
+  //Median and SD sweep across the dense range and the long insert tail
+  insert_hist_t inserts = {0};
+  bam_access_insert_hist_add(&inserts,300,3);
+  bam_access_insert_hist_add(&inserts,INSERT_DENSE_SIZE+700,1);
+  bam_access_insert_hist_add(&inserts,100,1);
+  bam_access_insert_hist_add(&inserts,INSERT_DENSE_SIZE+700,1);
+  bam_access_insert_hist_add(&inserts,20000,2);
 
+  double mean;
+  double sd;
+  double median;
+  int check = bam_stats_calcs_calculate_mean_sd_median_insert_size(&inserts, &mean, &sd, &median);
+  if(check != 0) {
+    sprintf(err,"Calculation failed to complete\n");
+    return err;
+  }
+  if(inserts.total != 8 || bam_access_insert_hist_get(&inserts,INSERT_DENSE_SIZE+700) != 2){
+    sprintf(err,"Unexpected histogram counts\n");
+    return err;
+  }
+  //Sizes 100,300,300,300,8892,8892,20000,20000
+  if(mean != 58784.0/8.0){
+    sprintf(err,"Mean from calculation %f is not as expected %f\n",mean,58784.0/8.0);
+    return err;
+  }
+  if(median != (300.0+8892.0)/2.0){
+    sprintf(err,"median from calculation %f is not as expected %f\n",median,(300.0+8892.0)/2.0);
+    return err;
+  }
+  if(fabs(sd - 8112.26) > 0.01){
+    sprintf(err,"SD from calculation %f is not as expected ~8112.26\n",sd);
+    return err;
+  }
+  bam_access_insert_hist_destroy(&inserts);
+  return NULL;
+}
 
+char *bam_stats_calcs_calculate_trimmed_insert_size_test(){
+  //Nothing outside the window, same as the untrimmed calculation
+  insert_hist_t inserts = {0};
+  bam_access_insert_hist_add(&inserts,200,50);
+  bam_access_insert_hist_add(&inserts,100,50);
+  double mean;
+  double sd;
+  double median;
+  if(bam_stats_calcs_calculate_trimmed_insert_size(&inserts, RNA_INSERT_SD, &mean, &sd, &median) != 0){
+    sprintf(err,"Trimmed calculation failed to complete\n");
+    return err;
+  }
+  if(fabs(mean - exp_mean) > 1e-9 || fabs(sd - exp_sd) > 1e-9 || median != exp_median){
+    sprintf(err,"Untrimmed window gave %f/%f/%f\n",mean,sd,median);
+    return err;
+  }
+  bam_access_insert_hist_destroy(&inserts);
 
+  //Spliced pairs spanning introns are removed over successive iterations
+  bam_access_insert_hist_add(&inserts,290,50);
+  bam_access_insert_hist_add(&inserts,300,100);
+  bam_access_insert_hist_add(&inserts,310,50);
+  bam_access_insert_hist_add(&inserts,100000,1);
+  bam_access_insert_hist_add(&inserts,5000000,1);
+  if(bam_stats_calcs_calculate_trimmed_insert_size(&inserts, RNA_INSERT_SD, &mean, &sd, &median) != 0){
+    sprintf(err,"Trimmed calculation failed to complete\n");
+    return err;
+  }
+  if(fabs(mean - 300) > 1e-9 || fabs(sd - sqrt(50)) > 1e-9 || median != 300){
+    sprintf(err,"Trimmed stats %f/%f/%f not 300/%f/300\n",mean,sd,median,sqrt(50));
+    return err;
+  }
+  bam_access_insert_hist_destroy(&inserts);
   return NULL;
 }
 
 char *all_tests() {
    mu_suite_start();
    mu_run_test(bam_stats_calcs_calculate_mean_sd_median_insert_size_test);
+   mu_run_test(bam_stats_calcs_calculate_insert_size_overflow_test);
+   mu_run_test(bam_stats_calcs_calculate_trimmed_insert_size_test);
    return NULL;
 }
 
@@ -0,0 +1,187 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+#include <inttypes.h>
+#include "minunit.h"
+#include "bam_access_parallel.h"
+
+char *test_indexed_bam = "../t/data/coverage.bam";
+char *test_stream_bam = "../t/data/Stats.bam";
+
+char err[200];
+
+char *compare_stats(stats_rd_t ***exp, stats_rd_t ***got, int grps_size){
+  int i=0;
+  for(i=0;i<grps_size;i++){
+    int rd=0;
+    for(rd=0;rd<2;rd++){
+      stats_rd_t *e = exp[i][rd];
+      stats_rd_t *g = got[i][rd];
+      if(e->length != g->length || e->count != g->count || e->dups != g->dups || e->gc != g->gc
+          || e->umap != g->umap || e->divergent != g->divergent || e->mapped_bases != g->mapped_bases
+          || e->proper != g->proper || e->mapped_pairs != g->mapped_pairs || e->inter_chr_pairs != g->inter_chr_pairs){
+        sprintf(err,"RG %d read_%d counters differ between sequential and sharded runs (count %"PRIu64" vs %"PRIu64").\n",i,rd+1,e->count,g->count);
+        return err;
+      }
+      if(e->inserts.total != g->inserts.total || e->inserts.sum != g->inserts.sum){
+        sprintf(err,"RG %d read_%d insert size totals differ between sequential and sharded runs.\n",i,rd+1);
+        return err;
+      }
+      uint32_t ins;
+      for(ins = 0; ins < INSERT_DENSE_SIZE; ins++){
+        if(bam_access_insert_hist_get(&e->inserts, ins) != bam_access_insert_hist_get(&g->inserts, ins)){
+          sprintf(err,"RG %d read_%d insert size %"PRIu32" count differs.\n",i,rd+1,ins);
+          return err;
+        }
+      }
+      if(e->inserts.overflow){
+        khint_t k;
+        for(k = kh_begin(e->inserts.overflow); k != kh_end(e->inserts.overflow); ++k){
+          if(!kh_exist(e->inserts.overflow, k)) continue;
+          if(bam_access_insert_hist_get(&g->inserts, kh_key(e->inserts.overflow, k)) != kh_value(e->inserts.overflow, k)){
+            sprintf(err,"RG %d read_%d insert size %"PRIu32" count differs.\n",i,rd+1,kh_key(e->inserts.overflow, k));
+            return err;
+          }
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+char *test_bam_access_parallel_plan_shards(){
+  htsFile *input = hts_open(test_indexed_bam,"r");
+  if(input == NULL){
+    sprintf(err,"Error opening bam file %s\n",test_indexed_bam);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, test_indexed_bam);
+  if(idx == NULL){
+    sprintf(err,"Error loading index for %s\n",test_indexed_bam);
+    return err;
+  }
+  int n_shards = 0;
+  shard_t *shards = bam_access_parallel_plan_shards(head, idx, 8, &n_shards);
+  if(shards == NULL || n_shards < 2){
+    sprintf(err,"Expected at least two shards, got %d\n",n_shards);
+    return err;
+  }
+  if(shards[n_shards-1].tid != HTS_IDX_NOCOOR){
+    sprintf(err,"Final shard should be the unplaced unmapped tail, got tid %d\n",shards[n_shards-1].tid);
+    return err;
+  }
+  int i=0;
+  for(i=1;i<n_shards-1;i++){
+    if(shards[i].tid == shards[i-1].tid && shards[i].beg != shards[i-1].end){
+      sprintf(err,"Shards %d and %d are not contiguous\n",i-1,i);
+      return err;
+    }
+  }
+  free(shards);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *test_bam_access_parallel_process_indexed(){
+  int grps_size = 0;
+  stats_rd_t ***exp_stats;
+  stats_rd_t ***got_stats;
+  htsFile *input = hts_open(test_indexed_bam,"r");
+  if(input == NULL){
+    sprintf(err,"Error opening bam file %s\n",test_indexed_bam);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &exp_stats);
+  if(bam_access_process_reads(input, head, grps, grps_size, &exp_stats, 0) != 0){
+    sprintf(err,"Error processing reads sequentially\n");
+    return err;
+  }
+  hts_idx_t *idx = sam_index_load(input, test_indexed_bam);
+  got_stats = bam_access_init_stats(grps_size);
+
+  int threads[] = {1, 2, 3};
+  int t=0;
+  for(t=0;t<3;t++){
+    bam_access_destroy_stats(got_stats, grps_size);
+    got_stats = bam_access_init_stats(grps_size);
+    if(bam_access_parallel_process_indexed(test_indexed_bam, NULL, head, idx, grps, grps_size, &got_stats, 0, threads[t]) != 0){
+      sprintf(err,"Error processing reads with %d shard workers\n",threads[t]);
+      return err;
+    }
+    char *res = compare_stats(exp_stats, got_stats, grps_size);
+    if(res) return res;
+  }
+  bam_access_destroy_stats(got_stats, grps_size);
+  bam_access_destroy_stats(exp_stats, grps_size);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *test_bam_access_parallel_process_stream(){
+  int grps_size = 0;
+  stats_rd_t ***exp_stats;
+  htsFile *input = hts_open(test_stream_bam,"r");
+  if(input == NULL){
+    sprintf(err,"Error opening bam file %s\n",test_stream_bam);
+    return err;
+  }
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &exp_stats);
+  if(bam_access_process_reads(input, head, grps, grps_size, &exp_stats, 0) != 0){
+    sprintf(err,"Error processing reads sequentially\n");
+    return err;
+  }
+  bam_hdr_destroy(head);
+  hts_close(input);
+
+  int threads[] = {1, 2, 3};
+  int t=0;
+  for(t=0;t<3;t++){
+    input = hts_open(test_stream_bam,"r");
+    head = sam_hdr_read(input);
+    stats_rd_t ***got_stats = bam_access_init_stats(grps_size);
+    if(bam_access_parallel_process_stream(input, head, grps, grps_size, &got_stats, 0, threads[t]) != 0){
+      sprintf(err,"Error processing reads with %d stream workers\n",threads[t]);
+      return err;
+    }
+    char *res = compare_stats(exp_stats, got_stats, grps_size);
+    if(res) return res;
+    bam_access_destroy_stats(got_stats, grps_size);
+    bam_hdr_destroy(head);
+    hts_close(input);
+  }
+  bam_access_destroy_stats(exp_stats, grps_size);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_access_parallel_plan_shards);
+   mu_run_test(test_bam_access_parallel_process_indexed);
+   mu_run_test(test_bam_access_parallel_process_stream);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
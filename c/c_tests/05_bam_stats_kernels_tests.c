@@ -0,0 +1,196 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "bam_stats_kernels.h"
+
+char err[200];
+
+char *test_bam_stats_kernels_gc_count_known(){
+  //ACGTN GGCC, packed two bases per byte with the final low nibble as padding
+  uint8_t seq[] = {0x12, 0x48, 0xf4, 0x42, 0x20};
+  uint64_t count = bam_stats_kernels_gc_count(seq, 9);
+  if(count != 6){
+    sprintf(err,"Expected 6 G/C bases got %"PRIu64"\n",count);
+    return err;
+  }
+  //Padding nibble mustn't be counted even if it isn't zero
+  seq[4] = 0x24;
+  count = bam_stats_kernels_gc_count(seq, 9);
+  if(count != 6){
+    sprintf(err,"Expected 6 G/C bases with dirty padding got %"PRIu64"\n",count);
+    return err;
+  }
+  return NULL;
+}
+
+char *test_bam_stats_kernels_gc_count_impls(){
+  uint8_t buf[512];
+  srand(5);
+  gc_count_fn scalar = bam_stats_kernels_gc_impl(KERNEL_SCALAR);
+  int impl=0;
+  for(impl=KERNEL_LUT;impl<KERNEL_IMPL_COUNT;impl++){
+    gc_count_fn fn = bam_stats_kernels_gc_impl(impl);
+    if(fn == NULL) continue; //Not available on this CPU
+    int len=0;
+    for(len=0;len<=800;len++){
+      int offset = rand() % 32; //Unaligned loads
+      int i=0;
+      for(i=0;i<(int)sizeof(buf);i++) buf[i] = rand();
+      uint64_t exp = scalar(buf+offset, len);
+      uint64_t got = fn(buf+offset, len);
+      if(exp != got){
+        sprintf(err,"G/C implementation %d gave %"PRIu64", scalar %"PRIu64" for length %d\n",impl,got,exp,len);
+        return err;
+      }
+    }
+  }
+  return NULL;
+}
+
+char *test_bam_stats_kernels_mapped_bases_impls(){
+  uint32_t cigar[80];
+  srand(7);
+  mapped_bases_fn scalar = bam_stats_kernels_mapped_bases_impl(KERNEL_SCALAR);
+  //5S10M2I3D5M3N7=1X2H
+  uint32_t known[] = {5<<4|4, 10<<4|0, 2<<4|1, 3<<4|2, 5<<4|0, 3<<4|3, 7<<4|7, 1<<4|8, 2<<4|5};
+  uint64_t count = bam_stats_kernels_mapped_bases(known, 9);
+  if(count != 25){
+    sprintf(err,"Expected 25 mapped bases got %"PRIu64"\n",count);
+    return err;
+  }
+  int impl=0;
+  for(impl=KERNEL_LUT;impl<KERNEL_IMPL_COUNT;impl++){
+    mapped_bases_fn fn = bam_stats_kernels_mapped_bases_impl(impl);
+    if(fn == NULL) continue;
+    int rep=0;
+    for(rep=0;rep<2000;rep++){
+      int n = rand() % 70;
+      int offset = rand() % 8;
+      int i=0;
+      for(i=0;i<n+offset;i++) cigar[i] = ((uint32_t)rand() % (1<<28)) << 4 | (rand() % 10);
+      uint64_t exp = scalar(cigar+offset, n);
+      uint64_t got = fn(cigar+offset, n);
+      if(exp != got){
+        sprintf(err,"Mapped bases implementation %d gave %"PRIu64", scalar %"PRIu64" for %d ops\n",impl,got,exp,n);
+        return err;
+      }
+    }
+  }
+  return NULL;
+}
+
+#define QROW(q,c) staged[(q)*CYCLE_STRIDE_ALIGN + (c)]
+#define BROW(b,c) staged[(CYCLE_QUALS + (b))*CYCLE_STRIDE_ALIGN + (c)]
+
+char *test_bam_stats_kernels_cycle_update(){
+  //ACGTN with qualities 10,20,30,40,70
+  uint8_t seq[] = {0x12, 0x48, 0xf0};
+  uint8_t qual[] = {10, 20, 30, 40, 70};
+  uint8_t staged[CYCLE_STAGED_ROWS*CYCLE_STRIDE_ALIGN] = {0};
+  bam_stats_kernels_cycle_update(seq, qual, 5, 0, staged, CYCLE_STRIDE_ALIGN);
+  int exp_base[] = {0, 1, 2, 3, 4};
+  int exp_qual[] = {10, 20, 30, 40, CYCLE_QUALS-1};
+  int i=0;
+  for(i=0;i<5;i++){
+    if(BROW(exp_base[i], i) != 1 || QROW(exp_qual[i], i) != 1){
+      sprintf(err,"Forward read cycle %d not counted as expected\n",i+1);
+      return err;
+    }
+  }
+  //Reverse strand, first cycle is the complement of the last stored base
+  bam_stats_kernels_cycle_update(seq, qual, 5, 1, staged, CYCLE_STRIDE_ALIGN);
+  int exp_rev_base[] = {4, 0, 1, 2, 3};
+  for(i=0;i<5;i++){
+    if(BROW(exp_rev_base[i], i) != 1 + (exp_rev_base[i] == exp_base[i]) || QROW(exp_qual[4-i], i) != 1 + (i == 2)){
+      sprintf(err,"Reverse read cycle %d not counted as expected\n",i+1);
+      return err;
+    }
+  }
+  //Missing qualities only count bases
+  qual[0] = 0xff;
+  bam_stats_kernels_cycle_update(seq, qual, 5, 0, staged, CYCLE_STRIDE_ALIGN);
+  int cycle1 = 0;
+  for(i=0;i<CYCLE_QUALS;i++) cycle1 += QROW(i, 0);
+  if(cycle1 != 2 || BROW(0, 0) != 2){
+    sprintf(err,"Missing qualities should not be counted\n");
+    return err;
+  }
+  //Nothing beyond the read
+  for(i=5;i<CYCLE_STRIDE_ALIGN;i++){
+    int row=0;
+    for(row=0;row<CYCLE_QUALS+CYCLE_BASES;row++){
+      if(staged[row*CYCLE_STRIDE_ALIGN + i]){
+        sprintf(err,"Counted past the end of the read at cycle %d\n",i+1);
+        return err;
+      }
+    }
+  }
+  return NULL;
+}
+
+char *test_bam_stats_kernels_cycle_update_impls(){
+  int stride = 256;
+  uint8_t *exp = calloc(CYCLE_STAGED_ROWS*stride, 1);
+  uint8_t *got = calloc(CYCLE_STAGED_ROWS*stride, 1);
+  uint8_t seq[128];
+  uint8_t qual[256];
+  srand(9);
+  cycle_update_fn scalar = bam_stats_kernels_cycle_impl(KERNEL_SCALAR);
+  int impl=0;
+  for(impl=KERNEL_LUT;impl<KERNEL_IMPL_COUNT;impl++){
+    cycle_update_fn fn = bam_stats_kernels_cycle_impl(impl);
+    if(fn == NULL) continue; //Not available on this CPU
+    memset(exp, 0, CYCLE_STAGED_ROWS*stride);
+    memset(got, 0, CYCLE_STAGED_ROWS*stride);
+    int rep=0;
+    for(rep=0;rep<200;rep++){
+      int len = rand() % (stride + 1);
+      int i=0;
+      for(i=0;i<(int)sizeof(seq);i++) seq[i] = rand();
+      for(i=0;i<(int)sizeof(qual);i++) qual[i] = rand() % 80;
+      if(rep % 10 == 0) qual[0] = 0xff;
+      scalar(seq, qual, len, rep & 1, exp, stride);
+      fn(seq, qual, len, rep & 1, got, stride);
+    }
+    if(memcmp(exp, got, (CYCLE_QUALS+CYCLE_BASES)*stride) != 0){
+      sprintf(err,"Per cycle implementation %d differs from scalar\n",impl);
+      return err;
+    }
+  }
+  free(exp);
+  free(got);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_stats_kernels_gc_count_known);
+   mu_run_test(test_bam_stats_kernels_gc_count_impls);
+   mu_run_test(test_bam_stats_kernels_mapped_bases_impls);
+   mu_run_test(test_bam_stats_kernels_cycle_update);
+   mu_run_test(test_bam_stats_kernels_cycle_update_impls);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
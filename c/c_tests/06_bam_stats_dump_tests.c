@@ -0,0 +1,252 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+#include <inttypes.h>
+#include <unistd.h>
+#include "minunit.h"
+#include "bam_stats_dump.h"
+
+char *test_bam = "../t/data/Stats.bam";
+char *perl_json = "{\".\":{\"head\":\"@RG\\tID:anon\\tLB:anon\\tSM:anon\"},"
+                  "\"29976\":{\"head\":\"@RG\\tID:29976\\tPL:ILLUMINA\\tPU:5178_6\\tLB:lib\\tSM:smp\",\"length_1\":100,"
+                  "\"count_1\":4,\"gc_1\":10,\"fqp_1\":[[1,2],[3]],\"mapped_pairs\":3,\"proper\":2,\"inserts\":{\"300\":1,\"20000\":1}}}";
+
+char err[200];
+
+static stats_rd_t ***read_stats(rg_info_t ***grps, int *grps_size, int opts){
+  stats_rd_t ***grp_stats = NULL;
+  htsFile *input = hts_open(test_bam,"r");
+  if(input == NULL) return NULL;
+  bam_hdr_t *head = sam_hdr_read(input);
+  *grps = bam_access_parse_header(head, grps_size, &grp_stats);
+  if(bam_access_process_reads(input, head, *grps, *grps_size, &grp_stats, opts) != 0) return NULL;
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return grp_stats;
+}
+
+char *test_bam_stats_dump_round_trip(){
+  int grps_size = 0;
+  rg_info_t **grps = NULL;
+  stats_rd_t ***exp = read_stats(&grps, &grps_size, BAM_ACCESS_CYCLES);
+  if(exp == NULL){
+    sprintf(err,"Error reading stats from %s\n",test_bam);
+    return err;
+  }
+  char dump[] = "/tmp/bam_stats_dump_XXXXXX";
+  int fd = mkstemp(dump);
+  close(fd);
+  if(bam_stats_dump_write(dump, test_bam, grps, grps_size, exp) != 0){
+    sprintf(err,"Error writing stats dump\n");
+    return err;
+  }
+
+  //Merging the same dump twice doubles every counter, lengths and @RG details carry through
+  rg_info_t **got_grps = NULL;
+  int got_size = 0;
+  stats_rd_t ***got = NULL;
+  char *bam_name = NULL;
+  int rep=0;
+  for(rep=0;rep<2;rep++){
+    if(bam_stats_dump_merge_file(dump, &got_grps, &got_size, &got, &bam_name) != 0){
+      sprintf(err,"Error merging stats dump\n");
+      return err;
+    }
+  }
+  unlink(dump);
+  if(got_size != grps_size || bam_name == NULL || strcmp(bam_name, "Stats.bam") != 0){
+    sprintf(err,"Expected %d read groups from Stats.bam got %d\n",grps_size,got_size);
+    return err;
+  }
+  int i=0;
+  for(i=0;i<grps_size;i++){
+    if(strcmp(grps[i]->id, got_grps[i]->id) != 0 || strcmp(grps[i]->platform_unit, got_grps[i]->platform_unit) != 0
+        || strcmp(grps[i]->sample, got_grps[i]->sample) != 0){
+      sprintf(err,"Read group %s details not restored\n",grps[i]->id);
+      return err;
+    }
+    int rd=0;
+    for(rd=0;rd<2;rd++){
+      stats_rd_t *e = exp[i][rd];
+      stats_rd_t *g = got[i][rd];
+      if(e->length != g->length || 2*e->count != g->count || 2*e->dups != g->dups || 2*e->gc != g->gc
+          || 2*e->umap != g->umap || 2*e->divergent != g->divergent || 2*e->mapped_bases != g->mapped_bases
+          || 2*e->proper != g->proper || 2*e->mapped_pairs != g->mapped_pairs || 2*e->inter_chr_pairs != g->inter_chr_pairs
+          || 2*e->inserts.total != g->inserts.total || 2*e->inserts.sum != g->inserts.sum){
+        sprintf(err,"RG %s read_%d counters not doubled by merge\n",grps[i]->id,rd+1);
+        return err;
+      }
+      bam_access_cycle_hist_flush(&e->cycles);
+      if(e->cycles.n_cycles != g->cycles.n_cycles){
+        sprintf(err,"RG %s read_%d has %"PRIu32" cycles after merge, expected %"PRIu32"\n",grps[i]->id,rd+1,g->cycles.n_cycles,e->cycles.n_cycles);
+        return err;
+      }
+      uint32_t c=0;
+      for(c=0;c<e->cycles.n_cycles*CYCLE_QUALS;c++){
+        if(2*e->cycles.quals[c] != g->cycles.quals[c] || (c < e->cycles.n_cycles*CYCLE_BASES && 2*e->cycles.bases[c] != g->cycles.bases[c])){
+          sprintf(err,"RG %s read_%d per cycle counts not doubled by merge\n",grps[i]->id,rd+1);
+          return err;
+        }
+      }
+    }
+  }
+  bam_access_destroy_stats(exp, grps_size);
+  bam_access_destroy_stats(got, got_size);
+  free(bam_name);
+  return NULL;
+}
+
+char *test_bam_stats_dump_merge_perl_json(){
+  char dump[] = "/tmp/bam_stats_dump_XXXXXX";
+  int fd = mkstemp(dump);
+  FILE *out = fdopen(fd, "w");
+  fputs(perl_json, out);
+  fclose(out);
+
+  rg_info_t **grps = NULL;
+  int grps_size = 0;
+  stats_rd_t ***grp_stats = NULL;
+  char *bam_name = NULL;
+  int chk = bam_stats_dump_merge_file(dump, &grps, &grps_size, &grp_stats, &bam_name);
+  unlink(dump);
+  if(chk != 0 || grps_size != 2){
+    sprintf(err,"Error merging PCAP::Bam::Stats json_stats output\n");
+    return err;
+  }
+  if(strcmp(grps[1]->id, "29976") != 0 || strcmp(grps[1]->platform, "ILLUMINA") != 0 || strcmp(grps[1]->lib, "lib") != 0){
+    sprintf(err,"Read group details not parsed from head\n");
+    return err;
+  }
+  stats_rd_t *st = grp_stats[1][0];
+  if(st->length != 100 || st->count != 4 || st->gc != 10 || st->proper != 2 || st->mapped_pairs != 3
+      || bam_access_insert_hist_get(&st->inserts, 300) != 1 || bam_access_insert_hist_get(&st->inserts, 20000) != 1){
+    sprintf(err,"Counters not read from json_stats output\n");
+    return err;
+  }
+  if(st->cycles.n_cycles != 2 || st->cycles.quals[0] != 1 || st->cycles.quals[1] != 2 || st->cycles.quals[CYCLE_QUALS] != 3){
+    sprintf(err,"Quality plot data not read from json_stats output\n");
+    return err;
+  }
+  if(grp_stats[0][0]->count != 0){
+    sprintf(err,"Anonymous group should be empty\n");
+    return err;
+  }
+  bam_access_destroy_stats(grp_stats, grps_size);
+  return NULL;
+}
+
+char *test_bam_stats_dump_merge_lengths(){
+  //Parts of one read group with no reads, then 100bp and 150bp reads, as lanes trimmed differently
+  char *parts[] = {
+    "{\"29976\":{\"head\":\"@RG\\tID:29976\\tLB:lib\\tSM:smp\"}}",
+    "{\"29976\":{\"head\":\"@RG\\tID:29976\\tLB:lib\\tSM:smp\",\"length_1\":100,\"count_1\":4}}",
+    "{\"29976\":{\"head\":\"@RG\\tID:29976\\tLB:lib\\tSM:smp\",\"length_1\":150,\"length_2\":150,\"count_1\":2,\"count_2\":2}}"
+  };
+  rg_info_t **grps = NULL;
+  int grps_size = 0;
+  stats_rd_t ***grp_stats = NULL;
+  char *bam_name = NULL;
+  int i=0;
+  for(i=0; i<3; i++){
+    char dump[] = "/tmp/bam_stats_dump_XXXXXX";
+    int fd = mkstemp(dump);
+    FILE *out = fdopen(fd, "w");
+    fputs(parts[i], out);
+    fclose(out);
+    int chk = bam_stats_dump_merge_file(dump, &grps, &grps_size, &grp_stats, &bam_name);
+    unlink(dump);
+    if(chk != 0){
+      sprintf(err,"Error merging dump %d with a different read length\n",i);
+      return err;
+    }
+  }
+  //The earliest dump with a length wins for each read
+  if(grps_size != 1 || grp_stats[0][0]->length != 100 || grp_stats[0][1]->length != 150){
+    sprintf(err,"Merged read lengths %"PRIu32"/%"PRIu32", expected 100/150\n",grp_stats[0][0]->length,grp_stats[0][1]->length);
+    return err;
+  }
+  if(grp_stats[0][0]->count != 6 || grp_stats[0][1]->count != 2){
+    sprintf(err,"Counters not summed across dumps with different read lengths\n");
+    return err;
+  }
+  bam_access_destroy_stats(grp_stats, grps_size);
+  return NULL;
+}
+
+char *test_bam_stats_dump_checkpoint(){
+  int grps_size = 0;
+  rg_info_t **grps = NULL;
+  stats_rd_t ***exp = read_stats(&grps, &grps_size, 0);
+  char dump[] = "/tmp/bam_stats_dump_XXXXXX";
+  int fd = mkstemp(dump);
+  close(fd);
+  bam_stats_checkpoint_t ckpt = {123456789, 42, 1};
+  if(bam_stats_dump_write_checkpoint(dump, test_bam, &ckpt, grps, grps_size, exp) != 0){
+    sprintf(err,"Error writing checkpoint\n");
+    return err;
+  }
+  //A plain dump isn't a checkpoint
+  char plain[] = "/tmp/bam_stats_dump_XXXXXX";
+  fd = mkstemp(plain);
+  close(fd);
+  bam_stats_dump_write(plain, test_bam, grps, grps_size, exp);
+
+  rg_info_t **got_grps = NULL;
+  int got_size = 0;
+  stats_rd_t ***got = NULL;
+  char *bam_name = NULL;
+  bam_stats_checkpoint_t read = {0, 0, 0};
+  int chk = bam_stats_dump_read_checkpoint(dump, &got_grps, &got_size, &got, &bam_name, &read);
+  rg_info_t **plain_grps = NULL;
+  int plain_size = 0;
+  stats_rd_t ***plain_stats = NULL;
+  bam_stats_checkpoint_t plain_read = {0, 0, 0};
+  int chk_plain = bam_stats_dump_read_checkpoint(plain, &plain_grps, &plain_size, &plain_stats, &bam_name, &plain_read);
+  unlink(dump);
+  unlink(plain);
+  if(chk != 0 || read.voffset != 123456789 || read.records != 42){
+    sprintf(err,"Checkpoint offset not restored\n");
+    return err;
+  }
+  if(chk_plain == 0){
+    sprintf(err,"Dump without checkpoint details accepted as a checkpoint\n");
+    return err;
+  }
+  if(got_size != grps_size || got[0][0]->count != exp[0][0]->count){
+    sprintf(err,"Checkpoint counters not restored\n");
+    return err;
+  }
+  bam_access_destroy_stats(exp, grps_size);
+  bam_access_destroy_stats(got, got_size);
+  bam_access_destroy_stats(plain_stats, plain_size);
+  free(bam_name);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_stats_dump_round_trip);
+   mu_run_test(test_bam_stats_dump_merge_perl_json);
+   mu_run_test(test_bam_stats_dump_merge_lengths);
+   mu_run_test(test_bam_stats_dump_checkpoint);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
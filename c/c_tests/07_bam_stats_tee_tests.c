@@ -0,0 +1,136 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+#include <inttypes.h>
+#include <unistd.h>
+#include "minunit.h"
+#include "bam_stats_tee.h"
+
+char *test_bam = "../t/data/Stats.bam";
+
+char err[200];
+
+static int same_bytes(char *a, char *b){
+  FILE *fa = fopen(a, "rb");
+  FILE *fb = fopen(b, "rb");
+  int same = fa && fb;
+  while(same){
+    int ca = fgetc(fa);
+    int cb = fgetc(fb);
+    if(ca != cb) same = 0;
+    if(ca == EOF) break;
+  }
+  if(fa) fclose(fa);
+  if(fb) fclose(fb);
+  return same;
+}
+
+char *test_bam_stats_tee_copy_and_stats(){
+  char copy[] = "/tmp/bam_stats_tee_XXXXXX";
+  int fd = mkstemp(copy);
+  close(fd);
+  bam_stats_tee_t *tee = bam_stats_tee_start(test_bam, copy, 1);
+  if(tee == NULL){
+    sprintf(err,"Error starting copy of %s\n",test_bam);
+    return err;
+  }
+  htsFile *input = bam_stats_tee_input(tee);
+  bam_hdr_t *head = sam_hdr_read(input);
+  int grps_size = 0;
+  stats_rd_t ***got;
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &got);
+  if(bam_access_process_reads(input, head, grps, grps_size, &got, 0) != 0){
+    sprintf(err,"Error processing reads from the copy\n");
+    return err;
+  }
+  if(bam_stats_tee_finish(tee, NULL) != 0){
+    sprintf(err,"Error completing copy\n");
+    return err;
+  }
+  int same = same_bytes(test_bam, copy);
+  unlink(copy);
+  if(!same){
+    sprintf(err,"Copy differs from %s\n",test_bam);
+    return err;
+  }
+
+  //Stats from the decoded copy match reading the file directly
+  stats_rd_t ***exp;
+  htsFile *direct = hts_open(test_bam,"r");
+  bam_hdr_t *dhead = sam_hdr_read(direct);
+  int exp_size = 0;
+  bam_access_parse_header(dhead, &exp_size, &exp);
+  bam_access_process_reads(direct, dhead, grps, grps_size, &exp, 0);
+  int i=0;
+  for(i=0;i<grps_size;i++){
+    int rd=0;
+    for(rd=0;rd<2;rd++){
+      if(exp[i][rd]->count != got[i][rd]->count || exp[i][rd]->gc != got[i][rd]->gc
+          || exp[i][rd]->inserts.total != got[i][rd]->inserts.total){
+        sprintf(err,"RG %d read_%d stats from the copy differ\n",i,rd+1);
+        return err;
+      }
+    }
+  }
+  bam_access_destroy_stats(exp, grps_size);
+  bam_access_destroy_stats(got, grps_size);
+  bam_hdr_destroy(head);
+  bam_hdr_destroy(dhead);
+  hts_close(direct);
+  return NULL;
+}
+
+char *test_bam_stats_tee_finish_early(){
+  char copy[] = "/tmp/bam_stats_tee_XXXXXX";
+  int fd = mkstemp(copy);
+  close(fd);
+  bam_stats_tee_t *tee = bam_stats_tee_start(test_bam, copy, 0);
+  if(tee == NULL){
+    sprintf(err,"Error starting copy of %s\n",test_bam);
+    return err;
+  }
+  //Decoder stops after the header, the copy still has to complete
+  bam_hdr_t *head = sam_hdr_read(bam_stats_tee_input(tee));
+  if(head == NULL){
+    sprintf(err,"Error reading header from the copy\n");
+    return err;
+  }
+  bam_hdr_destroy(head);
+  if(bam_stats_tee_finish(tee, NULL) != 0){
+    sprintf(err,"Error completing copy after the decoder stopped\n");
+    return err;
+  }
+  int same = same_bytes(test_bam, copy);
+  unlink(copy);
+  if(!same){
+    sprintf(err,"Copy differs from %s when the decoder stops early\n",test_bam);
+    return err;
+  }
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_stats_tee_copy_and_stats);
+   mu_run_test(test_bam_stats_tee_finish_early);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
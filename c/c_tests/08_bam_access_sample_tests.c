@@ -0,0 +1,139 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include "minunit.h"
+#include "bam_access_sample.h"
+
+char *test_indexed_bam = "../t/data/coverage.bam";
+
+char err[200];
+
+char *test_bam_access_sample_ratio(){
+  uint64_t y[] = {1, 2, 3};
+  uint64_t x[] = {2, 4, 6};
+  double est = 0;
+  double half = 0;
+  if(bam_access_sample_ratio(y, x, 3, &est, &half) != 0 || fabs(est - 0.5) > 1e-12 || fabs(half) > 1e-12){
+    sprintf(err,"Proportional chunks should give 0.5 exactly, got %f +/- %f\n",est,half);
+    return err;
+  }
+  uint64_t y2[] = {0, 4};
+  if(bam_access_sample_ratio(y2, x, 2, &est, &half) != 0 || fabs(est - 4.0/6.0) > 1e-12 || !(half > 0)){
+    sprintf(err,"Expected a positive interval around %f, got %f +/- %f\n",4.0/6.0,est,half);
+    return err;
+  }
+  uint64_t zero[] = {0, 0};
+  if(bam_access_sample_ratio(y2, zero, 2, &est, &half) != -1){
+    sprintf(err,"Ratio over an empty denominator should fail\n");
+    return err;
+  }
+  return NULL;
+}
+
+char *test_bam_access_sample_plan_chunks(){
+  htsFile *input = hts_open(test_indexed_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, test_indexed_bam);
+  if(idx == NULL){
+    sprintf(err,"Error loading index for %s\n",test_indexed_bam);
+    return err;
+  }
+  shard_t *a = bam_access_sample_plan_chunks(head, idx, 50, 7);
+  shard_t *b = bam_access_sample_plan_chunks(head, idx, 50, 7);
+  if(a == NULL || b == NULL){
+    sprintf(err,"Error planning chunks\n");
+    return err;
+  }
+  int i=0;
+  for(i=0;i<50;i++){
+    if(a[i].tid != b[i].tid || a[i].beg != b[i].beg){
+      sprintf(err,"Chunk %d differs between runs with the same seed\n",i);
+      return err;
+    }
+    if(a[i].tid >= 0 && (uint32_t)a[i].beg >= head->target_len[a[i].tid]){
+      sprintf(err,"Chunk %d starts beyond its contig\n",i);
+      return err;
+    }
+    if(i > 0 && (unsigned int)a[i].tid < (unsigned int)a[i-1].tid){
+      sprintf(err,"Chunks %d and %d are not in file order\n",i-1,i);
+      return err;
+    }
+  }
+  free(a);
+  free(b);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *test_bam_access_sample_process(){
+  int grps_size = 0;
+  stats_rd_t ***grp_stats;
+  htsFile *input = hts_open(test_indexed_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, test_indexed_bam);
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  //Overlapping chunks in file order, each record must still only be counted once
+  shard_t chunks[] = {{0, 0, INT_MAX}, {0, 9992, INT_MAX}, {0, 9994, INT_MAX}, {1, 0, INT_MAX}};
+  sample_t *sample = bam_access_sample_process(input, head, idx, chunks, 4, grps, grps_size, grp_stats, 0, 10);
+  if(sample == NULL){
+    sprintf(err,"Error sampling %s\n",test_indexed_bam);
+    return err;
+  }
+  //10 + 10 + 3 left on contig 1 + 1 on contig 2
+  if(sample->records != 24 || sample->index_records != 24){
+    sprintf(err,"Sampled %"PRIu64" records of %"PRIu64", expected all 24\n",sample->records,sample->index_records);
+    return err;
+  }
+  uint64_t total = 0;
+  uint64_t chunk_total = 0;
+  int i=0;
+  for(i=0;i<grps_size;i++) total += grp_stats[i][0]->count + grp_stats[i][1]->count;
+  for(i=0;i<sample->n_chunks;i++) chunk_total += sample->count[i];
+  if(total != chunk_total){
+    sprintf(err,"Chunk counts %"PRIu64" don't sum to the stats %"PRIu64"\n",chunk_total,total);
+    return err;
+  }
+  double scale = bam_access_sample_scale(sample, grp_stats, grps_size);
+  if(fabs(scale - (double)sample->index_records / sample->records) > 1e-9){
+    sprintf(err,"Unexpected scale %f\n",scale);
+    return err;
+  }
+  bam_access_sample_destroy(sample);
+  bam_access_destroy_stats(grp_stats, grps_size);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_access_sample_ratio);
+   mu_run_test(test_bam_access_sample_plan_chunks);
+   mu_run_test(test_bam_access_sample_process);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,161 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+#include <unistd.h>
+#include "minunit.h"
+#include "bam_access_regions.h"
+
+char *test_indexed_bam = "../t/data/coverage.bam";
+char *test_bed = "../t/data/coverage_exons.bed";
+char *test_gff = "../t/data/coverage_exons.gff3";
+
+char err[200];
+
+static char *write_targets(char *path, const char *content){
+  int fd = mkstemp(path);
+  FILE *out = fdopen(fd, "w");
+  fputs(content, out);
+  fclose(out);
+  return path;
+}
+
+char *test_bam_access_regions_read(){
+  htsFile *input = hts_open(test_indexed_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  //Same exon as BED and GFF3
+  int n_bed = 0;
+  int n_gff = 0;
+  shard_t *bed = bam_access_regions_read(test_bed, head, &n_bed);
+  shard_t *gff = bam_access_regions_read(test_gff, head, &n_gff);
+  if(bed == NULL || gff == NULL || n_bed != 1 || n_gff != 1){
+    sprintf(err,"Error reading targets from %s and %s\n",test_bed,test_gff);
+    return err;
+  }
+  if(bed[0].tid != 0 || bed[0].beg != 9992 || bed[0].end != 9997 || gff[0].tid != bed[0].tid || gff[0].beg != bed[0].beg || gff[0].end != bed[0].end){
+    sprintf(err,"BED and GFF3 exons differ %d:%d-%d, %d:%d-%d\n",bed[0].tid,bed[0].beg,bed[0].end,gff[0].tid,gff[0].beg,gff[0].end);
+    return err;
+  }
+  free(bed);
+  free(gff);
+
+  //Unsorted, overlapping and abutting regions merge, unknown contigs are dropped
+  char path[] = "/tmp/bam_access_regions_XXXXXX";
+  write_targets(path, "# comment\n2\t50\t60\n1\t100\t200\n1\t150\t250\nX\t1\t10\n1\t250\t300\n1\t400\t500\n");
+  int n = 0;
+  shard_t *regions = bam_access_regions_read(path, head, &n);
+  unlink(path);
+  if(regions == NULL || n != 3 || regions[0].tid != 0 || regions[0].beg != 100 || regions[0].end != 300
+      || regions[1].beg != 400 || regions[2].tid != 1){
+    sprintf(err,"Targets not sorted and merged, got %d regions\n",n);
+    return err;
+  }
+  free(regions);
+
+  char bad[] = "/tmp/bam_access_regions_XXXXXX";
+  write_targets(bad, "1\t100\t100\n");
+  regions = bam_access_regions_read(bad, head, &n);
+  unlink(bad);
+  if(regions != NULL){
+    sprintf(err,"Zero length BED region accepted\n");
+    return err;
+  }
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+static uint64_t total_count(stats_rd_t ***grp_stats, int grps_size){
+  uint64_t total = 0;
+  int i=0;
+  for(i=0;i<grps_size;i++) total += grp_stats[i][0]->count + grp_stats[i][1]->count;
+  return total;
+}
+
+char *test_bam_access_regions_process(){
+  htsFile *input = hts_open(test_indexed_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, test_indexed_bam);
+  if(idx == NULL){
+    sprintf(err,"Error loading index for %s\n",test_indexed_bam);
+    return err;
+  }
+  //Reads at 9992-10012 span both regions
+  char path[] = "/tmp/bam_access_regions_XXXXXX";
+  write_targets(path, "1\t9990\t9994\n1\t10000\t10005\n");
+  int n = 0;
+  shard_t *regions = bam_access_regions_read(path, head, &n);
+  unlink(path);
+  int grps_size = 0;
+  stats_rd_t ***grp_stats = NULL;
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  if(regions == NULL || bam_access_regions_process(input, idx, regions, n, grps, grps_size, grp_stats, 0) != 0){
+    sprintf(err,"Error processing target regions\n");
+    return err;
+  }
+
+  //Expected from a full scan, counting reads that overlap any region once
+  stats_rd_t ***exp_stats = bam_access_init_stats(grps_size);
+  rg_lookup_t *lookup = bam_access_rg_lookup_init(grps, grps_size);
+  htsFile *scan = hts_open(test_indexed_bam,"r");
+  bam_hdr_t *scan_head = sam_hdr_read(scan);
+  bam1_t *b = bam_init1();
+  while(sam_read1(scan, scan_head, b) >= 0){
+    int r=0;
+    for(r=0;r<n;r++){
+      if(b->core.tid == regions[r].tid && b->core.pos < regions[r].end && bam_endpos(b) > regions[r].beg){
+        bam_access_process_read(b, lookup, exp_stats, 0);
+        break;
+      }
+    }
+  }
+  uint64_t got = total_count(grp_stats, grps_size);
+  uint64_t exp = total_count(exp_stats, grps_size);
+  if(got != exp || got == 0){
+    sprintf(err,"Expected %d reads in the regions, counted %d\n",(int)exp,(int)got);
+    return err;
+  }
+  int i=0;
+  for(i=0;i<grps_size;i++){
+    if(grp_stats[i][0]->mapped_bases != exp_stats[i][0]->mapped_bases || grp_stats[i][1]->umap != exp_stats[i][1]->umap){
+      sprintf(err,"RG %s counters differ from the full scan\n",grps[i]->id);
+      return err;
+    }
+  }
+  bam_destroy1(b);
+  bam_hdr_destroy(scan_head);
+  hts_close(scan);
+  bam_access_rg_lookup_destroy(lookup);
+  bam_access_destroy_stats(exp_stats, grps_size);
+  bam_access_destroy_stats(grp_stats, grps_size);
+  free(regions);
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_access_regions_read);
+   mu_run_test(test_bam_access_regions_process);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
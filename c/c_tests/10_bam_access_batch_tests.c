@@ -0,0 +1,126 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+
+#include <inttypes.h>
+#include "minunit.h"
+#include "bam_access_batch.h"
+
+char *test_indexed_bam = "../t/data/coverage.bam";
+char *test_stream_bam = "../t/data/Stats.bam";
+
+char err[200];
+
+typedef struct {
+  char *files[2];
+  stats_rd_t ***exp[2];
+  int grps_size[2];
+  int seen[2];
+  int mismatch;
+  pthread_mutex_t lock;
+} expected_t;
+
+static stats_rd_t ***sequential_stats(char *file, int *grps_size){
+  stats_rd_t ***grp_stats = NULL;
+  htsFile *input = hts_open(file,"r");
+  if(input == NULL) return NULL;
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, grps_size, &grp_stats);
+  if(bam_access_process_reads(input, head, grps, *grps_size, &grp_stats, 0) != 0) return NULL;
+  bam_access_destroy_groups(grps, *grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return grp_stats;
+}
+
+static int check_input(batch_input_t *in, void *data){
+  expected_t *exp = (expected_t *) data;
+  int f = strcmp(in->input_file, exp->files[0]) == 0 ? 0 : 1;
+  int bad = in->grps_size != exp->grps_size[f];
+  int i=0;
+  for(i=0;!bad && i<in->grps_size;i++){
+    int rd=0;
+    for(rd=0;rd<2;rd++){
+      stats_rd_t *e = exp->exp[f][i][rd];
+      stats_rd_t *g = in->grp_stats[i][rd];
+      if(e->length != g->length || e->count != g->count || e->dups != g->dups || e->gc != g->gc
+          || e->umap != g->umap || e->divergent != g->divergent || e->mapped_bases != g->mapped_bases
+          || e->proper != g->proper || e->mapped_pairs != g->mapped_pairs || e->inter_chr_pairs != g->inter_chr_pairs
+          || e->inserts.total != g->inserts.total || e->inserts.sum != g->inserts.sum) bad = 1;
+    }
+  }
+  pthread_mutex_lock(&exp->lock);
+  exp->seen[f]++;
+  if(bad) exp->mismatch = 1;
+  pthread_mutex_unlock(&exp->lock);
+  return 0;
+}
+
+char *test_bam_access_batch_process(){
+  expected_t exp;
+  memset(&exp, 0, sizeof(expected_t));
+  pthread_mutex_init(&exp.lock, NULL);
+  exp.files[0] = test_indexed_bam;
+  exp.files[1] = test_stream_bam;
+  int f=0;
+  for(f=0;f<2;f++){
+    exp.exp[f] = sequential_stats(exp.files[f], &exp.grps_size[f]);
+    if(exp.exp[f] == NULL){
+      sprintf(err,"Error processing %s sequentially\n",exp.files[f]);
+      return err;
+    }
+  }
+
+  //Indexed and unindexed inputs, the same file twice, on varying numbers of workers
+  char *inputs[] = {test_indexed_bam, test_stream_bam, test_indexed_bam};
+  int threads[] = {1, 2, 5};
+  int t=0;
+  for(t=0;t<3;t++){
+    memset(exp.seen, 0, sizeof(exp.seen));
+    int failed = bam_access_batch_process(inputs, 3, NULL, 0, threads[t], check_input, &exp);
+    if(failed != 0 || exp.seen[0] != 2 || exp.seen[1] != 1){
+      sprintf(err,"Batch on %d workers failed %d inputs, reported %d/%d\n",threads[t],failed,exp.seen[0],exp.seen[1]);
+      return err;
+    }
+    if(exp.mismatch){
+      sprintf(err,"Batch on %d workers differs from sequential runs\n",threads[t]);
+      return err;
+    }
+  }
+
+  //A bad input fails alone
+  char *with_missing[] = {test_indexed_bam, "../t/data/not_really_a.bam"};
+  memset(exp.seen, 0, sizeof(exp.seen));
+  int failed = bam_access_batch_process(with_missing, 2, NULL, 0, 2, check_input, &exp);
+  if(failed != 1 || exp.seen[0] != 1){
+    sprintf(err,"Expected one failed input and the other reported, got %d failed\n",failed);
+    return err;
+  }
+  for(f=0;f<2;f++) bam_access_destroy_stats(exp.exp[f], exp.grps_size[f]);
+  pthread_mutex_destroy(&exp.lock);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_access_batch_process);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
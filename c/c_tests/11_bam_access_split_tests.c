@@ -0,0 +1,172 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+#include <inttypes.h>
+#include "minunit.h"
+#include "bam_access_split.h"
+#include "htslib/bgzf.h"
+
+//Header and records in the first BGZF block at 0, more records in the block at 1490, EOF block at 1727
+char *test_split_bam = "../t/data/reconcile_bas.bam";
+char *test_bam = "../t/data/Stats.bam";
+char *test_cov_bam = "../t/data/coverage.bam";
+
+char err[200];
+
+char *test_bam_access_split_boundary(){
+  htsFile *input = hts_open(test_split_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  int64_t first_record = bgzf_tell(input->fp.bgzf);
+  int64_t got = bam_access_split_boundary(input, test_split_bam, head, first_record, 0);
+  if(got != first_record){
+    sprintf(err,"Start of file should give the first record %"PRId64" got %"PRId64"\n",first_record,got);
+    return err;
+  }
+  //Mid block syncs to the next block header and its first record
+  got = bam_access_split_boundary(input, test_split_bam, head, first_record, 700);
+  if(got != (int64_t)1490 << 16){
+    sprintf(err,"Expected the record at the start of block 1490, got %"PRId64"\n",got);
+    return err;
+  }
+  got = bam_access_split_boundary(input, test_split_bam, head, first_record, 1490);
+  if(got != (int64_t)1490 << 16){
+    sprintf(err,"A target on a block header should give that block, got %"PRId64"\n",got);
+    return err;
+  }
+  //Only the empty EOF block follows
+  got = bam_access_split_boundary(input, test_split_bam, head, first_record, 1600);
+  if(got != -1){
+    sprintf(err,"Expected no record after the last data block, got %"PRId64"\n",got);
+    return err;
+  }
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+static stats_rd_t ***read_part(char *file, int part, int n_parts, int *grps_size){
+  stats_rd_t ***grp_stats = NULL;
+  htsFile *input = hts_open(file,"r");
+  if(input == NULL) return NULL;
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, grps_size, &grp_stats);
+  int64_t beg = 0, end = 0;
+  if(bam_access_split_range(input, file, head, part, n_parts, &beg, &end) != 0) return NULL;
+  if(bam_access_split_process(input, head, grps, *grps_size, &grp_stats, 0, beg, end) != 0) return NULL;
+  bam_access_destroy_groups(grps, *grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return grp_stats;
+}
+
+//reconcile_bas.bam @RG lines don't parse, count records between the range ends directly
+char *test_bam_access_split_range(){
+  int n_parts=1;
+  int64_t total = -1;
+  for(n_parts=1;n_parts<=6;n_parts++){
+    int64_t records = 0;
+    int64_t prev_end = 0;
+    int part=0;
+    for(part=0;part<n_parts;part++){
+      htsFile *input = hts_open(test_split_bam,"r");
+      bam_hdr_t *head = sam_hdr_read(input);
+      int64_t beg = 0, end = 0;
+      if(bam_access_split_range(input, test_split_bam, head, part, n_parts, &beg, &end) != 0){
+        sprintf(err,"Error finding part %d/%d\n",part+1,n_parts);
+        return err;
+      }
+      if(part > 0 && beg != prev_end){
+        sprintf(err,"Part %d/%d starts at %"PRId64" but the previous ended at %"PRId64"\n",part+1,n_parts,beg,prev_end);
+        return err;
+      }
+      prev_end = end;
+      if(beg >= 0){
+        bam1_t *b = bam_init1();
+        bgzf_seek(input->fp.bgzf, beg, SEEK_SET);
+        while((end < 0 || bgzf_tell(input->fp.bgzf) < end) && sam_read1(input, head, b) >= 0) records++;
+        bam_destroy1(b);
+      }
+      bam_hdr_destroy(head);
+      hts_close(input);
+    }
+    if(total < 0) total = records;
+    if(records != total || total == 0){
+      sprintf(err,"%d parts read %"PRId64" records, expected %"PRId64"\n",n_parts,records,total);
+      return err;
+    }
+  }
+  return NULL;
+}
+
+char *test_bam_access_split_process(){
+  char *files[] = {test_cov_bam, test_bam};
+  int f=0;
+  for(f=0;f<2;f++){
+    int grps_size = 0;
+    stats_rd_t ***exp = read_part(files[f], 0, 1, &grps_size);
+    if(exp == NULL){
+      sprintf(err,"Error reading %s as a single part\n",files[f]);
+      return err;
+    }
+    int n_parts=2;
+    for(n_parts=2;n_parts<=5;n_parts++){
+      //Parts merged in order give the whole file, every record counted exactly once
+      stats_rd_t ***got = bam_access_init_stats(grps_size);
+      int part=0;
+      for(part=0;part<n_parts;part++){
+        int part_size = 0;
+        stats_rd_t ***part_stats = read_part(files[f], part, n_parts, &part_size);
+        if(part_stats == NULL || part_size != grps_size){
+          sprintf(err,"Error reading part %d/%d of %s\n",part+1,n_parts,files[f]);
+          return err;
+        }
+        bam_access_merge_stats(got, part_stats, grps_size);
+        bam_access_destroy_stats(part_stats, part_size);
+      }
+      int i=0;
+      for(i=0;i<grps_size;i++){
+        int rd=0;
+        for(rd=0;rd<2;rd++){
+          stats_rd_t *e = exp[i][rd];
+          stats_rd_t *g = got[i][rd];
+          if(e->length != g->length || e->count != g->count || e->dups != g->dups || e->gc != g->gc || e->umap != g->umap
+              || e->divergent != g->divergent || e->mapped_bases != g->mapped_bases || e->proper != g->proper
+              || e->mapped_pairs != g->mapped_pairs || e->inserts.total != g->inserts.total || e->inserts.sum != g->inserts.sum){
+            sprintf(err,"%d parts of %s: read group %d read_%d counted %"PRIu64" reads, expected %"PRIu64"\n",
+                    n_parts,files[f],i,rd+1,g->count,e->count);
+            return err;
+          }
+        }
+      }
+      bam_access_destroy_stats(got, grps_size);
+    }
+    bam_access_destroy_stats(exp, grps_size);
+  }
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_bam_access_split_boundary);
+   mu_run_test(test_bam_access_split_range);
+   mu_run_test(test_bam_access_split_process);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,205 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+#include <inttypes.h>
+#include <unistd.h>
+#include "minunit.h"
+#include "bam_access.h"
+#include "bam_stats_output.h"
+#include "pcap_stats.h"
+
+char *test_bam = "../t/data/Stats.bam";
+char *other_bam = "../t/data/multi_sample.bam";
+
+char err[200];
+
+static int same_file(char *a, char *b){
+  FILE *fa = fopen(a, "r");
+  FILE *fb = fopen(b, "r");
+  int same = fa != NULL && fb != NULL;
+  while(same){
+    int ca = fgetc(fa);
+    int cb = fgetc(fb);
+    if(ca != cb) same = 0;
+    if(ca == EOF || cb == EOF) break;
+  }
+  if(fa) fclose(fa);
+  if(fb) fclose(fb);
+  return same;
+}
+
+//.bas from the bam_stats read loop
+static int expected_bas(char *bas){
+  int grps_size = 0;
+  stats_rd_t ***grp_stats = NULL;
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  rg_info_t **grps = bam_access_parse_header(head, &grps_size, &grp_stats);
+  if(bam_access_process_reads(input, head, grps, grps_size, &grp_stats, 0) != 0) return -1;
+  if(bam_stats_output_print_results(grps, grps_size, grp_stats, test_bam, bas, 0) != 0) return -1;
+  bam_access_destroy_stats(grp_stats, grps_size);
+  bam_access_destroy_groups(grps, grps_size);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return 0;
+}
+
+char *test_pcap_stats_add_record(){
+  char exp[] = "/tmp/pcap_stats_XXXXXX";
+  close(mkstemp(exp));
+  char got[] = "/tmp/pcap_stats_XXXXXX";
+  close(mkstemp(got));
+  char split[] = "/tmp/pcap_stats_XXXXXX";
+  close(mkstemp(split));
+  if(expected_bas(exp) != 0){
+    sprintf(err,"Error generating expected .bas for %s\n",test_bam);
+    return err;
+  }
+
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  pcap_stats_t *all = pcap_stats_init(head, 0);
+  //Alternate records to two halves merged in order
+  pcap_stats_t *half[2] = {pcap_stats_init(head, 0), pcap_stats_init(head, 0)};
+  if(all == NULL || half[0] == NULL || half[1] == NULL){
+    sprintf(err,"Error initialising stats from the %s header\n",test_bam);
+    return err;
+  }
+  bam1_t *b = bam_init1();
+  int n=0;
+  while(sam_read1(input, head, b) >= 0){
+    if(pcap_stats_add_record(all, b) != 0 || pcap_stats_add_record(half[n++ % 2], b) != 0){
+      sprintf(err,"Error adding record %d\n",n);
+      return err;
+    }
+  }
+  bam_destroy1(b);
+  if(pcap_stats_merge(half[0], half[1]) != 0){
+    sprintf(err,"Error merging stats\n");
+    return err;
+  }
+  if(pcap_stats_write_bas(all, test_bam, got) != 0 || pcap_stats_write_bas(half[0], test_bam, split) != 0){
+    sprintf(err,"Error writing .bas\n");
+    return err;
+  }
+  int same = same_file(exp, got);
+  int same_split = same_file(exp, split);
+  unlink(exp);
+  unlink(got);
+  unlink(split);
+  if(!same){
+    sprintf(err,"Library .bas differs from the bam_stats read loop\n");
+    return err;
+  }
+  if(!same_split){
+    sprintf(err,"Merged halves .bas differs from a single pass\n");
+    return err;
+  }
+  pcap_stats_destroy(all);
+  pcap_stats_destroy(half[0]);
+  pcap_stats_destroy(half[1]);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *test_pcap_stats_merge_other_header(){
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  htsFile *other = hts_open(other_bam,"r");
+  bam_hdr_t *other_head = sam_hdr_read(other);
+  pcap_stats_t *a = pcap_stats_init(head, 0);
+  pcap_stats_t *b = pcap_stats_init(other_head, 0);
+  if(pcap_stats_merge(a, b) == 0){
+    sprintf(err,"Stats with different read groups should not merge\n");
+    return err;
+  }
+  pcap_stats_destroy(a);
+  pcap_stats_destroy(b);
+  bam_hdr_destroy(head);
+  bam_hdr_destroy(other_head);
+  hts_close(input);
+  hts_close(other);
+  return NULL;
+}
+
+char *test_pcap_stats_unknown_rg(){
+  char got[] = "/tmp/pcap_stats_XXXXXX";
+  close(mkstemp(got));
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  pcap_stats_t *stats = pcap_stats_init(head, 0);
+  bam1_t *b = bam_init1();
+  int n=0;
+  //Header has @RG lines, drop the RG tag of one counted record and point another at an ID not in the header
+  while(n < 2 && sam_read1(input, head, b) >= 0){
+    if(b->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FSUPPLEMENTARY)) continue;
+    uint8_t *rg = bam_aux_get(b, "RG");
+    if(rg == NULL){
+      sprintf(err,"Record %d of %s has no RG tag\n",n,test_bam);
+      return err;
+    }
+    if(n == 0) rg[-2] = 'X';
+    else rg[1] = 'Z';
+    if(pcap_stats_add_record(stats, b) != 0){
+      sprintf(err,"Record %d without a known RG was rejected\n",n);
+      return err;
+    }
+    n++;
+  }
+  bam_destroy1(b);
+  if(pcap_stats_write_bas(stats, test_bam, got) != 0){
+    sprintf(err,"Error writing .bas\n");
+    return err;
+  }
+  //Counted as anon, as PCAP::Bam::Stats does
+  FILE *fp = fopen(got, "r");
+  char line[2048];
+  uint64_t total = 0;
+  while(fgets(line, sizeof(line), fp) != NULL){
+    char *ptr = NULL;
+    char *field = strtok_r(line, "\t", &ptr);
+    int col=0;
+    char *rg_col = NULL;
+    for(col=1; field != NULL; col++, field = strtok_r(NULL, "\t", &ptr)){
+      if(col == 6) rg_col = field;
+      if(col == 15 && rg_col && strcmp(rg_col, ".") == 0) total = strtoull(field, NULL, 10);
+    }
+  }
+  fclose(fp);
+  unlink(got);
+  if(total != 2){
+    sprintf(err,"Anonymous group has %"PRIu64" reads, expected 2\n",total);
+    return err;
+  }
+  pcap_stats_destroy(stats);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_pcap_stats_add_record);
+   mu_run_test(test_pcap_stats_merge_other_header);
+   mu_run_test(test_pcap_stats_unknown_rg);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,540 @@
+/*########LICENCE#########
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*#########LICENCE#########*/
+
+#include <inttypes.h>
+#include <unistd.h>
+#include "minunit.h"
+#include "diff_bams_stream.h"
+#include "diff_bams_parallel.h"
+#include "diff_bams_unordered.h"
+
+char *test_bam = "../t/data/Stats.bam";
+char *test_cov_bam = "../t/data/coverage.bam"; //Indexed
+
+char err[200];
+
+static int count_records(char *file, int skip_z){
+  htsFile *input = hts_open(file,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  bam1_t *b = bam_init1();
+  int n = 0;
+  while(sam_read1(input, head, b) >= 0) if(!skip_z || b->core.qual != 0) n++;
+  bam_destroy1(b);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return n;
+}
+
+char *test_diff_bams_stream(){
+  int skip_z=0;
+  for(skip_z=0; skip_z<2; skip_z++){
+    int exp = count_records(test_bam, skip_z);
+    htsFile *input = hts_open(test_bam,"r");
+    bam_hdr_t *head = sam_hdr_read(input);
+    diff_stream_t *stream = diff_bams_stream_start(input, head, skip_z);
+    if(stream == NULL){
+      sprintf(err,"Error starting stream on %s\n",test_bam);
+      return err;
+    }
+    int got = 0;
+    bam1_t *b = NULL;
+    while((b = diff_bams_stream_next(stream)) != NULL){
+      if(skip_z && b->core.qual == 0){
+        sprintf(err,"MAPQ 0 record %s not skipped\n",bam_get_qname(b));
+        return err;
+      }
+      got++;
+    }
+    int ret = diff_bams_stream_finish(stream);
+    if(got != exp || ret != -1){
+      sprintf(err,"Expected %d records and end of file from stream (skip %d), got %d (%d)\n",exp,skip_z,got,ret);
+      return err;
+    }
+    bam_hdr_destroy(head);
+    hts_close(input);
+  }
+  return NULL;
+}
+
+char *test_diff_bams_stream_stop_early(){
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  diff_stream_t *stream = diff_bams_stream_start(input, head, 0);
+  if(diff_bams_stream_next(stream) == NULL){
+    sprintf(err,"No record from stream\n");
+    return err;
+  }
+  //Decoder must be released without reading the rest
+  if(diff_bams_stream_finish(stream) != 0){
+    sprintf(err,"Stream stopped early should report 0\n");
+    return err;
+  }
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+static char *read_file(char *file, char *buf, size_t size){
+  FILE *in = fopen(file, "r");
+  size_t n = fread(buf, 1, size-1, in);
+  buf[n] = '\0';
+  fclose(in);
+  return buf;
+}
+
+char *test_diff_bams_loci(){
+  char *names[] = {"2", "10", "1"};
+  bam_hdr_t head;
+  memset(&head, 0, sizeof(bam_hdr_t));
+  head.n_targets = 3;
+  head.target_name = names;
+  //Consecutive repeats are one run, rows come out in the order added
+  diff_loci_t *loci = diff_bams_loci_init(1);
+  diff_bams_loci_add(loci, 0, 100, 1);
+  diff_bams_loci_add(loci, 0, 100, 1);
+  diff_bams_loci_add(loci, 0, 101, 1);
+  diff_bams_loci_add(loci, 2, 5, 1);
+  diff_bams_loci_add(loci, -1, -1, 1);
+  //Windowed, runs spanning two sources are merged when appended
+  diff_loci_t *part = diff_bams_loci_init(100);
+  diff_bams_loci_add(part, 1, 1099, 1);
+  int64_t mid = diff_bams_loci_mark(part);
+  diff_bams_loci_add(part, 1, 1001, 2);
+  diff_bams_loci_add(part, 1, 1100, 1);
+  int64_t end = diff_bams_loci_mark(part);
+  diff_loci_t *windows = diff_bams_loci_init(100);
+  diff_bams_loci_add(windows, 0, 99, 1);
+  if(diff_bams_loci_append(windows, part, 0, mid) != 0 || diff_bams_loci_append(windows, part, mid, end) != 0){
+    sprintf(err,"Error appending flag difference locations\n");
+    return err;
+  }
+
+  char out_file[] = "/tmp/diff_bams_loci_XXXXXX";
+  int fd = mkstemp(out_file);
+  FILE *out = fdopen(fd, "w");
+  int chk = diff_bams_loci_write(out, &head, loci);
+  chk |= diff_bams_loci_write(out, &head, windows);
+  fclose(out);
+  if(chk != 0){
+    sprintf(err,"Error writing flag difference locations\n");
+    return err;
+  }
+  char *exp = "2\t100\t2\n2\t101\t1\n1\t5\t1\n*\t-1\t1\n2\t0\t1\n10\t1000\t3\n10\t1100\t1\n";
+  char got[120];
+  read_file(out_file, got, sizeof(got));
+  unlink(out_file);
+  if(strcmp(exp, got) != 0){
+    sprintf(err,"Unexpected flag difference report:\n%s\n",got);
+    return err;
+  }
+  diff_bams_loci_destroy(loci);
+  diff_bams_loci_destroy(part);
+  diff_bams_loci_destroy(windows);
+
+  //Moving backwards (input not coordinate sorted) is an error, unplaced sorts last
+  diff_loci_t *order = diff_bams_loci_init(100);
+  diff_bams_loci_add(order, 1, 1200, 1);
+  if(diff_bams_loci_add(order, 1, 1250, 1) != 0 || diff_bams_loci_add(order, 1, 1150, 1) == 0
+      || diff_bams_loci_add(order, 0, 2000, 1) == 0){
+    sprintf(err,"Flag difference before the previous window should be rejected\n");
+    return err;
+  }
+  diff_bams_loci_add(order, -1, -1, 1);
+  if(diff_bams_loci_add(order, 2, 5, 1) == 0){
+    sprintf(err,"Flag difference after unplaced records should be rejected\n");
+    return err;
+  }
+  diff_bams_loci_destroy(order);
+  return NULL;
+}
+
+char *test_diff_bams_fields_compare(){
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  bam1_t *a = bam_init1();
+  sam_read1(input, head, a); //MAPQ 0 with RG:Z and NM:C aux tags
+  bam1_t *b = bam_dup1(a);
+  diff_fields_t *fields = diff_bams_fields_init();
+  if(diff_bams_fields_compare(a, b, fields) != 0){
+    sprintf(err,"Copy of a record should compare as identical\n");
+    return err;
+  }
+  b->core.qual = 30;
+  bam_get_qual(b)[0]++;
+  uint8_t *nm = bam_aux_get(b, "NM");
+  nm[1]++;
+  if(diff_bams_fields_compare(a, b, fields) != 1){
+    sprintf(err,"Changed record should compare as different\n");
+    return err;
+  }
+  if(fields->fields[DIFF_FIELD_MAPQ] != 1 || fields->fields[DIFF_FIELD_QUAL] != 1 || fields->fields[DIFF_FIELD_AUX] != 1
+      || fields->tags['N' << 8 | 'M'] != 1 || fields->tags['R' << 8 | 'G'] != 0
+      || fields->fields[DIFF_FIELD_SEQ] != 0 || fields->fields[DIFF_FIELD_FLAG] != 0 || fields->fields[DIFF_FIELD_OTHER] != 0){
+    sprintf(err,"Mismatches not counted against MAPQ, QUAL and the NM tag only\n");
+    return err;
+  }
+  //Encoding only differences are still counted
+  bam_copy1(b, a);
+  b->core.bin++;
+  if(diff_bams_fields_compare(a, b, fields) != 1 || fields->fields[DIFF_FIELD_OTHER] != 1){
+    sprintf(err,"Bin difference not counted\n");
+    return err;
+  }
+  diff_bams_fields_destroy(fields);
+  bam_destroy1(a);
+  bam_destroy1(b);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+char *test_diff_bams_parallel(){
+  htsFile *input = hts_open(test_cov_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, test_cov_bam);
+  int exp = count_records(test_cov_bam, 0);
+  int nthreads=1;
+  diff_opts_t opts = {0, 1, 1, 1, 0};
+  for(nthreads=1; nthreads<=4; nthreads++){
+    diff_result_t result = {0, 0, NULL, 0, NULL};
+    if(diff_bams_parallel(test_cov_bam, test_cov_bam, NULL, head, idx, &opts, nthreads, &result) != 0){
+      sprintf(err,"Error comparing %s to itself on %d threads\n",test_cov_bam,nthreads);
+      return err;
+    }
+    if(result.records != (uint64_t)exp || result.flag_diffs != 0 || result.loci != NULL || result.differ != 0){
+      sprintf(err,"Expected %d matching records on %d threads, got %"PRIu64" with %"PRIu64" flag differences\n",
+                exp,nthreads,result.records,result.flag_diffs);
+      return err;
+    }
+    diff_bams_result_destroy(&result);
+  }
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+#define SPREAD_PER_CONTIG 200
+#define SPREAD_UNPLACED 6
+
+//Copies of the first coverage.bam record spread along both contigs, two per position, then a few unplaced.
+//Every flip_every-th record has its duplicate flag flipped (0 for none). Indexed for diff_bams_parallel.
+static int write_spread_bam(char *file, int flip_every){
+  htsFile *input = hts_open(test_cov_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  bam1_t *b = bam_init1();
+  if(sam_read1(input, head, b) < 0) return -1;
+  htsFile *out = hts_open(file,"wb");
+  if(out == NULL || sam_hdr_write(out, head) != 0) return -1;
+  int tid=0, i=0, n=0;
+  for(tid=0; tid<=head->n_targets; tid++){
+    int count = tid < head->n_targets ? SPREAD_PER_CONTIG : SPREAD_UNPLACED;
+    for(i=0; i<count; i++){
+      if(tid < head->n_targets){
+        b->core.tid = b->core.mtid = tid;
+        b->core.pos = b->core.mpos = (int32_t)((uint64_t)(i / 2) * (head->target_len[tid] - 1000) / (count / 2));
+        b->core.flag &= ~(BAM_FUNMAP | BAM_FMUNMAP);
+        b->core.bin = bam_reg2bin(b->core.pos, bam_endpos(b));
+      }else{
+        b->core.tid = b->core.mtid = -1;
+        b->core.pos = b->core.mpos = -1;
+        b->core.flag |= BAM_FUNMAP | BAM_FMUNMAP;
+        b->core.bin = bam_reg2bin(-1, 0);
+      }
+      uint16_t flag = b->core.flag;
+      if(flip_every && n % flip_every == 0) b->core.flag ^= BAM_FDUP;
+      if(sam_write1(out, head, b) < 0) return -1;
+      b->core.flag = flag;
+      n++;
+    }
+  }
+  bam_destroy1(b);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  if(hts_close(out) != 0) return -1;
+  return sam_index_build(file, 0);
+}
+
+//Compares in file order as diff_bams does without an index, stopping at opts->limit differing records
+static int diff_sequential(char *file_a, char *file_b, diff_opts_t *opts, diff_result_t *result){
+  htsFile *in_a = hts_open(file_a,"r");
+  bam_hdr_t *head_a = sam_hdr_read(in_a);
+  htsFile *in_b = hts_open(file_b,"r");
+  bam_hdr_t *head_b = sam_hdr_read(in_b);
+  bam1_t *a = bam_init1();
+  bam1_t *b = bam_init1();
+  int chk = 0;
+  while(sam_read1(in_a, head_a, a) >= 0 && sam_read1(in_b, head_b, b) >= 0){
+    if(diff_bams_compare(a, b, opts, result) != DIFF_MATCH){
+      chk = -1;
+      break;
+    }
+    if(opts->limit && result->differ >= opts->limit) break;
+  }
+  bam_destroy1(a);
+  bam_destroy1(b);
+  bam_hdr_destroy(head_a);
+  bam_hdr_destroy(head_b);
+  hts_close(in_a);
+  hts_close(in_b);
+  return chk;
+}
+
+//"#Chr\tPos\tCount" rows as diff_bams -c reports them
+static char *loci_rows(bam_hdr_t *head, diff_loci_t *loci, char *buf, size_t size){
+  char out_file[] = "/tmp/diff_bams_loci_XXXXXX";
+  int fd = mkstemp(out_file);
+  FILE *out = fdopen(fd, "w");
+  if(loci) diff_bams_loci_write(out, head, loci);
+  fclose(out);
+  read_file(out_file, buf, size);
+  unlink(out_file);
+  return buf;
+}
+
+char *test_diff_bams_parallel_flags(){
+  char file_a[] = "/tmp/diff_bams_a_XXXXXX";
+  close(mkstemp(file_a));
+  char file_b[] = "/tmp/diff_bams_b_XXXXXX";
+  close(mkstemp(file_b));
+  if(write_spread_bam(file_a, 0) != 0 || write_spread_bam(file_b, 7) != 0){
+    sprintf(err,"Error writing test inputs\n");
+    return err;
+  }
+  htsFile *input = hts_open(file_a,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  hts_idx_t *idx = sam_index_load(input, file_a);
+  //Per position, then windows wide enough that runs carry across shard boundaries
+  int32_t windows[2] = {1, 50000000};
+  char exp[8192];
+  char got[8192];
+  int w=0, nthreads=0;
+  for(w=0; w<2; w++){
+    diff_opts_t opts = {0, 1, windows[w], 0, 0};
+    diff_result_t seq = {0, 0, NULL, 0, NULL};
+    if(diff_sequential(file_a, file_b, &opts, &seq) != 0 || seq.flag_diffs == 0){
+      sprintf(err,"Error comparing test inputs in file order\n");
+      return err;
+    }
+    loci_rows(head, seq.loci, exp, sizeof(exp));
+    for(nthreads=1; nthreads<=4; nthreads++){
+      diff_result_t result = {0, 0, NULL, 0, NULL};
+      if(diff_bams_parallel(file_a, file_b, NULL, head, idx, &opts, nthreads, &result) != 0){
+        sprintf(err,"Error comparing test inputs on %d threads\n",nthreads);
+        return err;
+      }
+      if(result.records != seq.records || result.flag_diffs != seq.flag_diffs
+          || strcmp(loci_rows(head, result.loci, got, sizeof(got)), exp) != 0){
+        sprintf(err,"Window %d on %d threads: %"PRIu64" flag differences in %"PRIu64" records, expected %"PRIu64" in %"PRIu64"\n",
+                  windows[w],nthreads,result.flag_diffs,result.records,seq.flag_diffs,seq.records);
+        return err;
+      }
+      diff_bams_result_destroy(&result);
+    }
+    diff_bams_result_destroy(&seq);
+  }
+
+  //Full mode shares the -l count between workers, one worker stops exactly where a sequential run would
+  diff_opts_t opts = {0, 1, 1, 1, 5};
+  diff_opts_t all = {0, 1, 1, 1, 0};
+  diff_result_t seq = {0, 0, NULL, 0, NULL};
+  diff_result_t whole = {0, 0, NULL, 0, NULL};
+  diff_sequential(file_a, file_b, &opts, &seq);
+  diff_sequential(file_a, file_b, &all, &whole);
+  loci_rows(head, seq.loci, exp, sizeof(exp));
+  for(nthreads=1; nthreads<=4; nthreads++){
+    diff_result_t result = {0, 0, NULL, 0, NULL};
+    if(diff_bams_parallel(file_a, file_b, NULL, head, idx, &opts, nthreads, &result) != 0){
+      sprintf(err,"Error comparing test inputs with a limit on %d threads\n",nthreads);
+      return err;
+    }
+    if(result.differ < opts.limit || result.differ > whole.differ || result.flag_diffs != result.differ){
+      sprintf(err,"Limit of %"PRIu64" on %d threads gave %"PRIu64" differing records\n",opts.limit,nthreads,result.differ);
+      return err;
+    }
+    if(nthreads == 1 && (result.differ != seq.differ || strcmp(loci_rows(head, result.loci, got, sizeof(got)), exp) != 0)){
+      sprintf(err,"Limit on one thread should stop as a sequential run does\n");
+      return err;
+    }
+    diff_bams_result_destroy(&result);
+  }
+  diff_bams_result_destroy(&seq);
+  diff_bams_result_destroy(&whole);
+
+  hts_idx_destroy(idx);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  char bai[64];
+  unlink(file_a);
+  sprintf(bai, "%s.bai", file_a);
+  unlink(bai);
+  unlink(file_b);
+  sprintf(bai, "%s.bai", file_b);
+  unlink(bai);
+  return NULL;
+}
+
+char *test_diff_bams_digest(){
+  htsFile *input = hts_open(test_bam,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  bam1_t *a = bam_init1();
+  sam_read1(input, head, a);
+  bam1_t *b = bam_dup1(a);
+  b->core.qual++;
+  diff_digest_t da = diff_bams_digest(a, 0);
+  diff_digest_t db = diff_bams_digest(b, 0);
+  diff_digest_t fa = diff_bams_digest(a, 1);
+  diff_digest_t fb = diff_bams_digest(b, 1);
+  //MAPQ only matters in full mode
+  if(da.id != db.id || da.content != db.content || fa.id != fb.id || fa.content == fb.content){
+    sprintf(err,"Digest should only change content in full mode for a MAPQ change\n");
+    return err;
+  }
+  b->core.flag ^= BAM_FREAD1 | BAM_FREAD2;
+  if(diff_bams_digest(b, 0).id == da.id){
+    sprintf(err,"Other end of the pair should have a different identity\n");
+    return err;
+  }
+  bam_destroy1(a);
+  bam_destroy1(b);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return NULL;
+}
+
+//Writes the records of src to dst in reverse order, flipping the duplicate flag of the record at flip (-1 for none)
+static int write_reversed_bam(char *src, char *dst, int flip){
+  htsFile *input = hts_open(src,"r");
+  bam_hdr_t *head = sam_hdr_read(input);
+  int n = count_records(src, 0);
+  bam1_t **recs = (bam1_t **) calloc(n, sizeof(bam1_t *));
+  int i=0;
+  for(i=0; i<n; i++){
+    recs[i] = bam_init1();
+    if(sam_read1(input, head, recs[i]) < 0) return -1;
+  }
+  if(flip >= 0) recs[flip]->core.flag ^= BAM_FDUP;
+  htsFile *out = hts_open(dst,"wb");
+  if(out == NULL || sam_hdr_write(out, head) != 0) return -1;
+  for(i=n-1; i>=0; i--){
+    if(sam_write1(out, head, recs[i]) < 0) return -1;
+    bam_destroy1(recs[i]);
+  }
+  free(recs);
+  bam_hdr_destroy(head);
+  hts_close(input);
+  return hts_close(out);
+}
+
+char *test_diff_bams_unordered_reversed(){
+  char file[] = "/tmp/diff_bams_rev_XXXXXX";
+  close(mkstemp(file));
+  uint64_t budgets[2] = {64, 1 << 20};
+  diff_opts_t opts = {0, 0, 1, 0, 0};
+  uint64_t n = count_records(test_bam, 0);
+  int flip=0, m=0;
+  //Reversed as is, then with one record's duplicate flag changed
+  for(flip=-1; flip<=0; flip++){
+    if(write_reversed_bam(test_bam, file, flip < 0 ? -1 : (int)(n / 2)) != 0){
+      sprintf(err,"Error writing reversed copy of %s\n",test_bam);
+      return err;
+    }
+    for(m=0; m<2; m++){
+      htsFile *in_a = hts_open(test_bam,"r");
+      bam_hdr_t *head_a = sam_hdr_read(in_a);
+      htsFile *in_b = hts_open(file,"r");
+      bam_hdr_t *head_b = sam_hdr_read(in_b);
+      diff_unordered_t got = {0, 0, 0, 0, 0, 0};
+      if(diff_bams_unordered(in_a, head_a, in_b, head_b, "/tmp", 3, budgets[m], &opts, 2, &got) != 0){
+        sprintf(err,"Error comparing %s to a reversed copy\n",test_bam);
+        return err;
+      }
+      uint64_t exp_differ = flip < 0 ? 0 : 1;
+      if(got.records_a != n || got.records_b != n || got.matched != n - exp_differ || got.differ != exp_differ
+          || got.only_a != 0 || got.only_b != 0){
+        sprintf(err,"Reversed copy of %s with %"PRIu64" changed flags: %"PRIu64" matched, %"PRIu64" differ, %"PRIu64"/%"PRIu64" unpaired\n",
+                  test_bam,exp_differ,got.matched,got.differ,got.only_a,got.only_b);
+        return err;
+      }
+      bam_hdr_destroy(head_a);
+      bam_hdr_destroy(head_b);
+      hts_close(in_a);
+      hts_close(in_b);
+    }
+  }
+  unlink(file);
+  return NULL;
+}
+
+char *test_diff_bams_unordered(){
+  char *files[2] = {test_bam, test_cov_bam};
+  //Tiny budgets force a partition to be joined over several passes
+  uint64_t budgets[2] = {64, 1 << 20};
+  diff_opts_t opts = {0, 0, 1, 0, 0};
+  int f=0, m=0;
+  for(f=0; f<2; f++){
+    for(m=0; m<2; m++){
+      htsFile *in_a = hts_open(test_bam,"r");
+      bam_hdr_t *head_a = sam_hdr_read(in_a);
+      htsFile *in_b = hts_open(files[f],"r");
+      bam_hdr_t *head_b = sam_hdr_read(in_b);
+      diff_unordered_t got = {0, 0, 0, 0, 0, 0};
+      if(diff_bams_unordered(in_a, head_a, in_b, head_b, "/tmp", 3, budgets[m], &opts, 2, &got) != 0){
+        sprintf(err,"Error comparing %s and %s in any order\n",test_bam,files[f]);
+        return err;
+      }
+      uint64_t n_a = count_records(test_bam, 0);
+      uint64_t n_b = count_records(files[f], 0);
+      if(got.records_a != n_a || got.records_b != n_b || got.matched + got.differ + got.only_a != n_a
+          || got.matched + got.differ + got.only_b != n_b){
+        sprintf(err,"Unordered counts don't add up for %s against %s\n",test_bam,files[f]);
+        return err;
+      }
+      if(f == 0 && got.matched != n_a){
+        sprintf(err,"%s should match itself in any order, %"PRIu64" of %"PRIu64" matched\n",test_bam,got.matched,n_a);
+        return err;
+      }
+      if(f == 1 && got.matched == n_a){
+        sprintf(err,"%s and %s should differ\n",test_bam,files[f]);
+        return err;
+      }
+      bam_hdr_destroy(head_a);
+      bam_hdr_destroy(head_b);
+      hts_close(in_a);
+      hts_close(in_b);
+    }
+  }
+  return NULL;
+}
+
+char *all_tests() {
+   mu_suite_start();
+   mu_run_test(test_diff_bams_stream);
+   mu_run_test(test_diff_bams_stream_stop_early);
+   mu_run_test(test_diff_bams_loci);
+   mu_run_test(test_diff_bams_fields_compare);
+   mu_run_test(test_diff_bams_parallel);
+   mu_run_test(test_diff_bams_parallel_flags);
+   mu_run_test(test_diff_bams_digest);
+   mu_run_test(test_diff_bams_unordered);
+   mu_run_test(test_diff_bams_unordered_reversed);
+   return NULL;
+}
+
+RUN_TESTS(all_tests);
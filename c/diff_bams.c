@@ -1,17 +1,25 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include "htslib/sam.h"
-#include "khash.h"
+#include "htslib/thread_pool.h"
 #include "dbg.h"
-
-KHASH_MAP_INIT_INT(posn,int32_t)
-KHASH_MAP_INIT_INT(chrom,khash_t(posn))
+#include "diff_bams_stream.h"
+#include "diff_bams_parallel.h"
+#include "diff_bams_unordered.h"
 
 char *bam_a_loc = NULL;
 char *bam_b_loc = NULL;
 char *ref_file = NULL;
 int skip_z = 0;
 int count_flag_diff = 0;
+int32_t window = 1;
+int full = 0;
+uint64_t limit = 1000;
+int nthreads = 0;
+int unordered = 0;
+int n_parts = DIFF_PARTITIONS;
+uint64_t mem_mb = 1024;
+char *tmp_dir = NULL;
 
 
 int check_exist(char *fname){
@@ -30,14 +38,29 @@ void print_version (int exit_code){
 
 void print_usage (int exit_code){
 
-	printf ("Usage: diff_bams -a bam_a.bam -b bam_b.bsm [-r reference.fa] [] [] [-h] [-v]\n\n");
+	printf ("Usage: diff_bams -a bam_a.bam -b bam_b.bsm [-r reference.fa] [-c [-w window]] [-s] [-f [-l limit]] [-@ threads] [-h] [-v]\n");
+	printf ("       diff_bams -u -a bam_a.bam -b bam_b.bam [-r reference.fa] [-s] [-f] [-P partitions] [-m MB] [-T dir] [-@ threads]\n\n");
 	printf ("Required:\n");
 	printf ("-a --bam_a          The first BAM|CRAM file.\n");
 	printf ("-b --bam_b          The second BAM|CRAM file.\n\n");
 	printf ("Other:\n");
   printf ("-r --ref            Required for CRAM, genome.fa with co-located fai.\n");
-  printf ("-c --count          Count flag differences.\n");
-  printf ("-s --skip           Don't include reads with MAPQ=0 in comparison.\n\n");
+  printf ("-c --count          Count flag differences and list their locations, inputs must be coordinate sorted.\n");
+  printf ("-w --window         With -c, count locations in windows of this many bases, reported by window start [1].\n");
+  printf ("-s --skip           Don't include reads with MAPQ=0 in comparison.\n");
+  printf ("-f --full           Compare every field, counting mismatches by field (FLAG, MAPQ, CIGAR, mate, TLEN, SEQ, QUAL, each aux tag)\n");
+  printf ("                    rather than stopping at a flag difference. Exits non-zero if any record differs.\n");
+  printf ("-l --limit          With -f, stop after this many differing records, 0 for no limit [1000].\n");
+  printf ("-@ --threads        Number of additional threads shared by both files to decompress BAM blocks / decode CRAM containers [0].\n");
+  printf ("                    Each file is always decoded on its own thread, ahead of the comparison.\n");
+  printf ("                    When > 1 and both files are indexed, index balanced regions are compared on this many threads instead.\n\n");
+  printf ("Any record order:\n");
+  printf ("-u --unordered      Match records by name, read 1/2 and secondary/supplementary status whatever the order of either file,\n");
+  printf ("                    e.g. name collated against coordinate sorted. Compares tid, pos and flag (every field with -f),\n");
+  printf ("                    reports counts of matching, differing and unmatched records. Exits non-zero if any differ.\n");
+  printf ("-P --partitions     Temporary partition files per input [%d].\n",DIFF_PARTITIONS);
+  printf ("-m --memory         Memory in MB for joining partitions, shared by the -@ threads [1024].\n");
+  printf ("-T --tmpdir         Directory for partition files, 16 bytes per record [$TMPDIR or /tmp].\n\n");
   printf ("-h --help           Display this usage information.\n");
 	printf ("-v --version        Prints the version number.\n\n");
   exit(exit_code);
@@ -54,6 +77,14 @@ void options(int argc, char *argv[]){
               {"bam_b",required_argument,0,'b'},
               {"skip",no_argument,0,'s'},
               {"count",no_argument,0,'c'},
+              {"window",required_argument,0,'w'},
+              {"full",no_argument,0,'f'},
+              {"unordered",no_argument,0,'u'},
+              {"partitions",required_argument,0,'P'},
+              {"memory",required_argument,0,'m'},
+              {"tmpdir",required_argument,0,'T'},
+              {"limit",required_argument,0,'l'},
+              {"threads",required_argument,0,'@'},
               { NULL, 0, NULL, 0}
 
    }; //End of declaring opts
@@ -62,7 +93,7 @@ void options(int argc, char *argv[]){
    int iarg = 0;
 
      //Iterate through options
-   while((iarg = getopt_long(argc, argv, "a:b:r:scvh", long_opts, &index)) != -1){
+   while((iarg = getopt_long(argc, argv, "a:b:r:@:l:w:P:m:T:scfuvh", long_opts, &index)) != -1){
     switch(iarg){
       case 's':
         skip_z = 1;
@@ -72,6 +103,53 @@ void options(int argc, char *argv[]){
         count_flag_diff = 1;
         break;
 
+      case 'w':
+        if(sscanf(optarg, "%"SCNi32, &window) != 1 || window < 1){
+          fprintf(stderr,"Invalid window (-w) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+      case 'f':
+        full = 1;
+        break;
+
+      case 'u':
+        unordered = 1;
+        break;
+
+      case 'P':
+        if(sscanf(optarg, "%i", &n_parts) != 1 || n_parts < 1){
+          fprintf(stderr,"Invalid number of partitions (-P) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+      case 'm':
+        if(sscanf(optarg, "%"SCNu64, &mem_mb) != 1 || mem_mb < 1){
+          fprintf(stderr,"Invalid memory (-m) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+      case 'T':
+        tmp_dir = optarg;
+        break;
+
+      case 'l':
+        if(sscanf(optarg, "%"SCNu64, &limit) != 1){
+          fprintf(stderr,"Invalid limit (-l) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
+      case '@':
+        if(sscanf(optarg, "%i", &nthreads) != 1 || nthreads < 0){
+          fprintf(stderr,"Invalid number of threads (-@) '%s'.\n",optarg);
+          print_usage(1);
+        }
+        break;
+
       case 'r':
         ref_file = optarg;
         break;
@@ -104,6 +182,16 @@ void options(int argc, char *argv[]){
    }//End of iteration through options
 
    //Do some checking to ensure required arguments were passed and are accessible files
+  if(unordered && count_flag_diff){
+    fprintf(stderr,"Option '-c' can't be used with '-u', records aren't compared in coordinate order\n");
+    print_usage(1);
+  }
+
+  if(tmp_dir == NULL){
+    tmp_dir = getenv("TMPDIR");
+    if(tmp_dir == NULL) tmp_dir = "/tmp";
+  }
+
   if(ref_file != NULL){
     if(check_exist(ref_file) != 1){
       fprintf(stderr,"Reference fasta file (-r) %s does not exist.\n",ref_file);
@@ -139,9 +227,14 @@ int main(int argc, char *argv[]){
   htsFile *htsb = NULL;
   bam_hdr_t *heada = NULL;
   bam_hdr_t *headb = NULL;
-  khash_t(chrom) *chr_hash = NULL;
+  hts_idx_t *idxa = NULL;
+  hts_idx_t *idxb = NULL;
+  diff_result_t result = {0, 0, NULL, 0, NULL};
   bam1_t *reada = NULL;
   bam1_t *readb = NULL;
+  diff_stream_t *streama = NULL;
+  diff_stream_t *streamb = NULL;
+  htsThreadPool pool = {NULL, 0};
   options(argc, argv);
   //Open bam file a
   htsa = hts_open(bam_a_loc,"r");
@@ -155,6 +248,26 @@ int main(int argc, char *argv[]){
     hts_set_fai_filename(htsb, ref_file);
   }
 
+  //Indexed inputs are compared region by region on nthreads workers, each opening both files
+  if(nthreads > 1 && !unordered){
+    idxa = sam_index_load(htsa, bam_a_loc);
+    idxb = sam_index_load(htsb, bam_b_loc);
+    if(idxa == NULL || idxb == NULL){
+      if(idxa) hts_idx_destroy(idxa);
+      if(idxb) hts_idx_destroy(idxb);
+      idxa = NULL;
+      idxb = NULL;
+    }
+  }
+
+  //Otherwise one pool decompresses both files
+  if(nthreads > 0 && idxa == NULL){
+    pool.pool = hts_tpool_init(nthreads);
+    check(pool.pool != NULL, "Error creating thread pool of %d threads.",nthreads);
+    check(hts_set_opt(htsa, HTS_OPT_THREAD_POOL, &pool) == 0, "Error attaching thread pool to '%s'.",bam_a_loc);
+    check(hts_set_opt(htsb, HTS_OPT_THREAD_POOL, &pool) == 0, "Error attaching thread pool to '%s'.",bam_b_loc);
+  }
+
   heada = sam_hdr_read(htsa);
   check(heada != NULL, "Error reading header from opened hts file 'a' '%s'.",bam_a_loc);
   headb = sam_hdr_read(htsb);
@@ -173,130 +286,118 @@ int main(int argc, char *argv[]){
   }
   fprintf(stdout,"Reference sequence order passed\n");
 
-  uint64_t count = 0;
-  uint64_t flag_diffs = 0;
-  uint64_t last_coord = 0;
-  int chka = 0;
-  int chkb = 0;
-  reada = bam_init1();
-  readb = bam_init1();
-  while(1){
-    count++;
-    //Check the individual reads
-    chka = sam_read1(htsa,heada,reada);
-    chkb = sam_read1(htsb,headb,readb);
-
-    if(skip_z==1){
-      //Move to next non 0 MQ read
-      while(reada->core.qual == 0 && chka >= 0) {
-        chka = sam_read1(htsa,heada,reada);
+  diff_opts_t opts = {skip_z, count_flag_diff, window, full, full ? limit : 0};
+  if(unordered){
+    diff_unordered_t counts = {0, 0, 0, 0, 0, 0};
+    check(diff_bams_unordered(htsa, heada, htsb, headb, tmp_dir, n_parts, mem_mb << 20, &opts, nthreads, &counts) == 0,
+            "Error comparing '%s' and '%s'.",bam_a_loc,bam_b_loc);
+    fprintf(stdout,"Records in a: %"PRIu64"\n",counts.records_a);
+    fprintf(stdout,"Records in b: %"PRIu64"\n",counts.records_b);
+    fprintf(stdout,"Matching records: %"PRIu64"\n",counts.matched);
+    fprintf(stdout,"Differing records: %"PRIu64"\n",counts.differ);
+    fprintf(stdout,"Only in a: %"PRIu64"\n",counts.only_a);
+    fprintf(stdout,"Only in b: %"PRIu64"\n",counts.only_b);
+    int differ = counts.differ || counts.only_a || counts.only_b;
+    bam_hdr_destroy(heada);
+    bam_hdr_destroy(headb);
+    hts_close(htsa);
+    hts_close(htsb);
+    if(pool.pool) hts_tpool_destroy(pool.pool);
+    return differ;
+  }
+
+  if(idxa && idxb){
+    log_info("Comparing index regions on %d threads.",nthreads);
+    check(diff_bams_parallel(bam_a_loc, bam_b_loc, ref_file, heada, idxa, &opts, nthreads, &result) == 0,
+            "Error comparing '%s' and '%s'.",bam_a_loc,bam_b_loc);
+  }else{
+    //Decode both files concurrently, MAPQ 0 records are dropped by the decoders
+    streama = diff_bams_stream_start(htsa,heada,skip_z);
+    check(streama != NULL, "Error starting decoder for '%s'.",bam_a_loc);
+    streamb = diff_bams_stream_start(htsb,headb,skip_z);
+    check(streamb != NULL, "Error starting decoder for '%s'.",bam_b_loc);
+    uint64_t count = 0;
+    while(1){
+      count++;
+      //Check the individual reads
+      reada = diff_bams_stream_next(streama);
+      readb = diff_bams_stream_next(streamb);
+
+      if(reada == NULL && readb == NULL){
+        break;
       }
-      while(readb->core.qual == 0 && chkb >= 0) {
-        chkb = sam_read1(htsb,headb,readb);
+      if(reada == NULL || readb == NULL){
+        sentinel("Files have different number of records\n");
       }
-    }
-
-    if(chka<0 && chkb<0){
-      break;
-    }
-    if((chka>=0 && chkb <0) || (chkb>=0 && chka<0)){
-      sentinel("Files have different number of records\n");
-    }
-
-    if(reada->core.tid != readb->core.tid || reada->core.pos != readb->core.pos || strcmp(bam_get_qname(reada),bam_get_qname(readb))!=0){
-      sentinel("Files differ at record %"PRIu64" (qname) a=%s b=%s\n",count,bam_get_qname(reada),bam_get_qname(readb));
-    }
-
-    if(reada->core.flag != readb->core.flag){
-      if(count_flag_diff==1){
-        if(chr_hash == NULL){ chr_hash = kh_init(chrom);}
-        flag_diffs++;
-        int32_t pos = reada->core.pos;
-        if((pos - last_coord) >=0 ){ //Checking for different chr
-          int res;
-          khiter_t k = kh_get(chrom, chr_hash, reada->core.tid); // query the hash table
-          khash_t(posn) *pos_hash = NULL;
-          if(k == kh_end(chr_hash)){
-            k = kh_put(chrom,chr_hash,reada->core.tid,&res);
-            pos_hash = kh_init(posn);
-            khiter_t kpos = kh_put(posn,pos_hash,pos,&res);
-            kh_value(pos_hash,kpos) = 1;
-            kh_value(chr_hash,k) = *pos_hash;
-          }else{
-            *pos_hash = kh_value(chr_hash,k);
-            khiter_t kpos = kh_get(posn, pos_hash, pos); // query the pos hash table
-            if(kpos == kh_end(pos_hash)){
-              kpos = kh_put(posn,pos_hash,pos,&res);
-              kh_value(pos_hash,kpos) = 1;
-            }else{
-              kh_value(pos_hash,kpos) = kh_value(pos_hash,kpos)+1;
-            }
-            kh_value(chr_hash,k) = *pos_hash;
-          }
-        }
-        last_coord = pos;
-      }else{
+      int cmp = diff_bams_compare(reada, readb, &opts, &result);
+      check(cmp >= 0, "Error comparing record %"PRIu64".",count);
+      if(cmp == DIFF_RECORD){
+        sentinel("Files differ at record %"PRIu64" (qname) a=%s b=%s\n",count,bam_get_qname(reada),bam_get_qname(readb));
+      }
+      if(cmp == DIFF_FLAGS){
         sentinel("Files differ at record %"PRIu64" (flags) a=%s b=%s\n",count,bam_get_qname(reada),bam_get_qname(readb));
       }
-    }//End of if flags don't match
-    if(count % 5000000 == 0) {
-      fprintf(stdout,"Matching records: %"PRIu64"",count);
-      if(count_flag_diff){
-        fprintf(stdout,"\t(flag mismatch: %"PRIu64")",flag_diffs);
+      if(opts.limit && result.differ >= opts.limit) break;
+      if(count % 5000000 == 0) {
+        fprintf(stdout,"Matching records: %"PRIu64"",count);
+        if(count_flag_diff){
+          fprintf(stdout,"\t(flag mismatch: %"PRIu64")",result.flag_diffs);
+        }
+        if(full){
+          fprintf(stdout,"\t(differing: %"PRIu64")",result.differ);
+        }
+        fprintf(stdout,"\r");
       }
-      fprintf(stdout,"\r");
-    }
-  }//End of looping through all reads
+    }//End of looping through all reads
+
+    int chka = diff_bams_stream_finish(streama);
+    streama = NULL;
+    int chkb = diff_bams_stream_finish(streamb);
+    streamb = NULL;
+    //Stopping at the limit leaves the decoders short of the end
+    int stopped = opts.limit && result.differ >= opts.limit;
+    check(chka == -1 || (stopped && chka == 0), "Error reading records from '%s'.",bam_a_loc);
+    check(chkb == -1 || (stopped && chkb == 0), "Error reading records from '%s'.",bam_b_loc);
+  }
 
-  fprintf(stdout,"Matching records: %"PRIu64"\n",count);
-  if(count_flag_diff && chr_hash != NULL){
-    fprintf(stdout,"Flag mismatches: %"PRIu64"\n",flag_diffs);
+  //Reported as one more than the records compared, as diff_bams.pl always has
+  fprintf(stdout,"Matching records: %"PRIu64"\n",result.records + 1);
+  if(count_flag_diff && result.loci != NULL){
+    fprintf(stdout,"Flag mismatches: %"PRIu64"\n",result.flag_diffs);
     fprintf(stdout,"Locations of flag differences:\n");
     fprintf(stdout,"#Chr\tPos\tCount\n");
-    khiter_t k;
-    for (k = kh_begin(chr_hash); k != kh_end(chr_hash); ++k) {
-      if (kh_exist(chr_hash, k)) {
-        const int32_t keyp = kh_key(chr_hash,k);
-        khash_t(posn) pos_hash = kh_value(chr_hash, k);
-        khiter_t kpos;
-        for (kpos = kh_begin(&pos_hash); kpos != kh_end(&pos_hash); ++kpos) {
-          if (kh_exist(&pos_hash, kpos)) {
-            const int32_t key = kh_key(&pos_hash,kpos);
-            int32_t counter = kh_value(&pos_hash,kpos);
-            fprintf(stdout,"%s\t%"PRIi32"\t%"PRIi32"\n",heada->target_name[keyp], key, counter);
-            kh_destroy(posn,&pos_hash);
-          }
-        }
-
-      }
+    check(diff_bams_loci_write(stdout, heada, result.loci) == 0, "Error writing locations of flag differences.");
+  }
+  if(full){
+    if(opts.limit && result.differ >= opts.limit) log_warn("Stopped after %"PRIu64" differing records (-l).",result.differ);
+    fprintf(stdout,"Differing records: %"PRIu64"\n",result.differ);
+    if(result.fields != NULL){
+      fprintf(stdout,"Mismatches by field:\n");
+      check(diff_bams_fields_write(stdout, result.fields) == 0, "Error writing mismatches by field.");
     }
-    kh_destroy(chrom,chr_hash);
   }
 
-  bam_destroy1(reada);
-  bam_destroy1(readb);
+  int differ = full && result.differ > 0;
+  diff_bams_result_destroy(&result);
+  if(idxa) hts_idx_destroy(idxa);
+  if(idxb) hts_idx_destroy(idxb);
   bam_hdr_destroy(heada);
   bam_hdr_destroy(headb);
   hts_close(htsa);
   hts_close(htsb);
-  return 0;
+  if(pool.pool) hts_tpool_destroy(pool.pool);
+  return differ;
 error:
-  if(count_flag_diff && chr_hash != NULL){
-    khiter_t k;
-    for (k = kh_begin(chr_hash); k != kh_end(chr_hash); ++k) {
-      if (kh_exist(chr_hash, k)) {
-        const int32_t keyp = kh_key(chr_hash,k);
-        khash_t(posn) pos_hash = kh_value(chr_hash, k);
-        kh_destroy(posn,&pos_hash);
-      }
-    }
-    kh_destroy(chrom,chr_hash);
-  }
-  if(reada) bam_destroy1(reada);
-  if(readb) bam_destroy1(readb);
+  diff_bams_result_destroy(&result);
+  if(idxa) hts_idx_destroy(idxa);
+  if(idxb) hts_idx_destroy(idxb);
+  //Records belong to the streams
+  if(streama) diff_bams_stream_finish(streama);
+  if(streamb) diff_bams_stream_finish(streamb);
   if(heada) bam_hdr_destroy(heada);
   if(headb) bam_hdr_destroy(headb);
   if(htsa) hts_close(htsa);
   if(htsb) hts_close(htsb);
+  if(pool.pool) hts_tpool_destroy(pool.pool);
   return 1;
 }
\ No newline at end of file
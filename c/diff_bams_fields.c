@@ -0,0 +1,190 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "diff_bams_fields.h"
+
+static const char *field_names[DIFF_FIELDS] = {"FLAG", "MAPQ", "CIGAR", "RNEXT", "PNEXT", "TLEN", "SEQ", "QUAL", "AUX", "OTHER"};
+
+diff_fields_t *diff_bams_fields_init(){
+  diff_fields_t *fields = (diff_fields_t *) calloc(1, sizeof(diff_fields_t));
+  check_mem(fields);
+  fields->tags = (uint64_t *) calloc(DIFF_AUX_TAGS, sizeof(uint64_t));
+  check_mem(fields->tags);
+  return fields;
+error:
+  diff_bams_fields_destroy(fields);
+  return NULL;
+}
+
+//Start of the tag after the one at s, NULL if it runs past end
+static uint8_t *aux_skip(uint8_t *s, uint8_t *end){
+  if(s + 3 > end) return NULL;
+  uint8_t *val = s + 2;
+  switch(*val){
+    case 'A': case 'c': case 'C':
+      s = val + 2;
+      break;
+    case 's': case 'S':
+      s = val + 3;
+      break;
+    case 'i': case 'I': case 'f':
+      s = val + 5;
+      break;
+    case 'd':
+      s = val + 9;
+      break;
+    case 'Z': case 'H':
+      s = val + 1;
+      while(s < end && *s) s++;
+      s++;
+      break;
+    case 'B': {
+      if(val + 6 > end) return NULL;
+      uint8_t sub = val[1];
+      uint32_t n;
+      memcpy(&n, val + 2, 4);
+      int size = (sub == 'c' || sub == 'C') ? 1 : (sub == 's' || sub == 'S') ? 2 : 4;
+      s = val + 6 + (uint64_t)n * size;
+      break;
+    }
+    default:
+      return NULL;
+  }
+  return s <= end ? s : NULL;
+}
+
+//Returns the tag in [s, end) with the same name as tag, setting *next to the tag following it
+static uint8_t *aux_find(uint8_t *s, uint8_t *end, uint8_t *tag, uint8_t **next){
+  while(s < end){
+    uint8_t *n = aux_skip(s, end);
+    if(n == NULL) return NULL;
+    if(s[0] == tag[0] && s[1] == tag[1]){
+      *next = n;
+      return s;
+    }
+    s = n;
+  }
+  return NULL;
+}
+
+static int compare_aux(bam1_t *a, bam1_t *b, diff_fields_t *fields){
+  uint8_t *a_end = a->data + a->l_data;
+  uint8_t *b_end = b->data + b->l_data;
+  uint8_t *s, *n, *other, *other_n;
+  int differ = 0;
+  //Tags in a missing from or different in b
+  for(s = bam_get_aux(a); s < a_end; s = n){
+    n = aux_skip(s, a_end);
+    check(n != NULL, "Malformed aux data in read %s.", bam_get_qname(a));
+    other = aux_find(bam_get_aux(b), b_end, s, &other_n);
+    if(other == NULL || n - s != other_n - other || memcmp(s, other, n - s) != 0){
+      fields->tags[s[0] << 8 | s[1]]++;
+      differ = 1;
+    }
+  }
+  //Tags only in b
+  for(s = bam_get_aux(b); s < b_end; s = n){
+    n = aux_skip(s, b_end);
+    check(n != NULL, "Malformed aux data in read %s.", bam_get_qname(b));
+    if(aux_find(bam_get_aux(a), a_end, s, &other_n) == NULL){
+      fields->tags[s[0] << 8 | s[1]]++;
+      differ = 1;
+    }
+  }
+  return differ;
+error:
+  return -1;
+}
+
+int diff_bams_fields_compare(bam1_t *a, bam1_t *b, diff_fields_t *fields){
+  assert(a != NULL);
+  assert(b != NULL);
+  assert(fields != NULL);
+  //Identical records, by far the common case
+  if(a->l_data == b->l_data && memcmp(&a->core, &b->core, sizeof(bam1_core_t)) == 0
+      && memcmp(a->data, b->data, a->l_data) == 0) return 0;
+
+  bam1_core_t *ca = &a->core;
+  bam1_core_t *cb = &b->core;
+  int found = 0;
+  if(ca->flag != cb->flag){ fields->fields[DIFF_FIELD_FLAG]++; found = 1; }
+  if(ca->qual != cb->qual){ fields->fields[DIFF_FIELD_MAPQ]++; found = 1; }
+  if(ca->n_cigar != cb->n_cigar || memcmp(bam_get_cigar(a), bam_get_cigar(b), ca->n_cigar << 2) != 0){
+    fields->fields[DIFF_FIELD_CIGAR]++;
+    found = 1;
+  }
+  if(ca->mtid != cb->mtid){ fields->fields[DIFF_FIELD_RNEXT]++; found = 1; }
+  if(ca->mpos != cb->mpos){ fields->fields[DIFF_FIELD_PNEXT]++; found = 1; }
+  if(ca->isize != cb->isize){ fields->fields[DIFF_FIELD_TLEN]++; found = 1; }
+  if(ca->l_qseq != cb->l_qseq || memcmp(bam_get_seq(a), bam_get_seq(b), (ca->l_qseq + 1) >> 1) != 0){
+    fields->fields[DIFF_FIELD_SEQ]++;
+    found = 1;
+  }
+  if(ca->l_qseq != cb->l_qseq || memcmp(bam_get_qual(a), bam_get_qual(b), ca->l_qseq) != 0){
+    fields->fields[DIFF_FIELD_QUAL]++;
+    found = 1;
+  }
+  int aux = compare_aux(a, b, fields);
+  check(aux >= 0, "Error comparing aux data of read %s.", bam_get_qname(a));
+  if(aux){ fields->fields[DIFF_FIELD_AUX]++; found = 1; }
+  if(!found) fields->fields[DIFF_FIELD_OTHER]++;
+  return 1;
+
+error:
+  return -1;
+}
+
+int diff_bams_fields_merge(diff_fields_t *target, diff_fields_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  int i;
+  for(i=0; i<DIFF_FIELDS; i++) target->fields[i] += source->fields[i];
+  for(i=0; i<DIFF_AUX_TAGS; i++) target->tags[i] += source->tags[i];
+  return 0;
+}
+
+int diff_bams_fields_write(FILE *out, diff_fields_t *fields){
+  assert(out != NULL);
+  assert(fields != NULL);
+  int i;
+  check(fprintf(out, "#Field\tMismatches\n") >= 0, "Error writing field mismatches.");
+  for(i=0; i<DIFF_FIELDS; i++){
+    check(fprintf(out, "%s\t%"PRIu64"\n", field_names[i], fields->fields[i]) >= 0, "Error writing field mismatches.");
+    if(i != DIFF_FIELD_AUX) continue;
+    int t;
+    for(t=0; t<DIFF_AUX_TAGS; t++){
+      if(fields->tags[t] == 0) continue;
+      check(fprintf(out, "AUX:%c%c\t%"PRIu64"\n", t >> 8, t & 0xff, fields->tags[t]) >= 0, "Error writing field mismatches.");
+    }
+  }
+  return 0;
+error:
+  return -1;
+}
+
+void diff_bams_fields_destroy(diff_fields_t *fields){
+  if(fields == NULL) return;
+  if(fields->tags) free(fields->tags);
+  free(fields);
+}
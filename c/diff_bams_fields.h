@@ -0,0 +1,63 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __diff_bams_fields_h__
+#define __diff_bams_fields_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "htslib/sam.h"
+
+//Fields compared after tid, pos and qname have matched, in report order
+enum {
+  DIFF_FIELD_FLAG,
+  DIFF_FIELD_MAPQ,
+  DIFF_FIELD_CIGAR,
+  DIFF_FIELD_RNEXT,
+  DIFF_FIELD_PNEXT,
+  DIFF_FIELD_TLEN,
+  DIFF_FIELD_SEQ,
+  DIFF_FIELD_QUAL,
+  DIFF_FIELD_AUX, //any aux tag, counted per tag in tags
+  DIFF_FIELD_OTHER, //bin, aux tag order or other encoding only differences
+  DIFF_FIELDS
+};
+
+#define DIFF_AUX_TAGS 65536 //One counter per two character tag
+
+//Mismatch counts by field, each counted at most once per record
+typedef struct {
+  uint64_t fields[DIFF_FIELDS];
+  uint64_t *tags; //[tag[0] << 8 | tag[1]]
+} diff_fields_t;
+
+diff_fields_t *diff_bams_fields_init();
+
+//Records must already match on tid, pos and qname. Returns 0 when identical, 1 when different
+//(counted in fields), -1 on a malformed aux block. Identical records cost a memcmp of core and data.
+int diff_bams_fields_compare(bam1_t *a, bam1_t *b, diff_fields_t *fields);
+
+int diff_bams_fields_merge(diff_fields_t *target, diff_fields_t *source);
+
+//"#Field\tMismatches" rows, fixed fields in SAM column order then aux tags that differed
+int diff_bams_fields_write(FILE *out, diff_fields_t *fields);
+
+void diff_bams_fields_destroy(diff_fields_t *fields);
+
+#endif
@@ -0,0 +1,135 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "dbg.h"
+#include "diff_bams_loci.h"
+
+//Runs read back from a spool per fread
+#define LOCI_READ_BUFFER 4096
+
+diff_loci_t *diff_bams_loci_init(int32_t window){
+  diff_loci_t *loci = (diff_loci_t *) calloc(1, sizeof(diff_loci_t));
+  check_mem(loci);
+  loci->window = window > 1 ? window : 1;
+  loci->spool = tmpfile();
+  check(loci->spool != NULL, "Error creating temporary file for flag difference locations.");
+  return loci;
+error:
+  diff_bams_loci_destroy(loci);
+  return NULL;
+}
+
+int diff_bams_loci_add(diff_loci_t *loci, int32_t tid, int32_t pos, uint64_t count){
+  assert(loci != NULL);
+  if(loci->window > 1 && pos >= 0) pos -= pos % loci->window;
+  if(loci->run.count && loci->run.tid == tid && loci->run.pos == pos){
+    loci->run.count += count;
+    return 0;
+  }
+  if(loci->run.count){
+    //Unplaced records (tid -1) sort after every contig
+    check((uint32_t)tid > (uint32_t)loci->run.tid || (tid == loci->run.tid && pos > loci->run.pos),
+            "Flag difference at %"PRIi32":%"PRIi32" comes before %"PRIi32":%"PRIi32", counting locations needs coordinate sorted input.",
+            tid,pos,loci->run.tid,loci->run.pos);
+    check(fwrite(&loci->run, sizeof(diff_locus_t), 1, loci->spool) == 1, "Error writing flag difference locations.");
+  }
+  loci->run.tid = tid;
+  loci->run.pos = pos;
+  loci->run.count = count;
+  return 0;
+error:
+  return -1;
+}
+
+int64_t diff_bams_loci_mark(diff_loci_t *loci){
+  assert(loci != NULL);
+  if(loci->run.count){
+    check(fwrite(&loci->run, sizeof(diff_locus_t), 1, loci->spool) == 1, "Error writing flag difference locations.");
+    loci->run.count = 0;
+  }
+  int64_t off = ftello(loci->spool);
+  check(off >= 0, "Error finding position in flag difference locations.");
+  return off;
+error:
+  return -1;
+}
+
+//Calls fn on each run in [beg, end) of the spool, leaving the spool positioned at its end for further runs
+static int loci_read(diff_loci_t *loci, int64_t beg, int64_t end, int (*fn)(diff_locus_t *run, void *data), void *data){
+  diff_locus_t buf[LOCI_READ_BUFFER];
+  check(fflush(loci->spool) == 0, "Error flushing flag difference locations.");
+  check(fseeko(loci->spool, beg, SEEK_SET) == 0, "Error seeking in flag difference locations.");
+  int64_t left = (end - beg) / sizeof(diff_locus_t);
+  while(left > 0){
+    size_t want = left < LOCI_READ_BUFFER ? (size_t)left : LOCI_READ_BUFFER;
+    check(fread(buf, sizeof(diff_locus_t), want, loci->spool) == want, "Error reading flag difference locations.");
+    size_t i;
+    for(i=0; i<want; i++) check(fn(&buf[i], data) == 0, "Error handling flag difference location.");
+    left -= want;
+  }
+  check(fseeko(loci->spool, 0, SEEK_END) == 0, "Error seeking in flag difference locations.");
+  return 0;
+error:
+  return -1;
+}
+
+static int append_run(diff_locus_t *run, void *data){
+  return diff_bams_loci_add((diff_loci_t *) data, run->tid, run->pos, run->count);
+}
+
+int diff_bams_loci_append(diff_loci_t *target, diff_loci_t *source, int64_t beg, int64_t end){
+  assert(target != NULL);
+  assert(source != NULL);
+  assert(target != source);
+  if(end <= beg) return 0;
+  return loci_read(source, beg, end, append_run, target);
+}
+
+typedef struct {
+  FILE *out;
+  bam_hdr_t *head;
+} loci_writer_t;
+
+static int write_run(diff_locus_t *run, void *data){
+  loci_writer_t *w = (loci_writer_t *) data;
+  const char *name = run->tid >= 0 && run->tid < w->head->n_targets ? w->head->target_name[run->tid] : "*";
+  return fprintf(w->out, "%s\t%"PRIi32"\t%"PRIu64"\n", name, run->pos, run->count) < 0 ? -1 : 0;
+}
+
+int diff_bams_loci_write(FILE *out, bam_hdr_t *head, diff_loci_t *loci){
+  assert(out != NULL);
+  assert(head != NULL);
+  assert(loci != NULL);
+  int64_t end = diff_bams_loci_mark(loci);
+  check(end >= 0, "Error ending flag difference locations.");
+  loci_writer_t w = {out, head};
+  check(loci_read(loci, 0, end, write_run, &w) == 0, "Error writing flag difference locations.");
+  return 0;
+error:
+  return -1;
+}
+
+void diff_bams_loci_destroy(diff_loci_t *loci){
+  if(loci == NULL) return;
+  if(loci->spool) fclose(loci->spool);
+  free(loci);
+}
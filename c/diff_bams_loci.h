@@ -0,0 +1,60 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __diff_bams_loci_h__
+#define __diff_bams_loci_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "htslib/sam.h"
+
+//Flag difference count for one position (or window start)
+typedef struct {
+  int32_t tid;
+  int32_t pos;
+  uint64_t count;
+} diff_locus_t;
+
+//Run-length accumulator over flag difference locations. Coordinate sorted input gives each
+//location as one run, written out to a temporary spool as soon as the position moves on,
+//so memory use doesn't depend on the number of differences and the spool is already sorted.
+typedef struct {
+  FILE *spool; //diff_locus_t, in the order seen
+  diff_locus_t run; //current run, count 0 when empty
+  int32_t window; //positions are binned to window starts, 1 for per position
+} diff_loci_t;
+
+//window of 0 or 1 counts per position
+diff_loci_t *diff_bams_loci_init(int32_t window);
+
+//Fails if the location comes before the current run, i.e. the input isn't coordinate sorted
+int diff_bams_loci_add(diff_loci_t *loci, int32_t tid, int32_t pos, uint64_t count);
+
+//Ends the current run, returning the spool offset after it (-1 on error)
+int64_t diff_bams_loci_mark(diff_loci_t *loci);
+
+//Adds the runs spooled in source between two marks, a run continuing the target's current one is merged
+int diff_bams_loci_append(diff_loci_t *target, diff_loci_t *source, int64_t beg, int64_t end);
+
+//"#Chr\tPos\tCount" rows in spool order, '*' for records without a contig
+int diff_bams_loci_write(FILE *out, bam_hdr_t *head, diff_loci_t *loci);
+
+void diff_bams_loci_destroy(diff_loci_t *loci);
+
+#endif
@@ -0,0 +1,352 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg.h"
+#include "bam_access_parallel.h"
+#include "diff_bams_parallel.h"
+
+//Number of regions handed out per worker, as bam_stats
+#define DIFF_SHARDS_PER_WORKER 4
+
+//Where a region's flag difference locations are in its worker's spool
+typedef struct {
+  int worker; //-1 if none
+  int64_t beg;
+  int64_t end;
+} diff_segment_t;
+
+typedef struct {
+  char *file_a;
+  char *file_b;
+  char *ref_file;
+  shard_t *shards;
+  diff_segment_t *segments; //by shard
+  int n_shards;
+  int id;
+  int *next_shard;
+  int *stop;
+  uint64_t *differ; //shared count towards opts->limit
+  pthread_mutex_t *lock;
+  diff_opts_t *opts;
+  diff_result_t result;
+  int status;
+} diff_worker_t;
+
+int diff_bams_compare(bam1_t *a, bam1_t *b, diff_opts_t *opts, diff_result_t *result){
+  assert(a != NULL);
+  assert(b != NULL);
+  assert(opts != NULL);
+  assert(result != NULL);
+  if(a->core.tid != b->core.tid || a->core.pos != b->core.pos || strcmp(bam_get_qname(a),bam_get_qname(b))!=0) return DIFF_RECORD;
+  result->records++;
+  if(a->core.flag != b->core.flag){
+    if(!opts->count_flags && !opts->full) return DIFF_FLAGS;
+    result->flag_diffs++;
+    if(opts->count_flags){
+      if(result->loci == NULL){
+        result->loci = diff_bams_loci_init(opts->window);
+        check(result->loci != NULL, "Error allocating flag difference locations.");
+      }
+      check(diff_bams_loci_add(result->loci, a->core.tid, a->core.pos, 1) == 0, "Error counting flag difference.");
+    }
+  }
+  if(opts->full){
+    if(result->fields == NULL){
+      result->fields = diff_bams_fields_init();
+      check(result->fields != NULL, "Error allocating field mismatch counts.");
+    }
+    int chk = diff_bams_fields_compare(a, b, result->fields);
+    check(chk >= 0, "Error comparing read %s.", bam_get_qname(a));
+    result->differ += chk;
+  }
+  return DIFF_MATCH;
+error:
+  return -1;
+}
+
+int diff_bams_result_merge(diff_result_t *target, diff_result_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  target->records += source->records;
+  target->flag_diffs += source->flag_diffs;
+  target->differ += source->differ;
+  if(source->fields != NULL){
+    if(target->fields == NULL){
+      target->fields = diff_bams_fields_init();
+      check(target->fields != NULL, "Error allocating field mismatch counts.");
+    }
+    diff_bams_fields_merge(target->fields, source->fields);
+  }
+  return 0;
+error:
+  return -1;
+}
+
+void diff_bams_result_destroy(diff_result_t *result){
+  if(result == NULL) return;
+  diff_bams_loci_destroy(result->loci);
+  result->loci = NULL;
+  diff_bams_fields_destroy(result->fields);
+  result->fields = NULL;
+}
+
+//Coordinate order, the unplaced tail last
+static int cmp_shard(const void *a, const void *b){
+  const shard_t *x = (const shard_t *) a;
+  const shard_t *y = (const shard_t *) b;
+  uint32_t xt = (uint32_t) x->tid; //HTS_IDX_NOCOOR is negative so sorts last unsigned
+  uint32_t yt = (uint32_t) y->tid;
+  if(xt != yt) return xt < yt ? -1 : 1;
+  return (x->beg > y->beg) - (x->beg < y->beg);
+}
+
+static int next_in_shard(htsFile *input, hts_itr_t *iter, shard_t *shard, bam1_t *b, int skip_z){
+  int ret;
+  while((ret = sam_itr_next(input, iter, b)) >= 0){
+    //Reads overlapping the shard start are owned by the previous shard
+    if(shard->tid >= 0 && b->core.pos < shard->beg) continue;
+    if(skip_z && b->core.qual == 0) continue;
+    break;
+  }
+  return ret;
+}
+
+static int diff_shard(diff_worker_t *w, htsFile *in_a, hts_idx_t *idx_a, htsFile *in_b, hts_idx_t *idx_b, bam_hdr_t *head, shard_t *shard){
+  hts_itr_t *iter_a = NULL;
+  hts_itr_t *iter_b = NULL;
+  bam1_t *reada = NULL;
+  bam1_t *readb = NULL;
+  const char *contig = shard->tid >= 0 ? head->target_name[shard->tid] : "*";
+
+  iter_a = sam_itr_queryi(idx_a, shard->tid, shard->beg, shard->end);
+  check(iter_a != NULL, "Error creating iterator for %s:%d in '%s'.", contig, shard->beg+1, w->file_a);
+  iter_b = sam_itr_queryi(idx_b, shard->tid, shard->beg, shard->end);
+  check(iter_b != NULL, "Error creating iterator for %s:%d in '%s'.", contig, shard->beg+1, w->file_b);
+  reada = bam_init1();
+  check_mem(reada);
+  readb = bam_init1();
+  check_mem(readb);
+  while(1){
+    if((w->result.records & 0xfff) == 0 && __atomic_load_n(w->stop, __ATOMIC_RELAXED)) break;
+    int chka = next_in_shard(in_a, iter_a, shard, reada, w->opts->skip_z);
+    int chkb = next_in_shard(in_b, iter_b, shard, readb, w->opts->skip_z);
+    check(chka >= -1, "Error reading '%s' from %s:%d (%d).", w->file_a, contig, shard->beg+1, chka);
+    check(chkb >= -1, "Error reading '%s' from %s:%d (%d).", w->file_b, contig, shard->beg+1, chkb);
+    if(chka < 0 && chkb < 0) break;
+    if(chka < 0 || chkb < 0){
+      sentinel("Files have different number of records in region from %s:%d\n", contig, shard->beg+1);
+    }
+    uint64_t differ = w->result.differ;
+    int cmp = diff_bams_compare(reada, readb, w->opts, &w->result);
+    check(cmp >= 0, "Error comparing records in region from %s:%d.", contig, shard->beg+1);
+    if(cmp == DIFF_RECORD){
+      sentinel("Files differ in region from %s:%d (qname) a=%s b=%s\n", contig, shard->beg+1, bam_get_qname(reada), bam_get_qname(readb));
+    }
+    if(cmp == DIFF_FLAGS){
+      sentinel("Files differ in region from %s:%d (flags) a=%s b=%s\n", contig, shard->beg+1, bam_get_qname(reada), bam_get_qname(readb));
+    }
+    if(w->result.differ != differ && w->opts->limit && __atomic_add_fetch(w->differ, 1, __ATOMIC_RELAXED) >= w->opts->limit){
+      __atomic_store_n(w->stop, 1, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+
+  bam_destroy1(reada);
+  bam_destroy1(readb);
+  hts_itr_destroy(iter_a);
+  hts_itr_destroy(iter_b);
+  return 0;
+
+error:
+  if(reada) bam_destroy1(reada);
+  if(readb) bam_destroy1(readb);
+  if(iter_a) hts_itr_destroy(iter_a);
+  if(iter_b) hts_itr_destroy(iter_b);
+  return -1;
+}
+
+static void *diff_worker(void *arg){
+  diff_worker_t *w = (diff_worker_t *) arg;
+  htsFile *in_a = NULL;
+  htsFile *in_b = NULL;
+  bam_hdr_t *head_a = NULL;
+  bam_hdr_t *head_b = NULL;
+  hts_idx_t *idx_a = NULL;
+  hts_idx_t *idx_b = NULL;
+
+  w->status = -1;
+  in_a = hts_open(w->file_a, "r");
+  check(in_a != NULL, "Error opening hts file for reading '%s'.", w->file_a);
+  in_b = hts_open(w->file_b, "r");
+  check(in_b != NULL, "Error opening hts file for reading '%s'.", w->file_b);
+  if(w->ref_file){
+    hts_set_fai_filename(in_a, w->ref_file);
+    hts_set_fai_filename(in_b, w->ref_file);
+  }
+  head_a = sam_hdr_read(in_a);
+  check(head_a != NULL, "Error reading header from opened hts file '%s'.", w->file_a);
+  head_b = sam_hdr_read(in_b);
+  check(head_b != NULL, "Error reading header from opened hts file '%s'.", w->file_b);
+  idx_a = sam_index_load(in_a, w->file_a);
+  check(idx_a != NULL, "Error loading index for '%s'.", w->file_a);
+  idx_b = sam_index_load(in_b, w->file_b);
+  check(idx_b != NULL, "Error loading index for '%s'.", w->file_b);
+
+  while(!__atomic_load_n(w->stop, __ATOMIC_RELAXED)){
+    pthread_mutex_lock(w->lock);
+    int s = (*w->next_shard)++;
+    pthread_mutex_unlock(w->lock);
+    if(s >= w->n_shards) break;
+    int64_t beg = w->result.loci ? diff_bams_loci_mark(w->result.loci) : 0;
+    check(beg >= 0, "Error marking flag difference locations.");
+    check(diff_shard(w, in_a, idx_a, in_b, idx_b, head_a, &w->shards[s]) == 0, "Error comparing region %d.", s);
+    if(w->result.loci){
+      w->segments[s].worker = w->id;
+      w->segments[s].beg = beg;
+      w->segments[s].end = diff_bams_loci_mark(w->result.loci);
+      check(w->segments[s].end >= 0, "Error marking flag difference locations.");
+    }
+  }
+
+  w->status = 0;
+error:
+  if(w->status != 0) __atomic_store_n(w->stop, 1, __ATOMIC_RELAXED);
+  if(idx_a) hts_idx_destroy(idx_a);
+  if(idx_b) hts_idx_destroy(idx_b);
+  if(head_a) bam_hdr_destroy(head_a);
+  if(head_b) bam_hdr_destroy(head_b);
+  if(in_a) hts_close(in_a);
+  if(in_b) hts_close(in_b);
+  return NULL;
+}
+
+int diff_bams_parallel(char *file_a, char *file_b, char *ref_file, bam_hdr_t *head, hts_idx_t *idx_a,
+                        diff_opts_t *opts, int nthreads, diff_result_t *result){
+  assert(file_a != NULL);
+  assert(file_b != NULL);
+  assert(head != NULL);
+  assert(idx_a != NULL);
+  assert(opts != NULL);
+  assert(result != NULL);
+  shard_t *shards = NULL;
+  diff_segment_t *segments = NULL;
+  uint8_t *planned = NULL;
+  diff_worker_t *workers = NULL;
+  pthread_t *threads = NULL;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  int n_shards = 0;
+  int next_shard = 0;
+  int stop = 0;
+  uint64_t differ = 0;
+  int started = 0;
+  int i, tid;
+  if(nthreads < 1) nthreads = 1;
+
+  //Regions are balanced on 'a', which may have no reads where 'b' does, so every contig gets at least one region
+  shards = bam_access_parallel_plan_shards(head, idx_a, nthreads * DIFF_SHARDS_PER_WORKER, &n_shards);
+  check(shards != NULL, "Error planning regions from index of '%s'.", file_a);
+  planned = (uint8_t *) calloc(head->n_targets + 1, sizeof(uint8_t));
+  check_mem(planned);
+  int missing = 0;
+  for(i=0; i<n_shards; i++) if(shards[i].tid >= 0) planned[shards[i].tid] = 1;
+  for(tid=0; tid<head->n_targets; tid++) if(!planned[tid]) missing++;
+  if(missing){
+    shard_t *grown = (shard_t *) realloc(shards, sizeof(shard_t) * (n_shards + missing));
+    check_mem(grown);
+    shards = grown;
+    for(tid=0; tid<head->n_targets; tid++){
+      if(planned[tid]) continue;
+      shards[n_shards].tid = tid;
+      shards[n_shards].beg = 0;
+      shards[n_shards].end = INT_MAX;
+      n_shards++;
+    }
+  }
+  qsort(shards, n_shards, sizeof(shard_t), cmp_shard);
+  segments = (diff_segment_t *) malloc(sizeof(diff_segment_t) * n_shards);
+  check_mem(segments);
+  for(i=0; i<n_shards; i++) segments[i].worker = -1;
+
+  workers = (diff_worker_t *) calloc(nthreads, sizeof(diff_worker_t));
+  check_mem(workers);
+  threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+  check_mem(threads);
+  for(i=0; i<nthreads; i++){
+    workers[i].file_a = file_a;
+    workers[i].file_b = file_b;
+    workers[i].ref_file = ref_file;
+    workers[i].shards = shards;
+    workers[i].segments = segments;
+    workers[i].n_shards = n_shards;
+    workers[i].id = i;
+    workers[i].next_shard = &next_shard;
+    workers[i].stop = &stop;
+    workers[i].differ = &differ;
+    workers[i].lock = &lock;
+    workers[i].opts = opts;
+  }
+  for(started=0; started<nthreads; started++){
+    check(pthread_create(&threads[started], NULL, diff_worker, &workers[started]) == 0, "Error starting worker thread %d.", started);
+  }
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  started = 0;
+
+  for(i=0; i<nthreads; i++){
+    check(workers[i].status == 0, "Worker %d failed.", i);
+    check(diff_bams_result_merge(result, &workers[i].result) == 0, "Error merging results from worker %d.", i);
+  }
+  //Each region's locations are a run of its worker's spool, stitched back together in region order
+  for(i=0; i<n_shards; i++){
+    diff_loci_t *source = segments[i].worker < 0 ? NULL : workers[segments[i].worker].result.loci;
+    if(source == NULL || segments[i].end <= segments[i].beg) continue;
+    if(result->loci == NULL){
+      result->loci = diff_bams_loci_init(opts->window);
+      check(result->loci != NULL, "Error allocating flag difference locations.");
+    }
+    check(diff_bams_loci_append(result->loci, source, segments[i].beg, segments[i].end) == 0, "Error gathering flag difference locations.");
+  }
+
+  for(i=0; i<nthreads; i++) diff_bams_result_destroy(&workers[i].result);
+  free(workers);
+  free(threads);
+  free(planned);
+  free(segments);
+  free(shards);
+  return 0;
+
+error:
+  if(started){
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  }
+  if(workers){
+    for(i=0; i<nthreads; i++) diff_bams_result_destroy(&workers[i].result);
+    free(workers);
+  }
+  if(threads) free(threads);
+  if(planned) free(planned);
+  if(segments) free(segments);
+  if(shards) free(shards);
+  return -1;
+}
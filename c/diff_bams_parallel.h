@@ -0,0 +1,66 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __diff_bams_parallel_h__
+#define __diff_bams_parallel_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "htslib/sam.h"
+#include "diff_bams_fields.h"
+#include "diff_bams_loci.h"
+
+typedef struct {
+  int skip_z; //ignore MAPQ 0 records
+  int count_flags; //tally flag differences by location rather than stopping
+  int32_t window; //flag difference locations binned to this width, 1 per position
+  int full; //compare every field, counting differences by field rather than stopping
+  uint64_t limit; //full mode stops after this many differing records, 0 for no limit
+} diff_opts_t;
+
+//Comparison totals, summed over workers
+typedef struct {
+  uint64_t records; //compared records
+  uint64_t flag_diffs;
+  diff_loci_t *loci; //flag difference locations, only when counting
+  uint64_t differ; //records differing in any field, full mode
+  diff_fields_t *fields; //full mode
+} diff_result_t;
+
+//diff_bams_compare results
+#define DIFF_MATCH 0 //same record, differences (if any) counted
+#define DIFF_RECORD 1 //tid, pos or qname differ, the files are out of step
+#define DIFF_FLAGS 2 //flags differ and aren't being counted
+
+//Compares a record pair, counting into result as opts asks. Returns DIFF_* or -1 on error.
+int diff_bams_compare(bam1_t *a, bam1_t *b, diff_opts_t *opts, diff_result_t *result);
+
+//Adds the counts, fields and (if the target has none) locations of source
+int diff_bams_result_merge(diff_result_t *target, diff_result_t *source);
+
+void diff_bams_result_destroy(diff_result_t *result);
+
+//Compares indexed, coordinate sorted inputs in index balanced regions (and the unplaced tail) on nthreads workers.
+//Headers must already have been checked to list the same contigs, differences other than flags stop all workers.
+//Stops all workers once opts->limit differing records have been found between them.
+//Flag difference locations are gathered in coordinate order, as a sequential run would give them.
+int diff_bams_parallel(char *file_a, char *file_b, char *ref_file, bam_hdr_t *head, hts_idx_t *idx_a,
+                        diff_opts_t *opts, int nthreads, diff_result_t *result);
+
+#endif
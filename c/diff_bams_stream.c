@@ -0,0 +1,181 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "dbg.h"
+#include "diff_bams_stream.h"
+
+typedef struct {
+  bam1_t **reads;
+  int n;
+  int last; //Final batch, ret holds the read status
+  int ret;
+} diff_batch_t;
+
+//Fixed size ring, every batch fits so pushes never wait
+typedef struct {
+  diff_batch_t *items[DIFF_STREAM_BATCHES];
+  int head;
+  int count;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+} diff_ring_t;
+
+struct diff_stream_t {
+  htsFile *input;
+  bam_hdr_t *head;
+  int skip_z;
+  int stop;
+  diff_batch_t batches[DIFF_STREAM_BATCHES];
+  diff_ring_t full; //decoder to comparator
+  diff_ring_t empty; //comparator back to decoder
+  diff_batch_t *current;
+  int pos;
+  int ret;
+  int done;
+  pthread_t thread;
+  int started;
+};
+
+static void ring_init(diff_ring_t *r){
+  r->head = 0;
+  r->count = 0;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->not_empty, NULL);
+}
+
+static void ring_destroy(diff_ring_t *r){
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->not_empty);
+}
+
+static void ring_push(diff_ring_t *r, diff_batch_t *batch){
+  pthread_mutex_lock(&r->lock);
+  assert(r->count < DIFF_STREAM_BATCHES);
+  r->items[(r->head + r->count) % DIFF_STREAM_BATCHES] = batch;
+  r->count++;
+  pthread_cond_signal(&r->not_empty);
+  pthread_mutex_unlock(&r->lock);
+}
+
+static diff_batch_t *ring_pop(diff_ring_t *r){
+  pthread_mutex_lock(&r->lock);
+  while(r->count == 0) pthread_cond_wait(&r->not_empty, &r->lock);
+  diff_batch_t *batch = r->items[r->head];
+  r->head = (r->head + 1) % DIFF_STREAM_BATCHES;
+  r->count--;
+  pthread_mutex_unlock(&r->lock);
+  return batch;
+}
+
+static void *decoder(void *arg){
+  diff_stream_t *s = (diff_stream_t *) arg;
+  int ret = 0;
+  while(1){
+    diff_batch_t *batch = ring_pop(&s->empty);
+    batch->n = 0;
+    while(!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE) && batch->n < DIFF_STREAM_BATCH_SIZE
+          && (ret = sam_read1(s->input, s->head, batch->reads[batch->n])) >= 0){
+      if(s->skip_z && batch->reads[batch->n]->core.qual == 0) continue; //Slot is reused
+      batch->n++;
+    }
+    batch->last = ret < 0 || __atomic_load_n(&s->stop, __ATOMIC_ACQUIRE);
+    batch->ret = ret;
+    ring_push(&s->full, batch);
+    if(batch->last) break;
+  }
+  return NULL;
+}
+
+diff_stream_t *diff_bams_stream_start(htsFile *input, bam_hdr_t *head, int skip_z){
+  assert(input != NULL);
+  assert(head != NULL);
+  diff_stream_t *s = (diff_stream_t *) calloc(1, sizeof(diff_stream_t));
+  check_mem(s);
+  s->input = input;
+  s->head = head;
+  s->skip_z = skip_z;
+  ring_init(&s->full);
+  ring_init(&s->empty);
+  int i=0, j=0;
+  for(i=0; i<DIFF_STREAM_BATCHES; i++){
+    s->batches[i].reads = (bam1_t **) calloc(DIFF_STREAM_BATCH_SIZE, sizeof(bam1_t *));
+    check_mem(s->batches[i].reads);
+    for(j=0; j<DIFF_STREAM_BATCH_SIZE; j++){
+      s->batches[i].reads[j] = bam_init1();
+      check_mem(s->batches[i].reads[j]);
+    }
+    ring_push(&s->empty, &s->batches[i]);
+  }
+  check(pthread_create(&s->thread, NULL, decoder, s) == 0, "Error starting decoder thread.");
+  s->started = 1;
+  return s;
+
+error:
+  diff_bams_stream_finish(s);
+  return NULL;
+}
+
+bam1_t *diff_bams_stream_next(diff_stream_t *s){
+  assert(s != NULL);
+  while(!s->done){
+    if(s->current != NULL && s->pos < s->current->n) return s->current->reads[s->pos++];
+    if(s->current != NULL){
+      if(s->current->last){
+        s->ret = s->current->ret;
+        s->done = 1;
+        break;
+      }
+      ring_push(&s->empty, s->current);
+    }
+    s->current = ring_pop(&s->full);
+    s->pos = 0;
+  }
+  return NULL;
+}
+
+int diff_bams_stream_finish(diff_stream_t *s){
+  if(s == NULL) return 0;
+  int ret = s->ret;
+  if(s->started){
+    if(!s->done){
+      //Stopped early, hand batches back until the decoder's final one so it never waits on us
+      __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+      ret = 0;
+      diff_batch_t *batch = s->current;
+      while(batch == NULL || !batch->last){
+        if(batch) ring_push(&s->empty, batch);
+        batch = ring_pop(&s->full);
+      }
+    }
+    pthread_join(s->thread, NULL);
+  }
+  int i=0, j=0;
+  for(i=0; i<DIFF_STREAM_BATCHES; i++){
+    if(s->batches[i].reads == NULL) continue;
+    for(j=0; j<DIFF_STREAM_BATCH_SIZE; j++) if(s->batches[i].reads[j]) bam_destroy1(s->batches[i].reads[j]);
+    free(s->batches[i].reads);
+  }
+  ring_destroy(&s->full);
+  ring_destroy(&s->empty);
+  free(s);
+  return ret;
+}
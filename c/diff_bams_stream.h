@@ -0,0 +1,42 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __diff_bams_stream_h__
+#define __diff_bams_stream_h__
+
+#include "htslib/sam.h"
+
+#define DIFF_STREAM_BATCH_SIZE 1024 //Records per batch handed from a decoder thread to the comparator
+#define DIFF_STREAM_BATCHES 8 //Batches in flight per input
+
+//One input decoded on its own thread into a single producer/single consumer ring of recycled record batches.
+typedef struct diff_stream_t diff_stream_t;
+
+//Starts the decoder thread, header already read. skip_z drops MAPQ 0 records on the decoder side.
+diff_stream_t *diff_bams_stream_start(htsFile *input, bam_hdr_t *head, int skip_z);
+
+//Next record in file order, NULL at the end of input or on a read error.
+//The record stays valid until the next call.
+bam1_t *diff_bams_stream_next(diff_stream_t *stream);
+
+//Stops the decoder, which may not have reached the end of input, and frees the stream.
+//Returns the last sam_read1 result (-1 at a clean end of file) or 0 when stopped early.
+int diff_bams_stream_finish(diff_stream_t *stream);
+
+#endif
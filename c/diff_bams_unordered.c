@@ -0,0 +1,355 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dbg.h"
+#include "diff_bams_unordered.h"
+
+//Bits of the flag that tell records with the same name apart
+#define DIFF_ID_FLAGS (BAM_FREAD1 | BAM_FREAD2 | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)
+
+typedef struct {
+  htsFile *input;
+  bam_hdr_t *head;
+  FILE **parts;
+  int n_parts;
+  diff_opts_t *opts;
+  uint64_t records;
+  int status;
+} spill_job_t;
+
+typedef struct {
+  FILE **parts_a;
+  FILE **parts_b;
+  int n_parts;
+  int *next_part;
+  pthread_mutex_t *lock;
+  uint64_t budget; //bytes of digests held at once
+  diff_unordered_t result;
+  int status;
+} join_worker_t;
+
+static inline uint64_t mix64(uint64_t x){
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint64_t hash_bytes(const uint8_t *p, size_t n, uint64_t h){
+  h ^= n * 0x9e3779b97f4a7c15ULL;
+  uint64_t w;
+  while(n >= 8){
+    memcpy(&w, p, 8);
+    h = mix64(h ^ w);
+    p += 8;
+    n -= 8;
+  }
+  w = 0;
+  memcpy(&w, p, n);
+  return mix64(h ^ w ^ ((uint64_t)n << 56));
+}
+
+diff_digest_t diff_bams_digest(bam1_t *b, int full){
+  assert(b != NULL);
+  diff_digest_t d;
+  d.id = hash_bytes((uint8_t *)bam_get_qname(b), strlen(bam_get_qname(b)), b->core.flag & DIFF_ID_FLAGS);
+  if(full){
+    d.content = hash_bytes(b->data, b->l_data, hash_bytes((uint8_t *)&b->core, sizeof(bam1_core_t), 0));
+  }else{
+    uint64_t core[2] = {((uint64_t)(uint32_t)b->core.tid << 32) | (uint32_t)b->core.pos, b->core.flag};
+    d.content = hash_bytes((uint8_t *)core, sizeof(core), 0);
+  }
+  return d;
+}
+
+//Unlinked as soon as it's open, so nothing is left behind whatever happens
+static FILE *open_partition(const char *tmp_dir){
+  char *name = NULL;
+  FILE *fp = NULL;
+  name = (char *) malloc(strlen(tmp_dir) + 20);
+  check_mem(name);
+  sprintf(name, "%s/diff_bams_XXXXXX", tmp_dir);
+  int fd = mkstemp(name);
+  check(fd >= 0, "Error creating partition file in '%s'.", tmp_dir);
+  unlink(name);
+  fp = fdopen(fd, "w+b");
+  check(fp != NULL, "Error opening partition file in '%s'.", tmp_dir);
+  free(name);
+  return fp;
+error:
+  if(name) free(name);
+  return NULL;
+}
+
+static void *spill(void *arg){
+  spill_job_t *job = (spill_job_t *) arg;
+  bam1_t *b = NULL;
+  int ret, i;
+  job->status = -1;
+  b = bam_init1();
+  check_mem(b);
+  while((ret = sam_read1(job->input, job->head, b)) >= 0){
+    if(job->opts->skip_z && b->core.qual == 0) continue;
+    diff_digest_t d = diff_bams_digest(b, job->opts->full);
+    check(fwrite(&d, sizeof(diff_digest_t), 1, job->parts[(uint32_t)d.id % job->n_parts]) == 1, "Error writing partition.");
+    job->records++;
+  }
+  check(ret == -1, "Error reading records, truncated or corrupt record (%d).", ret);
+  for(i=0; i<job->n_parts; i++) check(fflush(job->parts[i]) == 0, "Error writing partition.");
+  job->status = 0;
+error:
+  if(b) bam_destroy1(b);
+  return NULL;
+}
+
+static int cmp_digest(const void *a, const void *b){
+  const diff_digest_t *x = (const diff_digest_t *) a;
+  const diff_digest_t *y = (const diff_digest_t *) b;
+  if(x->id != y->id) return x->id < y->id ? -1 : 1;
+  return (x->content > y->content) - (x->content < y->content);
+}
+
+//Digests of a partition in this pass, selected by the id bits not used to pick the partition
+static diff_digest_t *load_pass(FILE *part, int pass, int passes, uint64_t expect, uint64_t *n){
+  diff_digest_t buf[DIFF_READ_BUFFER];
+  diff_digest_t *digests = NULL;
+  uint64_t size = expect ? expect : 1;
+  *n = 0;
+  digests = (diff_digest_t *) malloc(sizeof(diff_digest_t) * size);
+  check_mem(digests);
+  check(fseeko(part, 0, SEEK_SET) == 0, "Error seeking in partition.");
+  size_t got;
+  while((got = fread(buf, sizeof(diff_digest_t), DIFF_READ_BUFFER, part)) > 0){
+    size_t i;
+    for(i=0; i<got; i++){
+      if(passes > 1 && (int)(((buf[i].id >> 32) * passes) >> 32) != pass) continue;
+      if(*n == size){
+        size *= 2;
+        diff_digest_t *grown = (diff_digest_t *) realloc(digests, sizeof(diff_digest_t) * size);
+        check_mem(grown);
+        digests = grown;
+      }
+      digests[(*n)++] = buf[i];
+    }
+  }
+  check(!ferror(part), "Error reading partition.");
+  return digests;
+error:
+  if(digests) free(digests);
+  return NULL;
+}
+
+//Both sorted, records sharing an id are paired on content first, the rest as differing then unmatched
+static void join_digests(diff_digest_t *a, uint64_t na, diff_digest_t *b, uint64_t nb, diff_unordered_t *result){
+  uint64_t i = 0, j = 0;
+  while(i < na || j < nb){
+    if(j >= nb || (i < na && a[i].id < b[j].id)){
+      result->only_a++;
+      i++;
+      continue;
+    }
+    if(i >= na || b[j].id < a[i].id){
+      result->only_b++;
+      j++;
+      continue;
+    }
+    uint64_t id = a[i].id;
+    uint64_t ie = i, je = j;
+    while(ie < na && a[ie].id == id) ie++;
+    while(je < nb && b[je].id == id) je++;
+    uint64_t matched = 0, x = i, y = j;
+    while(x < ie && y < je){
+      if(a[x].content == b[y].content){
+        matched++;
+        x++;
+        y++;
+      }else if(a[x].content < b[y].content){
+        x++;
+      }else{
+        y++;
+      }
+    }
+    uint64_t left_a = (ie - i) - matched;
+    uint64_t left_b = (je - j) - matched;
+    uint64_t differ = left_a < left_b ? left_a : left_b;
+    result->matched += matched;
+    result->differ += differ;
+    result->only_a += left_a - differ;
+    result->only_b += left_b - differ;
+    i = ie;
+    j = je;
+  }
+}
+
+static int64_t partition_size(FILE *part){
+  if(fseeko(part, 0, SEEK_END) != 0) return -1;
+  off_t end = ftello(part);
+  return end < 0 ? -1 : end / (int64_t)sizeof(diff_digest_t);
+}
+
+static int join_partition(join_worker_t *w, int p){
+  diff_digest_t *a = NULL;
+  diff_digest_t *b = NULL;
+  int64_t na = partition_size(w->parts_a[p]);
+  int64_t nb = partition_size(w->parts_b[p]);
+  check(na >= 0 && nb >= 0, "Error finding size of partition %d.", p);
+  uint64_t cap = w->budget / sizeof(diff_digest_t);
+  if(cap < 2) cap = 2;
+  int passes = (int)((na + nb + cap - 1) / cap);
+  if(passes < 1) passes = 1;
+  int pass;
+  for(pass=0; pass<passes; pass++){
+    uint64_t got_a = 0, got_b = 0;
+    a = load_pass(w->parts_a[p], pass, passes, na / passes, &got_a);
+    check(a != NULL, "Error loading partition %d of first file.", p);
+    b = load_pass(w->parts_b[p], pass, passes, nb / passes, &got_b);
+    check(b != NULL, "Error loading partition %d of second file.", p);
+    qsort(a, got_a, sizeof(diff_digest_t), cmp_digest);
+    qsort(b, got_b, sizeof(diff_digest_t), cmp_digest);
+    join_digests(a, got_a, b, got_b, &w->result);
+    free(a);
+    free(b);
+    a = NULL;
+    b = NULL;
+  }
+  return 0;
+error:
+  if(a) free(a);
+  if(b) free(b);
+  return -1;
+}
+
+static void *join_worker(void *arg){
+  join_worker_t *w = (join_worker_t *) arg;
+  w->status = -1;
+  while(1){
+    pthread_mutex_lock(w->lock);
+    int p = (*w->next_part)++;
+    pthread_mutex_unlock(w->lock);
+    if(p >= w->n_parts) break;
+    check(join_partition(w, p) == 0, "Error joining partition %d.", p);
+  }
+  w->status = 0;
+error:
+  return NULL;
+}
+
+int diff_bams_unordered(htsFile *in_a, bam_hdr_t *head_a, htsFile *in_b, bam_hdr_t *head_b, const char *tmp_dir, int n_parts,
+                          uint64_t mem_budget, diff_opts_t *opts, int nthreads, diff_unordered_t *result){
+  assert(in_a != NULL);
+  assert(in_b != NULL);
+  assert(tmp_dir != NULL);
+  assert(opts != NULL);
+  assert(result != NULL);
+  FILE **parts_a = NULL;
+  FILE **parts_b = NULL;
+  join_worker_t *workers = NULL;
+  pthread_t *threads = NULL;
+  pthread_t spill_threads[2];
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  int next_part = 0;
+  int started = 0;
+  int i;
+  if(n_parts < 1) n_parts = DIFF_PARTITIONS;
+  if(nthreads < 1) nthreads = 1;
+
+  parts_a = (FILE **) calloc(n_parts, sizeof(FILE *));
+  check_mem(parts_a);
+  parts_b = (FILE **) calloc(n_parts, sizeof(FILE *));
+  check_mem(parts_b);
+  for(i=0; i<n_parts; i++){
+    parts_a[i] = open_partition(tmp_dir);
+    check(parts_a[i] != NULL, "Error creating partition %d.", i);
+    parts_b[i] = open_partition(tmp_dir);
+    check(parts_b[i] != NULL, "Error creating partition %d.", i);
+  }
+
+  //Spill both files at once, one reader each
+  spill_job_t jobs[2] = {{in_a, head_a, parts_a, n_parts, opts, 0, -1}, {in_b, head_b, parts_b, n_parts, opts, 0, -1}};
+  for(started=0; started<2; started++){
+    check(pthread_create(&spill_threads[started], NULL, spill, &jobs[started]) == 0, "Error starting reader thread %d.", started);
+  }
+  for(i=0; i<started; i++) pthread_join(spill_threads[i], NULL);
+  started = 0;
+  check(jobs[0].status == 0, "Error partitioning first file.");
+  check(jobs[1].status == 0, "Error partitioning second file.");
+  result->records_a = jobs[0].records;
+  result->records_b = jobs[1].records;
+
+  workers = (join_worker_t *) calloc(nthreads, sizeof(join_worker_t));
+  check_mem(workers);
+  threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+  check_mem(threads);
+  for(i=0; i<nthreads; i++){
+    workers[i].parts_a = parts_a;
+    workers[i].parts_b = parts_b;
+    workers[i].n_parts = n_parts;
+    workers[i].next_part = &next_part;
+    workers[i].lock = &lock;
+    workers[i].budget = mem_budget / nthreads;
+  }
+  for(started=0; started<nthreads; started++){
+    check(pthread_create(&threads[started], NULL, join_worker, &workers[started]) == 0, "Error starting join thread %d.", started);
+  }
+  for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  started = 0;
+  for(i=0; i<nthreads; i++){
+    check(workers[i].status == 0, "Join worker %d failed.", i);
+    result->matched += workers[i].result.matched;
+    result->differ += workers[i].result.differ;
+    result->only_a += workers[i].result.only_a;
+    result->only_b += workers[i].result.only_b;
+  }
+
+  for(i=0; i<n_parts; i++){
+    fclose(parts_a[i]);
+    fclose(parts_b[i]);
+  }
+  free(parts_a);
+  free(parts_b);
+  free(workers);
+  free(threads);
+  return 0;
+
+error:
+  if(workers){
+    for(i=0; i<started; i++) pthread_join(threads[i], NULL);
+  }else{
+    for(i=0; i<started; i++) pthread_join(spill_threads[i], NULL);
+  }
+  if(parts_a){
+    for(i=0; i<n_parts; i++) if(parts_a[i]) fclose(parts_a[i]);
+    free(parts_a);
+  }
+  if(parts_b){
+    for(i=0; i<n_parts; i++) if(parts_b[i]) fclose(parts_b[i]);
+    free(parts_b);
+  }
+  if(workers) free(workers);
+  if(threads) free(threads);
+  return -1;
+}
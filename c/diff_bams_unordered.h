@@ -0,0 +1,53 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __diff_bams_unordered_h__
+#define __diff_bams_unordered_h__
+
+#include <stdint.h>
+#include "htslib/sam.h"
+#include "diff_bams_parallel.h"
+
+#define DIFF_PARTITIONS 64 //Default partitions per file
+#define DIFF_READ_BUFFER 8192 //Digests read back per fread
+
+//Fixed size record summary spilled to the partitions
+typedef struct {
+  uint64_t id; //qname, read 1/2 and secondary/supplementary bits, also picks the partition
+  uint64_t content; //tid, pos and flag, or the whole record in full mode
+} diff_digest_t;
+
+typedef struct {
+  uint64_t records_a;
+  uint64_t records_b;
+  uint64_t matched; //same identity and content
+  uint64_t differ; //same identity, different content
+  uint64_t only_a;
+  uint64_t only_b;
+} diff_unordered_t;
+
+diff_digest_t diff_bams_digest(bam1_t *b, int full);
+
+//Compares the records of two inputs in any order. Each file is read once on its own thread, spilling digests
+//to n_parts temporary files in tmp_dir. Matching partitions are then joined on nthreads workers, each holding
+//at most mem_budget / nthreads bytes of digests, a partition too large for that is joined in several passes.
+int diff_bams_unordered(htsFile *in_a, bam_hdr_t *head_a, htsFile *in_b, bam_hdr_t *head_b, const char *tmp_dir, int n_parts,
+                          uint64_t mem_budget, diff_opts_t *opts, int nthreads, diff_unordered_t *result);
+
+#endif
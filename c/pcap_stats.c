@@ -0,0 +1,129 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bam_access.h"
+#include "bam_stats_output.h"
+#include "bam_stats_dump.h"
+#include "pcap_stats.h"
+
+#if PCAP_STATS_RNA != BAM_ACCESS_RNA || PCAP_STATS_NO_GC != BAM_ACCESS_NO_GC || PCAP_STATS_CYCLES != BAM_ACCESS_CYCLES
+#error "pcap_stats_init opts must match the bam_access_process_read flags"
+#endif
+
+struct pcap_stats_t {
+  rg_info_t **grps;
+  int grps_size;
+  stats_rd_t ***grp_stats;
+  rg_lookup_t *lookup;
+  int opts;
+};
+
+//PCAP::Bam::Stats always has the anonymous group, bam_access_parse_header only adds it when there are no @RG lines.
+//Left empty it isn't written to the .bas.
+static int add_anon_group(pcap_stats_t *stats){
+  int i=0;
+  for(i=0; i<stats->grps_size; i++){
+    if(strcmp(stats->grps[i]->id, ".") == 0) return 0;
+  }
+  rg_info_t **grown = (rg_info_t **) realloc(stats->grps, sizeof(rg_info_t *) * (stats->grps_size + 1));
+  check_mem(grown);
+  stats->grps = grown;
+  check(bam_access_grow_stats(&stats->grp_stats, stats->grps_size, stats->grps_size + 1) == 0, "Error adding anonymous read group.");
+  stats->grps[stats->grps_size] = bam_access_anon_group();
+  check(stats->grps[stats->grps_size] != NULL, "Error creating anonymous read group.");
+  stats->grps_size++;
+  return 0;
+error:
+  return -1;
+}
+
+pcap_stats_t *pcap_stats_init(bam_hdr_t *head, int opts){
+  assert(head != NULL);
+  pcap_stats_t *stats = (pcap_stats_t *) calloc(1, sizeof(pcap_stats_t));
+  check_mem(stats);
+  stats->opts = (opts & (BAM_ACCESS_RNA | BAM_ACCESS_NO_GC | BAM_ACCESS_CYCLES)) | BAM_ACCESS_ANON;
+  stats->grps = bam_access_parse_header(head, &stats->grps_size, &stats->grp_stats);
+  check(stats->grps != NULL, "Error fetching read groups from header.");
+  check(add_anon_group(stats) == 0, "Error adding anonymous read group.");
+  stats->lookup = bam_access_rg_lookup_init(stats->grps, stats->grps_size);
+  check(stats->lookup != NULL, "Error building read group lookup.");
+  return stats;
+error:
+  pcap_stats_destroy(stats);
+  return NULL;
+}
+
+int pcap_stats_add_record(pcap_stats_t *stats, bam1_t *b){
+  assert(stats != NULL);
+  assert(b != NULL);
+  return bam_access_process_read(b, stats->lookup, stats->grp_stats, stats->opts);
+}
+
+int pcap_stats_merge(pcap_stats_t *target, pcap_stats_t *source){
+  assert(target != NULL);
+  assert(source != NULL);
+  check(target->grps_size == source->grps_size, "Can't merge stats of %d read groups into %d.", source->grps_size, target->grps_size);
+  int i=0;
+  for(i=0; i<target->grps_size; i++){
+    check(strcmp(target->grps[i]->id, source->grps[i]->id) == 0, "Read group %s doesn't match %s, stats are from different headers.",
+          source->grps[i]->id, target->grps[i]->id);
+  }
+  return bam_access_merge_stats(target->grp_stats, source->grp_stats, target->grps_size);
+error:
+  return -1;
+}
+
+int pcap_stats_finalize(pcap_stats_t *stats){
+  assert(stats != NULL);
+  int i=0;
+  for(i=0; i<stats->grps_size; i++){
+    bam_access_cycle_hist_flush(&stats->grp_stats[i][0]->cycles);
+    bam_access_cycle_hist_flush(&stats->grp_stats[i][1]->cycles);
+  }
+  return 0;
+}
+
+int pcap_stats_write_bas(pcap_stats_t *stats, const char *bam_name, const char *file){
+  assert(stats != NULL);
+  check(pcap_stats_finalize(stats) == 0, "Error completing stats.");
+  return bam_stats_output_print_results(stats->grps, stats->grps_size, stats->grp_stats, (char *)bam_name, (char *)file,
+                                         stats->opts & BAM_ACCESS_RNA);
+error:
+  return -1;
+}
+
+int pcap_stats_write_dump(pcap_stats_t *stats, const char *bam_name, const char *file){
+  assert(stats != NULL);
+  check(pcap_stats_finalize(stats) == 0, "Error completing stats.");
+  return bam_stats_dump_write((char *)file, (char *)bam_name, stats->grps, stats->grps_size, stats->grp_stats);
+error:
+  return -1;
+}
+
+void pcap_stats_destroy(pcap_stats_t *stats){
+  if(stats == NULL) return;
+  bam_access_rg_lookup_destroy(stats->lookup);
+  if(stats->grp_stats) bam_access_destroy_stats(stats->grp_stats, stats->grps_size);
+  if(stats->grps) bam_access_destroy_groups(stats->grps, stats->grps_size);
+  free(stats);
+  return;
+}
@@ -0,0 +1,60 @@
+/*       LICENCE
+* PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+* Copyright (C) 2014-2016 ICGC PanCancer Project
+*
+* This program is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License
+* as published by the Free Software Foundation; either version 2
+* of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not see:
+*   http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#ifndef __pcap_stats_h__
+#define __pcap_stats_h__
+
+//In-process .bas statistics, built as libpcapstats for use from any htslib read loop:
+//  pcap_stats_t *stats = pcap_stats_init(head, 0);
+//  while(sam_read1(in, head, b) >= 0) pcap_stats_add_record(stats, b);
+//  pcap_stats_write_bas(stats, "sample.bam", "sample.bam.bas");
+//  pcap_stats_destroy(stats);
+//Records are counted as bam_stats counts them, secondary/supplementary/QC fail reads are skipped.
+
+#include "htslib/sam.h"
+
+//pcap_stats_init opts
+#define PCAP_STATS_RNA 1 //count secondary hits, RNA insert size trimming in the .bas
+#define PCAP_STATS_NO_GC 2 //G/C not counted
+#define PCAP_STATS_CYCLES 4 //per cycle quality and base composition, written to the dump
+
+typedef struct pcap_stats_t pcap_stats_t;
+
+//Read groups are taken from the header plus the anonymous '.' group (anon in the .bas, only written when it has reads).
+//Reads without an RG tag, or with an ID not in the header, are counted as anon.
+pcap_stats_t *pcap_stats_init(bam_hdr_t *head, int opts);
+
+int pcap_stats_add_record(pcap_stats_t *stats, bam1_t *b);
+
+//Adds source to target, both initialised from the same header. Read lengths are kept from target where set,
+//so merge in file order.
+int pcap_stats_merge(pcap_stats_t *target, pcap_stats_t *source);
+
+//Completes staged counters, call once all records are added (the write functions also call it)
+int pcap_stats_finalize(pcap_stats_t *stats);
+
+//bam_name is reported in the bam_filename column, file may be '-' for stdout
+int pcap_stats_write_bas(pcap_stats_t *stats, const char *bam_name, const char *file);
+
+//Stats dump (bam_stats -d), merged exactly by bam_stats --merge and PCAP::Bam::Stats::merge_json_stats
+int pcap_stats_write_dump(pcap_stats_t *stats, const char *bam_name, const char *file);
+
+void pcap_stats_destroy(pcap_stats_t *stats);
+
+#endif
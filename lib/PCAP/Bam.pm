@@ -36,12 +36,13 @@ use Data::UUID;
 use PCAP::Threaded;
 
 const my $BAMCOLLATE => q{(%s colsbs=268435456 collate=1 reset=1 exclude=SECONDARY,QCFAIL,SUPPLEMENTARY classes=F,F2 T=%s filename=%s level=1 > %s)};
-const my $BAMBAM_DUP => q{%s level=0 %s | %s tmpfile=%s level=0 markthreads=%d M=%s.met | %s tmpfile=%s index=1 md5=1 numthreads=%d md5filename=%s.md5 indexfilename=%s.bai | tee %s | %s -o %s.bas};
+const my $BAMBAM_DUP => q{%s level=0 %s | %s tmpfile=%s level=0 markthreads=%d M=%s.met | %s tmpfile=%s index=1 md5=1 numthreads=%d md5filename=%s.md5 indexfilename=%s.bai | %s -@ %d -T %s -o %s.bas};
 const my $BAMBAM_MERGE => q{%s %s tmpfile=%s md5filename=%s.md5 indexfilename=%s.bai index=1 md5=1 > %s};
 const my $BAMBAM_DUP_CRAM => q{%s level=0 %s | %s tmpfile=%s M=%s.met markthreads=%s level=0 | %s -r %s -t %d -I bam -O cram %s | tee %s | %s index - %s.crai};
 const my $BAMBAM_MERGE_CRAM => q{%s %s tmpfile=%s level=0 | %s -r %s -t %d -I bam -O cram %s | tee %s | %s index - %s.crai};
 const my $CRAM_CHKSUM => q{md5sum %s | perl -ne '/^(\S+)/; print "$1";' > %s.md5};
-const my $BAM_STATS => q{ -i %s -o %s};
+const my $BAM_STATS => q{ -i %s -o %s -@ %d};
+const my $BAM_STATS_CHECKPOINT => q{ -k %s -R};
 
 sub new {
   my ($class, $bam) = @_;
@@ -198,8 +199,9 @@ sub merge_and_mark_dup {
                               $helper_threads,
                               $marked,
                               $marked,
-                              $marked,
                               $tools{'bam_stats'},
+                              $helper_threads,
+                              $marked,
                               $marked;
     }
   }
@@ -227,7 +229,14 @@ sub bam_stats {
   if($options->{'nomarkdup'} || $options->{'cram'}) {
     # BAM with marked duplicates does this in streaming manner now
     my $command = _which('bam_stats') || die "Unable to find 'bam_stats' in path";
-    $command .= sprintf $BAM_STATS, $xam, $bas;
+    my $helper_threads = ($options->{'threads'} || 1) - 1;
+    $command .= sprintf $BAM_STATS, $xam, $bas, $helper_threads;
+    # sequential BAM reads can resume from where a preempted run stopped,
+    # sharded runs (2+ helper threads) are short enough to simply rerun
+    if(!$options->{'cram'} && $helper_threads < 2) {
+      my $checkpoint = File::Spec->catfile($tmp, 'progress', 'PCAP_Bam_bam_stats.0.checkpoint');
+      $command .= sprintf $BAM_STATS_CHECKPOINT, $checkpoint;
+    }
     PCAP::Threaded::external_process_handler(File::Spec->catdir($tmp, 'logs'), $command, 0);
   }
   PCAP::Threaded::touch_success(File::Spec->catdir($tmp, 'progress'), 0);
@@ -34,6 +34,7 @@ use File::Basename;
 use List::Util qw(sum sum0 first);
 use Bio::DB::HTS;
 use JSON;
+use PCAP::Bam::Stats::Lib;
 
 my $plots_available = 0;
 eval {
@@ -98,11 +99,23 @@ sub init{
     $rem = 0;
   }
 
+  my $use_lib = $args{-lib} ? 1 : 0;
+  if($use_lib && !PCAP::Bam::Stats::Lib->available) {
+    $use_lib = 0;
+    warn "WARN: libpcapstats (FFI::Platypus) not found, counting in perl\n";
+  }
+
   my $groups = _parse_header($sam);
   $self->{_file_path} = $path;
   $self->{_qualiy_scoring} = $q_scoring;
   $self->{_groups} = $groups;
-  _process_reads($groups,$sam,$q_scoring, $mod, $rem) unless(defined $args{-no_proc});
+  return if(defined $args{-no_proc});
+  if($use_lib) {
+    $self->_process_reads_lib($sam, $q_scoring, $mod, $rem);
+  }
+  else {
+    _process_reads($groups,$sam,$q_scoring, $mod, $rem);
+  }
 }
 
 sub merge_json_stats {
@@ -111,18 +124,37 @@ sub merge_json_stats {
 
   for my $json_groups(@{$json_stats}) {
     my $groups = decode_json $json_groups;
+    # bam_stats -d dumps wrap the groups with format details
+    if(exists $groups->{'format'} && $groups->{'format'} eq 'pcap-bam-stats') {
+      $groups = $groups->{'groups'};
+    }
     for my $group_id(keys %{$groups}) {
       for my $data_type(keys %{$groups->{$group_id}}) {
-        next if($data_type =~ m/^fqp/); # technically can be done but not a priority
-
         my $value = $groups->{$group_id}->{$data_type};
+        # per cycle quality (fqp) and base (fqb, bam_stats -p) counts
+        if($data_type =~ m/^fq[pb]_/) {
+          my $target = $new_stats{$group_id}{$data_type} ||= [];
+          for my $cycle(0..$#{$value}) {
+            next unless(defined $value->[$cycle]);
+            for my $idx(0..$#{$value->[$cycle]}) {
+              $target->[$cycle]->[$idx] += $value->[$cycle]->[$idx] || 0;
+            }
+          }
+          $self->{_qualiy_scoring} = 1 if($data_type =~ m/^fqp_/);
+          next;
+        }
         if($data_type eq 'inserts') {
           for my $sub_value_key(keys %{$value}){
             $new_stats{$group_id}{$data_type}{$sub_value_key} += $value->{$sub_value_key};
           }
           next;
         }
-        if(first {$data_type eq $_} (qw(head length_1 length_2))) {
+        # read length is kept from the earliest dump that has one, dumps are merged in the order given
+        if($data_type eq 'length_1' || $data_type eq 'length_2') {
+          $new_stats{$group_id}{$data_type} = $value unless($new_stats{$group_id}{$data_type});
+          next;
+        }
+        if($data_type eq 'head') {
           if(exists $new_stats{$group_id}{$data_type}) {
             die "\nERROR: '$data_type' data doesn't match, aborting merge\n" unless($new_stats{$group_id}{$data_type} eq $value);
           }
@@ -248,6 +280,21 @@ sub _process_reads {
   }
 }
 
+# counting done by libpcapstats, results merged as a bam_stats -d dump
+sub _process_reads_lib {
+  my ($self, $sam, $qualiy_scoring, $mod, $rem) = @_;
+  my $bam = $sam->hts_file;
+  my $header = $bam->header_read;
+  my $lib = PCAP::Bam::Stats::Lib->new($header, -qscoring => $qualiy_scoring);
+  my $processed_x = 0;
+  while (my $a = $bam->read1($header)) {
+    next if(($processed_x++ % $mod) != $rem);
+    $lib->add($a);
+  }
+  $self->merge_json_stats([$lib->json_stats(basename($self->{_file_path}))]);
+  return 1;
+}
+
 sub _add_to_qplot {
   my ($target, $qual_ref, $reverse) = @_;
   my @quals = ($reverse) ? (reverse @{$qual_ref}) : @{$qual_ref};
@@ -966,11 +1013,20 @@ PCAP::Bam::Stats - Generate mapping and read statistics for a BAM.
  my $stats = PCAP::Bam::Stats->new(-path => $input_bam);
   # or if quality plots required
  my $stats = PCAP::Bam::Stats->new(-path => $input_bam, -qscoring => defined $plots_dir);
+  # or counting in C with libpcapstats (PCAP::Bam::Stats::Lib) when available
+ my $stats = PCAP::Bam::Stats->new(-path => $input_bam, -lib => 1);
 
 =item init
 
 Initialise the object.
 
+=item merge_json_stats
+
+  $stats->merge_json_stats([$json_a, $json_b]);
+
+Adds per read group counts from JSON stats (bam_stats -d dumps or bare groups) in the order given.
+Read group headers must match, read lengths are taken from the earliest dump that has one.
+
 =item bas
 
   $stats->bas($fh);
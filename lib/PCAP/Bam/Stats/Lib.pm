@@ -0,0 +1,175 @@
+package PCAP::Bam::Stats::Lib;
+
+##########LICENCE##########
+# PCAP - NGS reference implementations and helper code for the ICGC/TCGA Pan-Cancer Analysis Project
+# Copyright (C) 2014 ICGC PanCancer Project
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not see:
+#   http://www.gnu.org/licenses/gpl-2.0.html
+##########LICENCE##########
+
+use PCAP;
+
+use strict;
+use English qw( -no_match_vars );
+use warnings FATAL=>'all';
+use autodie qw( :all );
+use Carp qw(croak carp);
+
+use Const::Fast qw( const );
+use File::Basename;
+use File::Temp qw(tempfile);
+use File::Which qw(which);
+
+# pcap_stats.h opts
+const my $RNA    => 1;
+const my $NO_GC  => 2;
+const my $CYCLES => 4;
+
+# libpcapstats is optional, found via PCAP_STATS_LIB or next to bam_stats ($INST_PATH/lib)
+my $lib_available = 0;
+eval {
+  require FFI::Platypus;
+  require FFI::CheckLib;
+  my @libpath;
+  if(my $bam_stats = which('bam_stats')) {
+    push @libpath, dirname($bam_stats).'/../lib';
+  }
+  my @libs = $ENV{PCAP_STATS_LIB} ? ($ENV{PCAP_STATS_LIB}) : FFI::CheckLib::find_lib(lib => 'pcapstats', libpath => \@libpath);
+  die "libpcapstats not found\n" unless(@libs);
+  my $ffi = FFI::Platypus->new(api => 1, lib => \@libs);
+  $ffi->attach([pcap_stats_init => '_init'] => ['opaque', 'int'] => 'opaque');
+  $ffi->attach([pcap_stats_add_record => '_add_record'] => ['opaque', 'opaque'] => 'int');
+  $ffi->attach([pcap_stats_merge => '_merge'] => ['opaque', 'opaque'] => 'int');
+  $ffi->attach([pcap_stats_write_bas => '_write_bas'] => ['opaque', 'string', 'string'] => 'int');
+  $ffi->attach([pcap_stats_write_dump => '_write_dump'] => ['opaque', 'string', 'string'] => 'int');
+  $ffi->attach([pcap_stats_destroy => '_destroy'] => ['opaque'] => 'void');
+  $lib_available = 1;
+  1;
+};
+
+sub available {
+  return $lib_available;
+}
+
+sub new {
+  my ($class, $header, %args) = @_;
+  croak "libpcapstats is not available (needs FFI::Platypus and libpcapstats.so)" unless($lib_available);
+  croak "A Bio::DB::HTS::Header is required" unless(ref $header);
+  my $opts = ($args{-rna} ? $RNA : 0) | ($args{-no_gc} ? $NO_GC : 0) | ($args{-qscoring} ? $CYCLES : 0);
+  my $ptr = _init(${$header}, $opts);
+  croak "Failed to initialise libpcapstats from header" unless(defined $ptr);
+  my $self = { '_ptr' => $ptr };
+  bless $self, $class;
+  return $self;
+}
+
+sub add {
+  my ($self, $a) = @_;
+  # Bio::DB::HTS::Alignment wraps the bam1_t pointer
+  croak "Failed to add alignment ".$a->qname if(_add_record($self->{'_ptr'}, ${$a}) != 0);
+  return 1;
+}
+
+sub merge {
+  my ($self, $other) = @_;
+  croak "Failed to merge stats" if(_merge($self->{'_ptr'}, $other->{'_ptr'}) != 0);
+  return 1;
+}
+
+sub write_bas {
+  my ($self, $bam_name, $file) = @_;
+  croak "Failed to write bas to $file" if(_write_bas($self->{'_ptr'}, $bam_name, $file) != 0);
+  return 1;
+}
+
+sub json_stats {
+  my ($self, $bam_name) = @_;
+  $bam_name ||= q{-};
+  my ($fh, $dump) = tempfile(UNLINK => 1);
+  close $fh;
+  croak "Failed to write stats dump" if(_write_dump($self->{'_ptr'}, $bam_name, $dump) != 0);
+  open my $IN, '<', $dump;
+  my $json = do { local $INPUT_RECORD_SEPARATOR; <$IN> };
+  close $IN;
+  unlink $dump;
+  return $json;
+}
+
+sub DESTROY {
+  my $self = shift;
+  _destroy($self->{'_ptr'}) if(defined $self->{'_ptr'});
+  delete $self->{'_ptr'};
+}
+
+1;
+
+__END__
+
+=head1 NAME
+
+PCAP::Bam::Stats::Lib - In-process bam_stats counting via libpcapstats.
+
+=head1 SYNOPSIS
+
+ my $bam = Bio::DB::HTS->new(-bam => $path)->hts_file;
+ my $header = $bam->header_read;
+ my $stats = PCAP::Bam::Stats::Lib->new($header);
+ while(my $a = $bam->read1($header)) {
+   # ... other work on the record
+   $stats->add($a);
+ }
+ $stats->write_bas($path, "$path.bas");
+
+=head2 Methods
+
+=over 4
+
+=item available
+
+True when FFI::Platypus is installed and libpcapstats.so was found, either at C<$ENV{PCAP_STATS_LIB}>
+or in the C<lib> directory alongside C<bam_stats>.
+
+=item new
+
+ my $stats = PCAP::Bam::Stats::Lib->new($header, -rna => 0, -no_gc => 0, -qscoring => 0);
+
+Read groups are taken from the Bio::DB::HTS::Header. C<-qscoring> collects per cycle quality and base counts
+into C<json_stats>.
+
+=item add
+
+ $stats->add($alignment);
+
+Count a Bio::DB::HTS::Alignment as bam_stats does, the record is not copied or decoded again.
+
+=item merge
+
+ $stats->merge($other);
+
+Add the counts of another object made from the same header, merge in file order so read lengths are kept.
+
+=item write_bas
+
+ $stats->write_bas($bam_name, $file);
+
+Write the *.bas, C<$file> may be '-' for stdout.
+
+=item json_stats
+
+ my $json = $stats->json_stats($bam_name);
+
+The stats dump (bam_stats -d), accepted by PCAP::Bam::Stats::merge_json_stats.
+
+=back
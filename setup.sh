@@ -5,10 +5,10 @@ SOURCE_BWA="https://github.com/lh3/bwa/archive/v0.7.15.tar.gz"
 SOURCE_SAMTOOLS="https://github.com/samtools/samtools/releases/download/1.3.1/samtools-1.3.1.tar.bz2"
 
 # for bamstats and Bio::DB::HTS
-SOURCE_HTSLIB="https://github.com/samtools/htslib/releases/download/1.3.2/htslib-1.3.2.tar.bz2"
+SOURCE_HTSLIB="https://github.com/samtools/htslib/releases/download/1.7/htslib-1.7.tar.bz2"
 
 # Bio::DB::HTS
-SOURCE_BIOBDHTS="https://github.com/Ensembl/Bio-HTS/archive/2.3.tar.gz"
+SOURCE_BIOBDHTS="https://github.com/Ensembl/Bio-HTS/archive/2.10.tar.gz"
 
 # for Bio::DB::BigWig
 SOURCE_KENTSRC="ftp://ftp.sanger.ac.uk/pub/cancer/legacy-dependancies/jksrc.v334.zip"
@@ -282,10 +282,14 @@ else
   echo
   cd $INIT_DIR
   make -C c clean
+  # bam_stats -T uses htslib's private hfile_internal.h, so build against the same source tree whose libhts.a is linked
   env HTSLIB=$SETUP_DIR/htslib make -C c -j$CPU prefix=$INST_PATH
   cp bin/bam_stats $INST_PATH/bin/.
   cp bin/reheadSQ $INST_PATH/bin/.
   cp bin/diff_bams $INST_PATH/bin/.
+  mkdir -p $INST_PATH/lib $INST_PATH/include
+  cp c/libpcapstats.so $INST_PATH/lib/.
+  cp c/pcap_stats.h $INST_PATH/include/.
   touch $SETUP_DIR/bam_stats.success
   make -C c clean
 fi
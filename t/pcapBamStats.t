@@ -172,6 +172,37 @@ subtest 'Object funcions' => sub {
 
 };
 
+subtest 'libpcapstats counting (-lib)' => sub {
+  plan skip_all => 'libpcapstats not available' unless(PCAP::Bam::Stats::Lib->available);
+  my $perl_obj = _create_test_object();
+  my $lib_obj = new_ok($MODULE => [-path => $test_bam_file, -lib => 1]);
+
+  # the bam_stats -d wrapper is removed by merge_json_stats, only read groups remain
+  ok(!exists $lib_obj->{_groups}->{$_}, "dump field '$_' not taken as a read group") for(qw(format version bam groups));
+  is_deeply($lib_obj->read_groups, $perl_obj->read_groups, 'same read groups');
+  for my $rg(@{$perl_obj->read_groups}) {
+    for my $read(1,2) {
+      is($lib_obj->read_length($rg, $read), $perl_obj->read_length($rg, $read), "read_length $rg read$read");
+    }
+  }
+  for my $read(1,2) {
+    is($lib_obj->count_total_reads($read), $perl_obj->count_total_reads($read), "count_total_reads read$read");
+    is($lib_obj->count_unmapped($read), $perl_obj->count_unmapped($read), "count_unmapped read$read");
+    is($lib_obj->count_duplicate_reads($read), $perl_obj->count_duplicate_reads($read), "count_duplicate_reads read$read");
+    is($lib_obj->count_total_mapped_bases($read), $perl_obj->count_total_mapped_bases($read), "count_total_mapped_bases read$read");
+    is($lib_obj->count_total_divergent_bases($read), $perl_obj->count_total_divergent_bases($read), "count_total_divergent_bases read$read");
+  }
+  is($lib_obj->count_properly_paired(), $perl_obj->count_properly_paired(), 'count_properly_paired');
+  is($lib_obj->med_insert_size(), $perl_obj->med_insert_size(), 'med_insert_size');
+
+  my $perl_bas = File::Temp->new(TEMPLATE => '/tmp/Bam_StatsXXXXXX', SUFFIX => '.bas.tmp');
+  my $lib_bas = File::Temp->new(TEMPLATE => '/tmp/Bam_StatsXXXXXX', SUFFIX => '.bas.tmp');
+  $perl_obj->bas($perl_bas);
+  $lib_obj->bas($lib_bas);
+  close $perl_bas;
+  close $lib_bas;
+  is_deeply(tsv_to_data($lib_bas->filename), tsv_to_data($perl_bas->filename), 'bas matches the Perl counts');
+};
 
 sub _create_test_object{
   return new $MODULE(-path=>$test_bam_file);